@@ -3,18 +3,32 @@
 TARGET=${1:-tpx3app}
 
 : ${CXX:=g++}
-LDFLAGS+=" -lPocoJSON -lPocoUtil -lPocoNet -lPocoFoundation -lpthread"
+LDFLAGS+=" -lPocoJSON -lPocoUtil -lPocoNet -lPocoFoundation -lz -lpthread"
 
 WARN_FLAGS+=" -Wall -Wextra"
 
+if [ -n "${HDF5}" ]; then
+    : ${HDF5_FLAGS:="$(pkg-config --cflags --libs hdf5 2>/dev/null || echo -lhdf5)"}
+    CXXFLAGS+=" -DHAVE_HDF5 ${HDF5_FLAGS}"
+fi
+
 if [ -z "${DEBUG}" ]; then
     SPEED_FLAGS+="-Ofast -DNDEBUG -march=native"
+    : ${LOG_MAX_PRIORITY:=6}
 elif [ -z "${NOOPT}" ]; then
     SPEED_FLAGS+="-Og -ggdb  -DNDEBUG -march=native"
 else
     SPEED_FLAGS+="-O0 -ggdb"
 fi
 
+if [ -n "${DEBUG}" ]; then
+    CXXFLAGS+=" -DCOUNT_ALLOCATIONS"
+fi
+
+if [ -n "${LOG_MAX_PRIORITY}" ]; then
+    CXXFLAGS+=" -DLOG_MAX_PRIORITY=${LOG_MAX_PRIORITY}"
+fi
+
 CXXFLAGS+=" $WARN_FLAGS $SPEED_FLAGS"
 
 TEST_FLAGS+=" -Og -ggdb -march=native"
@@ -35,7 +49,19 @@ case "$TARGET" in
         echo "$cmd"
         eval "$cmd";;
     "test")
-        cmd="${CXX} -I src/include src/test.cpp -std=c++17 ${TEST_FLAGS} -o test"
+        cmd="${CXX} -I src/include src/test.cpp -std=c++17 ${TEST_FLAGS} -lz -o test"
+        echo "$cmd"
+        eval "$cmd";;
+    "bench")
+        cmd="${CXX} -I src/include src/bench.cpp src/processing.cpp -std=c++17 ${CXXFLAGS} ${LDFLAGS} -o bench"
+        echo "$cmd"
+        eval "$cmd";;
+    "points-cache")
+        cmd="${CXX} -I src/include src/points_cache.cpp -std=c++17 ${CXXFLAGS} -o points-cache"
+        echo "$cmd"
+        eval "$cmd";;
+    "generator")
+        cmd="${CXX} -I src/include src/generate_stream.cpp -std=c++17 ${CXXFLAGS} -lpthread -o generator"
         echo "$cmd"
         eval "$cmd";;
     "doc")
@@ -49,16 +75,26 @@ case "$TARGET" in
         echo "  tpx3app        (default) analysis application"
         echo "  server         raw data replay server"
         echo "  test           some unit tests for parts of the queueing code"
+        echo "  bench          component and pipeline benchmarks, --json for machine readable output"
+        echo "  points-cache   XES points file validator and energy point table cache writer"
+        echo "  generator      synthetic raw event stream and configuration generator"
         echo "  doc            compile documentation in doc/html"
         echo "Debendencies:"
         echo "  ${LDFLAGS}"
         echo "Environment:"
         echo "  CXX            C++-17 and g++ options compatible compiler"
-        echo "  tpx3app, server:"
+        echo "  tpx3app, server, bench, points-cache, generator:"
         echo "    CXXFLAGS     extra compiler flags"
         echo "    LDFLAGS      extra linker flags"
         echo "    SPEED_FLAGS  extra optimization flags"
         echo "    WARN_FLAGS   extra warning flags"
+        echo "    DEBUG        if set, compile for debugging with heap allocation counting (see alloc_counter.h)"
+        echo "    NOOPT        with DEBUG: no optimization, assertions enabled"
+        echo "    LOG_MAX_PRIORITY  least important log priority compiled in, 1 (fatal) .. 8 (trace),"
+        echo "                 default 6 (information) without DEBUG, 8 with DEBUG"
+        echo "  tpx3app, bench:"
+        echo "    HDF5         if set, enable the hdf5 output format"
+        echo "    HDF5_FLAGS   hdf5 compiler and linker flags (default from pkg-config)"
         echo "  test:"
         echo "    TEST_FLAGS   extra test executable flags";;
     *)
@@ -0,0 +1,759 @@
+/*!
+\file
+Benchmarks for the performance critical components and the processing pipeline
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <new>
+#include <algorithm>
+#include <iterator>
+#include <filesystem>
+#include <stdexcept>
+#include <unistd.h>
+#include "logging.h"
+
+namespace {
+    std::atomic<uint64_t> num_allocations = 0;  //!< Number of calls to global operator new
+    Logger& logger = Logger::get("Tpx3App");    //!< Poco logger object, used by the detector code
+
+    #include "version.h"
+}
+
+#include "decoder.h"
+#include "period_queues.h"
+#include "histogram_reduction.h"
+#include "io_buffers.h"
+#include "energy_points.h"
+#include "xes_output.h"
+#include "stream_generator.h"
+#include "data_handler.h"
+
+/*!
+\brief Counting global allocation
+\param size Number of bytes
+\return Allocated memory
+*/
+void* operator new(std::size_t size)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+// gcc can't tell that the replacement operator new allocates with malloc
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+/*!
+\brief Global deallocation
+\param ptr Memory allocated with operator new
+*/
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+/*!
+\brief Global sized deallocation
+\param ptr Memory allocated with operator new
+*/
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#pragma GCC diagnostic pop
+
+namespace {
+
+    using wall_clock = std::chrono::high_resolution_clock;  //!< Clock type
+    using Decode = AsiRawStreamDecoder;                     //!< Raw stream decoder object
+
+    /*!
+    \brief Benchmark result
+    */
+    struct result final {
+        std::string section;    //!< Benchmark section
+        std::string name;       //!< Measured quantity
+        double value;           //!< Measured value
+        std::string unit;       //!< Unit of `value`
+    };
+
+    std::vector<result> results;    //!< Collected benchmark results
+
+    /*!
+    \brief Add benchmark result
+    \param section  Benchmark section
+    \param name     Measured quantity
+    \param value    Measured value
+    \param unit     Unit of `value`
+    */
+    void report(const std::string& section, const std::string& name, double value, const std::string& unit)
+    {
+        results.push_back({section, name, value, unit});
+    }
+
+    /*!
+    \brief Seconds since a time point
+    \param t Start time point
+    \return Elapsed time in seconds
+    */
+    double seconds_since(wall_clock::time_point t)
+    {
+        return std::chrono::duration<double>(wall_clock::now() - t).count();
+    }
+
+    /*!
+    \brief Generate raw chunk words: mostly hits, one TDC per `tdc_interval` words
+    \param n            Number of words
+    \param tdc_interval Words between TDC events
+    \return Raw words
+    */
+    std::vector<uint64_t> raw_words(size_t n, size_t tdc_interval)
+    {
+        std::vector<uint64_t> words(n);
+        uint64_t seed = 1;
+        for (size_t i=0; i<n; i++) {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            if ((i % tdc_interval) == tdc_interval - 1)
+                words[i] = (0x6UL << 60) | ((seed >> 4) & 0x0ffffffffffffe1fUL) | (1UL << 5);
+            else
+                words[i] = (0xbUL << 60) | (seed >> 4);
+        }
+        return words;
+    }
+
+    /*!
+    \brief Time a classifier over chunk sized pieces of the input
+    \param classify     Classifier function
+    \param words        Raw words
+    \param chunk_words  Number of words per chunk
+    \param repeat       Number of passes over the input
+    \param col          Output columns
+    \return Words per second
+    */
+    template<typename Classifier>
+    double words_per_second(Classifier classify, const std::vector<uint64_t>& words, size_t chunk_words, unsigned repeat, event_columns& col)
+    {
+        uint64_t check = 0;
+        const auto t1 = wall_clock::now();
+        for (unsigned r=0; r<repeat; r++) {
+            for (size_t i=0; i<words.size(); i+=chunk_words) {
+                classify(&words[i], std::min(chunk_words, words.size() - i), col);
+                check += col.num_hits + col.num_tdc;
+            }
+        }
+        const auto t2 = wall_clock::now();
+        if (check != words.size() * repeat)
+            std::cerr << "classifier lost words\n";
+        return (words.size() * repeat) / std::chrono::duration<double>(t2 - t1).count();
+    }
+
+    /*!
+    \brief Time period attribution of TOAs, per event and per block
+    \param toa          TOAs in clock ticks
+    \param block_size   Number of TOAs between TDCs
+    \param repeat       Number of passes over the input
+    \param per_event    Output: per event attribution TOAs per second
+    \param batch        Output: batch attribution TOAs per second
+    */
+    void period_attribution(const std::vector<int64_t>& toa, size_t block_size, unsigned repeat, double& per_event, double& batch)
+    {
+        period_predictor predictor{0, 10000};
+        period_queues queues;
+        for (period_type p=0; p<(period_type)(toa.back() / 10000 + 2); p+=2) {
+            queues[p].start = p * 10000;
+            queues[p].start_seen = true;
+        }
+        period_block block;
+        uint64_t check1 = 0, check2 = 0;
+
+        const auto t1 = wall_clock::now();
+        for (unsigned r=0; r<repeat; r++) {
+            for (size_t i=0; i<toa.size(); i++) {
+                auto index = queues.period_index_for(predictor.period_prediction(toa[i]));
+                queues.refined_index(index, toa[i]);
+                check1 += index.period + index.disputed;
+            }
+        }
+        const auto t2 = wall_clock::now();
+        for (unsigned r=0; r<repeat; r++) {
+            for (size_t i=0; i<toa.size(); i+=block_size) {
+                const size_t n = std::min(block_size, toa.size() - i);
+                queues.period_indices_for(predictor, &toa[i], n, block);
+                for (size_t j=0; j<n; j++) {
+                    const auto index = queues.refined_index(block, j, toa[i + j]);
+                    check2 += index.period + index.disputed;
+                }
+            }
+        }
+        const auto t3 = wall_clock::now();
+        if (check1 != check2)
+            std::cerr << "period attribution mismatch\n";
+        per_event = (toa.size() * repeat) / std::chrono::duration<double>(t2 - t1).count();
+        batch = (toa.size() * repeat) / std::chrono::duration<double>(t3 - t2).count();
+    }
+
+    /*!
+    \brief Time TDC processing in period queues: register start, split disputed events, purge
+    \param num_periods      Number of periods
+    \param disputed         Number of disputed events per period change
+    \param max_queues       Number of remembered period changes
+    \param tdc_time         Output: average TDC processing time in seconds
+    \return Number of allocations per TDC after warm-up
+    */
+    double tdc_cycle(unsigned num_periods, unsigned disputed, unsigned max_queues, double& tdc_time)
+    {
+        constexpr int64_t interval = 10000;
+        constexpr unsigned warm_up = 100;
+        period_queues queues;
+        uint64_t check = 0;
+        uint64_t allocations = 0;
+        double time = .0;
+        for (period_type p=1; p<num_periods; p++) {
+            if (p == warm_up)
+                allocations = num_allocations;
+            const period_index index{p - 1, p, true};
+            for (unsigned i=0; i<disputed; i++)
+                queues[index].queue.emplace_back(p * interval - 500 + (i * 37) % 1000, i);
+            const int64_t tdc = p * interval;
+            const auto t1 = wall_clock::now();
+            auto& rq = queues.registerStart(index, tdc);
+            const auto later = std::partition(std::begin(rq), std::end(rq), [tdc](const reordering_element& el) { return el.toa < tdc; });
+            for (auto el = std::begin(rq); el != later; ++el)
+                check += index.period + el->event;
+            for (auto el = later; el != std::end(rq); ++el)
+                check += index.disputed_period + el->event;
+            rq.clear();
+            while (queues.size() > max_queues)
+                queues.erase(queues.oldest());
+            time += std::chrono::duration<double>(wall_clock::now() - t1).count();
+        }
+        if ((check == 0) && (disputed > 0))
+            std::cerr << "no events\n";
+        tdc_time = time / (num_periods - 1);
+        return double(num_allocations - allocations) / (num_periods - warm_up);
+    }
+
+    /*!
+    \brief Time summing up and clearing partial histograms
+    \param size         Number of bins per histogram
+    \param num_parts    Number of partial histograms
+    \param num_helpers  Number of helper threads
+    \param repeat       Number of reductions
+    \return Average reduction time in seconds
+    */
+    double aggregation(size_t size, unsigned num_parts, unsigned num_helpers, unsigned repeat)
+    {
+        histogram_reduction::pool<int> pool{num_helpers};
+        std::vector<std::vector<int>> part(num_parts, std::vector<int>(size, 1));
+        std::vector<int*> src;
+        for (auto& p : part)
+            src.push_back(p.data());
+        std::vector<int> dst(size);
+        double time = .0;
+        for (unsigned r=0; r<repeat; r++) {
+            for (auto& p : part)
+                std::fill(std::begin(p), std::end(p), 1);
+            const auto t1 = wall_clock::now();
+            pool.run(dst.data(), src.data(), src.size(), size);
+            time += std::chrono::duration<double>(wall_clock::now() - t1).count();
+            if (dst[size / 2] != (int)num_parts)
+                std::cerr << "aggregation mismatch\n";
+        }
+        return time / repeat;
+    }
+
+
+    /*!
+    \brief Time the per word decoding functions of the raw stream decoder
+    \param words    Raw words, TOA events are decoded
+    \param tdc      Raw TDC words
+    \param repeat   Number of passes over the input
+    \param toa_rate Output: decoded TOA events per second
+    \param tdc_rate Output: decoded TDC events per second
+    */
+    void decoding(const std::vector<uint64_t>& words, const std::vector<uint64_t>& tdc, unsigned repeat, double& toa_rate, double& tdc_rate)
+    {
+        std::vector<uint64_t> toa;
+        std::copy_if(std::begin(words), std::end(words), std::back_inserter(toa), [](uint64_t w) { return Decode::matchesNibble(w, 0xb); });
+        uint64_t check = 0;
+        const auto t1 = wall_clock::now();
+        for (unsigned r=0; r<repeat; r++) {
+            for (const auto w : toa)
+                check += Decode::getToaClock(w) + Decode::packHit(Decode::getTotClock(w), Decode::getFlatPixel(w));
+        }
+        const auto t2 = wall_clock::now();
+        for (unsigned r=0; r<repeat; r++) {
+            for (const auto w : tdc)
+                check += Decode::getTdcClock(w);
+        }
+        const auto t3 = wall_clock::now();
+        if (check == 0)
+            std::cerr << "no events decoded\n";
+        toa_rate = (toa.size() * repeat) / std::chrono::duration<double>(t2 - t1).count();
+        tdc_rate = (tdc.size() * repeat) / std::chrono::duration<double>(t3 - t2).count();
+    }
+
+    /*!
+    \brief Time period predictor updates for TDC events and period predictions for hits
+    \param num_tdc          Number of TDC events, with some jitter
+    \param hits_per_tdc     Number of period predictions per TDC
+    \param window           Predictor fit window, 0 for median mode
+    \param update_rate      Output: TDC updates per second
+    \param prediction_rate  Output: period predictions per second
+    */
+    void prediction(unsigned num_tdc, unsigned hits_per_tdc, unsigned window, double& update_rate, double& prediction_rate)
+    {
+        constexpr int64_t interval = 10000;
+        std::vector<int64_t> tdc(num_tdc);
+        uint64_t seed = 1;
+        for (unsigned i=0; i<num_tdc; i++) {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            tdc[i] = (i + 1) * interval + (int64_t)((seed >> 33) % 21) - 10;
+        }
+        period_predictor predictor{0, interval};
+        predictor.set_window(window);
+        double check = .0;
+        const auto t1 = wall_clock::now();
+        for (unsigned i=0; i<num_tdc; i++) {
+            predictor.prediction_update(tdc[i]);
+            if ((i % 1024) == 1023)
+                predictor.start_update(tdc[i]);
+        }
+        check += predictor.interval_prediction();
+        const auto t2 = wall_clock::now();
+        const int64_t step = interval / hits_per_tdc;
+        for (unsigned i=0; i<num_tdc; i++) {
+            for (unsigned j=0; j<hits_per_tdc; j++)
+                check += predictor.period_prediction(tdc[i] + j * step);
+        }
+        const auto t3 = wall_clock::now();
+        if (check == .0)
+            std::cerr << "no predictions\n";
+        update_rate = num_tdc / std::chrono::duration<double>(t2 - t1).count();
+        prediction_rate = (double(num_tdc) * hits_per_tdc) / std::chrono::duration<double>(t3 - t2).count();
+    }
+
+    /*!
+    \brief Time IO buffer hand-off from a reader thread to an analyser thread
+    \tparam Pool        IO buffer pool type, `io_buffer_pool` or `io_buffer_ring`
+    \param pool         IO buffer pool
+    \param num_buffers  Number of buffers to pass
+    \return Buffers per second
+    */
+    template<typename Pool>
+    double handoff(Pool& pool, uint64_t num_buffers)
+    {
+        const auto t1 = wall_clock::now();
+        std::thread reader([&pool, num_buffers]{
+            for (uint64_t i=0; i<num_buffers; i++) {
+                auto buf = pool.get_empty_buffer();
+                buf->content_size = buf->content.size();
+                pool.put_nonempty_buffer({i, std::move(buf)});
+            }
+            pool.finish_writing();
+        });
+        uint64_t count = 0;
+        while (true) {
+            auto element = pool.get_nonempty_buffer();
+            if (! element.second)
+                break;
+            count++;
+            pool.put_empty_buffer(std::move(element.second));
+        }
+        reader.join();
+        const double time = seconds_since(t1);
+        if (count != num_buffers)
+            std::cerr << "IO buffers lost\n";
+        return num_buffers / time;
+    }
+
+    /*!
+    \brief Time histogramming of period attributed events through `processing::processEvent()`
+
+    `processing::init()` must have been called.
+
+    \param num_chips    Number of chips
+    \param num_events   Number of events per chip
+    \param toa_range    Relative TOAs are within [0..toa_range)
+    \return Events per second
+    */
+    double histogramming(unsigned num_chips, size_t num_events, int64_t toa_range)
+    {
+        std::vector<uint64_t> event(num_events);
+        std::vector<int64_t> reltoa(num_events);
+        uint64_t seed = 1;
+        for (size_t i=0; i<num_events; i++) {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            event[i] = Decode::packHit(50, (seed >> 16) % (chip_size * chip_size));
+            reltoa[i] = (seed >> 40) % toa_range;
+        }
+        const auto t1 = wall_clock::now();
+        for (unsigned c=0; c<num_chips; c++) {
+            for (size_t i=0; i<num_events; i++)
+                processing::processEvent(c, 0, reltoa[i], event[i]);
+        }
+        return (double(num_chips) * num_events) / seconds_since(t1);
+    }
+
+    /*!
+    \brief Time writing one period of XES data
+    \param format   Output format name, see `xes::Writer::create()`
+    \param data     XES data
+    \param fname    Output file name without period and extension
+    \return Write time in seconds
+    */
+    double write_time(const std::string& format, const xes::Data& data, const std::string& fname)
+    {
+        auto writer = xes::Writer::create(format, fname);
+        const auto t1 = wall_clock::now();
+        writer->Write(data, 0);
+        return seconds_since(t1);
+    }
+
+    /*!
+    \brief Time the analysis pipeline on a raw event stream file
+
+    The file is analysed by `DataHandler` with the tpx3app default IO buffer settings.
+    `processing::init()` must have been called.
+
+    \tparam Pool        Per chip IO buffer pool type, `io_buffer_pool` or `io_buffer_ring`
+    \param path         Raw event stream file
+    \param num_chips    Number of chips
+    \param period       TDC period in clock ticks
+    \param hits         Output: number of analysed TOA events
+    \return Analysis time in seconds
+    */
+    template<typename Pool>
+    double pipeline(const std::string& path, unsigned num_chips, int64_t period, uint64_t& hits)
+    {
+        file_source source{path};
+        const auto t1 = wall_clock::now();
+        DataHandler<Decode, Pool> handler(source, logger, 1024, 8, num_chips, period, 0.1, 4);
+        handler.run_async();
+        handler.await();
+        const double time = seconds_since(t1);
+        hits = handler.hitCount;
+        return time;
+    }
+
+    /*!
+    \brief Temporary working directory for processing configuration and output files
+
+    The constructor changes into the directory, the destructor changes back and removes it.
+    */
+    struct work_dir final {
+        std::filesystem::path previous; //!< Previous working directory
+        std::filesystem::path path;     //!< Temporary directory
+
+        /*!
+        \brief Constructor, create temporary directory
+        \throw std::runtime_error if the directory cannot be created
+        */
+        work_dir()
+            : previous{std::filesystem::current_path()}
+        {
+            std::string name = (std::filesystem::temp_directory_path() / "tpx3bench-XXXXXX").string();
+            if (! mkdtemp(name.data()))
+                throw std::runtime_error(std::string("unable to create temporary directory: ") + std::strerror(errno));
+            path = name;
+            std::filesystem::current_path(path);
+        }
+
+        work_dir(const work_dir&) = delete;
+        work_dir(work_dir&&) = delete;
+        work_dir& operator=(const work_dir&) = delete;
+        work_dir& operator=(work_dir&&) = delete;
+
+        /*!
+        \brief Destructor, remove temporary directory
+        */
+        ~work_dir()
+        {
+            std::error_code ec;
+            std::filesystem::current_path(previous, ec);
+            std::filesystem::remove_all(path, ec);
+        }
+    };
+
+    /*!
+    \brief Write Processing.ini and XESPoints.inp into the current directory
+
+    Every pixel maps to a single energy point, pixel p to energy point p mod `npoints`.
+
+    \param num_chips    Number of chips
+    \param bin_step     Time bin width in clock ticks
+    \param time_bins    Number of time bins
+    \param npoints      Number of energy points
+    */
+    void write_config(unsigned num_chips, unsigned bin_step, unsigned time_bins, unsigned npoints)
+    {
+        std::ofstream ini("Processing.ini");
+        ini << "TRStart=0\nTRStep=" << bin_step << "\nTRN=" << time_bins
+            << "\nFileOutputPath=./\nShortFileName=bench\nOutputFormat=binary\n";
+        std::ofstream points("XESPoints.inp");
+        for (unsigned c=0; c<num_chips; c++) {
+            for (unsigned p=0; p<chip_size*chip_size; p++)
+                points << c << ',' << p << ',' << (p % npoints) << ",1\n";
+        }
+        if (ini.close(), points.close(), ini.fail() || points.fail())
+            throw std::ios_base::failure("unable to write processing configuration");
+    }
+
+    /*!
+    \brief JSON string literal
+    \param s String
+    \return Quoted and escaped `s`
+    */
+    std::string json_string(const std::string& s)
+    {
+        std::string out = "\"";
+        for (const char c : s) {
+            if ((c == '"') || (c == '\\')) {
+                out += '\\';
+                out += c;
+            } else if ((unsigned char)c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        return out + '"';
+    }
+
+    /*!
+    \brief Print results as JSON
+    \param out      Output stream
+    \param params   Benchmark parameters as (name, value) pairs
+    */
+    void print_json(std::ostream& out, const std::vector<std::pair<std::string, double>>& params)
+    {
+        out << std::setprecision(9)
+            << "{\n  \"version\": " << json_string(VERSION)
+            << ",\n  \"isa\": " << json_string(Decode::vectorIsa)
+            << ",\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+            << ",\n  \"parameters\": {";
+        for (unsigned i=0; i<params.size(); i++)
+            out << (i ? "," : "") << "\n    " << json_string(params[i].first) << ": " << params[i].second;
+        out << "\n  },\n  \"results\": [";
+        for (unsigned i=0; i<results.size(); i++) {
+            const auto& r = results[i];
+            out << (i ? "," : "") << "\n    {\"section\": " << json_string(r.section) << ", \"name\": " << json_string(r.name) << ", \"value\": ";
+            if (std::isfinite(r.value))
+                out << r.value;
+            else
+                out << "null";
+            out << ", \"unit\": " << json_string(r.unit) << '}';
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    /*!
+    \brief Print results for humans
+    \param out Output stream
+    */
+    void print_text(std::ostream& out)
+    {
+        const std::string* section = nullptr;
+        for (const auto& r : results) {
+            if (!section || (*section != r.section))
+                out << r.section << '\n';
+            section = &r.section;
+            out << "  " << r.name << ": " << r.value << ' ' << r.unit << '\n';
+        }
+    }
+
+} // namespace
+
+/*!
+\brief Benchmark entry point
+\param argc Number of commandline arguments
+\param argv Commandline arguments: [--json] [number of words [chunk words [repetitions]]]
+\return 0 for ok
+*/
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    std::vector<std::string> args;
+    for (int i=1; i<argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0)
+            json = true;
+        else
+            args.emplace_back(argv[i]);
+    }
+    const size_t num_words = (args.size() > 0) ? std::stoul(args[0]) : (1ul << 20);
+    const size_t chunk_words = (args.size() > 1) ? std::stoul(args[1]) : 1024;
+    const unsigned repeat = (args.size() > 2) ? std::stoul(args[2]) : 20;
+
+    logger.setLevel(Message::PRIO_ERROR);
+
+    try {
+        const auto words = raw_words(num_words, 1000);
+        event_columns col;
+        {
+            const std::string section = "classify " + std::to_string(chunk_words) + " word chunks";
+            const double scalar = words_per_second(Decode::classifyScalar, words, chunk_words, repeat, col);
+            const double vector = words_per_second(Decode::classify, words, chunk_words, repeat, col);
+            report(section, "scalar", scalar, "words/s");
+            report(section, Decode::vectorIsa, vector, "words/s");
+            report(section, "speedup", vector / scalar, "x");
+        }
+
+        {
+            double toa_rate = .0, tdc_rate = .0;
+            decoding(words, raw_words(num_words / 16, 1), repeat, toa_rate, tdc_rate);
+            report("decode per word", "toa, tot, pixel", toa_rate, "events/s");
+            report("decode per word", "tdc", tdc_rate, "events/s");
+        }
+
+        {
+            double update_rate = .0, prediction_rate = .0;
+            prediction(std::max<size_t>(num_words / 16, 1024), 100, 0, update_rate, prediction_rate);
+            report("period predictor", "update", update_rate, "tdc/s");
+            report("period predictor", "prediction", prediction_rate, "hits/s");
+            prediction(std::max<size_t>(num_words / 16, 1024), 100, 16, update_rate, prediction_rate);
+            report("period predictor", "fit16 update", update_rate, "tdc/s");
+        }
+
+        {
+            std::vector<int64_t> sorted_toa(num_words);
+            for (size_t i=0; i<num_words; i++)
+                sorted_toa[i] = i * 10;     // 1000 hits per period
+            double per_event = .0, batch = .0;
+            period_attribution(sorted_toa, 1000, repeat, per_event, batch);
+            report("period attribution, blocks of 1000", "per event", per_event, "hits/s");
+            report("period attribution, blocks of 1000", "batch", batch, "hits/s");
+            report("period attribution, blocks of 1000", "speedup", batch / per_event, "x");
+        }
+
+        for (const unsigned disputed : {0u, 20u, 200u, 2000u}) {
+            const std::string section = "period queues, " + std::to_string(disputed) + " disputed events per TDC, 4 queues";
+            double tdc_time = .0;
+            const double allocations = tdc_cycle(200000, disputed, 4, tdc_time);
+            report(section, "TDC processing", tdc_time * 1e9, "ns");
+            report(section, "allocations per TDC", allocations, "");
+        }
+
+        {
+            const uint64_t num_buffers = std::max<size_t>(num_words / 64, 1024);
+            io_buffer_pool pool{8, 1024};
+            report("IO buffer hand-off, 1024 bytes", "pool", handoff(pool, num_buffers), "buffers/s");
+            io_buffer_ring ring{8, 1024};
+            report("IO buffer hand-off, 1024 bytes", "ring", handoff(ring, num_buffers), "buffers/s");
+        }
+
+        {
+            constexpr size_t histo_size = 16ul << 20;
+            const std::string section = "aggregation of 8 histograms with " + std::to_string(histo_size) + " bins";
+            const double serial = aggregation(histo_size, 8, 0, 10);
+            const unsigned helpers = histogram_reduction::pool<int>::helpers_for(histo_size, 3);
+            const double parallel = aggregation(histo_size, 8, helpers, 10);
+            report(section, "serial", serial * 1e3, "ms");
+            report(section, std::to_string(helpers) + " helpers", parallel * 1e3, "ms");
+            report(section, "speedup", serial / parallel, "x");
+        }
+
+        constexpr unsigned num_chips = 4;
+        constexpr unsigned npoints = 64;
+        constexpr unsigned time_bins = 1000;
+        constexpr unsigned bin_step = 10;
+        constexpr int64_t period = time_bins * bin_step;
+        detector_layout layout{2 * chip_size, 2 * chip_size, {{0, 0}, {chip_size, 0}, {0, chip_size}, {chip_size, chip_size}}};
+        work_dir dir;
+
+        {
+            Detector detector{layout};
+            detector.SetTimeROI(0, 1, 5000);
+            detector.energy_points.npoints = 1024;
+            xes::Data data{detector};
+            uint64_t seed = 1;
+            for (auto& bin : data.TDSpectra) {
+                seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                bin = (seed >> 33) % 100000;
+            }
+            const std::string section = "write 5000x1024 period";
+            report(section, "text (SaveToFile)", write_time("text", data, "write") * 1e3, "ms");
+            report(section, "binary", write_time("binary", data, "write") * 1e3, "ms");
+            #ifdef HAVE_HDF5
+                report(section, "hdf5", write_time("hdf5", data, "write") * 1e3, "ms");
+            #endif
+        }
+
+        write_config(num_chips, bin_step, time_bins, npoints);
+        {
+            // the first init parses XESPoints.inp and writes the energy point table cache, the second one loads it
+            const auto t0 = wall_clock::now();
+            processing::init(layout);
+            const auto t1 = wall_clock::now();
+            processing::init(layout);
+            const auto t2 = wall_clock::now();
+            const std::string section = "processing::init, " + std::to_string(num_chips) + " chips";
+            report(section, "XESPoints.inp", std::chrono::duration<double>{t1 - t0}.count() * 1e3, "ms");
+            report(section, "cached table", std::chrono::duration<double>{t2 - t1}.count() * 1e3, "ms");
+        }
+
+        report("histogramming, " + std::to_string(npoints) + " energy points", processing::kernelName(),
+               histogramming(num_chips, num_words, period), "hits/s");
+        {
+            // same ROI length with a power of two bin step
+            constexpr unsigned pow2_step = 8;
+            write_config(num_chips, pow2_step, period / pow2_step, npoints);
+            processing::init(layout);
+            report("histogramming, " + std::to_string(npoints) + " energy points", processing::kernelName(),
+                   histogramming(num_chips, num_words, period), "hits/s");
+            write_config(num_chips, bin_step, time_bins, npoints);
+            processing::init(layout);
+        }
+
+        {
+            // the IO buffer pools poll, so don't run more analyser threads than there are spare cores
+            const unsigned stream_chips = std::clamp(std::thread::hardware_concurrency(), 2u, num_chips + 1) - 1;
+            constexpr unsigned ntoa = 1000;
+            const uint64_t nperiods = std::max<uint64_t>(num_words * 4 / (stream_chips * ntoa), 16);
+            const auto stream = stream_generator::generate_stream(stream_chips, period, nperiods, 50, ntoa, 1);
+            {
+                std::ofstream raw("stream.raw", std::ios::binary);
+                raw.write(reinterpret_cast<const char*>(stream.data()), stream.size() * sizeof(uint64_t));
+                raw.close();
+                if (raw.fail())
+                    throw std::ios_base::failure("unable to write stream.raw");
+            }
+            const std::string section = "pipeline, " + std::to_string(stream_chips) + " chips, " + std::to_string(nperiods) + " periods, " + std::to_string(ntoa) + " hits per period";
+            const double mbytes = (stream.size() * sizeof(uint64_t)) * 1e-6;
+            uint64_t hits = 0;
+            const double map_time = pipeline<io_buffer_pool>("stream.raw", stream_chips, period, hits);
+            report(section, "map pool", hits / map_time, "hits/s");
+            report(section, "map pool bandwidth", mbytes / map_time, "MB/s");
+            const double ring_time = pipeline<io_buffer_ring>("stream.raw", stream_chips, period, hits);
+            report(section, "ring pool", hits / ring_time, "hits/s");
+            report(section, "ring pool bandwidth", mbytes / ring_time, "MB/s");
+            report(section, "hits", hits, "");
+        }
+    } catch (std::exception& ex) {
+        std::cerr << "benchmark failed: " << ex.what() << '\n';
+        return 1;
+    }
+
+    if (json)
+        print_json(std::cout, {{"words", num_words}, {"chunk_words", chunk_words}, {"repeat", repeat}});
+    else
+        print_text(std::cout);
+    return 0;
+}
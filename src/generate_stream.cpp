@@ -0,0 +1,265 @@
+/*!
+\file
+Generate a production scale synthetic raw event stream with matching analysis configuration files
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stream_generator.h"
+
+namespace {
+
+    /*!
+    \brief Print help text
+    \param progname The name of the executable
+    */
+    [[noreturn]]
+    void help(const std::string& progname)
+    {
+        const stream_generator::config defaults;
+        std::cout << progname << " (-h | --help)\n";
+        std::cout << progname << " [(-t | --threads) NUM] [(-o | --output) PATH] [(-d | --config-dir) DIR] [SPEC]\n";
+        std::cout << "  Generate a synthetic raw event stream and the XESPoints.inp and Processing.ini files\n"
+                     "  for analysing it. The detector layout is written to the output path + .json,\n"
+                     "  where tpx3app --input-file finds it.\n"
+                     "  -t, --threads     number of generator threads (default: number of cores)\n"
+                     "  -o, --output      raw event stream file, - for stdout (default: synthetic.tpx3)\n"
+                     "  -d, --config-dir  directory for XESPoints.inp and Processing.ini (default: .)\n"
+                     "  SPEC              comma separated list of KEY=VALUE stream model settings, defaults:\n"
+                     "                    " << defaults << "\n"
+                     "    chips       number of chips\n"
+                     "    period      mean period length in clock ticks (1.5625ns)\n"
+                     "    periods     number of periods, periods * period must stay below 2^34 clock ticks\n"
+                     "    hits        mean number of hits per chip and period, Poisson distributed\n"
+                     "    chunk_hits  mean number of hits per chunk, at most 2000\n"
+                     "    tdc_jitter  largest TDC deviation from the period grid in clock ticks\n"
+                     "    disorder    largest emission delay in clock ticks, hits and TDCs within this\n"
+                     "                window overtake each other around period boundaries\n"
+                     "    tot_min     smallest TOT\n"
+                     "    tot_max     largest TOT\n"
+                     "    points      number of energy points, stripes along the pixel row\n"
+                     "    bins        minimum number of time bins per period\n"
+                     "    packet_ids  1: start chunks with SERVAL 3.2 packet ids, 0: no packet ids\n"
+                     "    seed        random seed\n"
+                     "  The same SPEC generates the same stream, independent of the number of threads.\n"
+                     "  The replay server generates it directly with server --generate=SPEC.\n";
+        exit(0);
+    }
+
+    /*!
+    \brief Write all bytes
+    \param fd   File descriptor
+    \param buf  Byte buffer
+    \param size Number of bytes
+    \throw std::runtime_error if writing fails
+    */
+    void write_all(int fd, const char* buf, size_t size)
+    {
+        while (size > 0) {
+            const ssize_t written = ::write(fd, buf, size);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string{"write failed: "} + std::strerror(errno));
+            }
+            buf += written;
+            size -= written;
+        }
+    }
+
+    /*!
+    \brief Write a configuration file
+    \param path     File path
+    \param cfg      Stream model settings
+    \param writer   File content writer
+    \throw std::runtime_error if the file cannot be written
+    */
+    template<typename Writer>
+    void write_file(const std::string& path, const stream_generator::config& cfg, Writer writer)
+    {
+        std::ofstream out(path);
+        writer(out, cfg);
+        if (out.close(), out.fail())
+            throw std::runtime_error(std::string{"unable to write "} + path);
+        std::cerr << path << " written\n";
+    }
+
+    /*!
+    \brief Generate the stream in parallel and write it in order
+
+    Worker threads generate blocks of periods for all chips into a ring of slots,
+    the calling thread writes the slots in block order.
+
+    \param gen      Stream model
+    \param fd       Output file descriptor
+    \param threads  Number of worker threads
+    \return Number of hits written
+    */
+    uint64_t generate(const stream_generator::generator& gen, int fd, unsigned threads)
+    {
+        constexpr uint64_t block_periods = 16;  // periods per block
+        const uint64_t periods = gen.settings().periods;
+        const uint64_t blocks = (periods + block_periods - 1) / block_periods;
+        const uint64_t nslots = 2 * threads;
+
+        struct slot final {
+            std::vector<uint64_t> words;    // raw stream words of the block
+            uint64_t hits = 0;              // number of hits in the block
+            bool ready = false;             // block generated, not written yet
+        };
+        std::vector<slot> slots(nslots);
+        std::mutex mutex;
+        std::condition_variable cond;
+        uint64_t next_block = 0;            // next block to generate
+        uint64_t written = 0;               // blocks written
+        bool failed = false;                // stop on error
+        std::exception_ptr error;           // first worker error
+
+        std::vector<std::thread> worker;
+        for (unsigned t=0; t<threads; t++) {
+            worker.emplace_back([&]() {
+                try {
+                    for (;;) {
+                        uint64_t b;
+                        {
+                            std::unique_lock lock(mutex);
+                            if (failed || (next_block >= blocks))
+                                return;
+                            b = next_block++;
+                            cond.wait(lock, [&]() { return failed || (b < written + nslots); });
+                            if (failed)
+                                return;
+                        }
+                        slot& s = slots[b % nslots];
+                        s.words.clear();
+                        s.hits = gen.generate(b * block_periods, std::min(periods, (b + 1) * block_periods), s.words);
+                        {
+                            std::lock_guard lock(mutex);
+                            s.ready = true;
+                        }
+                        cond.notify_all();
+                    }
+                } catch (...) {
+                    std::lock_guard lock(mutex);
+                    if (! error)
+                        error = std::current_exception();
+                    failed = true;
+                    cond.notify_all();
+                }
+            });
+        }
+
+        uint64_t hits = 0;
+        try {
+            for (uint64_t b=0; b<blocks; b++) {
+                slot& s = slots[b % nslots];
+                {
+                    std::unique_lock lock(mutex);
+                    cond.wait(lock, [&]() { return failed || s.ready; });
+                    if (failed)
+                        break;
+                }
+                write_all(fd, reinterpret_cast<const char*>(s.words.data()), s.words.size() * sizeof(uint64_t));
+                hits += s.hits;
+                {
+                    std::lock_guard lock(mutex);
+                    s.ready = false;
+                    written++;
+                }
+                cond.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            error = std::current_exception();
+            failed = true;
+            cond.notify_all();
+        }
+
+        for (auto& w : worker)
+            w.join();
+        if (error)
+            std::rethrow_exception(error);
+        return hits;
+    }
+
+} // namespace
+
+/*!
+\brief Main function
+\param argc Number of commandline arguments
+\param argv Commandline argument values
+\return 0 if no errors, not 0 otherwise
+*/
+int main(int argc, char *argv[])
+{
+    std::string output = "synthetic.tpx3";
+    std::string config_dir = ".";
+    std::string spec;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "--help") || (arg == "-h")) {
+            help(argv[0]);
+        } else if ((arg == "--threads") || (arg == "-t")) {
+            if ((++i == argc) || ((threads = std::strtoul(argv[i], nullptr, 10)) == 0)) {
+                std::cerr << "positive number of threads expected\n";
+                return 1;
+            }
+        } else if ((arg == "--output") || (arg == "-o")) {
+            if (++i == argc) {
+                std::cerr << "output path expected\n";
+                return 1;
+            }
+            output = argv[i];
+        } else if ((arg == "--config-dir") || (arg == "-d")) {
+            if (++i == argc) {
+                std::cerr << "configuration directory expected\n";
+                return 1;
+            }
+            config_dir = argv[i];
+        } else {
+            spec = arg;
+        }
+    }
+
+    try {
+        stream_generator::config cfg;
+        cfg.parse(spec);
+        const stream_generator::generator gen{cfg};
+        std::cerr << "generating " << cfg << " with " << threads << " threads, "
+                  << gen.chunks_per_period() << " chunks per chip and period\n";
+
+        write_file(config_dir + "/XESPoints.inp", cfg, stream_generator::write_points);
+        write_file(config_dir + "/Processing.ini", cfg, stream_generator::write_processing);
+        if (output != "-")
+            write_file(output + ".json", cfg, stream_generator::write_layout);
+
+        const int fd = (output == "-") ? STDOUT_FILENO : ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error(std::string{"unable to open "} + output + ": " + std::strerror(errno));
+        const auto t0 = std::chrono::steady_clock::now();
+        const uint64_t hits = generate(gen, fd, threads);
+        const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if ((fd != STDOUT_FILENO) && (::close(fd) != 0))
+            throw std::runtime_error(std::string{"unable to close "} + output + ": " + std::strerror(errno));
+        std::cerr << output << ": " << hits << " hits in " << time << "s, " << (hits / time) << " hits/s\n";
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
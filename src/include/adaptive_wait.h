@@ -0,0 +1,176 @@
+#ifndef ADAPTIVE_WAIT_H
+#define ADAPTIVE_WAIT_H
+
+/*!
+\file
+Provide adaptive waiting: spin briefly, then park the thread on a futex
+*/
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <cstdint>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*!
+\brief Adaptive waiting for hand-offs between threads
+
+A waiting thread first polls its condition for a short while, which keeps the hand-off latency
+low for a steady stream of data. If the condition stays false, the thread parks on a futex
+and is woken by the next `wait_point::notify()`, so idle threads don't burn cores between bursts.
+Parking always has a timeout, so conditions that are changed without notification (like stop flags)
+are still noticed.
+*/
+namespace adaptive_wait {
+
+    static constexpr unsigned spin_count = 1024;    //!< Number of condition polls with a pause instruction before yielding
+    static constexpr unsigned yield_count = 16;     //!< Number of condition polls with a yield before parking
+    static constexpr long park_timeout_ns = 10'000'000; //!< Maximum park duration in nanoseconds
+
+    /*!
+    \brief Waiting statistics of a thread
+    */
+    struct wait_stats final {
+        uint64_t waits = 0;     //!< Number of waits where the condition was not met right away
+        uint64_t parks = 0;     //!< Number of futex parks
+        double spin = .0;       //!< Seconds spent polling
+        double parked = .0;     //!< Seconds spent parked or preparing to park
+
+        /*!
+        \brief Add statistics of another thread
+        \param other Other statistics
+        \return Reference to this
+        */
+        inline wait_stats& operator+=(const wait_stats& other) noexcept
+        {
+            waits += other.waits;
+            parks += other.parks;
+            spin += other.spin;
+            parked += other.parked;
+            return *this;
+        }
+
+        /*!
+        \brief Statistics for logging
+        \return Description like `spin 0.1s, parked 2.5s, 1200 parks, 1500 waits`
+        */
+        inline std::string to_string() const
+        {
+            return "spin " + std::to_string(spin) + "s, parked " + std::to_string(parked) + "s, "
+                 + std::to_string(parks) + " parks, " + std::to_string(waits) + " waits";
+        }
+    };
+
+    /*!
+    \brief Waiting statistics of the calling thread
+    */
+    inline thread_local wait_stats stats;
+
+    /*!
+    \brief Tell the CPU that this is a polling loop
+    */
+    inline void cpu_relax() noexcept
+    {
+        #if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+        #elif defined(__aarch64__)
+            asm volatile("yield");
+        #endif
+    }
+
+    /*!
+    \brief Point threads wait at until another thread changes their condition (an event count)
+
+    The notifier changes the condition first and calls `notify()` afterwards. Without waiters,
+    `notify()` costs a fence and a load. Waiters register before the final condition check,
+    so a notification between that check and parking is never lost.
+    */
+    class wait_point final {
+        std::atomic<uint32_t> seq{0};       //!< Futex word, incremented by notifications with waiters
+        std::atomic<uint32_t> waiters{0};   //!< Number of threads about to park or parked
+
+        /*!
+        \brief Futex system call
+        \param op       Futex operation
+        \param val      Operation value
+        \param timeout  Wait timeout, nullptr for none
+        */
+        inline void futex(int op, uint32_t val, const struct timespec* timeout) noexcept
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), op, val, timeout, nullptr, 0);
+        }
+
+      public:
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+        /*!
+        \brief Notifier side: wake all waiting threads after changing their condition
+        */
+        inline void notify() noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters.load(std::memory_order_relaxed) == 0)
+                return;
+            seq.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+        }
+
+        /*!
+        \brief Waiter side: wait until a condition is met
+
+        Time and parks are accounted in the calling thread's `stats`.
+
+        \tparam Ready   Condition type, callable returning bool
+        \param ready    Condition, may also take the awaited item (like a try_pop)
+        */
+        template<typename Ready>
+        inline void await(Ready&& ready)
+        {
+            if (ready())
+                return;
+            using clock = std::chrono::steady_clock;
+            stats.waits++;
+            const auto t0 = clock::now();
+            for (unsigned i=0; i<spin_count; i++) {
+                cpu_relax();
+                if (ready()) {
+                    stats.spin += std::chrono::duration<double>(clock::now() - t0).count();
+                    return;
+                }
+            }
+            for (unsigned i=0; i<yield_count; i++) {
+                std::this_thread::yield();
+                if (ready()) {
+                    stats.spin += std::chrono::duration<double>(clock::now() - t0).count();
+                    return;
+                }
+            }
+            const auto t1 = clock::now();
+            stats.spin += std::chrono::duration<double>(t1 - t0).count();
+            while (true) {
+                waiters.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const uint32_t key = seq.load(std::memory_order_relaxed);
+                if (ready()) {
+                    waiters.fetch_sub(1, std::memory_order_relaxed);
+                    break;
+                }
+                stats.parks++;
+                const struct timespec timeout{0, park_timeout_ns};
+                futex(FUTEX_WAIT_PRIVATE, key, &timeout);
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                if (ready())
+                    break;
+            }
+            stats.parked += std::chrono::duration<double>(clock::now() - t1).count();
+        }
+    };
+
+} // namespace adaptive_wait
+
+#endif // ADAPTIVE_WAIT_H
@@ -0,0 +1,103 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+/*!
+\file
+Provide per thread heap allocation counting for checking allocation free hot paths
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/*!
+\brief Heap allocation counter
+
+If `COUNT_ALLOCATIONS` is defined (DEBUG builds, see compile.sh), the global `operator new`
+variants are replaced by versions that count allocations of the calling thread.
+The replacements are defined in the translation unit that defines `ALLOC_COUNTER_DEFINE`
+before including this header, which must be exactly one per program (the one with `main()`).
+
+Threads take a `mark()` after warm-up and check `since()` at the end of their steady state,
+which should be 0 for the hot paths of the reader and analyser threads.
+*/
+namespace alloc_counter {
+
+    #ifdef COUNT_ALLOCATIONS
+        static constexpr bool enabled = true;   //!< Allocations are counted
+    #else
+        static constexpr bool enabled = false;  //!< Allocations are not counted
+    #endif
+
+    /*!
+    \brief Number of heap allocations of the calling thread
+    */
+    inline thread_local uint64_t thread_count = 0;
+
+    /*!
+    \brief Allocation count mark
+    \return Current number of heap allocations of the calling thread
+    */
+    inline uint64_t mark() noexcept
+    {
+        return thread_count;
+    }
+
+    /*!
+    \brief Heap allocations since a mark
+    \param m Mark taken by the calling thread
+    \return Number of heap allocations of the calling thread since `m`, always 0 if counting is not enabled
+    */
+    inline uint64_t since(uint64_t m) noexcept
+    {
+        return thread_count - m;
+    }
+
+} // namespace alloc_counter
+
+#if defined(COUNT_ALLOCATIONS) && defined(ALLOC_COUNTER_DEFINE)
+
+    /*!
+    \brief Counting replacement of the global allocation function
+    \param size Number of bytes
+    \return Allocated memory
+    \throw std::bad_alloc if there is no memory
+    */
+    void* operator new(std::size_t size)
+    {
+        alloc_counter::thread_count++;
+        if (void* p = std::malloc(size ? size : 1))
+            return p;
+        throw std::bad_alloc{};
+    }
+
+    /*!
+    \brief Counting replacement of the global allocation function for over-aligned types
+    \param size     Number of bytes
+    \param align    Alignment
+    \return Allocated memory
+    \throw std::bad_alloc if there is no memory
+    */
+    void* operator new(std::size_t size, std::align_val_t align)
+    {
+        alloc_counter::thread_count++;
+        const std::size_t a = static_cast<std::size_t>(align);
+        if (void* p = std::aligned_alloc(a, ((size ? size : 1) + a - 1) & ~(a - 1)))
+            return p;
+        throw std::bad_alloc{};
+    }
+
+    void* operator new[](std::size_t size) { return operator new(size); }   //!< Array version \param size Number of bytes \return Allocated memory
+    void* operator new[](std::size_t size, std::align_val_t align) { return operator new(size, align); }    //!< Array version \param size Number of bytes \param align Alignment \return Allocated memory
+    void operator delete(void* p) noexcept { std::free(p); }                //!< Deallocation \param p Memory
+    void operator delete[](void* p) noexcept { std::free(p); }              //!< Deallocation \param p Memory
+    void operator delete(void* p, std::size_t) noexcept { std::free(p); }   //!< Sized deallocation \param p Memory
+    void operator delete[](void* p, std::size_t) noexcept { std::free(p); } //!< Sized deallocation \param p Memory
+    void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }  //!< Aligned deallocation \param p Memory
+    void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }//!< Aligned deallocation \param p Memory
+    void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }     //!< Sized aligned deallocation \param p Memory
+    void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }   //!< Sized aligned deallocation \param p Memory
+
+#endif
+
+#endif // ALLOC_COUNTER_H
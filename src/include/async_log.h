@@ -0,0 +1,112 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+/*!
+\file
+Asynchronous logging channel
+*/
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include "Poco/AutoPtr.h"
+#include "Poco/Channel.h"
+#include "Poco/Message.h"
+#include "mpsc_ring.h"
+
+/*!
+\brief Poco logging channel that hands messages to a writer thread
+
+Logging threads only copy the message into a lock-free `mpsc_ring`, the writer thread
+passes messages on to the target channel. If the ring is full, messages are dropped
+instead of waiting, and the writer reports the number of dropped messages.
+So a slow target channel, like a console, never stalls a logging thread.
+*/
+class async_channel final : public Poco::Channel {
+    Poco::AutoPtr<Poco::Channel> target;    //!< Channel that does the actual output
+    mpsc_ring<Poco::Message> queue;         //!< Messages not yet passed to `target`
+    std::atomic<uint64_t> dropped = 0;      //!< Number of messages dropped since the last report
+    std::atomic<bool> stop = false;         //!< Stop writer thread
+    std::thread writer;                     //!< Writer thread
+
+    /*!
+    \brief Report dropped messages to the target channel
+    */
+    inline void reportDropped()
+    {
+        const uint64_t n = dropped.exchange(0, std::memory_order_relaxed);
+        if (n > 0)
+            target->log(Poco::Message("Tpx3App", std::to_string(n) + " log messages dropped", Poco::Message::PRIO_WARNING));
+    }
+
+    /*!
+    \brief Writer thread main loop, sleeps for a millisecond when there is nothing to do
+    */
+    inline void serve()
+    {
+        Poco::Message msg;
+        while (true) {
+            if (queue.try_pop(msg)) {
+                target->log(msg);
+                continue;
+            }
+            reportDropped();
+            if (stop.load(std::memory_order_acquire)) {
+                while (queue.try_pop(msg))
+                    target->log(msg);
+                reportDropped();
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+  public:
+    /*!
+    \brief Constructor, starts the writer thread
+    \param channel  Target channel
+    \param capacity Maximum number of queued messages
+    */
+    inline async_channel(const Poco::AutoPtr<Poco::Channel>& channel, std::size_t capacity)
+        : target{channel}, queue{capacity}
+    {
+        writer = std::thread([this]{ serve(); });
+    }
+
+    async_channel(const async_channel&) = delete;
+    async_channel(async_channel&&) = delete;
+    async_channel& operator=(const async_channel&) = delete;
+    async_channel& operator=(async_channel&&) = delete;
+
+    /*!
+    \brief Destructor, stops the writer thread
+    */
+    inline ~async_channel() override
+    {
+        close();
+    }
+
+    /*!
+    \brief Queue message for the writer thread
+    \param msg Log message, dropped if the queue is full
+    */
+    inline void log(const Poco::Message& msg) override
+    {
+        Poco::Message copy{msg};
+        if (! queue.try_push(std::move(copy)))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*!
+    \brief Pass all queued messages to the target channel and stop the writer thread
+    */
+    inline void close() override
+    {
+        stop.store(true, std::memory_order_release);
+        if (writer.joinable())
+            writer.join();
+    }
+};
+
+#endif // ASYNC_LOG_H
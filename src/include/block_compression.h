@@ -0,0 +1,488 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+/*!
+\file
+Provide compression of raw stream copies in independent zlib blocks
+*/
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <zlib.h>
+
+/*!
+\brief Block compressed raw stream files
+
+A compressed file is a sequence of blocks, each consisting of a `block_header` followed by
+the zlib compressed (deflate) block data. Blocks are independent of each other, so they are
+compressed and decompressed in parallel. The block magic differs from the `TPX3` chunk magic,
+so readers recognize compressed files by their first 4 bytes.
+*/
+namespace block_compression {
+
+    static constexpr uint32_t magic = 0x5a585054UL;         //!< 'TPXZ' as uint32_t, little endian
+    static constexpr std::size_t default_block_size = 1ul << 20;    //!< Default uncompressed block size
+
+    /*!
+    \brief Header in front of every compressed block, all numbers little endian
+    */
+    struct block_header final {
+        uint32_t magic;         //!< `block_compression::magic`
+        uint32_t flags;         //!< Reserved, 0
+        uint32_t raw_size;      //!< Uncompressed block size in bytes
+        uint32_t packed_size;   //!< Compressed block size in bytes, without this header
+    };
+    static_assert(sizeof(block_header) == 16);
+
+    /*!
+    \brief Check for a compressed file
+    \param data File content
+    \param size File size in bytes
+    \return True if the file content starts with a block header
+    */
+    inline bool is_compressed(const char* data, std::size_t size) noexcept
+    {
+        uint32_t word;
+        if (size < sizeof(word))
+            return false;
+        std::memcpy(&word, data, sizeof(word));
+        return word == magic;
+    }
+
+    /*!
+    \brief Compress block
+    \param raw      Uncompressed bytes
+    \param size     Number of uncompressed bytes
+    \param level    zlib compression level 1 (fast) .. 9 (small)
+    \return Block header and compressed data
+    \throw std::runtime_error if zlib fails
+    */
+    inline std::vector<char> compress(const char* raw, std::size_t size, int level)
+    {
+        uLongf packed = compressBound(size);
+        std::vector<char> res(sizeof(block_header) + packed);
+        if (compress2(reinterpret_cast<Bytef*>(&res[sizeof(block_header)]), &packed, reinterpret_cast<const Bytef*>(raw), size, level) != Z_OK)
+            throw std::runtime_error("block compression failed");
+        const block_header header{magic, 0, uint32_t(size), uint32_t(packed)};
+        std::memcpy(res.data(), &header, sizeof(header));
+        res.resize(sizeof(block_header) + packed);
+        return res;
+    }
+
+    /*!
+    \brief Block location within a compressed file
+    */
+    struct block_info final {
+        std::size_t offset;     //!< Offset of the compressed data within the file
+        std::size_t packed;     //!< Compressed size in bytes
+        std::size_t raw_offset; //!< Offset of the uncompressed data
+        std::size_t raw;        //!< Uncompressed size in bytes
+    };
+
+    /*!
+    \brief Find all blocks of a compressed file
+    \param data File content
+    \param size File size in bytes
+    \return Blocks in file order
+    \throw std::runtime_error if the file does not consist of complete blocks
+    */
+    inline std::vector<block_info> index(const char* data, std::size_t size)
+    {
+        std::vector<block_info> res;
+        std::size_t raw_offset = 0;
+        for (std::size_t pos=0; pos<size;) {
+            block_header header;
+            if (pos + sizeof(header) > size)
+                throw std::runtime_error("incomplete compressed block header at end of file");
+            std::memcpy(&header, &data[pos], sizeof(header));
+            if (header.magic != magic)
+                throw std::runtime_error(std::string("compressed block header expected at offset ") + std::to_string(pos));
+            pos += sizeof(header);
+            if (pos + header.packed_size > size)
+                throw std::runtime_error("incomplete compressed block at end of file");
+            res.push_back({pos, header.packed_size, raw_offset, header.raw_size});
+            pos += header.packed_size;
+            raw_offset += header.raw_size;
+        }
+        return res;
+    }
+
+    /*!
+    \brief Uncompressed size of a compressed file
+    \param blocks Blocks, see `index()`
+    \return Number of uncompressed bytes
+    */
+    inline std::size_t raw_size(const std::vector<block_info>& blocks) noexcept
+    {
+        return blocks.empty() ? 0 : (blocks.back().raw_offset + blocks.back().raw);
+    }
+
+    /*!
+    \brief Decompress a compressed file in parallel
+    \param data     File content
+    \param blocks   Blocks, see `index()`
+    \param out      Output memory for `raw_size(blocks)` bytes
+    \param threads  Number of decompression threads, 0 for all hardware threads
+    \throw std::runtime_error if a block is corrupt
+    */
+    inline void decompress(const char* data, const std::vector<block_info>& blocks, char* out, unsigned threads=0)
+    {
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = std::max(1u, std::min<unsigned>(threads, blocks.size()));
+        std::vector<std::thread> pool;
+        std::vector<std::string> error(threads);
+        for (unsigned t=0; t<threads; t++) {
+            pool.emplace_back([&, t]() {
+                for (std::size_t i=t; i<blocks.size(); i+=threads) {
+                    const auto& block = blocks[i];
+                    uLongf raw = block.raw;
+                    if ((uncompress(reinterpret_cast<Bytef*>(&out[block.raw_offset]), &raw, reinterpret_cast<const Bytef*>(&data[block.offset]), block.packed) != Z_OK) ||
+                        (raw != block.raw)) {
+                        error[t] = std::string("corrupt compressed block at offset ") + std::to_string(block.offset - sizeof(block_header));
+                        return;
+                    }
+                }
+            });
+        }
+        for (auto& thread : pool)
+            thread.join();
+        for (const auto& err : error)
+            if (! err.empty())
+                throw std::runtime_error(err);
+    }
+
+    /*!
+    \brief Sequential reader decompressing a compressed file block by block
+
+    Only a window of two blocks per decompression thread is held in memory. The threads
+    decompress the blocks ahead of the read position in parallel, while `read()` copies
+    decompressed bytes out in file order.
+    */
+    class block_reader final {
+        /*!
+        \brief Decompression buffer for one block
+        */
+        struct slot final {
+            std::vector<char> raw;      //!< Uncompressed bytes
+            bool ready = false;         //!< `raw` holds the block, or `error` is set
+            std::string error;          //!< Decompression error
+        };
+
+        const char* data;                           //!< Compressed file content
+        const std::vector<block_info> blocks;       //!< Blocks, see `index()`
+        std::vector<slot> slots;                    //!< Block b is decompressed into slot b % slots.size()
+        std::size_t nextJob = 0;                    //!< Next block to decompress, protected by `lock`
+        std::size_t current = 0;                    //!< Block at the read position, protected by `lock`
+        std::size_t pos = 0;                        //!< Read position within the current block
+        std::mutex lock;                            //!< Protect `slots` state, `nextJob`, `current` and `stop`
+        std::condition_variable changed;            //!< Signal block completion, consumption and stop
+        std::vector<std::thread> pool;              //!< Decompression threads
+        bool stop = false;                          //!< Decompression threads should stop
+
+        /*!
+        \brief Decompression thread main loop
+        */
+        inline void serve()
+        {
+            std::unique_lock guard{lock};
+            while (true) {
+                changed.wait(guard, [this]() { return stop || ((nextJob < blocks.size()) && (nextJob < current + slots.size())); });
+                if (stop)
+                    return;
+                const std::size_t b = nextJob++;
+                slot& s = slots[b % slots.size()];
+                guard.unlock();
+                const auto& block = blocks[b];
+                s.raw.resize(block.raw);
+                uLongf raw = block.raw;
+                std::string err;
+                if ((uncompress(reinterpret_cast<Bytef*>(s.raw.data()), &raw, reinterpret_cast<const Bytef*>(&data[block.offset]), block.packed) != Z_OK) ||
+                    (raw != block.raw))
+                    err = std::string("corrupt compressed block at offset ") + std::to_string(block.offset - sizeof(block_header));
+                guard.lock();
+                s.error = std::move(err);
+                s.ready = true;
+                changed.notify_all();
+            }
+        }
+
+    public:
+        /*!
+        \brief Constructor, starts the decompression threads
+        \param file_data    Compressed file content, must outlive the reader
+        \param file_blocks  Blocks, see `index()`
+        \param threads      Number of decompression threads, 0 for all hardware threads
+        */
+        inline block_reader(const char* file_data, const std::vector<block_info>& file_blocks, unsigned threads=0)
+            : data{file_data}, blocks{file_blocks}
+        {
+            if (threads == 0)
+                threads = std::max(std::thread::hardware_concurrency(), 1u);
+            threads = std::max(1u, std::min<unsigned>(threads, blocks.size()));
+            slots.resize(2 * threads);
+            for (unsigned t=0; t<threads; t++)
+                pool.emplace_back([this]() { serve(); });
+        }
+
+        block_reader(const block_reader&) = delete;
+        block_reader& operator=(const block_reader&) = delete;
+
+        /*!
+        \brief Destructor, stops the decompression threads
+        */
+        inline ~block_reader()
+        {
+            {
+                std::lock_guard guard{lock};
+                stop = true;
+            }
+            changed.notify_all();
+            for (auto& thread : pool)
+                thread.join();
+        }
+
+        /*!
+        \brief Read decompressed bytes
+        \param out  Output buffer
+        \param size Maximum number of bytes to read
+        \return Number of bytes read, less than `size` only at the end of the file
+        \throw std::runtime_error if a block is corrupt
+        */
+        inline std::size_t read(char* out, std::size_t size)
+        {
+            std::size_t done = 0;
+            while ((done < size) && (current < blocks.size())) {
+                slot& s = slots[current % slots.size()];
+                if (pos == 0) {
+                    std::unique_lock guard{lock};
+                    changed.wait(guard, [&s]() { return s.ready; });
+                    if (! s.error.empty())
+                        throw std::runtime_error(s.error);
+                }
+                const std::size_t n = std::min(size - done, s.raw.size() - pos);
+                std::memcpy(&out[done], &s.raw[pos], n);
+                done += n;
+                pos += n;
+                if (pos == s.raw.size()) {
+                    {
+                        std::lock_guard guard{lock};
+                        s.ready = false;
+                        current++;
+                    }
+                    pos = 0;
+                    changed.notify_all();
+                }
+            }
+            return done;
+        }
+    };
+
+    /*!
+    \brief Multithreaded block compressor writing to an output stream
+
+    The caller cuts the raw stream into blocks of about `block_size` bytes. Full blocks are
+    compressed by a pool of threads, while the caller writes finished blocks in order.
+    At most two blocks per compression thread are in flight, then `write()` waits.
+    Blocks end at `write()` call boundaries, so with `write()` called once per chunk, every
+    block holds complete chunks.
+    */
+    class compressor final {
+        /*!
+        \brief Block compression job
+        */
+        struct job final {
+            std::vector<char> raw;      //!< Uncompressed bytes
+            std::vector<char> packed;   //!< Block header and compressed bytes
+            bool taken = false;         //!< A compression thread works on this job
+            bool done = false;          //!< `packed` is ready
+        };
+
+        std::ostream& out;                      //!< Compressed output
+        const int level;                        //!< zlib compression level
+        const std::size_t blockSize;            //!< Uncompressed block size
+        std::vector<char> current;              //!< Block collected by the caller
+        std::deque<std::unique_ptr<job>> jobs;  //!< Jobs in file order, protected by `lock`
+        std::mutex lock;                        //!< Protect `jobs`, `stop` and `error`
+        std::condition_variable changed;        //!< Signal job submission, completion and stop
+        std::vector<std::thread> pool;          //!< Compression threads
+        bool stop = false;                      //!< Compression threads should stop
+        std::string error;                      //!< Compression error
+        uint64_t rawBytes = 0;                  //!< Number of uncompressed bytes written out
+        uint64_t packedBytes = 0;               //!< Number of compressed bytes written out
+
+        /*!
+        \brief Compression thread main loop
+        */
+        inline void serve()
+        {
+            std::unique_lock guard{lock};
+            while (true) {
+                job* next = nullptr;
+                for (auto& j : jobs) {
+                    if (! j->taken) {
+                        next = j.get();
+                        break;
+                    }
+                }
+                if (next == nullptr) {
+                    if (stop)
+                        return;
+                    changed.wait(guard);
+                    continue;
+                }
+                next->taken = true;
+                guard.unlock();
+                std::vector<char> packed;
+                std::string err;
+                try {
+                    packed = compress(next->raw.data(), next->raw.size(), level);
+                } catch (std::exception& ex) {
+                    err = ex.what();
+                }
+                guard.lock();
+                next->packed = std::move(packed);
+                next->done = true;
+                if (! err.empty())
+                    error = err;
+                changed.notify_all();
+            }
+        }
+
+        /*!
+        \brief Write finished jobs at the head of the queue
+        \param guard Lock guard holding `lock`
+        \param limit Wait until at most this many jobs are queued
+        \throw std::runtime_error on compression or output errors
+        */
+        inline void drain(std::unique_lock<std::mutex>& guard, std::size_t limit)
+        {
+            while (true) {
+                if (! error.empty())
+                    throw std::runtime_error(error);
+                if (jobs.empty())
+                    return;
+                if (jobs.front()->done) {
+                    std::unique_ptr<job> j = std::move(jobs.front());
+                    jobs.pop_front();
+                    guard.unlock();
+                    out.write(j->packed.data(), j->packed.size());
+                    rawBytes += j->raw.size();
+                    packedBytes += j->packed.size();
+                    guard.lock();
+                    if (! out)
+                        throw std::runtime_error("compressed output write error");
+                    continue;
+                }
+                if (jobs.size() <= limit)
+                    return;
+                changed.wait(guard);
+            }
+        }
+
+        /*!
+        \brief Submit collected block for compression
+        \param limit Wait until at most this many jobs are queued afterwards
+        */
+        inline void submit(std::size_t limit)
+        {
+            std::unique_lock guard{lock};
+            if (! current.empty()) {
+                jobs.emplace_back(new job{});
+                jobs.back()->raw.swap(current);
+                current.reserve(blockSize);
+                changed.notify_all();
+            }
+            drain(guard, limit);
+        }
+
+      public:
+        /*!
+        \brief Constructor, starts the compression threads
+        \param output   Compressed output stream
+        \param threads  Number of compression threads, at least 1
+        \param zlevel   zlib compression level 1 (fast) .. 9 (small)
+        \param block    Uncompressed block size in bytes
+        */
+        inline compressor(std::ostream& output, unsigned threads, int zlevel, std::size_t block=default_block_size)
+            : out{output}, level{zlevel}, blockSize{block}
+        {
+            current.reserve(blockSize);
+            threads = std::max(threads, 1u);
+            for (unsigned i=0; i<threads; i++)
+                pool.emplace_back([this]{ serve(); });
+        }
+
+        compressor(const compressor&) = delete;
+        compressor(compressor&&) = delete;
+        compressor& operator=(const compressor&) = delete;
+        compressor& operator=(compressor&&) = delete;
+
+        /*!
+        \brief Destructor, stops the compression threads without writing outstanding blocks
+        */
+        inline ~compressor()
+        {
+            {
+                std::lock_guard guard{lock};
+                stop = true;
+                changed.notify_all();
+            }
+            for (auto& thread : pool)
+                thread.join();
+        }
+
+        /*!
+        \brief Add raw bytes
+        \param data Raw bytes
+        \param size Number of raw bytes
+        \throw std::runtime_error on compression or output errors
+        */
+        inline void write(const char* data, std::size_t size)
+        {
+            current.insert(current.end(), data, data + size);
+            if (current.size() >= blockSize)
+                submit(2 * pool.size());
+        }
+
+        /*!
+        \brief Compress and write all outstanding bytes
+        \throw std::runtime_error on compression or output errors
+        */
+        inline void flush()
+        {
+            submit(0);
+        }
+
+        /*!
+        \brief Number of uncompressed bytes written out so far
+        \return Bytes
+        */
+        inline uint64_t raw_bytes() const noexcept
+        {
+            return rawBytes;
+        }
+
+        /*!
+        \brief Number of compressed bytes written out so far
+        \return Bytes including block headers
+        */
+        inline uint64_t packed_bytes() const noexcept
+        {
+            return packedBytes;
+        }
+    };
+
+} // namespace block_compression
+
+#endif // BLOCK_COMPRESSION_H
@@ -0,0 +1,735 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+/*!
+\file
+Provide periodic checkpoints of the in-flight analysis state in a memory mapped file
+*/
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include <ios>
+#include <ostream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared_types.h"
+#include "period_predictor.h"
+#include "event_reordering.h"
+#include "metrics.h"
+#include "thread_placement.h"
+
+/*!
+\brief Checkpoint and resume of the analysis state
+
+When asked to, every analyser thread copies the state of its chip into a `chip_state` at the TDC event
+starting a common cut period, so all chip states describe the same point of the raw stream:
+the period predictor, the remembered period changes with their disputed events, the histogram save point
+and the per thread histograms of the periods that are not saved yet. The checkpoint writer thread (see `store`)
+serializes the chip states into an `image` and writes it into one of the two image slots of the checkpoint `file`.
+The slot with the older image is overwritten, so a crash while writing leaves the previous checkpoint intact.
+
+Resuming restores the newest valid image before the analysis threads start. Events between the checkpoint
+and the restart are lost, and raw stream time stamps must continue, i.e. the detector keeps acquiring.
+*/
+namespace checkpoint {
+
+    static constexpr char magic[8] = { 'T', 'P', 'X', '3', 'C', 'K', 'P', '1' };   //!< Checkpoint file magic and format version
+    static constexpr std::size_t page_size = 4096;  //!< Size of the file header region and alignment of image slots
+
+    /*!
+    \brief Remembered period change
+    */
+    struct queued_change final {
+        period_type period = 0;     //!< Higher period number of the period change
+        int64_t start = 0;          //!< Period start time stamp in clock ticks, valid if `start_seen` is set
+        uint64_t events = 0;        //!< Number of disputed events, they follow those of the previous changes in `chip_state::events`
+        uint64_t start_seen = 0;    //!< Non zero if the TDC of the period change has been seen
+    };
+
+    /*!
+    \brief Per thread histogram of a period that is not saved yet
+    */
+    struct histogram final {
+        period_type period = 0;     //!< Period of the histogram data slot
+        uint32_t worker = 0;        //!< Histogramming worker number within the chip
+        int32_t before_roi = 0;     //!< Number of events before the time ROI
+        int32_t after_roi = 0;      //!< Number of events after the time ROI
+        int32_t total = 0;          //!< Total number of events
+    };
+
+    /*!
+    \brief Analysis state of one chip
+    */
+    struct chip_state final {
+        period_predictor predictor;             //!< Period predictor
+        uint64_t tdcs = 0;                      //!< Number of TDC events seen
+        period_type save_point = 0;             //!< Next period for which histograms are saved
+        std::vector<queued_change> queues;      //!< Remembered period changes
+        std::vector<reordering_element> events; //!< Disputed events of all `queues`
+        std::vector<histogram> histograms;      //!< Histograms of periods from `save_point` on
+        std::vector<int32_t> bins;              //!< Bins of all `histograms`, `image::bins` per histogram
+
+        /*!
+        \brief Empty the state, keeps allocated memory
+        */
+        inline void clear() noexcept
+        {
+            tdcs = 0;
+            save_point = 0;
+            queues.clear();
+            events.clear();
+            histograms.clear();
+            bins.clear();
+        }
+    };
+
+    /*!
+    \brief Analysis state of all chips
+    */
+    struct image final {
+        uint64_t sequence = 0;          //!< Checkpoint number, increases with every checkpoint written to the file
+        uint32_t workers = 1;           //!< Number of histogramming workers per chip
+        uint64_t bins = 0;              //!< Number of bins per histogram
+        int64_t save_interval = 0;      //!< Histogram saving period in TDC periods
+        std::vector<chip_state> chip;   //!< Chip states indexed by chip number
+    };
+
+    static_assert(std::is_trivially_copyable_v<period_predictor>);
+    static_assert(std::is_trivially_copyable_v<reordering_element>);
+
+    /*!
+    \brief Serialized image header
+    */
+    struct image_header final {
+        uint64_t sequence;          //!< `image::sequence`
+        uint32_t chips;             //!< Number of chips
+        uint32_t workers;           //!< `image::workers`
+        uint64_t bins;              //!< `image::bins`
+        int64_t save_interval;      //!< `image::save_interval`
+    };
+
+    /*!
+    \brief Serialized chip state header, followed by the `queues`, `events`, `histograms` and `bins` arrays
+    */
+    struct chip_header final {
+        period_predictor predictor; //!< `chip_state::predictor`
+        uint64_t tdcs;              //!< `chip_state::tdcs`
+        period_type save_point;     //!< `chip_state::save_point`
+        uint64_t queues;            //!< Number of queued changes
+        uint64_t events;            //!< Number of disputed events
+        uint64_t histograms;        //!< Number of histograms
+    };
+
+    /*!
+    \brief FNV-1a hash of an image
+    \param data Image bytes
+    \param size Number of bytes
+    \return 64 bit hash
+    */
+    [[gnu::pure]]
+    inline uint64_t checksum(const char* data, std::size_t size) noexcept
+    {
+        uint64_t hash = 14695981039346656037UL;
+        for (std::size_t i=0; i<size; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211UL;
+        }
+        return hash;
+    }
+
+    /*!
+    \brief Serialize an image in host byte order
+    \param img  Image
+    \param out  Set to the image bytes, keeps allocated memory
+    */
+    inline void serialize(const image& img, std::vector<char>& out)
+    {
+        out.clear();
+        auto put = [&out](const auto* p, std::size_t n) {
+            const char* bytes = reinterpret_cast<const char*>(p);
+            out.insert(std::end(out), bytes, bytes + n * sizeof(*p));
+        };
+        const image_header header{img.sequence, (uint32_t)img.chip.size(), img.workers, img.bins, img.save_interval};
+        put(&header, 1);
+        for (const auto& state : img.chip) {
+            const chip_header ch{state.predictor, state.tdcs, state.save_point, state.queues.size(), state.events.size(), state.histograms.size()};
+            put(&ch, 1);
+            put(state.queues.data(), state.queues.size());
+            put(state.events.data(), state.events.size());
+            put(state.histograms.data(), state.histograms.size());
+            put(state.bins.data(), state.bins.size());
+        }
+    }
+
+    /*!
+    \brief Parse a serialized image
+    \param data Image bytes
+    \param size Number of bytes
+    \param img  Set to the image
+    \throw std::runtime_error if the image is inconsistent
+    */
+    inline void parse(const char* data, std::size_t size, image& img)
+    {
+        const char* pos = data;
+        const char* const end = data + size;
+        auto need = [&pos, end](uint64_t n, std::size_t element) {
+            if (n > (std::size_t)(end - pos) / element)
+                throw std::runtime_error("truncated checkpoint image");
+        };
+        auto take = [&pos, &need](auto* p, std::size_t n) {
+            need(n, sizeof(*p));
+            std::memcpy(static_cast<void*>(p), pos, n * sizeof(*p));
+            pos += n * sizeof(*p);
+        };
+        image_header header;
+        take(&header, 1);
+        img.sequence = header.sequence;
+        img.workers = header.workers;
+        img.bins = header.bins;
+        img.save_interval = header.save_interval;
+        img.chip.clear();
+        img.chip.resize(header.chips);
+        for (auto& state : img.chip) {
+            chip_header ch;
+            take(&ch, 1);
+            state.predictor = ch.predictor;
+            state.tdcs = ch.tdcs;
+            state.save_point = ch.save_point;
+            need(ch.queues, sizeof(queued_change));
+            state.queues.resize(ch.queues);
+            take(state.queues.data(), ch.queues);
+            uint64_t events = 0;
+            for (const auto& q : state.queues)
+                events += q.events;
+            if (events != ch.events)
+                throw std::runtime_error("checkpoint reorder queues don't match their events");
+            need(ch.events, sizeof(reordering_element));
+            state.events.assign(ch.events, reordering_element{0, 0});
+            take(state.events.data(), ch.events);
+            need(ch.histograms, sizeof(histogram));
+            state.histograms.resize(ch.histograms);
+            take(state.histograms.data(), ch.histograms);
+            if (header.bins)
+                need(ch.histograms, header.bins * sizeof(int32_t));
+            state.bins.resize(ch.histograms * header.bins);
+            take(state.bins.data(), state.bins.size());
+        }
+        if (pos != end)
+            throw std::runtime_error("trailing bytes after checkpoint image");
+    }
+
+    /*!
+    \brief Memory mapped checkpoint file with two image slots
+
+    The file starts with a `page_size` region holding the `file_header`, image slots are `page_size` aligned.
+    A slot is relocated to the end of the file if an image doesn't fit, the space it used before is not reused.
+    */
+    class file final {
+        /*!
+        \brief Image slot description
+        */
+        struct slot_header final {
+            uint64_t sequence;      //!< Image sequence number, 0 for an empty slot
+            uint64_t offset;        //!< Slot offset within the file
+            uint64_t size;          //!< Image size in bytes
+            uint64_t capacity;      //!< Slot size in bytes
+            uint64_t checksum;      //!< Image checksum, see `checkpoint::checksum()`
+        };
+
+        /*!
+        \brief File header
+        */
+        struct file_header final {
+            char magic[8];          //!< `checkpoint::magic`
+            uint32_t completed;     //!< Non zero if the analysis finished, such a checkpoint must not be resumed
+            uint32_t reserved;      //!< Unused
+            slot_header slot[2];    //!< Image slots
+        };
+        static_assert(sizeof(file_header) <= page_size);
+
+        const std::string path;     //!< File path
+        int fd = -1;                //!< File descriptor
+        char* map = nullptr;        //!< Mapped file content
+        std::size_t mapped = 0;     //!< Mapped size, equal to the file size
+
+        /*!
+        \brief Mapped file header
+        \return File header reference
+        */
+        inline file_header& header() noexcept
+        {
+            return *reinterpret_cast<file_header*>(map);
+        }
+
+        /*!
+        \brief Resize and remap the file
+        \param size New file size
+        \throw std::ios_base::failure on errors
+        */
+        inline void resize(std::size_t size)
+        {
+            if (map)
+                munmap(map, mapped);
+            map = nullptr;
+            mapped = 0;
+            if (ftruncate(fd, size) != 0)
+                throw std::ios_base::failure(std::string("unable to resize checkpoint file ") + path + ": " + std::strerror(errno));
+            void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem == MAP_FAILED)
+                throw std::ios_base::failure(std::string("unable to map checkpoint file ") + path + ": " + std::strerror(errno));
+            map = static_cast<char*>(mem);
+            mapped = size;
+        }
+
+        /*!
+        \brief Flush a file range to disk
+        \param offset   Range offset
+        \param size     Range size
+        \throw std::ios_base::failure on errors
+        */
+        inline void sync(std::size_t offset, std::size_t size)
+        {
+            const std::size_t start = offset & ~(page_size - 1);
+            if (msync(map + start, offset + size - start, MS_SYNC) != 0)
+                throw std::ios_base::failure(std::string("unable to flush checkpoint file ") + path + ": " + std::strerror(errno));
+        }
+
+      public:
+        /*!
+        \brief Constructor, opens or creates the checkpoint file
+
+        The images of an existing checkpoint file are kept until they are overwritten by newer ones.
+
+        \param p File path
+        \throw std::ios_base::failure if the file cannot be opened or mapped
+        */
+        inline explicit file(const std::string& p)
+            : path{p}
+        {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0)
+                throw std::ios_base::failure(std::string("unable to open checkpoint file ") + path + ": " + std::strerror(errno));
+            try {
+                struct stat info;
+                if (fstat(fd, &info) != 0)
+                    throw std::ios_base::failure(std::string("unable to stat checkpoint file ") + path + ": " + std::strerror(errno));
+                const std::size_t size = info.st_size;
+                resize(std::max(size, page_size));
+                if ((size < page_size) || (std::memcmp(header().magic, magic, sizeof(magic)) != 0)) {
+                    resize(page_size);
+                    std::memset(map, 0, page_size);
+                    std::memcpy(header().magic, magic, sizeof(magic));
+                    sync(0, page_size);
+                }
+            } catch (...) {
+                if (map)
+                    munmap(map, mapped);
+                ::close(fd);
+                throw;
+            }
+        }
+
+        file(const file&) = delete;
+        file(file&&) = delete;
+        file& operator=(const file&) = delete;
+        file& operator=(file&&) = delete;
+
+        /*!
+        \brief Destructor, unmaps and closes the file
+        */
+        inline ~file()
+        {
+            if (map)
+                munmap(map, mapped);
+            ::close(fd);
+        }
+
+        /*!
+        \brief Newest image sequence number
+        \return Sequence number of the newest slot, 0 for none
+        */
+        inline uint64_t sequence() noexcept
+        {
+            return std::max(header().slot[0].sequence, header().slot[1].sequence);
+        }
+
+        /*!
+        \brief Write an image into the slot with the older image
+        \param data     Image bytes, see `serialize()`
+        \param sequence Image sequence number, must be bigger than `sequence()`
+        \throw std::ios_base::failure on errors
+        */
+        inline void write(const std::vector<char>& data, uint64_t sequence)
+        {
+            const unsigned k = (header().slot[0].sequence <= header().slot[1].sequence) ? 0 : 1;
+            slot_header s = header().slot[k];
+            if (s.capacity < data.size()) {
+                s.offset = mapped;
+                s.capacity = (data.size() + data.size() / 2 + page_size - 1) & ~(page_size - 1);
+                resize(s.offset + s.capacity);
+            }
+            std::memcpy(map + s.offset, data.data(), data.size());
+            sync(s.offset, data.size());
+            s.sequence = sequence;
+            s.size = data.size();
+            s.checksum = checksum(data.data(), data.size());
+            header().slot[k] = s;
+            header().completed = 0;
+            sync(0, sizeof(file_header));
+        }
+
+        /*!
+        \brief Mark the checkpoint file as belonging to a finished analysis
+        \throw std::ios_base::failure on errors
+        */
+        inline void complete()
+        {
+            header().completed = 1;
+            sync(0, sizeof(file_header));
+        }
+
+        /*!
+        \brief Read the newest valid image of a checkpoint file
+        \param path         File path
+        \param data         Set to the image bytes
+        \param completed    Set to true if the file belongs to a finished analysis
+        \return False if the file doesn't exist or has no valid image
+        */
+        static inline bool read(const std::string& path, std::vector<char>& data, bool& completed)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat info;
+            const bool ok = (fstat(fd, &info) == 0) && (static_cast<std::size_t>(info.st_size) >= page_size);
+            void* mem = ok ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if (mem == MAP_FAILED)
+                return false;
+            const std::size_t size = info.st_size;
+            const char* content = static_cast<const char*>(mem);
+            file_header h;
+            std::memcpy(&h, content, sizeof(h));
+            bool found = false;
+            if (std::memcmp(h.magic, magic, sizeof(magic)) == 0) {
+                completed = (h.completed != 0);
+                const unsigned newest = (h.slot[0].sequence >= h.slot[1].sequence) ? 0 : 1;
+                for (const unsigned k : { newest, 1 - newest }) {
+                    const slot_header& s = h.slot[k];
+                    if ((s.sequence == 0) || (s.offset > size) || (s.size > size - s.offset))
+                        continue;
+                    if (checksum(content + s.offset, s.size) != s.checksum)
+                        continue;
+                    data.assign(content + s.offset, content + s.offset + s.size);
+                    found = true;
+                    break;
+                }
+            }
+            munmap(mem, size);
+            return found;
+        }
+    };
+
+    /*!
+    \brief Load the newest valid checkpoint
+    \param path Checkpoint file path
+    \return Image
+    \throw std::runtime_error if there is no valid checkpoint, or it belongs to a finished analysis
+    */
+    inline image load(const std::string& path)
+    {
+        std::vector<char> data;
+        bool completed = false;
+        if (! file::read(path, data, completed))
+            throw std::runtime_error(std::string("no valid checkpoint in ") + path);
+        if (completed)
+            throw std::runtime_error(std::string("checkpoint ") + path + " belongs to a finished analysis");
+        image img;
+        parse(data.data(), data.size(), img);
+        return img;
+    }
+
+    /*!
+    \brief Periodic checkpoint writer
+
+    The writer thread requests a checkpoint every `interval`, with a cut period `cut_lead` periods ahead of
+    the chip that is furthest ahead. Analyser threads check `pending()` at TDC events, and at the TDC event
+    starting the cut period they fill in their `state()` and call `captured()`. Once all chips have captured
+    their state, the writer thread writes the image. Chip states are only touched by their analyser between
+    the request and `captured()`, and only by the writer thread afterwards, so they need no locking.
+
+    A chip that is already past the cut period when it sees the request, or chip states with different
+    save points, abandon the checkpoint: on restore, a period that some chips had returned and others had not
+    would be written again with partial data. Checkpoints are only written while all chips receive TDC events.
+    */
+    class store final {
+        file output;                        //!< Checkpoint file
+        const std::chrono::duration<double> interval;   //!< Time between checkpoint requests
+        image current;                      //!< Chip states filled in by the analyser threads
+        std::atomic<uint64_t> requested;    //!< Sequence number of the latest requested checkpoint
+        std::atomic<period_type> cut;       //!< Cut period of the latest requested checkpoint
+        std::atomic<bool> missed;           //!< A chip was past the cut period of the latest requested checkpoint
+        std::unique_ptr<std::atomic<uint64_t>[]> chipSequence; //!< Per chip sequence number of the latest captured state
+        std::unique_ptr<std::atomic<period_type>[]> chipPeriod; //!< Per chip period of the latest TDC event
+        std::mutex lock;                    //!< Protect `finished`, used for waiting
+        std::condition_variable wakeup;     //!< Signal captured states and `finished`
+        bool finished = false;              //!< No more checkpoints
+        std::vector<char> buffer;           //!< Serialized image, owned by the writer thread
+        std::string error;                  //!< Write error, only valid after `finish()`
+        std::string writerPlacement_;       //!< Writer thread placement description, only valid after `finish()`
+        std::thread writer;                 //!< Checkpoint writer thread
+
+        /*!
+        \brief Live counters of the writer thread
+        */
+        struct alignas(metrics::cache_line) writer_metrics final {
+            metrics::counter written;       //!< Number of checkpoints written
+            metrics::counter abandoned;     //!< Number of checkpoints abandoned because the chips missed the common cut period
+            metrics::counter bytes;         //!< Size of the latest checkpoint in bytes
+            metrics::counter writeNs;       //!< Time spent serializing and writing checkpoints in nanoseconds
+        } writerMetrics;                    //!< Live counters of the writer thread
+
+        /*!
+        \brief Check for captured chip states
+        \param sequence Checkpoint sequence number
+        \return True if all chips have captured their state for `sequence`
+        */
+        inline bool allCaptured(uint64_t sequence) const noexcept
+        {
+            for (std::size_t i=0; i<current.chip.size(); i++)
+                if (chipSequence[i].load(std::memory_order_acquire) != sequence)
+                    return false;
+            return true;
+        }
+
+        /*!
+        \brief Check the captured chip states for a common cut
+        \return True if no chip missed the cut period and all chips have the same save point
+        */
+        inline bool consistent() const noexcept
+        {
+            if (missed.load(std::memory_order_relaxed))
+                return false;
+            for (const auto& state : current.chip)
+                if (state.save_point != current.chip.front().save_point)
+                    return false;
+            return true;
+        }
+
+        /*!
+        \brief Checkpoint writer thread main loop
+        */
+        inline void serve()
+        {
+            writerPlacement_ = placement::place(placement::writer, 1);
+            try {
+                while (true) {
+                    uint64_t sequence = 0;
+                    {
+                        std::unique_lock guard{lock};
+                        if (wakeup.wait_for(guard, interval, [this]() { return finished; }))
+                            break;
+                        sequence = requested.load(std::memory_order_relaxed) + 1;
+                        period_type ahead = chipPeriod[0].load(std::memory_order_relaxed);
+                        for (std::size_t i=1; i<current.chip.size(); i++)
+                            ahead = std::max(ahead, chipPeriod[i].load(std::memory_order_relaxed));
+                        cut.store(ahead + cut_lead, std::memory_order_relaxed);
+                        missed.store(false, std::memory_order_relaxed);
+                        requested.store(sequence, std::memory_order_release);
+                        wakeup.wait(guard, [this, sequence]() { return finished || allCaptured(sequence); });
+                        if (! allCaptured(sequence))
+                            break;
+                    }
+                    if (! consistent()) {
+                        writerMetrics.abandoned.add();
+                        continue;
+                    }
+                    const auto t1 = std::chrono::steady_clock::now();
+                    current.sequence = sequence;
+                    serialize(current, buffer);
+                    output.write(buffer, sequence);
+                    const auto t2 = std::chrono::steady_clock::now();
+                    writerMetrics.writeNs.add(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+                    writerMetrics.bytes.set(buffer.size());
+                    writerMetrics.written.add();
+                }
+            } catch (std::exception& ex) {
+                error = ex.what();
+            }
+        }
+
+      public:
+        static constexpr period_type cut_lead = 16; //!< Cut period distance from the chip that is furthest ahead
+
+        /*!
+        \brief Constructor, opens the checkpoint file and starts the writer thread
+        \param path     Checkpoint file path, existing checkpoints are kept until they are overwritten
+        \param layout   Histogram layout (`workers`, `bins`, `save_interval`) and number of chips (`chip.size()`)
+        \param every    Time between checkpoints
+        \throw std::ios_base::failure if the file cannot be opened
+        */
+        inline store(const std::string& path, image&& layout, std::chrono::duration<double> every)
+            : output{path}, interval{every}, current{std::move(layout)}, chipSequence{new std::atomic<uint64_t>[current.chip.size()]},
+              chipPeriod{new std::atomic<period_type>[current.chip.size()]}
+        {
+            const uint64_t sequence = output.sequence();
+            requested.store(sequence, std::memory_order_relaxed);
+            cut.store(0, std::memory_order_relaxed);
+            missed.store(false, std::memory_order_relaxed);
+            for (std::size_t i=0; i<current.chip.size(); i++) {
+                chipSequence[i].store(sequence, std::memory_order_relaxed);
+                chipPeriod[i].store(0, std::memory_order_relaxed);
+            }
+            writer = std::thread([this]{ serve(); });
+        }
+
+        store(const store&) = delete;
+        store(store&&) = delete;
+        store& operator=(const store&) = delete;
+        store& operator=(store&&) = delete;
+
+        /*!
+        \brief Destructor, stops the writer thread
+        */
+        inline ~store()
+        {
+            finish(false);
+        }
+
+        /*!
+        \brief Analyser side: check for a checkpoint cut at a TDC event
+        \param chip     Chip number
+        \param period   Period started by the TDC event
+        \return True if the chip state should be captured now, at the cut period of the requested checkpoint
+        */
+        inline bool pending(unsigned chip, period_type period) noexcept
+        {
+            chipPeriod[chip].store(period, std::memory_order_relaxed);
+            const uint64_t sequence = requested.load(std::memory_order_acquire);
+            if (sequence == chipSequence[chip].load(std::memory_order_relaxed))
+                return false;
+            const period_type target = cut.load(std::memory_order_relaxed);
+            if (period < target)
+                return false;
+            if (period > target) {
+                // the chip was past the cut before it saw the request
+                missed.store(true, std::memory_order_relaxed);
+                captured(chip);
+                return false;
+            }
+            return true;
+        }
+
+        /*!
+        \brief Analyser side: chip state to fill in, only while `pending()` is true
+        \param chip Chip number
+        \return Chip state reference
+        */
+        inline chip_state& state(unsigned chip) noexcept
+        {
+            return current.chip[chip];
+        }
+
+        /*!
+        \brief Analyser side: the chip state is filled in
+        \param chip Chip number
+        */
+        inline void captured(unsigned chip)
+        {
+            chipSequence[chip].store(requested.load(std::memory_order_relaxed), std::memory_order_release);
+            std::lock_guard guard{lock};
+            wakeup.notify_all();
+        }
+
+        /*!
+        \brief Stop the writer thread, a checkpoint that is not captured completely yet is abandoned
+        \param complete Mark the checkpoint file as belonging to a finished analysis
+        */
+        inline void finish(bool complete)
+        {
+            {
+                std::lock_guard guard{lock};
+                finished = true;
+            }
+            wakeup.notify_all();
+            if (writer.joinable())
+                writer.join();
+            if (complete && error.empty()) {
+                try {
+                    output.complete();
+                } catch (std::exception& ex) {
+                    error = ex.what();
+                }
+            }
+        }
+
+        /*!
+        \brief Write live checkpoint counters in Prometheus text format
+        \param out Output stream
+        */
+        inline void writeMetrics(std::ostream& out) const
+        {
+            metrics::describe(out, "tpx3_checkpoints_total", "counter", "Number of analysis state checkpoints written");
+            metrics::sample(out, "tpx3_checkpoints_total", writerMetrics.written.get());
+            metrics::describe(out, "tpx3_checkpoints_abandoned_total", "counter", "Number of analysis state checkpoints abandoned because chips missed the common cut period");
+            metrics::sample(out, "tpx3_checkpoints_abandoned_total", writerMetrics.abandoned.get());
+            metrics::describe(out, "tpx3_checkpoint_bytes", "gauge", "Size of the latest analysis state checkpoint");
+            metrics::sample(out, "tpx3_checkpoint_bytes", writerMetrics.bytes.get());
+            metrics::describe(out, "tpx3_checkpoint_write_seconds_total", "counter", "Time spent serializing and writing checkpoints");
+            metrics::sample(out, "tpx3_checkpoint_write_seconds_total", writerMetrics.writeNs.get() * 1e-9);
+        }
+
+        /*!
+        \brief Number of checkpoints written
+        \return Checkpoints written by this store
+        */
+        inline uint64_t written() const noexcept
+        {
+            return writerMetrics.written.get();
+        }
+
+        /*!
+        \brief Number of checkpoints abandoned
+        \return Checkpoints requested by this store that were not written because the chips missed the common cut
+        */
+        inline uint64_t abandoned() const noexcept
+        {
+            return writerMetrics.abandoned.get();
+        }
+
+        /*!
+        \brief Write error
+        \return Error message, empty if there was none; only valid after `finish()`
+        */
+        inline const std::string& writeError() const noexcept
+        {
+            return error;
+        }
+
+        /*!
+        \brief Writer thread placement
+        \return Placement description for logging; only valid after `finish()`
+        */
+        inline const std::string& writerPlacement() const noexcept
+        {
+            return writerPlacement_;
+        }
+    };
+
+} // namespace checkpoint
+
+#endif // CHECKPOINT_H
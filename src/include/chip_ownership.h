@@ -0,0 +1,58 @@
+#ifndef CHIP_OWNERSHIP_H
+#define CHIP_OWNERSHIP_H
+
+/*!
+\file
+Assignment of chips to parallel raw stream readers
+*/
+
+#include <vector>
+#include <atomic>
+
+/*!
+\brief Per chip owning reader of parallel raw streams
+
+The per chip IO buffer pools have a single writer, and chunk order is only defined within one stream.
+The first reader that receives a chunk of a chip owns the chip from then on, the other readers skip
+chunks of that chip. This works for servers sending chip c to destination c modulo the number of destinations
+as well as for servers duplicating the full stream to every destination.
+*/
+class chip_ownership final {
+    std::vector<std::atomic<unsigned>> owner;   //!< Per chip reader number + 1, 0 before the first chunk of the chip
+
+public:
+    /*!
+    \brief Constructor
+    \param nchips Number of chips
+    */
+    inline explicit chip_ownership(unsigned nchips)
+        : owner(nchips)
+    {}
+
+    /*!
+    \brief Claim a chip for a reader
+    \param reader   Reader number
+    \param chip     Chip number
+    \return True if the reader owns the chip, false if another reader owns it
+    */
+    inline bool claim(unsigned reader, unsigned chip) noexcept
+    {
+        auto& o = owner[chip];
+        unsigned current = o.load(std::memory_order_relaxed);
+        if (__builtin_expect(current == reader + 1, 1))
+            return true;
+        return (current == 0) && o.compare_exchange_strong(current, reader + 1, std::memory_order_relaxed);
+    }
+
+    /*!
+    \brief Owning reader of a chip
+    \param chip Chip number
+    \return Reader number, -1 before the first chunk of the chip
+    */
+    inline int reader(unsigned chip) const noexcept
+    {
+        return int(owner[chip].load(std::memory_order_relaxed)) - 1;
+    }
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef CHUNK_SCAN_H
+#define CHUNK_SCAN_H
+
+/*!
+\file
+Packet header validation and resynchronisation helpers for corrupted raw streams
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "decoder.h"
+
+/*!
+\brief Resync mode helpers of the raw stream readers and analysers, see `DataHandler`
+
+Truncated chunks still consist of whole 64 bit words, so the readers scan forward
+in steps of words to the next plausible packet header. The analyser recognizes a
+truncated chunk by a chunk header or packet id within the chunk payload.
+*/
+namespace chunk_scan {
+
+    static constexpr uint64_t tpx_header = 861425748UL;    //!< 'TPX3' as uint64_t
+
+    /*!
+    \brief Check for a valid packet header without throwing
+    \tparam Decode          Raw stream decoder type
+    \tparam header_words    Number of 64 bit words in a packet header, 2 with packet ids
+    \param header           Packet header words
+    \param nchips           Number of chips
+    \return True if the header has the chunk magic, a valid chip number, a chunk size that is a multiple of 8,
+            and with packet ids, a packet id word within the chunk
+    */
+    template<typename Decode, unsigned header_words>
+    inline bool plausible_header(const uint64_t* header, uint64_t nchips) noexcept
+    {
+        if ((header[0] & 0xffffffffUL) != tpx_header)
+            return false;
+        const uint64_t chunkSize = Decode::getBits(header[0], 63, 48);
+        if ((Decode::getBits(header[0], 39, 32) >= nchips) || (chunkSize % sizeof(uint64_t) != 0))
+            return false;
+        if constexpr (header_words > 1)
+            return Decode::matchesByte(header[1], 0x50) && (chunkSize >= (header_words - 1) * sizeof(uint64_t));
+        else
+            return true;
+    }
+
+    /*!
+    \brief Find the next plausible packet header
+    \tparam Decode          Raw stream decoder type
+    \tparam header_words    Number of 64 bit words in a packet header
+    \param data             Raw stream bytes
+    \param pos              Start position, 64 bit word aligned relative to the last chunk
+    \param fill             Number of valid bytes
+    \param nchips           Number of chips
+    \return Position of the first plausible packet header at or after `pos`, or the first position
+            in steps of words without a complete header before `fill` if there is none
+    */
+    template<typename Decode, unsigned header_words>
+    inline size_t next_header(const char* data, size_t pos, size_t fill, uint64_t nchips) noexcept
+    {
+        for (; pos + header_words * sizeof(uint64_t) <= fill; pos += sizeof(uint64_t)) {
+            uint64_t header[header_words];
+            std::memcpy(header, &data[pos], sizeof(header));
+            if (plausible_header<Decode, header_words>(header, nchips))
+                break;
+        }
+        return pos;
+    }
+
+    /*!
+    \brief Bytes of a chunk buffer beyond the end of a truncated chunk
+    \param columns      Classified buffer content
+    \param data_size    Buffer size in bytes
+    \return Number of bytes from the chunk header or packet id within the buffer on, 0 for a complete buffer
+    */
+    inline size_t truncated_bytes(const event_columns& columns, size_t data_size) noexcept
+    {
+        return (columns.reason != event_columns::none) ? (data_size - columns.stop * sizeof(uint64_t)) : 0;
+    }
+
+} // namespace chunk_scan
+
+#endif // CHUNK_SCAN_H
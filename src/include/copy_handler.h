@@ -12,9 +12,11 @@ Provide raw stream to file copying code
 #include <thread>
 #include <mutex>
 #include <chrono>
+#include <memory>
 #include "Poco/Exception.h"
 #include "Poco/Net/StreamSocket.h"
 #include "logging.h"
+#include "block_compression.h"
 
 namespace {
     using Poco::Net::StreamSocket;
@@ -27,12 +29,16 @@ namespace {
 
 /*!
 \brief Handler object for copying raw stream data to a file
+
+With compression threads, the writer thread hands the chunks to a `block_compression::compressor`,
+which writes zlib compressed blocks of complete chunks.
 */
 class CopyHandler final {
 
     StreamSocket& dataStream;   //!< Raw event data stream receiving end
     std::ofstream streamFile;   //!< Write raw event data into this file
     Logger& logger;             //!< Poco::Logger object for logging
+    std::unique_ptr<block_compression::compressor> compressor;  //!< Block compressor writing to `streamFile`, nullptr for uncompressed copies
 
     /*!
     \brief List of IO buffers
@@ -48,6 +54,7 @@ class CopyHandler final {
     std::thread writerThread;   //!< Raw event data writer thread
     std::mutex memberMutex;     //!< Protect member variables here
     std::atomic<bool> stopOperation = false; //!< Stop requested flag
+    std::atomic<bool> readerFinished = false; //!< Reader thread reached the end of the stream
 
     /*!
     \brief Check stop flag
@@ -113,7 +120,7 @@ class CopyHandler final {
                     throw DataFormatException("unknown header");
 
                 uint64_t chunk_size = value >> 48;
-                logger << "chunk " << chunk_size << " bytes\n";
+                logger << "chunk " << chunk_size << " bytes" << log_debug;
 
                 std::unique_ptr<std::vector<char>> data(new std::vector<char>(chunk_size + 8));
                 *(uint64_t*)data->data() = value;
@@ -145,6 +152,7 @@ class CopyHandler final {
         }
 
     reader_stopped:
+        readerFinished.store(true, std::memory_order_release);
         readTime += time;
         logger << "reader stopped" << log_debug;
     }
@@ -161,21 +169,36 @@ class CopyHandler final {
 
             do {
                 std::unique_ptr<std::vector<char>> data;
+                bool finished = false;
 
                 do {
                     std::this_thread::yield();
+                    finished = readerFinished.load(std::memory_order_acquire);
                     std::lock_guard lock{memberMutex};
                     if (! buffers.empty()) {
                         data = std::move(buffers.front());
                         buffers.pop_front();
                     }
-                } while (!stop() && (data.get() == nullptr));
+                } while (!stop() && !finished && (data.get() == nullptr));
 
                 if (stop())
                     goto reader_stopped;
 
+                if (data.get() == nullptr) {
+                    if (compressor) {
+                        const auto t1 = wall_clock::now();
+                        compressor->flush();
+                        time += std::chrono::duration<double>(wall_clock::now() - t1).count();
+                        logger << "compressed " << compressor->raw_bytes() << " bytes to " << compressor->packed_bytes() << " bytes" << log_info;
+                    }
+                    break;
+                }
+
                 const auto t1 = wall_clock::now();
-                streamFile.write(data->data(), data->size());
+                if (compressor)
+                    compressor->write(data->data(), data->size());
+                else
+                    streamFile.write(data->data(), data->size());
                 const auto t2 = wall_clock::now();
                 time += std::chrono::duration<double>(t2 - t1).count();
                 totalBytes += data->size();
@@ -203,11 +226,15 @@ public:
     \param socket   Raw event data receiving end
     \param path     File path for writing the received raw event data
     \param log      Logging object
+    \param compressionThreads Number of block compression threads, 0 for uncompressed copies
+    \param level    zlib compression level 1 (fast) .. 9 (small)
     */
-    CopyHandler(StreamSocket& socket, const std::string& path, Logger& log)
-        : dataStream{socket}, streamFile(path), logger{log}
+    CopyHandler(StreamSocket& socket, const std::string& path, Logger& log, unsigned compressionThreads=0, int level=1)
+        : dataStream{socket}, streamFile(path, std::ios::binary), logger{log}
     {
-        logger << "CopyHandler(" << socket.address().toString() << ", " << path << ')' << log_trace;
+        logger << "CopyHandler(" << socket.address().toString() << ", " << path << ", " << compressionThreads << ", " << level << ')' << log_trace;
+        if (compressionThreads > 0)
+            compressor.reset(new block_compression::compressor{streamFile, compressionThreads, level});
     }
 
     /*!
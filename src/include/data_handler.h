@@ -11,20 +11,32 @@ Code for processing raw data stream
 #endif
 
 #include <vector>
+#include <algorithm>
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <ostream>
+#include <cmath>
+#include <cstdlib>
 #include "Poco/Exception.h"
-#include "Poco/Net/StreamSocket.h"
 #include "logging.h"
+#include "raw_source.h"
 #include "io_buffers.h"
 #include "period_predictor.h"
 #include "period_queues.h"
+#include "event_batches.h"
 #include "processing.h"
 #include "spin_lock.h"
+#include "metrics.h"
+#include "thread_placement.h"
+#include "stream_archive.h"
+#include "checkpoint.h"
+#include "latency_trace.h"
+#include "alloc_counter.h"
+#include "chip_ownership.h"
+#include "chunk_scan.h"
 
 namespace {
-    using Poco::Net::StreamSocket;
     using Poco::LogicException;
     using Poco::RuntimeException;
     using Poco::ReadFileException;
@@ -34,8 +46,10 @@ namespace {
 
 /*!
 \brief Handler object for processing a raw data stream
+\tparam Decode Raw stream decoder type
+\tparam Pool   Per chip IO buffer pool type, `io_buffer_pool` or `io_buffer_ring`
 */
-template<typename Decode>
+template<typename Decode, typename Pool=io_buffer_pool>
 class DataHandler final {
     constexpr static uint64_t tpxHeader = 861425748UL; //!< 'TPX3' as uint64_t
     #if SERVER_VERSION >= 320
@@ -44,12 +58,22 @@ class DataHandler final {
         uint64_t DATA_OFFSET = 0;               //!< Start offset of event data within raw event data packet
     #endif
 
-    StreamSocket& dataStream;                   //!< Raw event data stream receiving end
     Logger& logger;                             //!< Poco::Logger object for logging
-    io_buffer_pool_collection perChipBufferPool;//!< Per chip IO buffer pool
-    const size_t bufferSize;                    //!< IO buffer size in bytes
-    std::thread readerThread;                   //!< Raw event data stream reader thread
+    buffer_pool_collection<Pool> perChipBufferPool;//!< Per chip IO buffer pool
+    const size_t bufferSize;                    //!< IO buffer size in bytes, or slab size in slab receive mode
+    const size_t numBuffers;                    //!< Number of preallocated IO buffers per chip, or number of slabs in slab receive mode
+    const bool slabMode;                        //!< Receive into large slabs, pass per chunk views to the analysers
+    const bool resync;                          //!< Skip corrupted data and continue instead of stopping, see `plausibleHeader()`
+    static constexpr size_t viewsPerSlab = 256; //!< Per chip view buffers per slab in slab receive mode
+    stream_archive* archive;                    //!< Raw stream archive for slab receive mode, nullptr for none
+    checkpoint::store* checkpoints;             //!< Periodic analysis state checkpoints, nullptr for none
+    latency_trace::tracer* trace = nullptr;     //!< Period latency tracing, nullptr for none
     std::vector<std::thread> analyserThreads;   //!< Per chip event analyzer threads
+    const unsigned workersPerChip;              //!< Number of histogramming workers per chip, 1: histogramming within analyser thread
+    std::vector<std::thread> workerThreads;     //!< Histogramming worker threads, indexed by chip number * workersPerChip + worker number
+    std::vector<std::unique_ptr<batch_dispatcher>> workerBatches; //!< Per chip event batch distribution to the histogramming workers
+    static constexpr size_t batchSize = 4096;   //!< Number of events per batch
+    static constexpr size_t batchesPerWorker = 8;   //!< Number of batches in flight per worker
     // std::mutex coutMutex;                    //!< Output mutex for debugging
     spin_lock::type memberMutex{spin_lock::init}; //!< Protection for member variables
     std::atomic<unsigned> analyzerReady = 0;    //!< Counter for ready event analyzer threads
@@ -58,7 +82,62 @@ class DataHandler final {
     int64_t initialPeriod;                      //!< Initial TDC period interval in clock ticks
     std::vector<period_predictor> predictor;    //!< Per chip period predictors
     std::vector<period_queues> queues;          //!< Per chip period interval change event reorder queues
+    std::vector<uint64_t> resumedTdcs;          //!< Per chip number of TDC events restored by `resume()`, 0 for a fresh start
     unsigned maxPeriodQueues = 2;               //!< Default value for number of memorized period change intervals
+    static constexpr uint64_t warmupBuffers = 1024; //!< Number of IO buffers or slabs a thread handles before its heap allocations are expected to stop
+
+    /*!
+    \brief Live counters of an analyser thread
+    */
+    struct alignas(metrics::cache_line) analyser_metrics final {
+        metrics::counter hits;                  //!< Number of TOA events histogrammed or queued
+        metrics::counter tdcs;                  //!< Number of TDC events
+        metrics::counter disputed;              //!< Number of TOA events within disputed period change intervals
+        metrics::counter buffers;               //!< Number of IO buffers analysed
+        metrics::counter reorderQueues;         //!< Number of remembered period interval changes
+        metrics::counter droppedBytes;          //!< Number of bytes dropped from truncated chunks in resync mode
+        metrics::counter lostPackets;           //!< Number of packets missing from the packet number sequence in resync mode
+        metrics::counter latePackets;           //!< Number of packets arriving after a later packet in resync mode
+        metrics::counter reseeds;               //!< Number of period predictor reseeds in resync mode
+        metrics::counter misattributed;         //!< Number of disputed events the period prediction alone would have attributed to the wrong period
+        metrics::counter tdcErrorMax;           //!< Largest TDC time prediction error in clock ticks
+        metrics::counter residual;              //!< Latest RMS residual of the period predictor linear fit in clock ticks
+    };
+
+    /*!
+    \brief Live counters of the reader thread
+    */
+    struct alignas(metrics::cache_line) reader_metrics final {
+        metrics::counter bytes;                 //!< Number of raw stream bytes received
+        metrics::counter chunks;                //!< Number of raw event data packet chunks received
+        metrics::counter resyncs;               //!< Number of invalid packet headers resynchronised from in resync mode
+        metrics::counter skippedBytes;          //!< Number of bytes skipped to find the next valid packet header in resync mode
+        metrics::counter foreignChunks;         //!< Number of chunks skipped because their chip is owned by another reader
+    };
+
+    /*!
+    \brief Raw event data stream with its reader thread
+    */
+    struct stream_reader final {
+        raw_source& source;                     //!< Raw event data stream source
+        std::unique_ptr<io_slab_pool> slabPool; //!< Receive slabs for slab receive mode
+        std::thread thread;                     //!< Reader thread
+        reader_metrics metrics;                 //!< Reader thread counters
+
+        /*!
+        \brief Constructor
+        \param s Raw event data stream source
+        */
+        inline explicit stream_reader(raw_source& s) noexcept
+            : source{s}
+        {}
+    };
+
+    std::vector<analyser_metrics> analyserMetrics;  //!< Per chip analyser thread counters
+    std::vector<std::unique_ptr<stream_reader>> readers;   //!< Raw event data stream readers
+    chip_ownership chipOwners;                  //!< Per chip owning reader, see `chip_ownership`
+    std::atomic<unsigned> readersRunning = 0;   //!< Number of reader threads that didn't finish yet
+    std::vector<metrics::counter> bufferMetrics;//!< Per chip number of IO buffers passed to the analyser, written by the reader thread of the chip
 
     /*!
     \brief Check stop requested flag
@@ -79,17 +158,18 @@ class DataHandler final {
 
     /*!
     \brief Read from raw event data stream into buffer
+    \param source Raw event data stream source
     \param buf Byte buffer
     \param size Number of bytes to read
     \return Number of bytes effectively read
     */
-    int readData(void* buf, int size)
+    int readData(raw_source& source, void* buf, int size)
     {
         // logger << "readData(" << buf << ", " << size << ')' << log_trace;
         int numBytes = 0;
 
         do {
-            int numRead = dataStream.receiveBytes(&static_cast<char*>(buf)[numBytes], size - numBytes);
+            int numRead = source.receiveBytes(&static_cast<char*>(buf)[numBytes], size - numBytes);
             if (numRead == 0)
                 break;
             numBytes += numRead;
@@ -98,27 +178,148 @@ class DataHandler final {
         return numBytes;
     }
 
+    #if SERVER_VERSION >= 320
+        static constexpr unsigned headerWords = 2;  //!< Number of 64 bit words in a packet header
+    #else
+        static constexpr unsigned headerWords = 1;  //!< Number of 64 bit words in a packet header
+    #endif
+
     /*!
-    \brief Read packet header from raw event data stream
+    \brief Validate and decode packet header
+    \param header       Packet header words
     \param chipIndex    Chip number reference
     \param chunkSize    Raw event data packet chunk size reference
     \param packetId     Raw event data packet number reference
-    \return Number of bytes effectively read
+    \throw DataFormatException if the header is invalid
     */
-    int readPacketHeader(uint64_t& chipIndex, uint64_t& chunkSize, uint64_t& packetId)
+    void checkPacketHeader(const uint64_t* header, uint64_t& chipIndex, uint64_t& chunkSize, uint64_t& packetId) const
     {
-        // logger << "readPacketHeader()" << log_trace;
+        if ((header[0] & 0xffffffffUL) != tpxHeader)
+            throw DataFormatException("chunk header expected");
+        chipIndex = Decode::getBits(header[0], 39, 32);
+        chunkSize = Decode::getBits(header[0], 63, 48);
+        if (chipIndex >= perChipBufferPool.size())
+            throw DataFormatException(std::string("invalid chip index ") + std::to_string(chipIndex));
         #if SERVER_VERSION >= 320
-            uint64_t header[2];
+            if (!Decode::matchesByte(header[1], 0x50))
+                throw DataFormatException("packet id expected");
+            if (chunkSize < DATA_OFFSET)
+                throw DataFormatException("chunk too small for packet id");
+            packetId = Decode::getBits(header[1], 47, 0);
+            // logger << "packet header: chipIndex " << chipIndex << ", chunkSize " << chunkSize << ", packetId " << packetId << log_info;
         #else
-            uint64_t header[1];
+            packetId = 0;
+            // logger << "packet header: chipIndex " << chipIndex << ", chunkSize " << chunkSize << log_info;
         #endif
+    }
+
+    /*!
+    \brief Check for a valid packet header without throwing
+
+    Resync mode uses this to scan forward to the next packet header, in steps of 64 bit words,
+    since truncated chunks still consist of whole words.
+
+    \param header Packet header words
+    \return True if `checkPacketHeader()` accepts the header and the chunk size is a multiple of 8
+    */
+    bool plausibleHeader(const uint64_t* header) const noexcept
+    {
+        return chunk_scan::plausible_header<Decode, headerWords>(header, perChipBufferPool.size());
+    }
+
+    /*!
+    \brief Resync mode: check the packet number of a chunk against the packet number sequence of its chip
+
+    The packet numbers of a chip are consecutive (SERVAL 3.2 and later).
+
+    \param packetId Packet number of the chunk
+    \param next     Expected packet number, 0 before the first chunk
+    \param m        Analyser counters of the chip
+    \return True if packets went missing before this one
+    */
+    static bool packetGap(uint64_t packetId, uint64_t& next, analyser_metrics& m) noexcept
+    {
+        if (__builtin_expect((packetId == next) || (next == 0), 1)) {
+            next = packetId + 1;
+            return false;
+        }
+        if (packetId < next) {
+            m.latePackets.add();
+            return false;
+        }
+        m.lostPackets.add(packetId - next);
+        next = packetId + 1;
+        return true;
+    }
+
+    /*!
+    \brief Skip bytes of the raw event data stream
+    \param source Raw event data stream source
+    \param size   Number of bytes to skip
+    \return Number of bytes effectively skipped
+    */
+    int skipData(raw_source& source, int size)
+    {
+        char buf[4096];
+        int numBytes = 0;
+        while (numBytes < size) {
+            const int numRead = readData(source, buf, std::min<int>(sizeof(buf), size - numBytes));
+            if (numRead == 0)
+                break;
+            numBytes += numRead;
+        }
+        return numBytes;
+    }
+
+    /*!
+    \brief Reader side: finish the per chip IO buffer pools once the last reader stops
+    */
+    void readerFinished()
+    {
+        if (readersRunning.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        for (auto& pool : perChipBufferPool)
+            pool->finish_writing();
+    }
+
+    /*!
+    \brief Read packet header from raw event data stream
+    \param source       Raw event data stream source
+    \param chipIndex    Chip number reference
+    \param chunkSize    Raw event data packet chunk size reference
+    \param packetId     Raw event data packet number reference
+    \param m            Reader counters, for resync mode
+    \return Number of bytes effectively read, including bytes skipped in resync mode
+    */
+    int readPacketHeader(raw_source& source, uint64_t& chipIndex, uint64_t& chunkSize, uint64_t& packetId, reader_metrics& m)
+    {
+        // logger << "readPacketHeader()" << log_trace;
+        uint64_t header[headerWords];
         
-        int numRead = readData(header, sizeof(header));
+        int numRead = readData(source, header, sizeof(header));
         if (numRead == 0)
             return 0;
-        if (numRead != sizeof(header))
+        if (numRead != sizeof(header)) {
+            if (resync) {
+                m.skippedBytes.add(numRead);
+                return 0;
+            }
             throw ReadFileException(std::string("unable to read packet header") + std::to_string(numRead));
+        }
+
+        if (resync && ! plausibleHeader(header)) {
+            m.resyncs.add();
+            do {
+                m.skippedBytes.add(sizeof(uint64_t));
+                std::copy(&header[1], &header[headerWords], &header[0]);
+                const int n = readData(source, &header[headerWords - 1], sizeof(uint64_t));
+                if (n != sizeof(uint64_t)) {
+                    m.skippedBytes.add((headerWords - 1) * sizeof(uint64_t) + n);
+                    return 0;
+                }
+                numRead += n;
+            } while (! plausibleHeader(header));
+        }
 
         // logger << "packed header: " << std::hex << header[0]
         //     #if SERVER_VERSION >= 320
@@ -126,30 +327,70 @@ class DataHandler final {
         //     #endif
         //         << std::dec << log_debug;
 
-        if ((header[0] & 0xffffffffUL) != tpxHeader)
-            throw DataFormatException("chunk header expected");
-        chipIndex = Decode::getBits(header[0], 39, 32);
-        chunkSize = Decode::getBits(header[0], 63, 48);
-        #if SERVER_VERSION >= 320
-            if (!Decode::matchesByte(header[1], 0x50))
-                throw DataFormatException("packet id expected");
-            packetId = Decode::getBits(header[1], 47, 0);
-            // logger << "packet header: chipIndex " << chipIndex << ", chunkSize " << chunkSize << ", packetId " << packetId << log_info;
-        #else
-            packetId = 0;
-            // logger << "packet header: chipIndex " << chipIndex << ", chunkSize " << chunkSize << log_info;
-        #endif
+        checkPacketHeader(header, chipIndex, chunkSize, packetId);
 
         return numRead;
     }
 
+    /*!
+    \brief Log heap allocations of the calling thread after warm-up
+
+    Only active with allocation counting, see alloc_counter.h.
+
+    \param what  Thread kind
+    \param index Thread number
+    \param mark  Allocation count mark taken after `warmupBuffers` buffers, see `alloc_counter::mark()`
+    \param warm  Was the mark taken?
+    */
+    void reportAllocations(const char* what, unsigned index, uint64_t mark, bool warm)
+    {
+        if constexpr (alloc_counter::enabled) {
+            if (! warm)
+                return;
+            const uint64_t n = alloc_counter::since(mark);
+            if (n == 0)
+                logger << what << ' ' << index << ": no heap allocations after warm-up" << log_info;
+            else
+                logger << what << ' ' << index << ": " << n << " heap allocations after warm-up" << log_warn;
+        }
+    }
+
+    /*!
+    \brief Log the resync mode counters of a reader, if data was skipped
+    \param index Reader number
+    */
+    void reportResync(unsigned index)
+    {
+        const auto& m = readers[index]->metrics;
+        if (resync && (m.resyncs.get() || m.skippedBytes.get()))
+            logger << "reader " << index << ": resync: " << m.resyncs.get() << " invalid packet headers, "
+                   << m.skippedBytes.get() << " bytes skipped" << log_warn;
+    }
+
+    /*!
+    \brief Log the number of chunks a reader skipped because another reader owns their chip
+    \param index Reader number
+    */
+    void reportForeign(unsigned index)
+    {
+        const uint64_t n = readers[index]->metrics.foreignChunks.get();
+        if (n > 0)
+            logger << "reader " << index << ": " << n << " chunks of chips owned by other raw streams skipped" << log_info;
+    }
+
     /*!
     \brief Code for raw event data reader thread
+    \param index Reader number
     */
-    void readData()
+    void readData(unsigned index)
     {
         double spinTime = .0;
         double workTime = .0;
+        logger << placement::place(placement::reader, index) << log_info;
+        raw_source& dataStream = readers[index]->source;
+        auto& readerMetrics = readers[index]->metrics;
+        uint64_t buffers = 0;
+        uint64_t allocMark = 0;
 
         try {
             do {
@@ -161,11 +402,29 @@ class DataHandler final {
 
                 {
                     const auto t1 = wall_clock::now();
-                    bytesRead = readPacketHeader(chipIndex, chunkSize, packetId);
+                    bytesRead = readPacketHeader(dataStream, chipIndex, chunkSize, packetId, readerMetrics);
                     const auto t2 = wall_clock::now();
                     workTime += std::chrono::duration<double>(t2 - t1).count();
                     if (bytesRead == 0)
                         break;
+                    readerMetrics.bytes.add(bytesRead);
+                    readerMetrics.chunks.add();
+                }
+
+                if (! chipOwners.claim(index, chipIndex)) {
+                    const int restData = chunkSize - totalBytes;
+                    const int skipped = skipData(dataStream, restData);
+                    readerMetrics.bytes.add(skipped);
+                    readerMetrics.foreignChunks.add();
+                    if (skipped != restData) {
+                        if (resync) {
+                            // truncated chunk at end of stream
+                            readerMetrics.skippedBytes.add(skipped);
+                            break;
+                        }
+                        throw ReadFileException("incomplete chunk at end of stream");
+                    }
+                    continue;
                 }
 
                 while (totalBytes < chunkSize) {
@@ -192,12 +451,18 @@ class DataHandler final {
                         const int readSize = std::min(restCapacity, restData);
                         bytesRead = dataStream.receiveBytes(&data[bytesBuffered], readSize);
                         totalBytes += bytesRead;
+                        readerMetrics.bytes.add(std::max(bytesRead, 0));
 
                         // logger << "read " << bytesRead << " bytes into buffer " << eventBuffer->id << ", " << totalBytes
                         //        << " total" << log_debug;
 
                         eventBuffer->content_size += bytesRead;
 
+                        if ((bytesRead == 0) && resync) {
+                            // truncated chunk at end of stream
+                            readerMetrics.skippedBytes.add(eventBuffer->content_size);
+                            goto reader_stopped;
+                        }
                         if (bytesRead <= 0)
                             throw ReadFileException("no bytes received");
                         if (bytesRead == readSize)
@@ -207,6 +472,8 @@ class DataHandler final {
                     } while (true);
 
                     const auto t3 = wall_clock::now();
+                    if (trace)
+                        eventBuffer->arrival = latency_trace::now();
 
                     // {
                     //     auto logproxy = logger << "  data[0..32] = ";
@@ -216,6 +483,9 @@ class DataHandler final {
                     //     logproxy << std::dec << log_debug;
                     // }
                     bufferPool.put_nonempty_buffer({ packetId, std::move(eventBuffer) });
+                    bufferMetrics[chipIndex].add();
+                    if (++buffers == warmupBuffers)
+                        allocMark = alloc_counter::mark();
 
                     spinTime += std::chrono::duration<double>{t2 - t1}.count();
                     workTime += std::chrono::duration<double>{t3 - t2}.count();
@@ -230,19 +500,175 @@ class DataHandler final {
         }
 
     reader_stopped:
-        for (auto& pool : perChipBufferPool)
-            pool->finish_writing();
+        reportAllocations("reader", index, allocMark, buffers >= warmupBuffers);
+        reportResync(index);
+        reportForeign(index);
+        readerFinished();
 
         {
             spin_lock lock{memberMutex};
             readTime += workTime;
             readSpinTime += spinTime;
+            readWaits += adaptive_wait::stats;
         }
+        logger << "reader waits: " << adaptive_wait::stats.to_string() << log_info;
 
         logger << "reader stopped" << log_debug;
 
     }
 
+    /*!
+    \brief Get a free slab, wait if there is none
+    \param slabPool Receive slabs of the reader
+    \return Slab with one reference for the reader, nullptr if stop was requested
+    */
+    io_slab* getSlab(io_slab_pool& slabPool)
+    {
+        return slabPool.get([this]() { return stop(); });
+    }
+
+    /*!
+    \brief Code for raw event data reader thread in slab receive mode
+
+    The raw stream is received into large slabs with as few `receiveBytes` calls as possible.
+    Complete raw event data packet chunks within the slab are passed as views to the per chip
+    analysers. A partial chunk at the end of a slab is copied to the start of the next slab.
+
+    \param index Reader number
+    */
+    void readSlabs(unsigned index)
+    {
+        constexpr size_t headerSize = headerWords * sizeof(uint64_t);
+        double spinTime = .0;
+        double workTime = .0;
+        logger << placement::place(placement::reader, index) << log_info;
+        raw_source& dataStream = readers[index]->source;
+        io_slab_pool& slabPool = *readers[index]->slabPool;
+        auto& readerMetrics = readers[index]->metrics;
+        io_slab* slab = nullptr;
+        uint64_t slabs = 0;
+        uint64_t allocMark = 0;
+        bool scanning = false;  // resync mode: looking for the next valid packet header
+
+        const auto start = wall_clock::now();
+        try {
+            slab = getSlab(slabPool);
+            spinTime += std::chrono::duration<double>{wall_clock::now() - start}.count();
+            size_t pos = 0;     // start of first unprocessed chunk within slab
+
+            while (slab) {
+                const int bytesRead = dataStream.receiveBytes(&slab->data[slab->fill], slab->capacity - slab->fill);
+                if (bytesRead < 0)
+                    throw ReadFileException("no bytes received");
+                readerMetrics.bytes.add(bytesRead);
+                const uint64_t arrival = trace ? latency_trace::now() : 0;
+                if (bytesRead == 0) {
+                    if (pos != slab->fill) {
+                        if (! resync)
+                            throw ReadFileException(std::string("incomplete chunk at end of stream, ") + std::to_string(slab->fill - pos) + " bytes");
+                        readerMetrics.skippedBytes.add(slab->fill - pos);
+                    }
+                    break;
+                }
+                slab->fill += bytesRead;
+
+                while (pos + headerSize <= slab->fill) {
+                    uint64_t chipIndex = 0;
+                    uint64_t chunkSize = 0;
+                    uint64_t packetId = 0;
+                    if (resync) {
+                        const size_t next = chunk_scan::next_header<Decode, headerWords>(slab->data, pos, slab->fill, perChipBufferPool.size());
+                        if (next != pos) {
+                            if (! scanning)
+                                readerMetrics.resyncs.add();
+                            scanning = true;
+                            readerMetrics.skippedBytes.add(next - pos);
+                            pos = next;
+                            continue;
+                        }
+                    }
+                    scanning = false;
+                    checkPacketHeader(reinterpret_cast<const uint64_t*>(&slab->data[pos]), chipIndex, chunkSize, packetId);
+                    const size_t chunkEnd = pos + sizeof(uint64_t) + chunkSize;
+                    if (chunkEnd > slab->fill)
+                        break;
+                    if (! chipOwners.claim(index, chipIndex)) {
+                        readerMetrics.foreignChunks.add();
+                    } else if (chunkSize > DATA_OFFSET) {
+                        auto& bufferPool = *perChipBufferPool[chipIndex];
+                        const auto t3 = wall_clock::now();
+                        auto eventBuffer = bufferPool.get_empty_buffer();
+                        const auto t4 = wall_clock::now();
+                        spinTime += std::chrono::duration<double>{t4 - t3}.count();
+                        if (eventBuffer == nullptr)
+                            throw LogicException("received nullptr as empty buffer");
+                        eventBuffer->content_offset = DATA_OFFSET;
+                        eventBuffer->chunk_size = chunkSize;
+                        eventBuffer->set_view(*slab, pos + headerSize, chunkSize - DATA_OFFSET);
+                        eventBuffer->arrival = arrival;
+                        bufferPool.put_nonempty_buffer({ packetId, std::move(eventBuffer) });
+                        bufferMetrics[chipIndex].add();
+                    }
+                    readerMetrics.chunks.add();
+                    pos = chunkEnd;
+                }
+
+                if (slab->fill == slab->capacity) {
+                    // archived bytes end at the last complete chunk, or at a block boundary before it for direct IO
+                    const size_t keep = archive ? archive->put(slab, pos) : pos;
+                    const auto t1 = wall_clock::now();
+                    io_slab* next = getSlab(slabPool);
+                    const auto t2 = wall_clock::now();
+                    spinTime += std::chrono::duration<double>{t2 - t1}.count();
+                    if (next) {
+                        next->carry = next->fill = slab->fill - keep;
+                        std::copy(&slab->data[keep], &slab->data[slab->fill], next->data);
+                    }
+                    slab->release();
+                    slab = next;
+                    pos -= keep;
+                    if (++slabs == warmupBuffers)
+                        allocMark = alloc_counter::mark();
+                }
+            }
+        } catch (Poco::Exception& ex) {
+            stopNow();
+            logger << "reader exception: " << ex.displayText() << log_critical;
+        } catch (std::exception& ex) {
+            stopNow();
+            logger << "reader exception: " << ex.what() << log_critical;
+        }
+
+        if (slab) {
+            if (archive && ! stop())
+                archive->put(slab, slab->fill, true);
+            slab->release();
+        }
+        if (archive) {
+            archive->finish();
+            logger << "archive: " << archive->written() << " bytes written, " << archive->dropped() << " bytes dropped, "
+                   << archive->writerPlacement() << log_info;
+            if (! archive->writeError().empty())
+                logger << "archive: " << archive->writeError() << log_error;
+        }
+        workTime = std::chrono::duration<double>{wall_clock::now() - start}.count() - spinTime;
+
+        reportAllocations("reader", index, allocMark, slabs >= warmupBuffers);
+        reportResync(index);
+        reportForeign(index);
+        readerFinished();
+
+        {
+            spin_lock lock{memberMutex};
+            readTime += workTime;
+            readSpinTime += spinTime;
+            readWaits += adaptive_wait::stats;
+        }
+        logger << "reader waits: " << adaptive_wait::stats.to_string() << log_info;
+
+        logger << "reader stopped" << log_debug;
+    }
+
     // ----------------------- BINNING AND PURGING LOGIC ------------------------
     /*!
     \brief Purge period change interval from memory
@@ -251,19 +677,34 @@ class DataHandler final {
     */
     inline void purgePeriod(unsigned chipIndex, period_type period)
     {
+        if ((workersPerChip > 1) && processing::purgeRequired(chipIndex, period))
+            drainWorkers(chipIndex);
         processing::purgePeriod(chipIndex, period);
     }
 
+    /*!
+    \brief Wait until all events of a chip are histogrammed
+    \param chipIndex    Chip number
+    */
+    inline void drainWorkers(unsigned chipIndex)
+    {
+        workerBatches[chipIndex]->drain();
+    }
+
     /*!
     \brief Process TOA event
     \param chipIndex    Chip number
     \param period       Period number
     \param toaclk       TOA event clock ticks counter
-    \param event        Raw TOA event
+    \param event        Packed hit (see AsiRawStreamDecoder::packHit)
     */
     inline void processEvent(unsigned chipIndex, period_type period, int64_t toaclk, uint64_t event)
     {
         auto start = queues[chipIndex][period].start;
+        if (workersPerChip > 1) {
+            workerBatches[chipIndex]->add({period, toaclk - start, event});
+            return;
+        }
         // processing::processEvent(chipIndex, period, toaclk, toaclk - start, event);
         processing::processEvent(chipIndex, period, toaclk - start, event);
     }
@@ -282,9 +723,9 @@ class DataHandler final {
     {
         // logger << "purgeQueues(" << chipIndex << ", " << toSize << ')' << log_trace;
         while (queues[chipIndex].size() > toSize) {
-            auto pp = queues[chipIndex].oldest();
-            purgePeriod(chipIndex, pp->first);
-            // logger << chipIndex << ": remove queue for period " << pp->first << log_debug;
+            const period_type pp = queues[chipIndex].oldest();
+            purgePeriod(chipIndex, pp);
+            // logger << chipIndex << ": remove queue for period " << pp << log_debug;
             queues[chipIndex].erase(pp);
         }
     }
@@ -294,20 +735,30 @@ class DataHandler final {
     \param chipIndex    Chip number
     \param index        Abstract period index
     \param tdcclk       TDC clock
+    \param predictedStart Start of the period change as predicted before the TDC
     \param event        Raw event
+    \return Number of queued events the period prediction alone would have attributed to the other period
     */
-    inline void processTdc(unsigned chipIndex, period_index& index, int64_t tdcclk) //, uint64_t event)
+    inline uint64_t processTdc(unsigned chipIndex, period_index& index, int64_t tdcclk, int64_t predictedStart) //, uint64_t event)
     {
 //        logger << "processTdc(" << chipIndex << ", " << index << ", " << tdcclk << ", " << std::hex << event << std::dec << ')' << log_trace;
         // const float tdc = Decode::clockToFloat(tdcclk);
 //        logger << chipIndex << ": TDC: " << tdc << log_info;
         auto& rq = queues[chipIndex].registerStart(index, tdcclk);
-        for (; !rq.empty(); rq.pop()) {
-            auto& el = rq.top();
-            processEvent(chipIndex, (tdcclk <= el.toa ? index.disputed_period : index.period), el.toa, el.event);
+        const auto later = std::partition(std::begin(rq), std::end(rq), [tdcclk](const reordering_element& el) { return el.toa < tdcclk; });
+        uint64_t misattributed = 0;
+        for (auto el = std::begin(rq); el != later; ++el) {
+            misattributed += (el->toa >= predictedStart);
+            processEvent(chipIndex, index.period, el->toa, el->event);
         }
+        for (auto el = later; el != std::end(rq); ++el) {
+            misattributed += (el->toa < predictedStart);
+            processEvent(chipIndex, index.disputed_period, el->toa, el->event);
+        }
+        rq.clear();
         // remove old period data
         purgeQueues(chipIndex, maxPeriodQueues);
+        return misattributed;
     }
 
     /*!
@@ -315,14 +766,74 @@ class DataHandler final {
     \param chipIndex    Chip number
     \param index        Abstract period index
     \param toaclk       TOA clock ticks counter
-    \param event        Raw event
+    \param event        Packed hit (see AsiRawStreamDecoder::packHit)
     */
     inline void enqueueEvent(unsigned chipIndex, period_index index, int64_t toaclk, uint64_t event)
     {
         // logger << "enqueueEvent(" << chipIndex << ", " << index.period << ", " << toaclk << ", " << std::hex << event << std::dec << ')' << log_trace;
         // logger << chipIndex << ": enqueue: " << index.period << ' ' << toaclk
         //        << " (" << std::hex << event << std::dec << ')' << log_debug;
-        queues[chipIndex][index].queue->push({toaclk, event});
+        queues[chipIndex][index].queue.emplace_back(toaclk, event);
+    }
+
+    /*!
+    \brief Copy the analysis state of a chip into the pending checkpoint
+
+    Called by the analyser thread right after the TDC event starting the cut period was processed.
+
+    \param chipIndex    Chip number
+    \param tdcs         Number of TDC events seen
+    */
+    void captureChip(unsigned chipIndex, uint64_t tdcs)
+    {
+        if (workersPerChip > 1)
+            drainWorkers(chipIndex);
+        auto& state = checkpoints->state(chipIndex);
+        state.clear();
+        state.predictor = predictor[chipIndex];
+        state.tdcs = tdcs;
+        queues[chipIndex].visit([&state](period_type period, const period_queue_element& el) {
+            state.queues.push_back({period, el.start, el.queue.size(), el.start_seen});
+            state.events.insert(std::end(state.events), std::begin(el.queue), std::end(el.queue));
+        });
+        processing::capture(chipIndex, state);
+        checkpoints->captured(chipIndex);
+    }
+
+    /*!
+    \brief Code for histogramming worker thread
+    \param chipIndex    Chip number
+    \param worker       Worker number for the chip
+    */
+    void histogramData(unsigned chipIndex, unsigned worker)
+    {
+        auto& channel = workerBatches[chipIndex]->worker(worker);
+        double spinTime = .0;
+        double workTime = .0;
+        logger << placement::place(placement::worker, chipIndex * workersPerChip + worker) << log_info;
+        processing::localize(chipIndex, worker);
+
+        while (true) {
+            const auto t1 = wall_clock::now();
+            auto batch = channel.get_full();
+            const auto t2 = wall_clock::now();
+            if (batch == nullptr)
+                break;
+            for (const auto& ev : batch->event)
+                processing::processEvent(chipIndex, worker, ev.period, ev.relative_toaclk, ev.event);
+            channel.put_empty(std::move(batch));
+            const auto t3 = wall_clock::now();
+            spinTime += std::chrono::duration<double>(t2 - t1).count();
+            workTime += std::chrono::duration<double>(t3 - t2).count();
+        }
+
+        {
+            spin_lock lock{memberMutex};
+            histogramTime += workTime;
+            histogramSpinTime += spinTime;
+            histogramWaits += adaptive_wait::stats;
+        }
+        logger << "worker " << chipIndex << '.' << worker << " waits: " << adaptive_wait::stats.to_string() << log_info;
     }
 
     /*!
@@ -333,13 +844,32 @@ class DataHandler final {
     {
         const unsigned chipIndex = threadId;
 
-        perChipBufferPool[chipIndex].reset(new io_buffer_pool{});
+        // place the thread before allocating its IO buffers and histograms
+        logger << placement::place(placement::analyser, chipIndex) << log_info;
+        if (workersPerChip == 1)
+            processing::localize(chipIndex, 0);
+        if (slabMode)
+            perChipBufferPool[chipIndex].reset(new Pool{numBuffers * viewsPerSlab, 0});
+        else
+            perChipBufferPool[chipIndex].reset(new Pool{numBuffers, bufferSize});
         analyzerReady.fetch_add(1, std::memory_order_release);
 
-        uint64_t tdcHits = 0;
+        uint64_t tdcHits = resumedTdcs[chipIndex];
         double spinTime = .0;
         double workTime = .0;
         uint64_t hits = 0;
+        uint64_t disputed = 0;
+        auto& liveMetrics = analyserMetrics[chipIndex];
+        event_columns columns;
+        period_block periods;
+        uint64_t buffers = 0;
+        uint64_t allocMark = 0;
+        uint64_t nextPacket = 0;    // resync mode: expected packet number
+        bool reseed = false;        // resync mode: reseed the period predictor at the next TDC
+        uint64_t tdcErrorMax = 0;   // largest TDC prediction error in clock ticks
+        bool resuming = (tdcHits > 0);  // resumed from a checkpoint: skip events until the predictor is rebased at the first TDC
+        latency_trace::ring* traceRing = trace ? &trace->analyser(chipIndex) : nullptr;
+        period_type tracedPeriod = std::numeric_limits<period_type>::min();    // latest period with a first event stamp
 
         try {
         
@@ -348,6 +878,7 @@ class DataHandler final {
             do {
                 uint64_t chunkSize = 0;
                 uint64_t totalBytes = DATA_OFFSET;
+                bool discard = false;   // resync mode: drop the rest of a truncated chunk
 
                 do {
 
@@ -362,72 +893,130 @@ class DataHandler final {
                     
                     size_t dataSize = eventBuffer->content_size;
                     chunkSize = eventBuffer->chunk_size;
+
+                    if (__builtin_expect(discard, 0)) {
+                        liveMetrics.droppedBytes.add(dataSize);
+                        totalBytes += dataSize;
+                        eventBuffer->release_view();
+                        bufferPool.put_empty_buffer(std::move(eventBuffer));
+                        continue;
+                    }
+                    if constexpr (headerWords > 1) {
+                        if (resync && (eventBuffer->content_offset == DATA_OFFSET) && packetGap(packetNumber, nextPacket, liveMetrics))
+                            reseed = (tdcHits >= 3);
+                    }
 //                    logger << threadId << ": full buffer " << eventBuffer->id
 //                                        << " chunk " << chunkSize
 //                                        << " offset " << eventBuffer->content_offset
 //                                        << " size " << eventBuffer->content_size
 //                                        << " packet " << packetNumber << log_debug;
 
-                    size_t processingByte = 0;
-                    const char* content = eventBuffer->content.data();
-                    bool predictorReady = (tdcHits >= 3);
-
-                    while (processingByte < dataSize) {
-                        uint64_t d = *reinterpret_cast<const uint64_t*>(&content[processingByte]);
-                        if (__builtin_expect((d & 0xffffffffUL) == tpxHeader, 0)) {
-                            throw RuntimeException(std::string("encountered chunk header within chunk at offset ") + std::to_string(processingByte));
-                        } else if (__builtin_expect(Decode::matchesNibble(d, 0xb), 1)) {
-                            if (__builtin_expect(predictorReady, 1)) {
-                                const int64_t toaclk = Decode::getToaClock(d);
-                                const double period = predictor[chipIndex].period_prediction(toaclk);
-                                auto index = queues[chipIndex].period_index_for(period);
-  //                              logger << threadId << ": toaclk=" << toaclk << ", period=" << period << ", index=" << index << ", predictor=" << predictor[chipIndex] << log_debug;
-                                queues[chipIndex].refined_index(index, toaclk);
-                                hits++;
-                                if (! index.disputed)
-                                    processEvent(chipIndex, index.period, toaclk, d);
-                                else
-                                    enqueueEvent(chipIndex, index, toaclk, d);
-                            } else {
-                                // logger << threadId << ": skip event " << std::hex << d << std::dec << log_info;
-                            }
-                        } else if (__builtin_expect(Decode::matchesNibble(d, 0x6), 0)) {
-                            const uint64_t tdcclk = Decode::getTdcClock(d);
-    //                        logger << threadId << ": tdc " << tdcclk  << " (" << std::hex << d << std::dec << ')' << log_debug;
-                            if (__builtin_expect(tdcHits == 0, 0)) {
-                                predictor[chipIndex].reset(tdcclk, initialPeriod);
-    //                            logger << threadId << ": predictor start, tdc " << tdcclk << " predictor " << predictor[chipIndex] << log_info;
-                            } else {
-                                predictor[chipIndex].prediction_update(tdcclk);
-                                if (tdcHits == 2) {
-                                    predictorReady = true;
-    //                                logger << threadId << ": predictor ready, tdc " << tdcclk << " predictor " << predictor[chipIndex] << log_info;
-                                }
-                            }
-                            tdcHits++;
-                            if (__builtin_expect(predictorReady, 1)) {
-                                const double period = predictor[chipIndex].period_prediction(tdcclk);
-                                auto index = queues[chipIndex].period_index_for(period);
-                                if (! __builtin_expect(index.disputed, 1)) {
-//                                    logger << threadId << ": tdc=" << tdcclk << ", period=" << period << ", index=" << index << ", predictor=" << predictor[chipIndex] << log_fatal;
-                                    throw RuntimeException("encountered undisputed period for tdc");
+                    const size_t numWords = dataSize / sizeof(uint64_t);
+                    const char* content = eventBuffer->data();
+                    bool predictorReady = (tdcHits >= 3) && ! resuming;
+
+                    Decode::classify(reinterpret_cast<const uint64_t*>(content), numWords, columns);
+
+                    size_t hit = 0;
+                    for (size_t tdc=0; tdc<=columns.num_tdc; tdc++) {
+                        const size_t hitsEnd = (tdc < columns.num_tdc) ? columns.tdc_position[tdc] : columns.num_hits;
+                        if (__builtin_expect(predictorReady, 1)) {
+                            hits += hitsEnd - hit;
+                            queues[chipIndex].period_indices_for(predictor[chipIndex], &columns.toa[hit], hitsEnd - hit, periods);
+                            for (size_t i=0; hit<hitsEnd; hit++, i++) {
+                                const int64_t toaclk = columns.toa[hit];
+                                const auto index = queues[chipIndex].refined_index(periods, i, toaclk);
+  //                              logger << threadId << ": toaclk=" << toaclk << ", index=" << index << ", predictor=" << predictor[chipIndex] << log_debug;
+                                const uint64_t packedHit = Decode::packHit(columns.tot[hit], columns.pixel[hit]);
+                                if (__builtin_expect(traceRing != nullptr, 0) && (index.period > tracedPeriod)) {
+                                    tracedPeriod = index.period;
+                                    traceRing->stamp(latency_trace::received, index.period, chipIndex, eventBuffer->arrival);
+                                    traceRing->stamp(latency_trace::first_event, index.period, chipIndex);
                                 }
-                                if (! predictor[chipIndex].ok(tdcclk)) {
-                                    predictor[chipIndex].start_update(tdcclk);
-//                                    logger << threadId << ": predictor recalibrate " << predictor[chipIndex] << log_info;
+                                if (! index.disputed) {
+                                    processEvent(chipIndex, index.period, toaclk, packedHit);
+                                } else {
+                                    enqueueEvent(chipIndex, index, toaclk, packedHit);
+                                    disputed++;
                                 }
-                                processTdc(chipIndex, index, tdcclk); //, d);
                             }
                         } else {
-                            if (__builtin_expect(Decode::matchesByte(d, 0x50), 0)) {
-                                throw RuntimeException(std::string("encountered packet ID within chunk at offset ") + std::to_string(processingByte));
+                            // logger << threadId << ": skip " << (hitsEnd - hit) << " events" << log_info;
+                        }
+                        hit = hitsEnd;
+                        if (tdc == columns.num_tdc)
+                            break;
+
+                        const uint64_t tdcclk = Decode::getTdcClock(columns.tdc[tdc]);
+    //                    logger << threadId << ": tdc " << tdcclk  << " (" << std::hex << columns.tdc[tdc] << std::dec << ')' << log_debug;
+                        int64_t predictedStart = tdcclk;    // period change start predicted before this TDC
+                        if (__builtin_expect(predictorReady && ! reseed, 1)) {
+                            const double expected = predictor[chipIndex].period_prediction(tdcclk);
+                            predictedStart -= std::llround((expected - std::round(expected)) * predictor[chipIndex].interval_prediction());
+                            const uint64_t error = std::abs(predictedStart - (int64_t)tdcclk);
+                            if (error > tdcErrorMax) {
+                                tdcErrorMax = error;
+                                liveMetrics.tdcErrorMax.set(error);
                             }
-                            // logger << threadId << ": unknown " << std::hex << d << std::dec << log_info;
                         }
+                        if (__builtin_expect(tdcHits == 0, 0)) {
+                            predictor[chipIndex].reset(tdcclk, initialPeriod);
+    //                        logger << threadId << ": predictor start, tdc " << tdcclk << " predictor " << predictor[chipIndex] << log_info;
+                        } else if (__builtin_expect(resuming, 0)) {
+                            predictor[chipIndex].reseed(tdcclk);
+                            predictorReady = true;
+                            resuming = reseed = false;
+                            logger << threadId << ": resumed at tdc " << tdcclk << ", period " << predictor[chipIndex].period_correction() << log_info;
+                        } else if (__builtin_expect(reseed, 0)) {
+                            predictor[chipIndex].reseed(tdcclk);
+                            liveMetrics.reseeds.add();
+                            reseed = false;
+                        } else {
+                            predictor[chipIndex].prediction_update(tdcclk);
+                            if (tdcHits == 2) {
+                                predictorReady = true;
+    //                            logger << threadId << ": predictor ready, tdc " << tdcclk << " predictor " << predictor[chipIndex] << log_info;
+                            }
+                        }
+                        tdcHits++;
+                        if (__builtin_expect(predictorReady, 1)) {
+                            const double period = predictor[chipIndex].period_prediction(tdcclk);
+                            auto index = queues[chipIndex].period_index_for(period);
+                            if (! __builtin_expect(index.disputed, 1)) {
+//                                logger << threadId << ": tdc=" << tdcclk << ", period=" << period << ", index=" << index << ", predictor=" << predictor[chipIndex] << log_fatal;
+                                if (! resync)
+                                    throw RuntimeException("encountered undisputed period for tdc");
+                                // TDCs went missing without a packet gap
+                                predictor[chipIndex].reseed(tdcclk);
+                                liveMetrics.reseeds.add();
+                                index = queues[chipIndex].period_index_for(predictor[chipIndex].period_prediction(tdcclk));
+                                predictedStart = tdcclk;
+                            }
+                            if (! predictor[chipIndex].ok(tdcclk)) {
+                                predictor[chipIndex].start_update(tdcclk);
+//                                logger << threadId << ": predictor recalibrate " << predictor[chipIndex] << log_info;
+                            }
+                            liveMetrics.misattributed.add(processTdc(chipIndex, index, tdcclk, predictedStart));
+                            if (__builtin_expect(traceRing != nullptr, 0))
+                                traceRing->stamp(latency_trace::tdc, index.period, chipIndex);
+                            liveMetrics.residual.set(std::llround(predictor[chipIndex].residual()));
+                            if (__builtin_expect(checkpoints != nullptr, 0) && checkpoints->pending(chipIndex, index.period))
+                                captureChip(chipIndex, tdcHits);
+                        }
+                    }
 
-                        processingByte += sizeof(uint64_t);
+                    if (__builtin_expect(columns.reason != event_columns::none, 0) && resync) {
+                        // truncated chunk, the rest belongs to the next one
+                        liveMetrics.droppedBytes.add(chunk_scan::truncated_bytes(columns, dataSize));
+                        discard = true;
+                    } else if (__builtin_expect(columns.reason == event_columns::chunk_header, 0)) {
+                        throw RuntimeException(std::string("encountered chunk header within chunk at offset ") + std::to_string(columns.stop * sizeof(uint64_t)));
+                    } else if (__builtin_expect(columns.reason == event_columns::packet_id, 0)) {
+                        throw RuntimeException(std::string("encountered packet ID within chunk at offset ") + std::to_string(columns.stop * sizeof(uint64_t)));
                     }
+                    const size_t processingByte = discard ? dataSize : columns.stop * sizeof(uint64_t);
 
+                    eventBuffer->release_view();
                     bufferPool.put_empty_buffer(std::move(eventBuffer));
 
                     if (processingByte != dataSize)
@@ -435,6 +1024,14 @@ class DataHandler final {
 
                     totalBytes += dataSize;
 
+                    liveMetrics.hits.set(hits);
+                    liveMetrics.tdcs.set(tdcHits);
+                    liveMetrics.disputed.set(disputed);
+                    liveMetrics.buffers.add();
+                    liveMetrics.reorderQueues.set(queues[chipIndex].size());
+                    if (++buffers == warmupBuffers)
+                        allocMark = alloc_counter::mark();
+
                     const auto t3 = wall_clock::now();
 
                     spinTime += std::chrono::duration<double>(t2 - t1).count();
@@ -445,19 +1042,31 @@ class DataHandler final {
             } while(! stop());
 
         analyser_stopped:
+            reportAllocations("analyser", threadId, allocMark, buffers >= warmupBuffers);
 
             // purge remaining queues
             purgeQueues(chipIndex);
             purgePeriod(chipIndex, std::numeric_limits<period_type>::max());
+            if (workersPerChip > 1)
+                drainWorkers(chipIndex);
 
             {
                 spin_lock lock{memberMutex};
                 hitCount += hits;
                 analyseTime += workTime;
                 analyseSpinTime += spinTime;
+                analyseWaits += adaptive_wait::stats;
             }
+            logger << threadId << ": analyser waits: " << adaptive_wait::stats.to_string() << log_info;
 
             logger << threadId << ": Processed " << hits << " events, " << tdcHits << " TDCs" << log_info;
+            logger << threadId << ": disputed " << disputed << " events (" << (hits ? 100. * disputed / hits : .0) << "%), "
+                   << liveMetrics.misattributed.get() << " corrected, largest TDC prediction error " << tdcErrorMax
+                   << " ticks (" << (100. * tdcErrorMax / predictor[chipIndex].interval_prediction()) << "% of period, threshold "
+                   << (100. * queues[chipIndex].threshold) << "%)" << log_info;
+            if (resync && (liveMetrics.droppedBytes.get() || liveMetrics.lostPackets.get() || liveMetrics.latePackets.get() || liveMetrics.reseeds.get()))
+                logger << threadId << ": resync: " << liveMetrics.droppedBytes.get() << " bytes dropped, " << liveMetrics.lostPackets.get() << " packets lost, "
+                       << liveMetrics.latePackets.get() << " late packets, " << liveMetrics.reseeds.get() << " predictor reseeds" << log_warn;
         } catch (Poco::Exception& ex) {
             stopNow();
             logger << threadId << ": analyser exception: " << ex.displayText() << log_critical;
@@ -465,40 +1074,161 @@ class DataHandler final {
             stopNow();
             logger << threadId << ": analyser exception: " << ex.what() << log_critical;
         }
+
+        perChipBufferPool[chipIndex]->finish_reading();
+        if (workersPerChip > 1)
+            workerBatches[chipIndex]->finish();
     }
 
 public:
     /*!
     \brief Constructor
-    \param socket   Raw event data stream receiving end
+    \param sources  Raw event data stream sources, each with its own reader thread. All chunks of a chip must arrive through the same source
     \param log      Poco::Logger object for logging
-    \param bufSize  IO buffer size
+    \param bufSize  IO buffer size, or slab size if `slabs` is true
+    \param numBufs  Number of preallocated IO buffers per chip, or number of slabs per source if `slabs` is true
     \param numChips Number of TPX3 chips for the detector that generated the events
     \param period   Initial TDC period
     \param undisputedThreshold Ratio r of disputed period interval, [r..1-r] will be undisputed. Must be less than 0.5
     \param maxQueues Number of recent period interval changes to remember
+    \param slabs    Use slab receive mode
+    \param workers  Number of histogramming workers per chip (must match processing::init()), 1 for histogramming within the analyser thread
+    \param tee      Archive for the received raw stream, requires slab receive mode and a single source, nullptr for none
+    \param disputedEvents Expected maximum number of events per chip within the disputed interval of a period change, preallocated in every reorder queue
+    \param resyncMode Skip corrupted data, truncated chunks and packet gaps instead of stopping
+    \param predictorWindow Number of TDCs for the period predictor linear fit, 0 for the median interval prediction (see period_predictor)
+    \param checkpointStore Periodic analysis state checkpoints, nullptr for none
+    \throw LogicException without sources, or for an archive without slab receive mode or with several sources
     */
-    DataHandler(StreamSocket& socket, Logger& log, unsigned long bufSize, unsigned long numChips, int64_t period, double undisputedThreshold, unsigned maxQueues)
-        : dataStream{socket}, logger{log}, perChipBufferPool{numChips}, bufferSize{bufSize},
-          analyserThreads(numChips), initialPeriod(period), predictor(numChips), queues(numChips),
-          maxPeriodQueues(maxQueues)
+    DataHandler(const std::vector<raw_source*>& sources, Logger& log, unsigned long bufSize, unsigned long numBufs, unsigned long numChips, int64_t period, double undisputedThreshold, unsigned maxQueues, bool slabs=false, unsigned workers=1, stream_archive* tee=nullptr, size_t disputedEvents=0, bool resyncMode=false, unsigned predictorWindow=0, checkpoint::store* checkpointStore=nullptr)
+        : logger{log}, perChipBufferPool{numChips}, bufferSize{bufSize}, numBuffers{numBufs}, slabMode{slabs}, resync{resyncMode}, archive{tee}, checkpoints{checkpointStore},
+          analyserThreads(numChips), workersPerChip{std::max(workers, 1u)}, initialPeriod(period), predictor(numChips), queues(numChips), resumedTdcs(numChips, 0),
+          maxPeriodQueues(maxQueues), analyserMetrics(numChips), chipOwners(numChips), bufferMetrics(numChips)
     {
-        io_buffer_pool::buffer_size = bufSize;
-        logger << "DataHandler(" << socket.address().toString() << ", " << bufSize << ", " << numChips << ", " << period << ", " << undisputedThreshold << ')' << log_trace;
-        for (auto& q : queues)
+        io_buffer_pool::buffer_size = slabMode ? 0 : bufSize;
+        if (sources.empty())
+            throw LogicException("no raw event data stream sources");
+        for (auto* source : sources)
+            readers.emplace_back(new stream_reader{*source});
+        logger << "DataHandler(" << sources[0]->name() << (sources.size() > 1 ? ", ..." : "") << ", " << bufSize << ", " << numBufs << ", " << numChips << ", " << period << ", " << undisputedThreshold << ", " << slabs << ", " << workers << ", " << disputedEvents << ", " << resyncMode << ", " << predictorWindow << ')' << log_trace;
+        if (workersPerChip > 1) {
+            workerThreads.resize(numChips * workersPerChip);
+            for (unsigned i=0; i<numChips; i++)
+                workerBatches.emplace_back(new batch_dispatcher{workersPerChip, batchesPerWorker, batchSize});
+        }
+        if (archive && ! slabMode)
+            throw LogicException("raw stream archiving requires slab receive mode");
+        if (archive && (readers.size() > 1))
+            throw LogicException("raw stream archiving requires a single raw stream");
+        if (slabMode) {
+            for (auto& reader : readers)
+                reader->slabPool.reset(new io_slab_pool{numBufs, bufSize});
+            const auto& slabPool = *readers[0]->slabPool;
+            logger << "receive slabs: " << readers.size() << " x " << slabPool.size() << " x " << slabPool.capacity() << " bytes"
+                   << (slabPool.huge() ? ", huge pages" : "") << log_info;
+        }
+        // remembered period changes plus the current one, with room for period number gaps
+        const size_t numSlots = std::max<size_t>(period_queues::default_capacity, 2 * (maxPeriodQueues + 1));
+        for (auto& q : queues) {
+            q = period_queues{numSlots};
+            q.reserve(disputedEvents);
             q.threshold = undisputedThreshold;
+        }
+        for (auto& p : predictor)
+            p.set_window(predictorWindow);
     }
 
     /*!
-    \brief Start a raw event data analyser thread for each chip, and one raw event data reader thread
+    \brief Constructor for a single raw event data stream
+    \param source   Raw event data stream source
+    \param log      Poco::Logger object for logging
+    \param bufSize  IO buffer size, or slab size if `slabs` is true
+    \param numBufs  Number of preallocated IO buffers per chip, or number of slabs if `slabs` is true
+    \param numChips Number of TPX3 chips for the detector that generated the events
+    \param period   Initial TDC period
+    \param undisputedThreshold Ratio r of disputed period interval, [r..1-r] will be undisputed. Must be less than 0.5
+    \param maxQueues Number of recent period interval changes to remember
+    \param slabs    Use slab receive mode
+    \param workers  Number of histogramming workers per chip (must match processing::init()), 1 for histogramming within the analyser thread
+    \param tee      Archive for the received raw stream, requires slab receive mode, nullptr for none
+    \param disputedEvents Expected maximum number of events per chip within the disputed interval of a period change, preallocated in every reorder queue
+    \param resyncMode Skip corrupted data, truncated chunks and packet gaps instead of stopping
+    \param predictorWindow Number of TDCs for the period predictor linear fit, 0 for the median interval prediction (see period_predictor)
+    \param checkpointStore Periodic analysis state checkpoints, nullptr for none
+    */
+    DataHandler(raw_source& source, Logger& log, unsigned long bufSize, unsigned long numBufs, unsigned long numChips, int64_t period, double undisputedThreshold, unsigned maxQueues, bool slabs=false, unsigned workers=1, stream_archive* tee=nullptr, size_t disputedEvents=0, bool resyncMode=false, unsigned predictorWindow=0, checkpoint::store* checkpointStore=nullptr)
+        : DataHandler(std::vector<raw_source*>{&source}, log, bufSize, numBufs, numChips, period, undisputedThreshold, maxQueues, slabs, workers, tee, disputedEvents, resyncMode, predictorWindow, checkpointStore)
+    {}
+
+    /*!
+    \brief Restore the analysis state from a checkpoint, before `run_async()`
+
+    Period predictors, reorder queues and histograms continue where the checkpoint left off.
+    Every analyser skips events until the first TDC event of the continuing raw stream,
+    which becomes the new base reference time of the restored period predictor.
+    The period predictor mode of the constructor takes precedence over the restored one.
+
+    \param img Checkpoint image, see checkpoint::load()
+    \throw LogicException if the checkpoint has a different number of chips
+    \throw std::invalid_argument if the checkpoint doesn't match the processing settings
+    */
+    void resume(const checkpoint::image& img)
+    {
+        if (img.chip.size() != predictor.size())
+            throw LogicException(std::string("checkpoint has ") + std::to_string(img.chip.size()) + " chips, detector has " + std::to_string(predictor.size()));
+        processing::restore(img);
+        for (unsigned chip=0; chip<img.chip.size(); chip++) {
+            const auto& state = img.chip[chip];
+            const unsigned window = predictor[chip].window();
+            predictor[chip] = state.predictor;
+            if (predictor[chip].window() != window)
+                predictor[chip].set_window(window);
+            std::size_t first = 0;
+            for (const auto& q : state.queues) {
+                auto& el = queues[chip][q.period];
+                el.start = q.start;
+                el.start_seen = (q.start_seen != 0);
+                el.queue.assign(std::begin(state.events) + first, std::begin(state.events) + first + q.events);
+                first += q.events;
+            }
+            // a predictor that wasn't ready yet starts over
+            resumedTdcs[chip] = (state.tdcs >= 3) ? state.tdcs : 0;
+            logger << chip << ": resume checkpoint " << img.sequence << ", " << state.tdcs << " TDCs, " << state.queues.size() << " reorder queues, "
+                   << state.histograms.size() << " histograms, predictor " << predictor[chip] << log_info;
+        }
+    }
+
+    /*!
+    \brief Stamp period milestones into a latency tracer, before `run_async()`
+
+    Reader threads stamp the arrival time of every IO buffer, analysers stamp the first event
+    and the ending TDC of every period into their ring of the tracer.
+
+    \param tracer Period latency tracer, configured by processing::init(), nullptr for none
+    */
+    void setTrace(latency_trace::tracer* tracer) noexcept
+    {
+        trace = tracer;
+    }
+
+    /*!
+    \brief Start a raw event data analyser thread for each chip, and a raw event data reader thread for each source
     */
     void run_async()
     {
+        for (unsigned i=0; i<workerThreads.size(); i++)
+            workerThreads[i] = std::thread([this, i]{this->histogramData(i / workersPerChip, i % workersPerChip);});
         for (unsigned i=0; i<analyserThreads.size(); i++)
             analyserThreads[i] = std::thread([this, i]{this->analyseData(i);});
         while (analyzerReady.load(std::memory_order_consume) != analyserThreads.size())
             std::this_thread::yield();
-        readerThread = std::thread([this]{this->readData();});
+        readersRunning.store(readers.size(), std::memory_order_relaxed);
+        for (unsigned i=0; i<readers.size(); i++) {
+            if (slabMode)
+                readers[i]->thread = std::thread([this, i]{this->readSlabs(i);});
+            else
+                readers[i]->thread = std::thread([this, i]{this->readData(i);});
+        }
     }
 
     /*!
@@ -506,16 +1236,120 @@ public:
     */
     void await()
     {
-        readerThread.join();
+        for (auto& reader : readers)
+            reader->thread.join();
         for (auto& thread : analyserThreads)
             thread.join();
+        for (auto& thread : workerThreads)
+            thread.join();
+    }
+
+    /*!
+    \brief Check for errors
+    \return True if a thread failed
+    */
+    bool failed() const noexcept
+    {
+        return stop();
+    }
+
+    /*!
+    \brief Write live reader and analyser counters in Prometheus text format
+
+    Only reads counters, can be called from any thread while the handler exists.
+
+    \param out Output stream
+    */
+    void writeMetrics(std::ostream& out) const
+    {
+        const unsigned nchips = analyserMetrics.size();
+        metrics::describe(out, "tpx3_reader_bytes_total", "counter", "Number of raw stream bytes received");
+        uint64_t bytes = 0, chunks = 0;
+        for (const auto& reader : readers) {
+            bytes += reader->metrics.bytes.get();
+            chunks += reader->metrics.chunks.get();
+        }
+        metrics::sample(out, "tpx3_reader_bytes_total", bytes);
+        metrics::describe(out, "tpx3_reader_chunks_total", "counter", "Number of raw event data packet chunks received");
+        metrics::sample(out, "tpx3_reader_chunks_total", chunks);
+        if (readers.size() > 1) {
+            uint64_t foreign = 0;
+            for (const auto& reader : readers)
+                foreign += reader->metrics.foreignChunks.get();
+            metrics::describe(out, "tpx3_reader_foreign_chunks_total", "counter", "Number of chunks skipped because their chip is owned by another raw stream");
+            metrics::sample(out, "tpx3_reader_foreign_chunks_total", foreign);
+        }
+        if (resync) {
+            uint64_t resyncs = 0, skipped = 0;
+            for (const auto& reader : readers) {
+                resyncs += reader->metrics.resyncs.get();
+                skipped += reader->metrics.skippedBytes.get();
+            }
+            metrics::describe(out, "tpx3_reader_resyncs_total", "counter", "Number of invalid packet headers the readers resynchronised from");
+            metrics::sample(out, "tpx3_reader_resyncs_total", resyncs);
+            metrics::describe(out, "tpx3_reader_skipped_bytes_total", "counter", "Number of raw stream bytes skipped to find the next valid packet header");
+            metrics::sample(out, "tpx3_reader_skipped_bytes_total", skipped);
+            metrics::describe(out, "tpx3_dropped_bytes_total", "counter", "Number of bytes dropped from truncated chunks");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_dropped_bytes_total", chip, analyserMetrics[chip].droppedBytes.get());
+            metrics::describe(out, "tpx3_lost_packets_total", "counter", "Number of packets missing from the packet number sequence");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_lost_packets_total", chip, analyserMetrics[chip].lostPackets.get());
+            metrics::describe(out, "tpx3_late_packets_total", "counter", "Number of packets arriving after a later packet");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_late_packets_total", chip, analyserMetrics[chip].latePackets.get());
+            metrics::describe(out, "tpx3_predictor_reseeds_total", "counter", "Number of period predictor reseeds after packet gaps or missing TDCs");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_predictor_reseeds_total", chip, analyserMetrics[chip].reseeds.get());
+        }
+        metrics::describe(out, "tpx3_events_total", "counter", "Number of TOA events analysed after the period predictor is ready");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_events_total", chip, analyserMetrics[chip].hits.get());
+        metrics::describe(out, "tpx3_disputed_events_total", "counter", "Number of TOA events within disputed period change intervals");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_disputed_events_total", chip, analyserMetrics[chip].disputed.get());
+        metrics::describe(out, "tpx3_misattributed_events_total", "counter", "Number of disputed events the period prediction alone would have attributed to the wrong period");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_misattributed_events_total", chip, analyserMetrics[chip].misattributed.get());
+        metrics::describe(out, "tpx3_tdc_prediction_error_max_ticks", "gauge", "Largest TDC time prediction error in clock ticks");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_tdc_prediction_error_max_ticks", chip, analyserMetrics[chip].tdcErrorMax.get());
+        if (predictor[0].window()) {
+            metrics::describe(out, "tpx3_predictor_residual_ticks", "gauge", "RMS residual of the period predictor linear fit in clock ticks");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_predictor_residual_ticks", chip, analyserMetrics[chip].residual.get());
+        }
+        metrics::describe(out, "tpx3_tdc_events_total", "counter", "Number of TDC events");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_tdc_events_total", chip, analyserMetrics[chip].tdcs.get());
+        metrics::describe(out, "tpx3_analysed_buffers_total", "counter", "Number of IO buffers analysed");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_analysed_buffers_total", chip, analyserMetrics[chip].buffers.get());
+        metrics::describe(out, "tpx3_queued_buffers", "gauge", "Number of IO buffers waiting for the analyser");
+        for (unsigned chip=0; chip<nchips; chip++) {
+            const uint64_t analysed = analyserMetrics[chip].buffers.get();
+            const uint64_t passed = std::max(bufferMetrics[chip].get(), analysed);
+            metrics::sample(out, "tpx3_queued_buffers", chip, passed - analysed);
+        }
+        metrics::describe(out, "tpx3_reorder_queues", "gauge", "Number of remembered period interval changes");
+        for (unsigned chip=0; chip<nchips; chip++)
+            metrics::sample(out, "tpx3_reorder_queues", chip, analyserMetrics[chip].reorderQueues.get());
+        if (archive)
+            archive->writeMetrics(out);
+        if (checkpoints)
+            checkpoints->writeMetrics(out);
     }
 
     uint64_t hitCount = 0;      //!< Number of TOA events encountered
-    double readSpinTime = .0;   //!< Time used in spin loop to wait for empty IO buffers
+    double readSpinTime = .0;   //!< Time used waiting for empty IO buffers, see `readWaits`
+    adaptive_wait::wait_stats readWaits;        //!< Waiting statistics of the reader thread
+    adaptive_wait::wait_stats analyseWaits;     //!< Aggregated waiting statistics of the analyser threads
+    adaptive_wait::wait_stats histogramWaits;   //!< Aggregated waiting statistics of the histogramming workers
     double readTime = .0;       //!< Time used for reading raw event data
-    double analyseSpinTime = .0;//!< Aggregated time used in spin loop to wait for full IO buffers
+    double analyseSpinTime = .0;//!< Aggregated time used waiting for full IO buffers, see `analyseWaits`
     double analyseTime = .0;    //!< Aggregated time used for analysing raw events
+    double histogramSpinTime = .0;//!< Aggregated time used by histogramming workers waiting for event batches, see `histogramWaits`
+    double histogramTime = .0;  //!< Aggregated time used by histogramming workers for histogramming
 };
 
 #endif // DATA_HANDLER_H
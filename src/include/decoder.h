@@ -7,6 +7,76 @@ Provide code for decoding Timepix3 raw stream data
 */
 
 #include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+    #if defined(__AVX512F__) && (__GNUC__ == 12)
+        // GCC 12 intrinsics header self-initializes undefined vectors
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        #include <immintrin.h>
+        #pragma GCC diagnostic pop
+    #else
+        #include <immintrin.h>
+    #endif
+#endif
+#include "layout.h"
+
+/*!
+\brief Structure of arrays output of the batch event classifier
+
+Hits (TOA events) go into the `toa`, `tot` and `pixel` columns.
+TDC events are recorded with their position within the hit columns,
+so the stateful period logic can process hits and TDCs in stream order.
+*/
+struct event_columns final {
+    std::vector<int64_t> toa;           //!< Hit TOA in clock ticks
+    std::vector<uint16_t> tot;          //!< Hit TOT in clock ticks
+    std::vector<uint16_t> pixel;        //!< Hit flat pixel index relative to chip
+    std::vector<uint32_t> tdc_position; //!< Number of hits before TDC event
+    std::vector<uint64_t> tdc;          //!< Raw TDC event
+    size_t num_hits = 0;                //!< Number of valid entries in hit columns
+    size_t num_tdc = 0;                 //!< Number of valid entries in TDC columns
+
+    /*!
+    \brief Reason for stopping classification before the end of the input
+    */
+    enum stop_reason : unsigned {
+        none,           //!< All words were classified
+        chunk_header,   //!< Encountered chunk header
+        packet_id       //!< Encountered packet ID
+    };
+    size_t stop = 0;            //!< Number of classified words, index of the offending word if `reason != none`
+    stop_reason reason = none;  //!< Why classification stopped
+
+    static constexpr size_t slack = 8;  //!< Vector stores may write this many entries past `num_hits`
+
+    /*!
+    \brief Make room for classifying words
+    \param num_words Number of input words
+    */
+    inline void reserve(size_t num_words)
+    {
+        if (toa.size() < num_words + slack) {
+            toa.resize(num_words + slack);
+            tot.resize(num_words + slack);
+            pixel.resize(num_words + slack);
+        }
+    }
+
+    /*!
+    \brief Forget all entries, keep columns allocated
+    */
+    inline void clear() noexcept
+    {
+        num_hits = num_tdc = stop = 0;
+        tdc_position.clear();
+        tdc.clear();
+        reason = none;
+    }
+};
 
 /*!
 \brief Decoder object for ASI Raw Data Stream
@@ -162,6 +232,252 @@ struct AsiRawStreamDecoder final {
     {
         return getBits(data, 29, 20);
     }
+
+    /*!
+    \brief Extract flat pixel index from event
+    \param data 64bit value - event data
+    \return Flat pixel index relative to chip, same as `x * chip_size + y` for `calculateXY()`
+    */
+    [[gnu::const]]
+    inline static unsigned getFlatPixel(uint64_t data) noexcept
+    {
+        const auto xy = calculateXY(data);
+        return (unsigned)(xy.first * chip_size + xy.second);
+    }
+
+    /*!
+    \brief Pack decoded hit information into one word
+    The packed word replaces the raw event for period reordering and histogramming.
+    \param tot         TOT clock ticks counter
+    \param flat_pixel  Flat pixel index relative to chip
+    \return Packed hit
+    */
+    [[gnu::const]]
+    inline static uint64_t packHit(uint64_t tot, unsigned flat_pixel) noexcept
+    {
+        return (tot << 16) | flat_pixel;
+    }
+
+    /*!
+    \brief Extract TOT clock from packed hit
+    \param hit Packed hit, see `packHit()`
+    \return TOT clock ticks counter
+    */
+    [[gnu::const]]
+    inline static uint64_t hitTot(uint64_t hit) noexcept
+    {
+        return hit >> 16;
+    }
+
+    /*!
+    \brief Extract flat pixel index from packed hit
+    \param hit Packed hit, see `packHit()`
+    \return Flat pixel index relative to chip
+    */
+    [[gnu::const]]
+    inline static unsigned hitPixel(uint64_t hit) noexcept
+    {
+        return hit & 0xffffUL;
+    }
+
+    static constexpr uint64_t chunkHeader = 861425748UL;    //!< 'TPX3' as uint64_t, low 32 bits of a chunk header
+
+    /*!
+    \brief Classify one word
+    \param word    Raw word
+    \param index   Word index within input
+    \param col     Output columns
+    \return False if classification has to stop at this word
+    */
+    inline static bool classifyWord(uint64_t word, size_t index, event_columns& col) noexcept
+    {
+        if (__builtin_expect((word & 0xffffffffUL) == chunkHeader, 0)) {
+            col.stop = index;
+            col.reason = event_columns::chunk_header;
+            return false;
+        } else if (__builtin_expect(matchesNibble(word, 0xb), 1)) {
+            const size_t i = col.num_hits++;
+            col.toa[i] = getToaClock(word);
+            col.tot[i] = getTotClock(word);
+            col.pixel[i] = getFlatPixel(word);
+        } else if (__builtin_expect(matchesNibble(word, 0x6), 0)) {
+            col.tdc_position.push_back(col.num_hits);
+            col.tdc.push_back(word);
+            col.num_tdc++;
+        } else if (__builtin_expect(matchesByte(word, 0x50), 0)) {
+            col.stop = index;
+            col.reason = event_columns::packet_id;
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+    \brief Classify and decode raw words, one at a time
+    \param word    Raw words
+    \param n       Number of raw words
+    \param col     Output columns, will be cleared first
+    */
+    inline static void classifyScalar(const uint64_t* word, size_t n, event_columns& col)
+    {
+        col.clear();
+        col.reserve(n);
+        for (size_t i=0; i<n; i++)
+            if (! classifyWord(word[i], i, col))
+                return;
+        col.stop = n;
+    }
+
+#if defined(__AVX512F__)
+    static constexpr const char* vectorIsa = "avx512";  //!< Instruction set used by `classify()`
+
+    /*!
+    \brief Classify and decode raw words, 8 at a time
+
+    Blocks without TDCs, chunk headers or packet IDs are decoded in vector registers,
+    hits are compressed into the output columns. Other blocks go through `classifyWord()`.
+
+    \param word    Raw words
+    \param n       Number of raw words
+    \param col     Output columns, will be cleared first
+    */
+    inline static void classify(const uint64_t* word, size_t n, event_columns& col)
+    {
+        col.clear();
+        col.reserve(n);
+        const __m512i low32 = _mm512_set1_epi64(0xffffffffUL);
+        const __m512i header = _mm512_set1_epi64(chunkHeader);
+        const __m512i hitNibble = _mm512_set1_epi64(0xb);
+        const __m512i tdcNibble = _mm512_set1_epi64(0x6);
+        const __m512i pidByte = _mm512_set1_epi64(0x50);
+        const __m512i mask4 = _mm512_set1_epi64(0xf);
+        const __m512i mask3 = _mm512_set1_epi64(0x7);
+        const __m512i mask2 = _mm512_set1_epi64(0x3);
+        const __m512i mask10 = _mm512_set1_epi64(0x3ff);
+        const __m512i mask14 = _mm512_set1_epi64(0x3fff);
+        const __m512i mask16 = _mm512_set1_epi64(0xffff);
+        const __m512i maskDcol = _mm512_set1_epi64(0x0fe00);
+        const __m512i maskSpix = _mm512_set1_epi64(0x001f8);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m512i w = _mm512_loadu_si512(&word[i]);
+            const __m512i nibble = _mm512_srli_epi64(w, 60);
+            const __mmask8 special = _mm512_cmpeq_epi64_mask(_mm512_and_si512(w, low32), header)
+                                   | _mm512_cmpeq_epi64_mask(nibble, tdcNibble)
+                                   | _mm512_cmpeq_epi64_mask(_mm512_srli_epi64(w, 56), pidByte);
+            if (__builtin_expect(special != 0, 0)) {
+                for (size_t j=i; j<i+8; j++)
+                    if (! classifyWord(word[j], j, col))
+                        return;
+                continue;
+            }
+            const __mmask8 hit = _mm512_cmpeq_epi64_mask(nibble, hitNibble);
+            const __m512i ftoa = _mm512_and_si512(_mm512_srli_epi64(w, 16), mask4);
+            const __m512i toa = _mm512_and_si512(_mm512_srli_epi64(w, 30), mask14);
+            const __m512i coarse = _mm512_and_si512(w, mask16);
+            const __m512i toaclk = _mm512_sub_epi64(_mm512_slli_epi64(_mm512_add_epi64(_mm512_slli_epi64(coarse, 14), toa), 4), ftoa);
+            const __m512i tot = _mm512_and_si512(_mm512_srli_epi64(w, 20), mask10);
+            const __m512i encoded = _mm512_srli_epi64(w, 44);
+            const __m512i dcol = _mm512_srli_epi64(_mm512_and_si512(encoded, maskDcol), 8);
+            const __m512i spix = _mm512_srli_epi64(_mm512_and_si512(encoded, maskSpix), 1);
+            const __m512i pix = _mm512_and_si512(encoded, mask3);
+            const __m512i x = _mm512_add_epi64(dcol, _mm512_srli_epi64(pix, 2));
+            const __m512i y = _mm512_add_epi64(spix, _mm512_and_si512(pix, mask2));
+            const __m512i pixel = _mm512_or_si512(_mm512_slli_epi64(x, 8), y);
+            const size_t k = col.num_hits;
+            _mm512_storeu_si512(&col.toa[k], _mm512_maskz_compress_epi64(hit, toaclk));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&col.tot[k]), _mm512_cvtepi64_epi16(_mm512_maskz_compress_epi64(hit, tot)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&col.pixel[k]), _mm512_cvtepi64_epi16(_mm512_maskz_compress_epi64(hit, pixel)));
+            col.num_hits = k + __builtin_popcount(hit);
+        }
+        for (; i<n; i++)
+            if (! classifyWord(word[i], i, col))
+                return;
+        col.stop = n;
+    }
+#elif defined(__AVX2__)
+    static constexpr const char* vectorIsa = "avx2";    //!< Instruction set used by `classify()`
+
+    /*!
+    \brief Classify and decode raw words, 4 at a time
+
+    Blocks consisting of hits only are decoded in vector registers.
+    Other blocks go through `classifyWord()`.
+
+    \param word    Raw words
+    \param n       Number of raw words
+    \param col     Output columns, will be cleared first
+    */
+    inline static void classify(const uint64_t* word, size_t n, event_columns& col)
+    {
+        col.clear();
+        col.reserve(n);
+        const __m256i low32 = _mm256_set1_epi64x(0xffffffffL);
+        const __m256i header = _mm256_set1_epi64x(chunkHeader);
+        const __m256i hitNibble = _mm256_set1_epi64x(0xb);
+        const __m256i mask4 = _mm256_set1_epi64x(0xf);
+        const __m256i mask3 = _mm256_set1_epi64x(0x7);
+        const __m256i mask2 = _mm256_set1_epi64x(0x3);
+        const __m256i mask10 = _mm256_set1_epi64x(0x3ff);
+        const __m256i mask14 = _mm256_set1_epi64x(0x3fff);
+        const __m256i mask16 = _mm256_set1_epi64x(0xffff);
+        const __m256i maskDcol = _mm256_set1_epi64x(0x0fe00);
+        const __m256i maskSpix = _mm256_set1_epi64x(0x001f8);
+        // low 16 bits of every 64 bit lane into the low 4 bytes of each 128 bit half
+        const __m256i narrow = _mm256_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&word[i]));
+            const __m256i hit = _mm256_andnot_si256(_mm256_cmpeq_epi64(_mm256_and_si256(w, low32), header),
+                                                    _mm256_cmpeq_epi64(_mm256_srli_epi64(w, 60), hitNibble));
+            if (__builtin_expect(_mm256_movemask_pd(_mm256_castsi256_pd(hit)) != 0xf, 0)) {
+                for (size_t j=i; j<i+4; j++)
+                    if (! classifyWord(word[j], j, col))
+                        return;
+                continue;
+            }
+            const __m256i ftoa = _mm256_and_si256(_mm256_srli_epi64(w, 16), mask4);
+            const __m256i toa = _mm256_and_si256(_mm256_srli_epi64(w, 30), mask14);
+            const __m256i coarse = _mm256_and_si256(w, mask16);
+            const __m256i toaclk = _mm256_sub_epi64(_mm256_slli_epi64(_mm256_add_epi64(_mm256_slli_epi64(coarse, 14), toa), 4), ftoa);
+            const __m256i tot = _mm256_and_si256(_mm256_srli_epi64(w, 20), mask10);
+            const __m256i encoded = _mm256_srli_epi64(w, 44);
+            const __m256i dcol = _mm256_srli_epi64(_mm256_and_si256(encoded, maskDcol), 8);
+            const __m256i spix = _mm256_srli_epi64(_mm256_and_si256(encoded, maskSpix), 1);
+            const __m256i pix = _mm256_and_si256(encoded, mask3);
+            const __m256i x = _mm256_add_epi64(dcol, _mm256_srli_epi64(pix, 2));
+            const __m256i y = _mm256_add_epi64(spix, _mm256_and_si256(pix, mask2));
+            const __m256i pixel = _mm256_or_si256(_mm256_slli_epi64(x, 8), y);
+            const __m256i tot16 = _mm256_shuffle_epi8(tot, narrow);
+            const __m256i pixel16 = _mm256_shuffle_epi8(pixel, narrow);
+            const size_t k = col.num_hits;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&col.toa[k]), toaclk);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(&col.tot[k]),
+                             _mm_unpacklo_epi32(_mm256_castsi256_si128(tot16), _mm256_extracti128_si256(tot16, 1)));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(&col.pixel[k]),
+                             _mm_unpacklo_epi32(_mm256_castsi256_si128(pixel16), _mm256_extracti128_si256(pixel16, 1)));
+            col.num_hits = k + 4;
+        }
+        for (; i<n; i++)
+            if (! classifyWord(word[i], i, col))
+                return;
+        col.stop = n;
+    }
+#else
+    static constexpr const char* vectorIsa = "scalar";  //!< Instruction set used by `classify()`
+
+    /*!
+    \brief Classify and decode raw words, no vector instruction set available
+    \param word    Raw words
+    \param n       Number of raw words
+    \param col     Output columns, will be cleared first
+    */
+    inline static void classify(const uint64_t* word, size_t n, event_columns& col)
+    {
+        classifyScalar(word, n, col);
+    }
+#endif
 };  // AsiRawStreamDecoder
 
 #endif // DECODER_H
@@ -11,6 +11,7 @@ Detector description
 #include "shared_types.h"
 #include "layout.h"
 #include "logging.h"
+#include "event_kernel.h"
 
 /*!
 \brief Constant detector data
@@ -24,19 +25,21 @@ struct Detector final {
         \brief Histogramming mode
         
         If TOAMode is false then TOT is used for binnig (counts as a
-        function of energy and TOT as output)
+        function of energy and TOT as output). Set from the HistogramMode entry of Processing.ini
+        before the time ROI is set.
         */
-        static constexpr bool TOAMode = true;
+        bool TOAMode = true;
 
-        static constexpr u16 TOTRoiStart = 0;           //!< ROI start in terms of TOT
-        static constexpr u16 TOTRoiEnd = 64000;           //!< ROI end in terms of TOT
+        static constexpr u16 TOTRoiStart = event_kernel::tot_roi_start; //!< ROI start in terms of TOT
+        static constexpr u16 TOTRoiEnd = event_kernel::tot_roi_end;     //!< ROI end in terms of TOT
 
         u64 TRoiStart = TOAMode ? 0 : TOTRoiStart;      //!< ROI start offset in clock ticks relative to interval start
         u64 TRoiStep = 1;                               //!< Histogram bin width in clock ticks
         u64 TRoiN = TOAMode ? 5000 : 100;               //!< Number of histogram bins
         u64 TRoiEnd = TRoiStart + TRoiStep * TRoiN;     //!< ROI end offset in clock ticks relative to interval start
 
-        PixelIndexToEp energy_points;   //!< Abstract pixel index to energy point mapping
+        PixelIndexToEp energy_points;   //!< Abstract pixel index to energy point mapping, as read from the XES points file (only `npoints` if `ep_table` was cached)
+        EpTable ep_table;               //!< Compact version of `energy_points` used for histogramming
 
         /*!
         \brief Set region of interest within period interval
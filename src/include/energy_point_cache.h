@@ -0,0 +1,269 @@
+#ifndef ENERGY_POINT_CACHE_H
+#define ENERGY_POINT_CACHE_H
+
+/*!
+\file
+Provide XES points file parsing and a binary cache for the compact energy point table
+*/
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "energy_points.h"
+
+/*!
+\brief XES points file handling
+
+The XES points file has one line per mapped pixel:
+
+    chip, flatPixel, energyPoint0 [, energyPoint1 ...], weight0 [, weight1 ...]
+
+Parsing it for a whole detector takes a noticeable amount of time right before the acquisition starts.
+Therefore the resulting `EpTable` is cached in a binary file next to the text file, keyed by a hash of the
+text file content and the number of chips. A stale or broken cache is rebuilt from the text file.
+
+The cache file consists of a `cache_header` followed by the `entry`, `offset`, `energy_point` and `weight`
+arrays of the table in host byte order.
+*/
+namespace ep_cache {
+
+    static constexpr char magic[8] = { 'T', 'P', 'X', '3', 'E', 'P', 'C', '1' };   //!< Cache file magic and format version
+
+    /*!
+    \brief Cache file header
+    */
+    struct cache_header final {
+        char magic[8];          //!< `ep_cache::magic`
+        uint64_t hash;          //!< Hash of the XES points file content, see `content_hash()`
+        uint32_t num_chips;     //!< Number of chips
+        uint32_t npoints;       //!< Number of energy points
+        uint64_t num_parts;     //!< Number of energy point parts
+    };
+    static_assert(sizeof(cache_header) == 32);
+
+    /*!
+    \brief Cache file path for an XES points file
+    \param points_file XES points file path
+    \return Cache file path
+    */
+    inline std::string cache_path(const std::string& points_file)
+    {
+        return points_file + ".cache";
+    }
+
+    /*!
+    \brief FNV-1a hash of a file content
+    \param data File content
+    \return 64 bit hash
+    */
+    [[gnu::pure]]
+    inline uint64_t content_hash(std::string_view data) noexcept
+    {
+        uint64_t hash = 14695981039346656037UL;
+        for (const char c : data) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211UL;
+        }
+        return hash;
+    }
+
+    /*!
+    \brief Read whole file
+    \param path File path
+    \return File content
+    \throw std::ios_base::failure if the file cannot be read
+    */
+    inline std::string read_file(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (! in)
+            throw std::ios_base::failure(std::string{"failed to open "} + path);
+        std::string res(static_cast<std::size_t>(in.tellg()), '\0');
+        in.seekg(0);
+        if (! in.read(res.data(), res.size()))
+            throw std::ios_base::failure(std::string{"failed to read "} + path);
+        return res;
+    }
+
+    /*!
+    \brief Parse one comma separated number
+    \tparam T       Number type
+    \param field    Field text, surrounding blanks are allowed
+    \param line     Line number for error messages
+    \return Number
+    \throw std::invalid_argument if `field` is not a number of type T
+    */
+    template<typename T>
+    inline T parse_field(std::string_view field, unsigned line)
+    {
+        while (! field.empty() && ((field.front() == ' ') || (field.front() == '\t')))
+            field.remove_prefix(1);
+        while (! field.empty() && ((field.back() == ' ') || (field.back() == '\t') || (field.back() == '\r')))
+            field.remove_suffix(1);
+        T val{};
+        const auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), val);
+        if ((ec != std::errc{}) || (end != field.data() + field.size()))
+            throw std::invalid_argument(std::string{"failed to parse XESPoints file data at line "} + std::to_string(line));
+        return val;
+    }
+
+    /*!
+    \brief Parse XES points file content
+    \param text         XES points file content
+    \param num_chips    Number of chips
+    \param ep           Set to the pixel to energy point mapping
+    \throw std::invalid_argument if the content is invalid
+    */
+    inline void parse_points(std::string_view text, unsigned num_chips, PixelIndexToEp& ep)
+    {
+        ep.chip.assign(num_chips, ChipToEp{});
+        for (auto& chip : ep.chip)
+            chip.flat_pixel.resize(EpTable::pixels_per_chip);
+        ep.npoints = 0;
+
+        std::vector<std::string_view> field;
+        unsigned line = 0;
+        while (! text.empty()) {
+            line++;
+            std::string_view s = text.substr(0, text.find('\n'));
+            text.remove_prefix(std::min(s.size() + 1, text.size()));
+            if (! s.empty() && (s.back() == '\r'))
+                s.remove_suffix(1);
+            if (s.empty())
+                continue;
+            field.clear();
+            for (std::size_t pos=0;;) {
+                const std::size_t end = s.find(',', pos);
+                field.push_back(s.substr(pos, end - pos));
+                if (end == std::string_view::npos)
+                    break;
+                pos = end + 1;
+            }
+            if ((field.size() < 2) || ((field.size() % 2) != 0))
+                throw std::invalid_argument(std::string{"invalid XESPoints file line "} + std::to_string(line) + " (number of fields)");
+            const unsigned k = parse_field<unsigned>(field[0], line);  // chip
+            if (k >= num_chips)
+                throw std::invalid_argument(std::string{"invalid chip number in XESPoints file at line "} + std::to_string(line));
+            const unsigned l = parse_field<unsigned>(field[1], line);  // flatPixel
+            if (l >= EpTable::pixels_per_chip)
+                throw std::invalid_argument(std::string{"invalid pixel number in XESPoints file at line "} + std::to_string(line));
+            FlatPixelToEp& pixel = ep.at(PixelIndex::from(k, l));
+            const unsigned numEnergyPoints = (field.size() - 2u) / 2u;
+            for (unsigned m=0; m<numEnergyPoints; m++) {
+                EpPart part;
+                part.energy_point = parse_field<unsigned>(field[2 + m], line);
+                part.weight = parse_field<float>(field[2 + numEnergyPoints + m], line);
+                ep.npoints = std::max(ep.npoints, part.energy_point);
+                pixel.part.push_back(part);
+            }
+        }
+        ep.npoints += 1;
+    }
+
+    /*!
+    \brief Load cached energy point table
+    \param path         Cache file path
+    \param hash         Expected XES points file content hash
+    \param num_chips    Expected number of chips
+    \param table        Set to the cached table on success
+    \return True if the cache exists, matches `hash` and `num_chips`, is complete, and its part offsets
+            never decrease and stay within the parts, so a false return makes the caller rebuild the table
+    */
+    inline bool load(const std::string& path, uint64_t hash, unsigned num_chips, EpTable& table)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        const bool ok = (fstat(fd, &info) == 0) && (static_cast<std::size_t>(info.st_size) >= sizeof(cache_header));
+        void* mem = ok ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (mem == MAP_FAILED)
+            return false;
+        const std::size_t size = info.st_size;
+        const char* data = static_cast<const char*>(mem);
+        cache_header header;
+        std::memcpy(&header, data, sizeof(header));
+        const std::size_t numPixels = std::size_t(num_chips) * EpTable::pixels_per_chip;
+        const std::size_t expected = sizeof(header) + (2 * numPixels + 1) * sizeof(uint32_t)
+                                   + header.num_parts * (sizeof(uint32_t) + sizeof(float));
+        bool valid = (std::memcmp(header.magic, magic, sizeof(magic)) == 0) && (header.hash == hash) &&
+                     (header.num_chips == num_chips) && (size == expected);
+        if (valid) {
+            const char* pos = data + sizeof(header);
+            auto take = [&pos](auto& vec, std::size_t n) {
+                vec.resize(n);
+                std::memcpy(vec.data(), pos, n * sizeof(vec[0]));
+                pos += n * sizeof(vec[0]);
+            };
+            take(table.entry, numPixels);
+            take(table.offset, numPixels + 1);
+            take(table.energy_point, header.num_parts);
+            take(table.weight, header.num_parts);
+            table.npoints = header.npoints;
+            const auto& offset = table.offset;
+            valid = (offset.front() == 0) && (offset.back() <= header.num_parts) &&
+                    std::is_sorted(std::begin(offset), std::end(offset));
+        }
+        munmap(mem, size);
+        return valid;
+    }
+
+    /*!
+    \brief Write energy point table cache
+
+    The cache is written to a temporary file first and renamed, so readers never see a partial cache.
+
+    \param path         Cache file path
+    \param hash         XES points file content hash
+    \param num_chips    Number of chips
+    \param table        Energy point table
+    \throw std::ios_base::failure if the cache cannot be written
+    */
+    inline void save(const std::string& path, uint64_t hash, unsigned num_chips, const EpTable& table)
+    {
+        cache_header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.hash = hash;
+        header.num_chips = num_chips;
+        header.npoints = table.npoints;
+        header.num_parts = table.energy_point.size();
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            auto put = [&out](const auto& vec) {
+                out.write(reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(vec[0]));
+            };
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            put(table.entry);
+            put(table.offset);
+            put(table.energy_point);
+            put(table.weight);
+            out.close();
+            if (out.fail()) {
+                std::remove(tmp.c_str());
+                throw std::ios_base::failure(std::string{"failed to write "} + tmp);
+            }
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+            const int err = errno;
+            std::remove(tmp.c_str());
+            throw std::ios_base::failure(std::string{"failed to rename "} + tmp + ": " + std::strerror(err));
+        }
+    }
+
+} // namespace ep_cache
+
+#endif // ENERGY_POINT_CACHE_H
@@ -7,6 +7,9 @@ Pixel to energy point mapping
 */
 
 #include <vector>
+#include <cassert>
+#include <cstdint>
+#include "pixel_index.h"
 
 /*!
 \brief Partial energy point mapping
@@ -72,4 +75,104 @@ struct PixelIndexToEp final {
         }
 };
 
+/*!
+\brief Compact abstract pixel index to energy point mapping
+
+Built once from a `PixelIndexToEp` mapping. The parts of all pixels are stored in
+compressed sparse row layout: contiguous `energy_point` and `weight` arrays, and an `offset`
+array indexed by `chip * pixels_per_chip + flat_pixel`. Pixels with a single energy point and
+weight 1 have a packed 32 bit `entry` with the `single` bit set, which is all that is needed
+to register a hit for such a pixel.
+*/
+struct EpTable final {
+        static constexpr uint32_t single = 1u << 31;    //!< Packed entry flag for a single energy point with weight 1
+        static constexpr unsigned pixels_per_chip = chip_size * chip_size;  //!< Number of flat pixels per chip
+
+        std::vector<uint32_t> entry;            //!< Per pixel packed entry: `single | energy_point`, or 0 for the general case
+        std::vector<uint32_t> offset;           //!< Per pixel start of parts, one more element at the end
+        std::vector<uint32_t> energy_point;     //!< Part energy points
+        std::vector<float> weight;              //!< Part weights
+        unsigned npoints = 0;                   //!< Number of energy points
+
+        /*!
+        \brief Build the table
+        \param ep Pixel to energy point mapping
+        */
+        inline void build(const PixelIndexToEp& ep)
+        {
+                const size_t numPixels = ep.chip.size() * pixels_per_chip;
+                entry.assign(numPixels, 0);
+                offset.assign(numPixels + 1, 0);
+                energy_point.clear();
+                weight.clear();
+                npoints = ep.npoints;
+                size_t i = 0;
+                for (const auto& chip : ep.chip) {
+                        assert(chip.flat_pixel.size() == pixels_per_chip);
+                        for (const auto& pixel : chip.flat_pixel) {
+                                offset[i] = energy_point.size();
+                                if ((pixel.part.size() == 1) && (pixel.part[0].weight == 1.f) && (pixel.part[0].energy_point < single))
+                                        entry[i] = single | pixel.part[0].energy_point;
+                                for (const auto& part : pixel.part) {
+                                        energy_point.push_back(part.energy_point);
+                                        weight.push_back(part.weight);
+                                }
+                                i++;
+                        }
+                }
+                offset[i] = energy_point.size();
+        }
+
+        /*!
+        \brief Table for a subset of the chips
+        \param chips    Chip numbers of this table, indexed by the chip number within the new table
+        \return Table with the pixels of `chips` only
+        */
+        inline EpTable select(const std::vector<unsigned>& chips) const
+        {
+                EpTable res;
+                res.npoints = npoints;
+                for (const unsigned chip : chips) {
+                        assert((chip + 1) * pixels_per_chip <= entry.size());
+                        for (size_t pos=chip*pixels_per_chip; pos<(chip+1)*pixels_per_chip; pos++) {
+                                res.entry.push_back(entry[pos]);
+                                res.offset.push_back(res.energy_point.size());
+                                for (uint32_t part=offset[pos]; part<offset[pos + 1]; part++) {
+                                        res.energy_point.push_back(energy_point[part]);
+                                        res.weight.push_back(weight[part]);
+                                }
+                        }
+                }
+                res.offset.push_back(res.energy_point.size());
+                return res;
+        }
+
+        /*!
+        \brief Check for a table without multi energy point pixels
+        \return True if every pixel is unmapped or has a packed single energy point entry
+        */
+        [[gnu::pure]]
+        inline bool single_only() const noexcept
+        {
+                for (size_t i=0; i<entry.size(); i++) {
+                        if (! (entry[i] & single) && (offset[i + 1] != offset[i]))
+                                return false;
+                }
+                return true;
+        }
+
+        /*!
+        \brief Get table position of abstract pixel index
+        \param index    Abstract pixel index
+        \return Index into `entry` and `offset`
+        */
+        [[gnu::pure]]
+        inline size_t position(const PixelIndex& index) const noexcept
+        {
+                assert(index.flat_pixel < pixels_per_chip);
+                assert(index.chip * pixels_per_chip + index.flat_pixel < entry.size());
+                return index.chip * pixels_per_chip + index.flat_pixel;
+        }
+};
+
 #endif // ENERGY_POINTS_H
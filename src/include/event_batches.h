@@ -0,0 +1,233 @@
+#ifndef EVENT_BATCHES_H
+#define EVENT_BATCHES_H
+
+/*!
+\file
+Code for passing period attributed events from a chip analyser to histogramming workers
+*/
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include "shared_types.h"
+#include "spsc_ring.h"
+#include "adaptive_wait.h"
+
+/*!
+\brief Event with period attribution done
+*/
+struct batch_event final {
+    period_type period;         //!< Period number of the event
+    int64_t relative_toaclk;    //!< TOA in clock ticks relative to the start of `period`
+    uint64_t event;             //!< Packed hit (see AsiRawStreamDecoder::packHit)
+};
+
+/*!
+\brief Batch of period attributed events
+*/
+struct event_batch final {
+    std::vector<batch_event> event; //!< Events, capacity is reserved up front
+
+    /*!
+    \brief Constructor
+    \param capacity Maximum number of events in the batch
+    */
+    inline explicit event_batch(size_t capacity)
+    {
+        event.reserve(capacity);
+    }
+
+    /*!
+    \brief Query for full batch
+    \return True if no more events fit without reallocation
+    */
+    [[gnu::pure]]
+    inline bool full() const noexcept
+    {
+        return event.size() == event.capacity();
+    }
+};
+
+/*!
+\brief Batch transport between one chip analyser (producer) and one histogramming worker (consumer)
+
+Like `io_buffer_ring`, full batches travel through one `spsc_ring`, and emptied batches
+come back through another one. The consumer counts processed batches, so the producer
+can wait until the worker is idle (see `drain()`). Both sides wait adaptively (see adaptive_wait.h).
+*/
+struct batch_channel final {
+    spsc_ring<std::unique_ptr<event_batch>> full;   //!< Batches for the worker
+    spsc_ring<std::unique_ptr<event_batch>> free;   //!< Batches processed by the worker
+    alignas(64) std::atomic<uint64_t> processed = 0;//!< Number of batches processed by the worker
+    std::atomic<bool> no_more_batches = false;      //!< Flag for "no more batches are coming"
+    alignas(64) uint64_t dispatched = 0;            //!< Number of batches dispatched to the worker (producer only)
+    adaptive_wait::wait_point filled;               //!< Signal dispatched batches and `no_more_batches`, the worker waits here
+    adaptive_wait::wait_point freed;                //!< Signal processed batches, the producer waits here
+
+    /*!
+    \brief Constructor
+    \param num_batches  Number of batches in flight, rounded up to a power of two
+    \param batch_size   Number of events per batch
+    */
+    inline batch_channel(size_t num_batches, size_t batch_size)
+        : full{num_batches}, free{num_batches}
+    {
+        for (size_t i=0; i<free.capacity(); i++)
+            free.try_push(std::unique_ptr<event_batch>(new event_batch{batch_size}));
+    }
+
+    /*!
+    \brief Producer side: get an empty batch, wait for the worker if none is available
+    \return Empty batch
+    */
+    inline std::unique_ptr<event_batch> get_empty()
+    {
+        std::unique_ptr<event_batch> batch;
+        freed.await([this, &batch]() { return free.try_pop(batch); });
+        batch->event.clear();
+        return batch;
+    }
+
+    /*!
+    \brief Producer side: pass batch to the worker
+    \param batch Will be moved into the full ring
+    */
+    inline void dispatch(std::unique_ptr<event_batch>&& batch)
+    {
+        full.try_push(std::move(batch));    // never fails, there are only as many batches as ring slots
+        dispatched++;
+        filled.notify();
+    }
+
+    /*!
+    \brief Producer side: wait until the worker has processed all dispatched batches
+    */
+    inline void drain()
+    {
+        freed.await([this]() { return processed.load(std::memory_order_acquire) == dispatched; });
+    }
+
+    /*!
+    \brief Consumer side: get a batch
+    \return Batch with events, nullptr if no more batches are coming
+    */
+    inline std::unique_ptr<event_batch> get_full()
+    {
+        std::unique_ptr<event_batch> batch;
+        filled.await([this, &batch]() {
+            const bool stop = no_more_batches.load(std::memory_order_acquire);
+            return full.try_pop(batch) || stop;
+        });
+        return batch;
+    }
+
+    /*!
+    \brief Consumer side: return processed batch
+    \param batch Will be moved into the free ring
+    */
+    inline void put_empty(std::unique_ptr<event_batch>&& batch)
+    {
+        free.try_push(std::move(batch));
+        processed.fetch_add(1, std::memory_order_release);
+        freed.notify();
+    }
+
+    /*!
+    \brief Producer side: signal that no more batches are coming
+    */
+    inline void finish() noexcept
+    {
+        no_more_batches.store(true, std::memory_order_release);
+        filled.notify();
+    }
+
+    batch_channel(const batch_channel&) = delete;
+    batch_channel(batch_channel&&) = delete;
+    batch_channel& operator=(const batch_channel&) = delete;
+    batch_channel& operator=(batch_channel&&) = delete;
+};
+
+/*!
+\brief Round robin distribution of one chip analyser's events over its histogramming workers
+
+The analyser collects events into the batch under construction. Full batches go to the
+workers in turn, each through its own `batch_channel`, so every worker histograms a disjoint
+part of the events into its own per thread data. The batch under construction comes from the
+channel it is dispatched to next.
+*/
+class batch_dispatcher final {
+    std::vector<std::unique_ptr<batch_channel>> channel;    //!< Per worker batch channel
+    std::unique_ptr<event_batch> current;                   //!< Batch under construction
+    unsigned next = 0;                                      //!< Worker receiving the next batch
+
+public:
+    /*!
+    \brief Constructor
+    \param workers      Number of histogramming workers, at least 1
+    \param num_batches  Number of batches in flight per worker, see `batch_channel`
+    \param batch_size   Number of events per batch
+    */
+    inline batch_dispatcher(unsigned workers, size_t num_batches, size_t batch_size)
+    {
+        for (unsigned i=0; i<workers; i++)
+            channel.emplace_back(new batch_channel{num_batches, batch_size});
+        current = channel[0]->get_empty();
+    }
+
+    /*!
+    \brief Batch channel of a worker, for the worker side
+    \param worker   Worker number
+    \return Batch channel
+    */
+    inline batch_channel& worker(unsigned worker) noexcept
+    {
+        return *channel[worker];
+    }
+
+    /*!
+    \brief Add an event, dispatch the batch if it is full
+    \param ev   Period attributed event
+    */
+    inline void add(const batch_event& ev)
+    {
+        current->event.push_back(ev);
+        if (current->full())
+            dispatch();
+    }
+
+    /*!
+    \brief Pass batch under construction to the next worker
+    */
+    inline void dispatch()
+    {
+        if (current->event.empty())
+            return;
+        auto& ch = *channel[next];
+        if (++next == channel.size())
+            next = 0;
+        ch.dispatch(std::move(current));
+        current = channel[next]->get_empty();
+    }
+
+    /*!
+    \brief Dispatch batch under construction and wait until all workers are idle
+    */
+    inline void drain()
+    {
+        dispatch();
+        for (auto& ch : channel)
+            ch->drain();
+    }
+
+    /*!
+    \brief Signal that no more batches are coming to all workers
+    */
+    inline void finish() noexcept
+    {
+        for (auto& ch : channel)
+            ch->finish();
+    }
+};
+
+#endif // EVENT_BATCHES_H
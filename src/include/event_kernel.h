@@ -0,0 +1,145 @@
+#ifndef EVENT_KERNEL_H
+#define EVENT_KERNEL_H
+
+/*!
+\file
+Per event histogramming operations of the event processing kernels
+*/
+
+#include <cstdint>
+#include "decoder.h"
+#include "pixel_index.h"
+#include "energy_points.h"
+
+/*!
+\brief Per event histogramming operations
+
+The operations are templates specialized for the histogramming mode and the properties
+of the time ROI and the energy point table. The analysis selects one of the specializations
+at init time (see processing.cpp), every specialization must produce the same histogram as the
+generic one when its preconditions hold.
+
+The histogram type `Data` needs the members `TDSpectra`, `BeforeRoi`, `AfterRoi` and `Total` of `xes::Data`.
+*/
+namespace event_kernel {
+
+    using Decode = AsiRawStreamDecoder;     //!< Raw stream decoder object
+
+    static constexpr uint16_t tot_roi_start = 0;        //!< ROI start in terms of TOT
+    static constexpr uint16_t tot_roi_end = 64000;      //!< ROI end in terms of TOT
+
+    /*!
+    \brief Histogram binning parameters
+    */
+    struct binning final {
+        uint64_t start;         //!< ROI start offset in clock ticks relative to interval start
+        uint64_t end;           //!< ROI end offset in clock ticks relative to interval start
+        unsigned shift;         //!< log2(step), only valid if step is a power of two
+        float step_inv;         //!< 1. / step
+        unsigned npoints;       //!< Number of energy points
+
+        /*!
+        \brief Constructor
+        \param tRoiStart    ROI start
+        \param tRoiStep     Bin width, positive
+        \param tRoiN        Number of bins
+        \param nPoints      Number of energy points
+        */
+        inline binning(uint64_t tRoiStart, uint64_t tRoiStep, uint64_t tRoiN, unsigned nPoints) noexcept
+            : start{tRoiStart}, end{tRoiStart + tRoiStep * tRoiN},
+              shift{(unsigned)__builtin_ctzll(tRoiStep)}, step_inv{1.f/tRoiStep}, npoints{nPoints}
+        {}
+    };
+
+    /*!
+    \brief Add one event to histogram
+    TOT must be within (tot_roi_start,tot_roi_end) for this event
+    \tparam SingleEp        Every pixel of the energy point table is unmapped or has a single energy point with weight 1
+    \param data             Histogram
+    \param table            Compact energy point table
+    \param npoints          Number of energy points
+    \param index            Abstract pixel index of event
+    \param TimePoint        Histogram time bin
+    */
+    template<bool SingleEp, typename Data>
+    inline void add(Data& data, const EpTable& table, unsigned npoints, PixelIndex index, int TimePoint) noexcept
+    {
+        const size_t pos = table.position(index);
+        const uint32_t entry = table.entry[pos];
+        if constexpr (SingleEp) {
+            // unmapped pixels have entry 0
+            if (__builtin_expect(entry != 0, 1))
+                data.TDSpectra[TimePoint * npoints + (entry & ~EpTable::single)] += 1;
+            return;
+        }
+        if (__builtin_expect(entry & EpTable::single, 1)) {
+            data.TDSpectra[TimePoint * npoints + (entry & ~EpTable::single)] += 1;
+            return;
+        }
+
+        // multi part pixels, this loop used to take most of the histogramming time
+        for (uint32_t part = table.offset[pos]; part < table.offset[pos + 1]; part++)
+            data.TDSpectra[TimePoint * npoints + table.energy_point[part]] += table.weight[part];
+    }
+
+    /*!
+    \brief Analyse event and add it to histogram if appropriate
+
+    In TOT mode the TOT value is binned with the time ROI parameters instead of the TOA.
+
+    \tparam TOAMode         Histogram TOA (true) or TOT (false)
+    \tparam SingleEp        See add()
+    \tparam Pow2Step        The bin width is a power of two, bins are computed with a shift
+    \param data             Histogram
+    \param table            Compact energy point table
+    \param bins             Binning parameters
+    \param index            Abstract pixel index of event
+    \param reltoa           Event TOA relative to period interval start
+    \param tot              Event TOT value
+    */
+    template<bool TOAMode, bool SingleEp, bool Pow2Step, typename Data>
+    inline void analyse(Data& data, const EpTable& table, const binning& bins, PixelIndex index, int64_t reltoa, int64_t tot) noexcept
+    {
+        data.Total++;
+
+        const uint64_t FullToA = TOAMode ? reltoa : tot;
+
+        if (FullToA < bins.start) {
+            data.BeforeRoi++;
+        } else if (FullToA >= bins.end) {
+            data.AfterRoi++;
+        } else if ((tot > tot_roi_start) && (tot < tot_roi_end)) {
+            // not ideal here. Does not work if tot step is not 1
+            const uint64_t offset = FullToA - bins.start;
+            int TP;
+            if constexpr (Pow2Step)
+                TP = static_cast<int>(offset >> bins.shift);
+            else
+                TP = static_cast<int>(offset * bins.step_inv);
+            add<SingleEp>(data, table, bins.npoints, index, TP);
+        }
+    }
+
+    /*!
+    \brief Decode packed hit and analyse it
+    \tparam TOAMode         See analyse()
+    \tparam SingleEp        See add()
+    \tparam Pow2Step        See analyse()
+    \param data             Histogram
+    \param table            Compact energy point table
+    \param bins             Binning parameters
+    \param chipIndex        Chip that detected the event
+    \param relative_toaclk  Event TOA in clock ticks relative to period interval start
+    \param event            Packed hit, see `Decode::packHit()`
+    */
+    template<bool TOAMode, bool SingleEp, bool Pow2Step, typename Data>
+    inline void process(Data& data, const EpTable& table, const binning& bins, unsigned chipIndex, int64_t relative_toaclk, uint64_t event) noexcept
+    {
+        const uint64_t totclk = Decode::hitTot(event);
+        const unsigned flat_pixel = Decode::hitPixel(event);
+        analyse<TOAMode, SingleEp, Pow2Step>(data, table, bins, PixelIndex::from(chipIndex, flat_pixel), relative_toaclk, totclk);
+    }
+
+} // namespace event_kernel
+
+#endif // EVENT_KERNEL_H
@@ -14,12 +14,12 @@ Code for event reordering based on event TOA
 */
 struct reordering_element final {
     int64_t toa;    //!< TOA is the reordering priority
-    uint64_t event; //!< Raw event
+    uint64_t event; //!< Packed hit (see AsiRawStreamDecoder::packHit)
 
     /*!
     \brief Constructor
     \param toa_     TOA of event that participated in reordering
-    \param event_   Raw event that participated in reordering
+    \param event_   Packed hit that participated in reordering
     */
     inline reordering_element(int64_t toa_, uint64_t event_) noexcept
         : toa{toa_}, event{event_}
@@ -0,0 +1,224 @@
+#ifndef HISTOGRAM_REDUCTION_H
+#define HISTOGRAM_REDUCTION_H
+
+/*!
+\file
+Code for summing up partial histograms into one
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*!
+\brief Histogram reduction functionality
+*/
+namespace histogram_reduction {
+
+    constexpr std::size_t block_size = 2048;    //!< Number of bins reduced in one go, 8KiB of int bins so all blocks stay in L1
+
+    /*!
+    \brief Sum up a range of bins of partial histograms and clear those bins in the partial histograms
+
+    The destination bins are overwritten, not added to.
+    Work proceeds in blocks of `block_size` bins, so each source block is read and cleared
+    while it is in cache, and the destination block stays in cache across all sources.
+    The inner loops have no aliasing and vectorize.
+
+    \tparam T Bin type
+    \param dst      Destination histogram
+    \param src      Partial histograms
+    \param num_src  Number of partial histograms, at least 1
+    \param begin    First bin
+    \param end      One after last bin
+    */
+    template<typename T>
+    inline void sum_and_clear(T* __restrict dst, T* const* src, std::size_t num_src, std::size_t begin, std::size_t end) noexcept
+    {
+        for (std::size_t b=begin; b<end; b+=block_size) {
+            const std::size_t n = std::min(block_size, end - b);
+            T* __restrict d = dst + b;
+            {
+                T* __restrict s = src[0] + b;
+                for (std::size_t i=0; i<n; i++) {
+                    d[i] = s[i];
+                    s[i] = T{};
+                }
+            }
+            for (std::size_t k=1; k<num_src; k++) {
+                T* __restrict s = src[k] + b;
+                for (std::size_t i=0; i<n; i++) {
+                    d[i] += s[i];
+                    s[i] = T{};
+                }
+            }
+        }
+    }
+
+    /*!
+    \brief Split bins into parts of about equal size on block boundaries
+    \param size         Number of bins
+    \param num_parts    Number of parts, at least 1
+    \param part         Part number
+    \param begin        Output: first bin of `part`
+    \param end          Output: one after last bin of `part`
+    */
+    inline void part_range(std::size_t size, unsigned num_parts, unsigned part, std::size_t& begin, std::size_t& end) noexcept
+    {
+        const std::size_t num_blocks = (size + block_size - 1) / block_size;
+        begin = std::min(size, (num_blocks * part / num_parts) * block_size);
+        end = std::min(size, (num_blocks * (part + 1) / num_parts) * block_size);
+    }
+
+    /*!
+    \brief Small pool of helper threads for `sum_and_clear()` on large histograms
+
+    The calling thread reduces the first part itself, helper `i` reduces part `i + 1`.
+    Only one thread may call `run()`.
+    */
+    template<typename T>
+    class pool final {
+        std::vector<std::thread> helper;    //!< Helper threads
+        std::mutex lock;                    //!< Protect the job description below
+        std::condition_variable start;      //!< Signal new job to helpers
+        std::condition_variable done;       //!< Signal job part completion to the caller
+        unsigned generation = 0;            //!< Job number
+        unsigned busy = 0;                  //!< Number of helpers still working on the current job
+        bool stop = false;                  //!< Stop helper threads
+
+        T* dst = nullptr;                   //!< Job: destination histogram
+        T* const* src = nullptr;            //!< Job: partial histograms
+        std::size_t num_src = 0;            //!< Job: number of partial histograms
+        std::size_t size = 0;               //!< Job: number of bins
+
+        /*!
+        \brief Reduce one part of the current job
+        \param part Part number
+        */
+        inline void reduce(unsigned part) noexcept
+        {
+            std::size_t b, e;
+            part_range(size, helper.size() + 1, part, b, e);
+            sum_and_clear(dst, src, num_src, b, e);
+        }
+
+        /*!
+        \brief Helper thread main loop
+        \param part Part number of this helper
+        */
+        inline void serve(unsigned part)
+        {
+            unsigned seen = 0;
+            while (true) {
+                {
+                    std::unique_lock guard(lock);
+                    start.wait(guard, [this, seen]{ return stop || generation != seen; });
+                    if (stop)
+                        return;
+                    seen = generation;
+                }
+                reduce(part);
+                bool last;
+                {
+                    std::unique_lock guard(lock);
+                    last = (--busy == 0);
+                }
+                if (last)
+                    done.notify_one();
+            }
+        }
+
+      public:
+        /*!
+        \brief Minimum number of bins per part, smaller histograms are not worth splitting
+        */
+        static constexpr std::size_t min_part_size = 1ul << 18;
+
+        /*!
+        \brief Reasonable number of helpers for a histogram
+        \param size        Number of bins
+        \param max_helpers Upper limit
+        \return Number of helper threads
+        */
+        [[gnu::const]]
+        static constexpr unsigned helpers_for(std::size_t size, unsigned max_helpers) noexcept
+        {
+            const std::size_t parts = size / min_part_size;
+            return (parts > 1) ? (unsigned)std::min<std::size_t>(parts - 1, max_helpers) : 0;
+        }
+
+        /*!
+        \brief Constructor
+        \param num_helpers Number of helper threads, 0 for reducing on the calling thread only
+        */
+        inline explicit pool(unsigned num_helpers)
+        {
+            helper.reserve(num_helpers);
+            for (unsigned i=0; i<num_helpers; i++)
+                helper.emplace_back([this, i]{ serve(i + 1); });
+        }
+
+        pool(const pool&) = delete;
+        pool(pool&&) = delete;
+        pool& operator=(const pool&) = delete;
+        pool& operator=(pool&&) = delete;
+
+        /*!
+        \brief Destructor, stops helper threads
+        */
+        inline ~pool()
+        {
+            {
+                std::unique_lock guard(lock);
+                stop = true;
+            }
+            start.notify_all();
+            for (auto& h : helper)
+                h.join();
+        }
+
+        /*!
+        \brief Number of helper threads
+        \return Number of helpers
+        */
+        [[gnu::pure]]
+        inline std::size_t helpers() const noexcept
+        {
+            return helper.size();
+        }
+
+        /*!
+        \brief Sum up and clear partial histograms, see `sum_and_clear()`
+        \param dst_    Destination histogram
+        \param src_    Partial histograms
+        \param num_    Number of partial histograms, at least 1
+        \param size_   Number of bins
+        */
+        inline void run(T* dst_, T* const* src_, std::size_t num_, std::size_t size_)
+        {
+            if (helper.empty()) {
+                sum_and_clear(dst_, src_, num_, 0, size_);
+                return;
+            }
+            {
+                std::unique_lock guard(lock);
+                dst = dst_;
+                src = src_;
+                num_src = num_;
+                size = size_;
+                busy = helper.size();
+                generation++;
+            }
+            start.notify_all();
+            reduce(0);
+            std::unique_lock guard(lock);
+            done.wait(guard, [this]{ return busy == 0; });
+        }
+    };
+
+} // namespace histogram_reduction
+
+#endif // HISTOGRAM_REDUCTION_H
@@ -9,10 +9,19 @@ Code for buffering incoming IO
 #include <atomic>
 #include <vector>
 #include <map>
+#include <memory>
+#include <thread>
+#include <cassert>
 #include "spin_lock.h"
+#include "spsc_ring.h"
+#include "adaptive_wait.h"
+#include "io_slabs.h"
 
 /*!
 \brief Buffer for holding partial raw stream chunk data
+
+In slab receive mode the buffer holds no content of its own, but is a view
+into an `io_slab` covering a whole raw stream chunk.
 */
 struct io_buffer final {
     inline static std::atomic<unsigned> next_id;    //!< Buffer id for next buffer
@@ -20,8 +29,47 @@ struct io_buffer final {
     size_t content_offset = 0;                      //!< Content offset within raw event data packet chunk
     size_t content_size = 0;                        //!< Content size in number of bytes
     size_t chunk_size = 0;                          //!< Raw data event packet chunk size in number of bytes
+    const char* view = nullptr;                     //!< Content start within `slab`, nullptr if the content is in `content`
+    io_slab* slab = nullptr;                        //!< Slab referenced by a view
+    uint64_t arrival = 0;                           //!< Receive time stamp for latency tracing (see latency_trace.h), 0 if not traced
     unsigned id;                                    //!< Id of this buffer
 
+    /*!
+    \brief Get content
+    \return Pointer to the first content byte
+    */
+    [[gnu::pure]]
+    inline const char* data() const noexcept
+    {
+        return view ? view : content.data();
+    }
+
+    /*!
+    \brief Turn this buffer into a view into a slab
+    \param s       Slab, a reference will be added
+    \param offset  View start offset within the slab
+    \param size    View size in bytes
+    */
+    inline void set_view(io_slab& s, size_t offset, size_t size) noexcept
+    {
+        s.acquire();
+        slab = &s;
+        view = s.data + offset;
+        content_size = size;
+    }
+
+    /*!
+    \brief Drop the slab reference of a view
+    */
+    inline void release_view() noexcept
+    {
+        if (slab) {
+            slab->release();
+            slab = nullptr;
+            view = nullptr;
+        }
+    }
+
     /*!
     \brief Constructor
     \param sz IO buffer size in bytes
@@ -50,41 +98,43 @@ struct io_buffer_pool final {
     the their associated chunk number.
 
     Since keys are sorted, the begin of the multimap contains the first seen piece of the oldest chunk in the pool.
+    Multimap nodes are extracted and reinserted instead of being freed and allocated for every buffer.
     */
     using buffer_type = std::multimap<uint64_t, std::unique_ptr<io_buffer>>;
 
     using element_type = buffer_type::value_type;   //!< Alias for multimap element type
     buffer_type buffer;                             //!< The collection of IO buffers
+    std::vector<buffer_type::node_type> spare_nodes;//!< Empty multimap nodes for reuse, protected by `mb_lock`
     std::vector<std::unique_ptr<io_buffer>> free_list;//!< Empty IO buffers for reuse
     spin_lock::type mb_lock{spin_lock::init};       //!< Protect multimap with buffers
     spin_lock::type fl_lock{spin_lock::init};       //!< Protect `free_list`
     bool no_more_data = false;                      //!< Flag for "no more data is coming"
+    adaptive_wait::wait_point filled;               //!< Signal new buffers and `no_more_data`
 
     /*!
     \brief Get a buffer with some valid content
 
-    Block on `ready_for_reading` condvar if there are no IO buffers (`buffer` is empty) and
+    Wait on `filled` if there are no IO buffers (`buffer` is empty) and
     more data is expected (`no_more_data` is false).
 
     \return Pair of (chunk number, buffer pointer). If no data is coming, the buffer pointer is the nullptr.
     */
     inline element_type get_nonempty_buffer()
     {
-        bool empty = false;
-        bool stop = false;
-        buffer_type::node_type node;
-        do {
-            {
-                spin_lock lock(mb_lock);
-                stop = no_more_data;
-                if (!(empty = buffer.empty()))
-                    node = std::move(buffer.extract(std::begin(buffer)));
-            }
-            if (! empty)
-                return {node.key(), std::move(node.mapped())};
-        } while (! stop);
-        return {0, nullptr};
-    }   
+        uint64_t key = 0;
+        std::unique_ptr<io_buffer> buf;
+        filled.await([this, &key, &buf]() {
+            spin_lock lock(mb_lock);
+            if (buffer.empty())
+                return no_more_data;
+            auto node = buffer.extract(std::begin(buffer));
+            key = node.key();
+            buf = std::move(node.mapped());
+            spare_nodes.push_back(std::move(node));
+            return true;
+        });
+        return {key, std::move(buf)};
+    }
 
     /*!
     \brief Put a used buffer back to the `free_list`
@@ -98,6 +148,9 @@ struct io_buffer_pool final {
 
     /*!
     \brief Get an empty buffer from the `free_list`, or create a new one
+
+    New buffers are only created if the consumer falls behind by more than the preallocated buffers.
+
     \return Smart pointer to empty IO buffer ready for filling up
     */
     inline std::unique_ptr<io_buffer> get_empty_buffer()
@@ -123,8 +176,19 @@ struct io_buffer_pool final {
     */
     inline void put_nonempty_buffer(element_type&& element)
     {
-        spin_lock lock(mb_lock);
-        buffer.insert(std::move(element));
+        {
+            spin_lock lock(mb_lock);
+            if (spare_nodes.empty()) {
+                buffer.insert(std::move(element));
+            } else {
+                auto node = std::move(spare_nodes.back());
+                spare_nodes.pop_back();
+                node.key() = element.first;
+                node.mapped() = std::move(element.second);
+                buffer.insert(std::move(node));
+            }
+        }
+        filled.notify();
     }
 
     /*!
@@ -132,21 +196,171 @@ struct io_buffer_pool final {
     */
     inline void finish_writing()
     {
-        spin_lock lock(mb_lock);
-        no_more_data = true;
+        {
+            spin_lock lock(mb_lock);
+            no_more_data = true;
+        }
+        filled.notify();
+    }
+
+    /*!
+    \brief Signal that no more buffers will be consumed
+    Nothing to do here, `get_empty_buffer()` never waits for the consumer.
+    */
+    inline void finish_reading() noexcept
+    {}
+
+    /*!
+    \brief Constructor
+    \param num_buffers Number of IO buffers put on the `free_list` up front, with as many spare multimap nodes
+    \param buf_size    IO buffer size in bytes
+    */
+    inline explicit io_buffer_pool(size_t num_buffers=0, size_t buf_size=buffer_size)
+    {
+        buffer_size = buf_size;
+        free_list.reserve(num_buffers);
+        spare_nodes.reserve(num_buffers);
+        for (size_t i=0; i<num_buffers; i++) {
+            free_list.emplace_back(new io_buffer{buf_size});
+            spare_nodes.push_back(buffer.extract(buffer.emplace(0, nullptr)));
+        }
     }
 
-    io_buffer_pool() = default;
     io_buffer_pool(const io_buffer_pool&) = delete;
     io_buffer_pool(io_buffer_pool&&) = delete;
     io_buffer_pool& operator=(const io_buffer_pool&) = delete;
     io_buffer_pool& operator=(io_buffer_pool&&) = delete;
 };
 
+/*!
+\brief Bounded pool of IO buffers for exactly one producer and one consumer thread
+
+Alternative to `io_buffer_pool` with the same interface. All IO buffers are allocated
+by the constructor and circulate between two `spsc_ring`s:
+- the full ring transports filled buffers from the reader to the analyser thread
+- the free ring returns consumed buffers from the analyser to the reader thread
+
+There is no reordering by packet number. The single reader thread pushes the pieces
+of a chip's raw event data packet chunks in stream order, which is also packet number order.
+
+If all buffers are in use, `get_empty_buffer()` waits until the consumer returns one.
+Both sides wait adaptively (see adaptive_wait.h).
+*/
+struct io_buffer_ring final {
+    using element_type = std::pair<uint64_t, std::unique_ptr<io_buffer>>;  //!< (packet number, buffer) pair
+    spsc_ring<element_type> full;                       //!< Filled buffers, reader -> analyser
+    spsc_ring<std::unique_ptr<io_buffer>> free;         //!< Empty buffers, analyser -> reader
+    std::atomic<bool> no_more_data = false;             //!< Flag for "no more data is coming"
+    std::atomic<bool> no_more_reading = false;          //!< Flag for "no more buffers are consumed"
+    uint64_t last_packet = 0;                           //!< Packet number of last pushed buffer (producer only)
+    adaptive_wait::wait_point filled;                   //!< Signal new full buffers and `no_more_data`
+    adaptive_wait::wait_point freed;                    //!< Signal returned buffers and `no_more_reading`
+
+    /*!
+    \brief Constructor
+    \param num_buffers Number of preallocated IO buffers, rounded up to a power of two
+    \param buf_size    IO buffer size in bytes
+    */
+    inline explicit io_buffer_ring(size_t num_buffers, size_t buf_size=io_buffer_pool::buffer_size)
+        : full{num_buffers}, free{num_buffers}
+    {
+        for (size_t i=0; i<free.capacity(); i++)
+            free.try_push(std::unique_ptr<io_buffer>(new io_buffer{buf_size}));
+    }
+
+    /*!
+    \brief Get a buffer with some valid content
+
+    Wait for the full ring while more data is expected.
+
+    \return Pair of (chunk number, buffer pointer). If no data is coming, the buffer pointer is the nullptr.
+    */
+    inline element_type get_nonempty_buffer()
+    {
+        element_type element{0, nullptr};
+        filled.await([this, &element]() {
+            const bool stop = no_more_data.load(std::memory_order_acquire);
+            return full.try_pop(element) || stop;
+        });
+        return element;
+    }
+
+    /*!
+    \brief Return a used buffer to the reader
+    \param buf Will be moved into the free ring
+    */
+    inline void put_empty_buffer(std::unique_ptr<io_buffer>&& buf)
+    {
+        [[maybe_unused]] const bool ok = free.try_push(std::move(buf));
+        assert(ok);     // there are never more buffers than free ring slots
+        freed.notify();
+    }
+
+    /*!
+    \brief Get an empty buffer, wait for the consumer if none is available
+    \return Smart pointer to empty IO buffer ready for filling up, nullptr if the consumer has stopped
+    */
+    inline std::unique_ptr<io_buffer> get_empty_buffer()
+    {
+        std::unique_ptr<io_buffer> res;
+        freed.await([this, &res]() {
+            const bool stop = no_more_reading.load(std::memory_order_acquire);
+            return free.try_pop(res) || stop;
+        });
+        if (res)
+            res->content_size = 0;
+        return res;
+    }
+
+    /*!
+    \brief Pass full buffer to the consumer
+    \param element Will be moved into the full ring
+    */
+    inline void put_nonempty_buffer(element_type&& element)
+    {
+        assert(element.first >= last_packet);   // SERVAL sends a chip's packets in order
+        last_packet = element.first;
+        [[maybe_unused]] const bool ok = full.try_push(std::move(element));
+        assert(ok);     // there are never more buffers than full ring slots
+        filled.notify();
+    }
+
+    /*!
+    \brief Signal that no more data is coming
+    */
+    inline void finish_writing() noexcept
+    {
+        no_more_data.store(true, std::memory_order_release);
+        filled.notify();
+    }
+
+    /*!
+    \brief Signal that no more buffers will be consumed
+    Makes a waiting `get_empty_buffer()` return nullptr.
+    */
+    inline void finish_reading() noexcept
+    {
+        no_more_reading.store(true, std::memory_order_release);
+        freed.notify();
+    }
+
+    io_buffer_ring(const io_buffer_ring&) = delete;
+    io_buffer_ring(io_buffer_ring&&) = delete;
+    io_buffer_ring& operator=(const io_buffer_ring&) = delete;
+    io_buffer_ring& operator=(io_buffer_ring&&) = delete;
+};
+
 /*!
 \brief Collection of IO buffer pools
 There's one buffer per detector chip.
+\tparam Pool IO buffer pool type, `io_buffer_pool` or `io_buffer_ring`
+*/
+template<typename Pool>
+using buffer_pool_collection = std::vector<std::unique_ptr<Pool>>;
+
+/*!
+\brief Collection of multimap based IO buffer pools
 */
-using io_buffer_pool_collection = std::vector<std::unique_ptr<io_buffer_pool>>;
+using io_buffer_pool_collection = buffer_pool_collection<io_buffer_pool>;
 
 #endif // IO_BUFFERS_H
@@ -0,0 +1,241 @@
+#ifndef IO_SLABS_H
+#define IO_SLABS_H
+
+/*!
+\file
+Code for receiving the raw stream into large reference counted memory slabs
+*/
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cassert>
+#include <sys/mman.h>
+#include "spin_lock.h"
+#include "adaptive_wait.h"
+
+class io_slab_pool;
+
+/*!
+\brief Large contiguous receive buffer
+
+The raw event data stream is received into slabs without splitting it up.
+Per chip views (see `io_buffer`) point into the slab and hold a reference.
+When the last reference is dropped, the slab goes back to its pool.
+*/
+struct io_slab final {
+    char* data = nullptr;               //!< Slab memory
+    size_t capacity = 0;                //!< Slab size in bytes
+    size_t carry = 0;                   //!< Bytes at the start that were copied over from the previous slab
+    size_t fill = 0;                    //!< Number of valid bytes
+    bool huge = false;                  //!< Memory is backed by explicit huge pages
+    std::atomic<unsigned> refs = 0;     //!< Reference count
+    io_slab_pool* owner = nullptr;      //!< Slab pool this slab belongs to
+
+    /*!
+    \brief Add a reference
+    */
+    inline void acquire() noexcept
+    {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*!
+    \brief Drop a reference, the last reference returns the slab to its pool
+    */
+    inline void release() noexcept;
+
+    io_slab() = default;
+    io_slab(const io_slab&) = delete;
+    io_slab(io_slab&&) = delete;
+    io_slab& operator=(const io_slab&) = delete;
+    io_slab& operator=(io_slab&&) = delete;
+
+    /*!
+    \brief Destructor, unmaps slab memory
+    */
+    inline ~io_slab()
+    {
+        if (data)
+            munmap(data, capacity);
+    }
+};
+
+/*!
+\brief Fixed set of slabs shared by one reader and all analyser threads
+
+Slabs are requested by the reader thread only. They are released by whoever drops the last
+reference, which might be any analyser thread, so the free list is protected by a spin lock.
+That lock is taken once per slab, not once per raw event data packet chunk.
+*/
+class io_slab_pool final {
+    std::vector<std::unique_ptr<io_slab>> slabs;    //!< All slabs
+    std::vector<io_slab*> free_list;                //!< Slabs ready for reuse
+    spin_lock::type fl_lock{spin_lock::init};       //!< Protect `free_list`
+    adaptive_wait::wait_point released;             //!< Signal slabs returned to `free_list`
+
+    /*!
+    \brief Map anonymous memory for a slab
+
+    Explicit huge pages are tried first if the size is a multiple of the huge page size,
+    otherwise transparent huge pages are requested.
+
+    \param slab Slab object to map memory for, `capacity` must be set
+    \throw std::bad_alloc if no memory can be mapped
+    */
+    static void map(io_slab& slab)
+    {
+        void* mem = MAP_FAILED;
+        #ifdef MAP_HUGETLB
+            if ((slab.capacity % huge_page_size) == 0) {
+                mem = mmap(nullptr, slab.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                slab.huge = (mem != MAP_FAILED);
+            }
+        #endif
+        if (mem == MAP_FAILED) {
+            mem = mmap(nullptr, slab.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+                throw std::bad_alloc{};
+            #ifdef MADV_HUGEPAGE
+                madvise(mem, slab.capacity, MADV_HUGEPAGE);
+            #endif
+        }
+        slab.data = static_cast<char*>(mem);
+    }
+
+  public:
+    static constexpr size_t huge_page_size = 2ul << 20;     //!< Assumed explicit huge page size
+    static constexpr size_t page_size = 4096;               //!< Slab sizes are multiples of this
+    static constexpr size_t min_size = 128ul << 10;         //!< Minimum slab size, must hold the biggest chunk (16 bit size) plus header
+
+    /*!
+    \brief Round slab size to a usable value
+    \param size Requested slab size in bytes
+    \return Size rounded up to `min_size` and a multiple of `page_size`
+    */
+    [[gnu::const]]
+    static constexpr size_t slab_size(size_t size) noexcept
+    {
+        if (size < min_size)
+            size = min_size;
+        return (size + page_size - 1) & ~(page_size - 1);
+    }
+
+    /*!
+    \brief Constructor
+    \param num_slabs Number of slabs, at least 2
+    \param size      Slab size in bytes, see `slab_size()`
+    */
+    io_slab_pool(size_t num_slabs, size_t size)
+    {
+        if (num_slabs < 2)
+            num_slabs = 2;
+        size = slab_size(size);
+        slabs.reserve(num_slabs);
+        free_list.reserve(num_slabs);
+        for (size_t i=0; i<num_slabs; i++) {
+            slabs.emplace_back(new io_slab{});
+            auto& slab = *slabs.back();
+            slab.capacity = size;
+            slab.owner = this;
+            map(slab);
+            free_list.push_back(&slab);
+        }
+    }
+
+    io_slab_pool(const io_slab_pool&) = delete;
+    io_slab_pool(io_slab_pool&&) = delete;
+    io_slab_pool& operator=(const io_slab_pool&) = delete;
+    io_slab_pool& operator=(io_slab_pool&&) = delete;
+    ~io_slab_pool() = default;
+
+    /*!
+    \brief Get a free slab
+    \return Slab holding one reference for the caller, or nullptr if none is free
+    */
+    inline io_slab* try_get() noexcept
+    {
+        io_slab* slab = nullptr;
+        {
+            spin_lock lock{fl_lock};
+            if (free_list.empty())
+                return nullptr;
+            slab = free_list.back();
+            free_list.pop_back();
+        }
+        slab->carry = slab->fill = 0;
+        slab->refs.store(1, std::memory_order_relaxed);
+        return slab;
+    }
+
+    /*!
+    \brief Get a free slab, wait if there is none
+    \tparam Stop    Stop condition type, callable returning bool
+    \param stop     Stop waiting if this returns true
+    \return Slab holding one reference for the caller, or nullptr if `stop` returned true
+    */
+    template<typename Stop>
+    inline io_slab* get(Stop&& stop)
+    {
+        io_slab* slab = nullptr;
+        released.await([this, &slab, &stop]() {
+            return ((slab = try_get()) != nullptr) || stop();
+        });
+        return slab;
+    }
+
+    /*!
+    \brief Return slab to the free list
+    \param slab Slab without references
+    */
+    inline void put(io_slab* slab) noexcept
+    {
+        {
+            spin_lock lock{fl_lock};
+            free_list.push_back(slab);
+        }
+        released.notify();
+    }
+
+    /*!
+    \brief Number of slabs
+    \return Number of slabs in this pool
+    */
+    [[gnu::pure]]
+    inline size_t size() const noexcept
+    {
+        return slabs.size();
+    }
+
+    /*!
+    \brief Slab size
+    \return Size in bytes of each slab
+    */
+    [[gnu::pure]]
+    inline size_t capacity() const noexcept
+    {
+        return slabs.front()->capacity;
+    }
+
+    /*!
+    \brief Query explicit huge page backing
+    \return True if all slabs are backed by explicit huge pages
+    */
+    [[gnu::pure]]
+    inline bool huge() const noexcept
+    {
+        for (const auto& slab : slabs)
+            if (! slab->huge)
+                return false;
+        return true;
+    }
+};
+
+inline void io_slab::release() noexcept
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        owner->put(this);
+}
+
+#endif // IO_SLABS_H
@@ -0,0 +1,516 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+/*!
+\file
+Provide optional per period latency tracing from raw data arrival to written output
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "shared_types.h"
+
+/*!
+\brief Per period latency tracing
+
+Every thread of the pipeline stamps period milestones into its own `ring`, so stamping
+costs a clock read and a few stores without any synchronization. The rings are only read
+after all threads have stopped, by `tracer::analyse()`, `tracer::report()` and
+`tracer::write_chrome()`. A ring keeps the latest `capacity` stamps of its thread.
+
+Stamps are keyed by period number. An output period (a save point of the XES data manager)
+is identified with the last period it covers, so its end to end latency runs from the arrival
+of the first bytes of that period to the `written` stamp of the aggregate+write thread.
+*/
+namespace latency_trace {
+
+    /*!
+    \brief Period milestones
+    */
+    enum stage : uint32_t {
+        received,       //!< Raw bytes holding the first event of the period were received by a reader thread
+        first_event,    //!< Analyser saw the first event of the period
+        tdc,            //!< Analyser registered the TDC ending the period
+        returned,       //!< Analyser returned the per thread histogram of an output period
+        aggregated,     //!< Aggregate+write thread summed up the output period
+        written,        //!< Aggregate+write thread wrote the output period
+        slot_wait,      //!< Histogramming thread started to wait for a free period data slot
+        slot_wait_end,  //!< Histogramming thread got a period data slot
+        num_stages      //!< Number of stages
+    };
+
+    /*!
+    \brief Stage names, indexed by stage
+    */
+    inline constexpr const char* stage_name[num_stages] = {
+        "received", "first event", "tdc", "returned", "aggregated", "written", "slot wait", "slot wait end"
+    };
+
+    /*!
+    \brief Trace clock
+    \return Monotonic time in nanoseconds
+    */
+    inline uint64_t now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /*!
+    \brief Time stamp of a period milestone
+    */
+    struct entry final {
+        uint64_t ns;        //!< Time stamp, see now()
+        period_type period; //!< Period
+        uint32_t what;      //!< Stage
+        uint32_t thread;    //!< Chip or analysis thread number (chip number * workers per chip + worker number)
+    };
+
+    /*!
+    \brief Time stamp ring of a single thread
+    */
+    class ring final {
+        std::unique_ptr<entry[]> data;  //!< Time stamps
+        const uint64_t mask;            //!< Capacity - 1
+        uint64_t next = 0;              //!< Number of stamps so far
+
+        /*!
+        \brief Round up to a power of two
+        \param n Minimum value
+        \return Smallest power of two not less than `n`, at least 2
+        */
+        static constexpr uint64_t pow2(uint64_t n) noexcept
+        {
+            uint64_t p = 2;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+
+    public:
+        /*!
+        \brief Constructor
+        \param capacity Number of stamps to keep, rounded up to a power of two
+        */
+        explicit ring(size_t capacity)
+            : data{new entry[pow2(capacity)]}, mask{pow2(capacity) - 1}
+        {}
+
+        ring(const ring&) = delete;
+        ring(ring&&) = delete;
+        ring& operator=(const ring&) = delete;
+        ring& operator=(ring&&) = delete;
+
+        /*!
+        \brief Writer side: stamp a milestone, overwriting the oldest stamp if the ring is full
+        \param what     Stage
+        \param period   Period
+        \param thread   Chip or analysis thread number
+        \param ns       Time stamp
+        */
+        inline void stamp(stage what, period_type period, uint32_t thread, uint64_t ns=now()) noexcept
+        {
+            data[next & mask] = {ns, period, what, thread};
+            next++;
+        }
+
+        /*!
+        \brief Capacity
+        \return Maximum number of stamps kept
+        */
+        inline size_t capacity() const noexcept
+        {
+            return mask + 1;
+        }
+
+        /*!
+        \brief Number of stamps kept
+        \return Number of stamps, at most `capacity()`
+        */
+        inline size_t size() const noexcept
+        {
+            return std::min<uint64_t>(next, mask + 1);
+        }
+
+        /*!
+        \brief Number of stamps lost
+        \return Number of stamps overwritten by newer ones
+        */
+        inline uint64_t overwritten() const noexcept
+        {
+            return next - size();
+        }
+
+        /*!
+        \brief Visit the kept stamps, oldest first, after the writing thread stopped
+        \param f Function called with `const entry&`
+        */
+        template<typename Function>
+        void visit(Function&& f) const
+        {
+            for (uint64_t i=next-size(); i<next; i++)
+                f(data[i & mask]);
+        }
+    };
+
+    /*!
+    \brief Latency histogram with logarithmic buckets of linear sub buckets (HDR histogram style)
+
+    Values below 2^sub_bits are counted exactly, larger values with a relative error below 2^-sub_bits.
+    */
+    class histogram final {
+    public:
+        static constexpr unsigned sub_bits = 5;                 //!< Precision in bits
+        static constexpr uint64_t sub_count = 1u << sub_bits;   //!< Sub buckets per power of two
+
+    private:
+        std::vector<uint64_t> bins;     //!< Bucket counts
+        uint64_t n = 0;                 //!< Number of values
+        uint64_t lowest = std::numeric_limits<uint64_t>::max(); //!< Smallest value
+        uint64_t highest = 0;           //!< Largest value
+        double sum = .0;                //!< Sum of values
+
+    public:
+        /*!
+        \brief Bucket of a value
+        \param v Value
+        \return Bucket index
+        */
+        static constexpr size_t index(uint64_t v) noexcept
+        {
+            if (v < sub_count)
+                return v;
+            const unsigned shift = (63 - __builtin_clzll(v)) - sub_bits;
+            return (shift + 1) * sub_count + ((v >> shift) - sub_count);
+        }
+
+        /*!
+        \brief Largest value of a bucket
+        \param i Bucket index
+        \return Largest value counted in bucket `i`
+        */
+        static constexpr uint64_t bucket_max(size_t i) noexcept
+        {
+            if (i < sub_count)
+                return i;
+            const unsigned shift = i / sub_count - 1;
+            const uint64_t sub = i % sub_count + sub_count;
+            return ((sub + 1) << shift) - 1;
+        }
+
+        /*!
+        \brief Constructor
+        */
+        histogram()
+            : bins((64 - sub_bits + 1) * sub_count, 0)
+        {}
+
+        /*!
+        \brief Count a value
+        \param v Value
+        */
+        inline void record(uint64_t v) noexcept
+        {
+            bins[index(v)]++;
+            n++;
+            lowest = std::min(lowest, v);
+            highest = std::max(highest, v);
+            sum += v;
+        }
+
+        /*!
+        \brief Number of values
+        \return Count
+        */
+        inline uint64_t count() const noexcept
+        {
+            return n;
+        }
+
+        /*!
+        \brief Smallest value
+        \return Smallest value, 0 if empty
+        */
+        inline uint64_t min() const noexcept
+        {
+            return n ? lowest : 0;
+        }
+
+        /*!
+        \brief Largest value
+        \return Largest value, 0 if empty
+        */
+        inline uint64_t max() const noexcept
+        {
+            return highest;
+        }
+
+        /*!
+        \brief Mean value
+        \return Mean, 0 if empty
+        */
+        inline double mean() const noexcept
+        {
+            return n ? sum / n : .0;
+        }
+
+        /*!
+        \brief Value at quantile
+        \param q Quantile within [0..1]
+        \return Largest value of the bucket holding the value of rank ceil(q * count), capped at `max()`, 0 if empty
+        */
+        uint64_t value_at(double q) const noexcept
+        {
+            if (n == 0)
+                return 0;
+            const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * n));
+            uint64_t seen = 0;
+            for (size_t i=0; i<bins.size(); i++) {
+                seen += bins[i];
+                if (seen >= rank)
+                    return std::min(bucket_max(i), highest);
+            }
+            return highest;
+        }
+    };
+
+    /*!
+    \brief Latencies of the traced output periods
+    */
+    struct latencies final {
+        histogram since_received[num_stages];   //!< Time from `received` to the later stages of an output period, indexed by stage
+        histogram slot_wait;                    //!< Durations of waits for a free period data slot
+        uint64_t periods = 0;                   //!< Number of traced output periods with `received` and `written` stamps
+        uint64_t overwritten = 0;               //!< Number of stamps lost because a ring was full
+    };
+
+    /*!
+    \brief Time stamp rings of all pipeline threads
+    */
+    class tracer final {
+        const size_t ringCapacity;          //!< Capacity of every ring
+        const uint64_t origin;              //!< Trace start, see now()
+        unsigned chips = 0;                 //!< Number of chips
+        unsigned threads = 0;               //!< Number of histogramming threads
+        std::vector<std::unique_ptr<ring>> channel; //!< Per chip analyser rings, per histogramming thread rings, aggregate+write thread ring
+
+        /*!
+        \brief Output period milestones, merged from all rings
+        */
+        struct milestones final {
+            uint64_t at[num_stages] = {};   //!< Earliest `received` and `first_event`, latest `tdc` and `returned`, last other stamps, 0 for none
+        };
+
+        /*!
+        \brief Merge stamps of output periods
+        \return Milestones of periods with a `written` stamp, indexed by period
+        */
+        std::map<period_type, milestones> merge() const
+        {
+            std::map<period_type, milestones> all;
+            for (const auto& r : channel) {
+                r->visit([&all](const entry& e) {
+                    if (e.what >= slot_wait)
+                        return;
+                    uint64_t& at = all[e.period].at[e.what];
+                    if ((at == 0) || (((e.what == received) || (e.what == first_event)) ? (e.ns < at) : (e.ns > at)))
+                        at = e.ns;
+                });
+            }
+            for (auto it = std::begin(all); it != std::end(all);) {
+                if (it->second.at[written] == 0)
+                    it = all.erase(it);
+                else
+                    ++it;
+            }
+            return all;
+        }
+
+        /*!
+        \brief Write thread name metadata event
+        \param out      Output stream
+        \param tid      Trace thread id
+        \param name     Thread name
+        */
+        static void thread_name(std::ostream& out, unsigned tid, const std::string& name)
+        {
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}},\n";
+        }
+
+        /*!
+        \brief Write trace time in microseconds since the trace start, with nanosecond digits
+        \param out Output stream
+        \param ns  Time stamp, see now()
+        */
+        void micros(std::ostream& out, uint64_t ns) const
+        {
+            const uint64_t t = (ns > origin) ? ns - origin : 0;
+            const uint64_t frac = t % 1000;
+            out << (t / 1000) << '.' << (char)('0' + frac / 100) << (char)('0' + frac / 10 % 10) << (char)('0' + frac % 10);
+        }
+
+    public:
+        static constexpr size_t default_capacity = 1u << 16;   //!< Default number of stamps kept per thread
+
+        /*!
+        \brief Constructor
+        \param capacity Number of stamps kept per thread, rounded up to a power of two
+        */
+        explicit tracer(size_t capacity=default_capacity)
+            : ringCapacity{capacity}, origin{now()}
+        {}
+
+        tracer(const tracer&) = delete;
+        tracer(tracer&&) = delete;
+        tracer& operator=(const tracer&) = delete;
+        tracer& operator=(tracer&&) = delete;
+
+        /*!
+        \brief Create the rings, before any pipeline thread starts, previous stamps are lost
+        \param numChips         Number of chips
+        \param workersPerChip   Number of histogramming threads per chip
+        */
+        void configure(unsigned numChips, unsigned workersPerChip)
+        {
+            chips = numChips;
+            threads = numChips * std::max(workersPerChip, 1u);
+            channel.clear();
+            for (unsigned i=0; i<chips+threads+1; i++)
+                channel.emplace_back(new ring{ringCapacity});
+        }
+
+        /*!
+        \brief Ring of an analyser thread
+        \param chip Chip number
+        \return Ring, only to be written by the analyser thread of the chip, or before it started
+        */
+        inline ring& analyser(unsigned chip) noexcept
+        {
+            return *channel[chip];
+        }
+
+        /*!
+        \brief Ring of a histogramming thread
+        \param threadNo Analysis thread number (chip number * workers per chip + worker number)
+        \return Ring, only to be written by the histogramming thread, which is the analyser thread for a single worker per chip
+        */
+        inline ring& worker(unsigned threadNo) noexcept
+        {
+            return *channel[chips + threadNo];
+        }
+
+        /*!
+        \brief Ring of the aggregate+write thread
+        \return Ring, only to be written by the aggregate+write thread
+        */
+        inline ring& writer() noexcept
+        {
+            return *channel[chips + threads];
+        }
+
+        /*!
+        \brief Compute latency histograms, after all pipeline threads stopped
+        \return Latencies of the output periods found in the rings
+        */
+        latencies analyse() const
+        {
+            latencies res;
+            for (const auto& [period, m] : merge()) {
+                if (m.at[received] == 0)
+                    continue;
+                res.periods++;
+                for (unsigned s=first_event; s<=written; s++) {
+                    if (m.at[s] != 0)
+                        res.since_received[s].record((m.at[s] > m.at[received]) ? m.at[s] - m.at[received] : 0);
+                }
+            }
+            for (const auto& r : channel) {
+                res.overwritten += r->overwritten();
+                uint64_t begin = 0;
+                r->visit([&res, &begin](const entry& e) {
+                    if (e.what == slot_wait)
+                        begin = e.ns;
+                    else if ((e.what == slot_wait_end) && (begin != 0))
+                        res.slot_wait.record(e.ns - begin);
+                });
+            }
+            return res;
+        }
+
+        /*!
+        \brief Write a latency summary, after all pipeline threads stopped
+        \param out Output stream or log proxy
+        */
+        template<typename Stream>
+        void report(Stream& out) const
+        {
+            const latencies res = analyse();
+            const auto us = [](uint64_t ns) { return (ns + 500) / 1000; };
+            const auto line = [&out, &us](const histogram& h) {
+                out << h.count() << ", p50 " << us(h.value_at(.5)) << "us, p90 " << us(h.value_at(.9)) << "us, p99 " << us(h.value_at(.99))
+                    << "us, p99.9 " << us(h.value_at(.999)) << "us, max " << us(h.max()) << "us";
+            };
+            out << "latency trace: " << res.periods << " output periods, " << res.overwritten << " stamps overwritten";
+            for (unsigned s=first_event; s<=written; s++) {
+                out << "\n  received -> " << stage_name[s] << ": ";
+                line(res.since_received[s]);
+            }
+            out << "\n  slot waits: ";
+            line(res.slot_wait);
+        }
+
+        /*!
+        \brief Write the stamps as Chrome trace event JSON, after all pipeline threads stopped
+
+        The file can be opened with chrome://tracing or https://ui.perfetto.dev. Every ring becomes a thread
+        with instant events, slot waits become duration events, and output periods become async events
+        from `received` to `written`.
+
+        \param out Output stream
+        */
+        void write_chrome(std::ostream& out) const
+        {
+            out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+            for (unsigned i=0; i<chips; i++)
+                thread_name(out, i, "analyser " + std::to_string(i));
+            for (unsigned i=0; i<threads; i++)
+                thread_name(out, chips + i, "histogram " + std::to_string(i));
+            thread_name(out, chips + threads, "writer");
+            for (unsigned i=0; i<channel.size(); i++) {
+                channel[i]->visit([this, &out, i](const entry& e) {
+                    if (e.what == slot_wait)
+                        out << "{\"name\":\"slot wait\",\"ph\":\"B\"";
+                    else if (e.what == slot_wait_end)
+                        out << "{\"name\":\"slot wait\",\"ph\":\"E\"";
+                    else
+                        out << "{\"name\":\"" << stage_name[e.what] << "\",\"ph\":\"i\",\"s\":\"t\"";
+                    out << ",\"pid\":1,\"tid\":" << i << ",\"ts\":";
+                    micros(out, e.ns);
+                    out << ",\"args\":{\"period\":" << e.period << ",\"thread\":" << e.thread << "}},\n";
+                });
+            }
+            for (const auto& [period, m] : merge()) {
+                if (m.at[received] == 0)
+                    continue;
+                out << "{\"name\":\"period\",\"cat\":\"period\",\"ph\":\"b\",\"id\":" << period << ",\"pid\":1,\"ts\":";
+                micros(out, m.at[received]);
+                out << ",\"args\":{\"period\":" << period << "}},\n{\"name\":\"period\",\"cat\":\"period\",\"ph\":\"e\",\"id\":" << period << ",\"pid\":1,\"ts\":";
+                micros(out, m.at[written]);
+                out << "},\n";
+            }
+            out << "{\"name\":\"trace end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":";
+            micros(out, now());
+            out << "}\n]}\n";
+        }
+    };
+
+} // namespace latency_trace
+
+#endif // LATENCY_TRACE_H
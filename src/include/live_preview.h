@@ -0,0 +1,144 @@
+#ifndef LIVE_PREVIEW_H
+#define LIVE_PREVIEW_H
+
+/*!
+\file
+Provide live preview snapshots of the period histograms
+*/
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+
+/*!
+\brief Live preview of the XES histograms
+
+The aggregate+write thread publishes every aggregated period histogram together with the
+running sum of all periods since the start. Publishing goes through a triple buffer, so it
+never waits for readers and readers never see a half written snapshot.
+*/
+namespace preview {
+
+    /*!
+    \brief Consistent copy of the preview histograms
+    */
+    struct snapshot final {
+        uint64_t sequence = 0;          //!< Number of periods published so far, 0 for none
+        int64_t period = 0;             //!< Latest period number
+        uint32_t npoints = 0;           //!< Number of energy points
+        uint64_t time_points = 0;       //!< Number of time points
+        int64_t before_roi = 0;         //!< Number of events before the time ROI in the latest period
+        int64_t after_roi = 0;          //!< Number of events after the time ROI in the latest period
+        int64_t total = 0;              //!< Total number of events in the latest period
+        int64_t sum_total = 0;          //!< Total number of events in all periods
+        std::vector<int32_t> latest;    //!< Latest period histogram indexed by [time_point * npoints + energy_point]
+        std::vector<int64_t> sum;       //!< Sum of all period histograms, same index as `latest`
+    };
+
+    /*!
+    \brief Writer side and reader side of the preview snapshots
+
+    Only one thread may call `publish()`. Readers are serialized among themselves,
+    but never block the publishing thread.
+    */
+    class publisher final {
+        static constexpr unsigned fresh = 4;    //!< Flag in `middle`: the middle buffer holds an unread snapshot
+
+        snapshot buffer[3];             //!< Triple buffer
+        std::atomic<unsigned> middle{1};//!< Index of the buffer between writer and reader, possibly with the `fresh` flag
+        unsigned back = 0;              //!< Buffer owned by the writer
+        unsigned front = 2;             //!< Buffer owned by the readers, protected by `reader_lock`
+        std::mutex reader_lock;         //!< Serialize readers
+        snapshot state;                 //!< Running sum and counters, owned by the writer
+
+      public:
+        publisher() = default;
+        publisher(const publisher&) = delete;
+        publisher(publisher&&) = delete;
+        publisher& operator=(const publisher&) = delete;
+        publisher& operator=(publisher&&) = delete;
+
+        /*!
+        \brief Writer side: publish an aggregated period histogram
+
+        The running sum starts over if the histogram dimensions change.
+
+        \param period       Period number
+        \param npoints      Number of energy points
+        \param time_points  Number of time points
+        \param bins         Histogram with `npoints * time_points` bins indexed by [time_point * npoints + energy_point]
+        \param before_roi   Number of events before the time ROI
+        \param after_roi    Number of events after the time ROI
+        \param total        Total number of events
+        */
+        inline void publish(int64_t period, uint32_t npoints, uint64_t time_points, const int32_t* bins,
+                            int64_t before_roi, int64_t after_roi, int64_t total)
+        {
+            const std::size_t size = std::size_t(npoints) * time_points;
+            if ((state.npoints != npoints) || (state.time_points != time_points)) {
+                state.npoints = npoints;
+                state.time_points = time_points;
+                state.sum.assign(size, 0);
+                state.sum_total = 0;
+            }
+            for (std::size_t i=0; i<size; i++)
+                state.sum[i] += bins[i];
+            state.sum_total += total;
+            state.sequence++;
+
+            snapshot& out = buffer[back];
+            out.sequence = state.sequence;
+            out.period = period;
+            out.npoints = npoints;
+            out.time_points = time_points;
+            out.before_roi = before_roi;
+            out.after_roi = after_roi;
+            out.total = total;
+            out.sum_total = state.sum_total;
+            out.latest.assign(bins, bins + size);
+            out.sum = state.sum;
+            back = middle.exchange(back | fresh, std::memory_order_acq_rel) & ~fresh;
+        }
+
+        /*!
+        \brief Reader side: get the latest snapshot
+        \param out  Set to a copy of the latest snapshot
+        \return False if nothing was published yet, `out` is untouched in that case
+        */
+        inline bool read(snapshot& out)
+        {
+            std::lock_guard lock{reader_lock};
+            if (middle.load(std::memory_order_relaxed) & fresh)
+                front = middle.exchange(front, std::memory_order_acq_rel) & ~fresh;
+            if (buffer[front].sequence == 0)
+                return false;
+            out = buffer[front];
+            return true;
+        }
+    };
+
+    /*!
+    \brief Write snapshot as JSON object
+    \param out  Output stream
+    \param s    Snapshot
+    */
+    inline void write_json(std::ostream& out, const snapshot& s)
+    {
+        out << "{\"sequence\":" << s.sequence << ",\"period\":" << s.period
+            << ",\"energy_points\":" << s.npoints << ",\"time_points\":" << s.time_points
+            << ",\"before_roi\":" << s.before_roi << ",\"after_roi\":" << s.after_roi << ",\"total\":" << s.total
+            << ",\"sum_total\":" << s.sum_total << ",\"latest\":[";
+        for (std::size_t i=0; i<s.latest.size(); i++)
+            out << (i ? "," : "") << s.latest[i];
+        out << "],\"sum\":[";
+        for (std::size_t i=0; i<s.sum.size(); i++)
+            out << (i ? "," : "") << s.sum[i];
+        out << "]}\n";
+    }
+
+} // namespace preview
+
+#endif // LIVE_PREVIEW_H
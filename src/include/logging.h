@@ -9,6 +9,7 @@ Logging code
 */
 
 #include <sstream>
+#include <tuple>
 #include "Poco/Logger.h"
 
 namespace {
@@ -16,29 +17,62 @@ namespace {
     using Poco::Message;
 }
 
+#ifndef LOG_MAX_PRIORITY
+    /*!
+    \brief Least important log priority that is compiled in
+
+    Log statements with a bigger Poco priority number are removed at compile time.
+    The default keeps all of them, compile.sh lowers it for optimized builds.
+    */
+    #define LOG_MAX_PRIORITY 8
+#endif
+
+/*!
+\brief Log priority tag
+
+The priority is part of the type, so log statements with a priority that is not compiled in
+(see `LOG_MAX_PRIORITY`) are removed at compile time.
+
+\tparam P Poco logging priority
+*/
+template<Message::Priority P>
+struct log_priority final {
+    static constexpr Message::Priority value = P;                   //!< Poco logging priority
+    static constexpr bool compiled_in = ((int)P <= LOG_MAX_PRIORITY);   //!< Log statements with this priority are compiled in
+
+    /*!
+    \brief Conversion to Poco priority
+    \return Poco logging priority
+    */
+    constexpr operator Message::Priority() const noexcept
+    {
+        return P;
+    }
+};
+
 /*! A fatal error. The application will most likely terminate. This is the highest priority. */
-[[maybe_unused]] constexpr Message::Priority log_fatal = Message::PRIO_FATAL;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_FATAL> log_fatal{};
 
 /*! A critical error. The application might not be able to continue running successfully. */
-[[maybe_unused]] constexpr Message::Priority log_critical = Message::PRIO_CRITICAL;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_CRITICAL> log_critical{};
 
 /*! An error. An operation did not complete successfully, but the application as a whole is not affected. */
-[[maybe_unused]] constexpr Message::Priority log_error = Message::PRIO_ERROR;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_ERROR> log_error{};
 
 /*! A warning. An operation completed with an unexpected result. */
-[[maybe_unused]] constexpr Message::Priority log_warn = Message::PRIO_WARNING;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_WARNING> log_warn{};
 
 /*! A notice, which is an information with just a higher priority. */
-[[maybe_unused]] constexpr Message::Priority log_notice = Message::PRIO_NOTICE;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_NOTICE> log_notice{};
 
 /*! An informational message, usually denoting the successful completion of an operation. */
-[[maybe_unused]] constexpr Message::Priority log_info = Message::PRIO_INFORMATION;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_INFORMATION> log_info{};
 
 /*! A debugging message. */
-[[maybe_unused]] constexpr Message::Priority log_debug = Message::PRIO_DEBUG;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_DEBUG> log_debug{};
 
 /*! A tracing message. This is the lowest priority. */
-[[maybe_unused]] constexpr Message::Priority log_trace = Message::PRIO_TRACE;
+[[maybe_unused]] constexpr log_priority<Message::PRIO_TRACE> log_trace{};
 
 /*!
 \brief Proxy object for a Poco Logger object
@@ -88,15 +122,40 @@ struct LogProxy final : private std::ostringstream {
     /*!
     \brief Log saved output
     
-    The saved output is written to `logger` with the given priority.
+    The saved output is written to `logger` with the given priority, if the priority is enabled.
 
+    \param priority Poco logging priority
+    */
+    inline void flush(Message::Priority priority)
+    {
+        if (logger.is(priority))
+            logger.log(Message("Tpx3App", str(), priority));
+        str("");
+    }
+
+    /*!
+    \brief Log saved output
     \param priority Poco logging priority
     \return Reference to `this`
     */
     inline LogProxy& operator<< (const Message::Priority& priority)
     {
-        logger.log(Message("Tpx3App", str(), priority));
-        str("");
+        flush(priority);
+        return *this;
+    }
+
+    /*!
+    \brief Log saved output, nothing is logged if the priority is not compiled in
+    \tparam P Poco logging priority
+    \return Reference to `this`
+    */
+    template<Message::Priority P>
+    inline LogProxy& operator<< (log_priority<P>)
+    {
+        if constexpr (log_priority<P>::compiled_in)
+            flush(P);
+        else
+            str("");
         return *this;
     }
 
@@ -119,26 +178,89 @@ struct LogProxy final : private std::ostringstream {
     }
 };
 
+/*!
+\brief Lazily formatted log statement
+
+Collects references to the output values until it sees the log priority.
+The values are only formatted if the priority is compiled in (see `LOG_MAX_PRIORITY`)
+and enabled for the logger, so disabled log statements cost a level check, or nothing at all.
+
+The references are valid until the end of the full expression, therefore the output operators
+only work on temporaries, and a log statement has to be a single expression ending with the priority.
+Use `LogProxy` for log messages built across several statements.
+
+\tparam Args Output value types
+*/
+template<typename... Args>
+struct [[nodiscard]] LogStatement final {
+    Logger& logger;                     //!< Poco::Logger object the statement is for
+    std::tuple<const Args&...> values;  //!< Output values
+
+    /*!
+    \brief Output operator, remembers a reference to `value`
+    \param value Value to print out into the logging stream
+    \return Log statement with `value` appended
+    */
+    template<typename T>
+    inline LogStatement<Args..., T> operator<< (const T& value) && noexcept
+    {
+        return {logger, std::tuple_cat(values, std::tuple<const T&>{value})};
+    }
+
+    /*!
+    \brief Format the output values and log them with a runtime priority
+    \param priority Poco logging priority
+    */
+    inline void operator<< (Message::Priority priority) &&
+    {
+        if (logger.is(priority))
+            log(priority);
+    }
+
+    /*!
+    \brief Format the output values and log them, removed if the priority is not compiled in
+    \tparam P Poco logging priority
+    */
+    template<Message::Priority P>
+    inline void operator<< (log_priority<P>) &&
+    {
+        if constexpr (log_priority<P>::compiled_in) {
+            if (logger.is(P))
+                log(P);
+        }
+    }
+
+  private:
+    /*!
+    \brief Format the output values and log them
+    \param priority Poco logging priority
+    */
+    inline void log(Message::Priority priority) const
+    {
+        LogProxy proxy(logger);
+        std::apply([&proxy](const auto&... value) { (void)(proxy << ... << value); }, values);
+        proxy.flush(priority);
+    }
+};
+
 /*!
 \brief Operator for initial logging operation
-This will return a LogProxy object that collects output until it sees the log priority input (see LogProxy).
+This will return a LogStatement object that collects output until it sees the log priority input (see LogStatement).
 
 Example:
 Poco::Logger log;
 log << "my new log entry: " << "test" << log_info;
      |                       |         |
-collect and return LogProxy  collect   forward collected output to log with PRIO_INFORMATION
+collect and return           collect   check priority, format and forward collected output to log with PRIO_INFORMATION
 
 \param logger Poco logger object reference. Output will eventually be forwarded to this logger.
 \param value  Output value reference
-\return LogProxy object
+\return LogStatement object
 */
 template<typename T>
-inline LogProxy operator<< (Logger& logger, const T& value)
+inline LogStatement<T> operator<< (Logger& logger, const T& value) noexcept
 {
-    LogProxy proxy(logger);
-    proxy << value;
-    return proxy;
+    return {logger, std::tuple<const T&>{value}};
 }
 
 #endif // LOGGING_H
\ No newline at end of file
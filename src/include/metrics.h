@@ -0,0 +1,106 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*!
+\file
+Provide live pipeline counters and their Prometheus text representation
+*/
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <cstdint>
+
+/*!
+\brief Live pipeline metrics
+*/
+namespace metrics {
+
+    static constexpr std::size_t cache_line = 64;   //!< Assumed cache line size in bytes
+
+    /*!
+    \brief Counter or gauge with exactly one writing thread
+
+    The writer uses relaxed loads and stores only, so updating a counter costs the same
+    as updating a plain integer as long as no other thread touches the cache line. Groups of
+    counters written by the same thread should therefore be placed into a `cache_line`
+    aligned struct. Any thread may read the value at any time.
+    */
+    struct counter final {
+        std::atomic<uint64_t> value{0}; //!< Current value
+
+        /*!
+        \brief Writer side: increment
+        \param n Increment
+        */
+        inline void add(uint64_t n=1) noexcept
+        {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        /*!
+        \brief Writer side: set value
+        \param n New value
+        */
+        inline void set(uint64_t n) noexcept
+        {
+            value.store(n, std::memory_order_relaxed);
+        }
+
+        /*!
+        \brief Reader side: get value
+        \return Latest value seen by this thread
+        */
+        inline uint64_t get() const noexcept
+        {
+            return value.load(std::memory_order_relaxed);
+        }
+    };
+
+    /*!
+    \brief Write Prometheus help and type lines for a metric
+    \param out  Output stream
+    \param name Metric name
+    \param type Metric type, "counter" or "gauge"
+    \param help Metric description
+    */
+    inline void describe(std::ostream& out, const char* name, const char* type, const char* help)
+    {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    /*!
+    \brief Write Prometheus sample line without labels
+    \tparam T   Value type
+    \param out  Output stream
+    \param name Metric name
+    \param val  Sample value
+    */
+    template<typename T>
+    inline void sample(std::ostream& out, const char* name, const T& val)
+    {
+        out << name << ' ' << val << '\n';
+    }
+
+    /*!
+    \brief Write Prometheus sample line with a chip label
+    \tparam T   Value type
+    \param out  Output stream
+    \param name Metric name
+    \param chip Chip number
+    \param val  Sample value
+    */
+    template<typename T>
+    inline void sample(std::ostream& out, const char* name, unsigned chip, const T& val)
+    {
+        out << name << "{chip=\"" << chip << "\"} " << val << '\n';
+    }
+
+    /*!
+    \brief Prometheus text exposition format content type
+    */
+    inline const std::string content_type = "text/plain; version=0.0.4";
+
+} // namespace metrics
+
+#endif // METRICS_H
@@ -0,0 +1,150 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+/*!
+\file
+Provide HTTP endpoint serving live pipeline metrics in Prometheus text format
+*/
+
+#include <functional>
+#include <sstream>
+#include <string>
+#include "Poco/URI.h"
+#include "Poco/Net/SocketAddress.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/HTTPServer.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "metrics.h"
+
+namespace metrics {
+
+    /*!
+    \brief HTTP server answering GET /metrics
+
+    The server runs a single Poco HTTP server thread. Every request calls the collector,
+    which only reads `counter` values, so scraping never takes locks of the processing pipeline.
+    The same server serves other read-only documents, like the live preview, on a different path.
+    */
+    class endpoint final {
+      public:
+        using collector_type = std::function<void(std::ostream&)>;  //!< Writes all samples to the stream
+
+      private:
+        /*!
+        \brief Request handler
+        */
+        struct handler final : public Poco::Net::HTTPRequestHandler {
+            const endpoint& owner;          //!< Endpoint
+
+            /*!
+            \brief Constructor
+            \param e Endpoint
+            */
+            inline explicit handler(const endpoint& e)
+                : owner{e}
+            {}
+
+            /*!
+            \brief Handler function
+            \param request  Poco HTTP request object reference
+            \param response Poco HTTP response object
+            */
+            inline void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override
+            {
+                using Poco::Net::HTTPResponse;
+                if (request.getMethod() != "GET") {
+                    response.setStatus(HTTPResponse::HTTP_BAD_REQUEST);
+                    response.send() << "only GET is supported\n";
+                    return;
+                }
+                if (Poco::URI{request.getURI()}.getPath() != owner.path) {
+                    response.setStatus(HTTPResponse::HTTP_NOT_FOUND);
+                    response.send() << "use " << owner.path << '\n';
+                    return;
+                }
+                std::ostringstream body;
+                owner.collect(body);
+                const std::string text = body.str();
+                response.setContentType(owner.type);
+                response.setContentLength(text.size());
+                response.send() << text;
+            }
+        };
+
+        /*!
+        \brief Request handler factory
+        */
+        struct factory final : public Poco::Net::HTTPRequestHandlerFactory {
+            const endpoint& owner;          //!< Endpoint
+
+            /*!
+            \brief Constructor
+            \param e Endpoint
+            */
+            inline explicit factory(const endpoint& e)
+                : owner{e}
+            {}
+
+            /*!
+            \brief Create request handler
+            \param request Poco HTTP request object reference
+            \return Pointer to Poco request handler object
+            */
+            inline Poco::Net::HTTPRequestHandler* createRequestHandler([[maybe_unused]] const Poco::Net::HTTPServerRequest& request) override
+            {
+                return new handler{owner};
+            }
+        };
+
+        const collector_type collect;   //!< Writes all samples
+        const std::string path;         //!< Served URI path
+        const std::string type;         //!< Content type of the served document
+        Poco::Net::HTTPServer server;   //!< Poco HTTP server
+
+        /*!
+        \brief Single threaded HTTP server parameters
+        \return Parameters, owned by the HTTP server
+        */
+        static inline Poco::Net::HTTPServerParams* params()
+        {
+            auto* p = new Poco::Net::HTTPServerParams;
+            p->setMaxThreads(1);
+            p->setMaxQueued(4);
+            return p;
+        }
+
+      public:
+        /*!
+        \brief Constructor, starts the HTTP server
+        \param address  Listening address
+        \param c        Collector writing all samples in Prometheus text format
+        \param p        Served URI path
+        \param t        Content type of the document written by `c`
+        */
+        inline endpoint(const Poco::Net::SocketAddress& address, collector_type&& c, const std::string& p="/metrics", const std::string& t=content_type)
+            : collect{std::move(c)}, path{p}, type{t}, server{new factory{*this}, Poco::Net::ServerSocket{address}, params()}
+        {
+            server.start();
+        }
+
+        endpoint(const endpoint&) = delete;
+        endpoint(endpoint&&) = delete;
+        endpoint& operator=(const endpoint&) = delete;
+        endpoint& operator=(endpoint&&) = delete;
+
+        /*!
+        \brief Destructor, stops the HTTP server and aborts open connections
+        */
+        inline ~endpoint()
+        {
+            server.stopAll(true);
+        }
+    };
+
+} // namespace metrics
+
+#endif // METRICS_ENDPOINT_H
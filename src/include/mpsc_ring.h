@@ -0,0 +1,128 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+/*!
+\file
+Provide a bounded multiple producer single consumer ring buffer
+*/
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*!
+\brief Bounded lock-free multiple producer single consumer ring buffer
+
+The capacity is rounded up to a power of two, all slots are allocated up front.
+Every slot carries a sequence number that tells producers and the consumer whether
+the slot is free or filled for the current round (D. Vyukov's bounded queue).
+Producers claim positions with a CAS on the shared tail, so `try_push()` never blocks,
+it fails if the ring is full.
+
+Any thread may call `try_push()`, only one thread may call `try_pop()`.
+
+\tparam T Element type, must be default constructible and move assignable
+*/
+template<typename T>
+class mpsc_ring final {
+    static constexpr std::size_t cache_line = 64;   //!< Assumed cache line size in bytes
+
+    /*!
+    \brief Ring slot
+    */
+    struct cell final {
+        std::atomic<std::size_t> sequence;  //!< Position for which the slot is free (== position) or filled (== position + 1)
+        T value;                            //!< Element
+    };
+
+    alignas(cache_line) std::atomic<std::size_t> tail{0};   //!< Producer position
+    alignas(cache_line) std::size_t head = 0;               //!< Consumer position
+    std::unique_ptr<cell[]> slot;                           //!< Ring slots
+    std::size_t mask;                                       //!< Slot index mask, number of slots - 1
+
+    /*!
+    \brief Round up to power of two
+    \param n Value
+    \return Smallest power of two >= max(n, 2)
+    */
+    static constexpr std::size_t round_up(std::size_t n) noexcept
+    {
+        std::size_t p = 2;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+  public:
+    /*!
+    \brief Constructor
+    \param capacity Minimum number of elements the ring can hold
+    */
+    explicit mpsc_ring(std::size_t capacity)
+        : slot(new cell[round_up(capacity)]), mask{round_up(capacity) - 1}
+    {
+        for (std::size_t i=0; i<=mask; i++)
+            slot[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    mpsc_ring(const mpsc_ring&) = delete;
+    mpsc_ring(mpsc_ring&&) = delete;
+    mpsc_ring& operator=(const mpsc_ring&) = delete;
+    mpsc_ring& operator=(mpsc_ring&&) = delete;
+    ~mpsc_ring() = default;
+
+    /*!
+    \brief Producer side: append element
+    \param value Will be moved into the ring if there is space
+    \return False if the ring is full, `value` is untouched in that case
+    */
+    inline bool try_push(T&& value) noexcept
+    {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            cell& c = slot[pos & mask];
+            const std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(value);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*!
+    \brief Consumer side: remove oldest element
+    \param value Oldest element will be moved into this if the ring is not empty
+    \return False if the ring is empty, or the oldest element is still being written
+    */
+    inline bool try_pop(T& value) noexcept
+    {
+        cell& c = slot[head & mask];
+        if (c.sequence.load(std::memory_order_acquire) != head + 1)
+            return false;
+        value = std::move(c.value);
+        c.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+    /*!
+    \brief Maximum number of elements in the ring
+    \return Ring capacity
+    */
+    [[gnu::pure]]
+    inline std::size_t capacity() const noexcept
+    {
+        return mask + 1;
+    }
+};
+
+#endif // MPSC_RING_H
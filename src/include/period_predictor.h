@@ -5,24 +5,48 @@
 \file
 Code for maintaining a period prediction
 
-Both the period interval and number can be predicted
+Both the period interval and number can be predicted, either from the median
+of the last TDC intervals, or from a linear fit over a window of TDC time points
 */
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 
 /*!
 \brief Period predictor object
+
+Median mode (the default) predicts the interval as the median of the last 3 TDC intervals,
+and the base reference time has to be moved forward with `start_update()` regularly.
+
+Fit mode (see `set_window()`) assigns every TDC the rounded predicted period number and fits
+a line through the last `window()` (period number, TDC time) pairs. The sums are accumulated
+exactly in integers relative to the latest TDC, so the fit doesn't lose precision over long runs.
+The base reference time moves to the fitted start of the latest period on every update, which
+tracks a drifting interval and never extrapolates further than one period.
 */
 class period_predictor final {
+  public:
+    static constexpr unsigned max_window = 64;  //!< Maximum number of TDC time points for the linear fit
+
+  private:
     static constexpr double extrapolation_threshold = 100.; //!< Don't extrapolate past theis threshold
     static constexpr int N = 4;     //!< Number of past TDC time points stored
     std::array<int64_t, N> past;    //!< Storage for past TDC time time stamps. `first`points to the most recent time stamp.
     int64_t start;                  //!< Base reference time point in clock ticks
     double interval;                //!< Period interval prediction in clock ticks
+    double interval_inv;            //!< 1. / `interval`
     long correction;                //!< Correction factor: distance in number of periods between 0 and `start`
     unsigned first = 0;             //!< Index of first time stamp in `past`
 
+    unsigned fit_window = 0;        //!< Number of TDC time points for the linear fit, 0 for median mode
+    unsigned fit_count = 0;         //!< Number of valid entries in `fit_ts` and `fit_period`
+    unsigned fit_next = 0;          //!< Next entry in `fit_ts` and `fit_period`
+    std::array<int64_t, max_window> fit_ts;     //!< TDC time points for the linear fit
+    std::array<long, max_window> fit_period;    //!< Period numbers of `fit_ts`
+    double fit_residual = .0;       //!< RMS residual of the linear fit in clock ticks
+    double interval_drift = .0;     //!< Smoothed interval change per TDC in clock ticks
+
     /*!
     \brief Calculate period interval prediction
 
@@ -32,14 +56,70 @@ class period_predictor final {
     */
     inline double predict_interval() const noexcept
     {
+        static_assert(N == 4, "median of 3 intervals");
         std::array<double, N-1> diff;
         for (unsigned i=0; i<N-1; i++) {
             const unsigned l = (first + i) % N;
             const unsigned h = (l + 1) % N;
             diff[i] = past[h] - past[l];
         }
-        std::sort(std::begin(diff), std::end(diff));
-        return diff[(N-1) / 2];
+        return std::max(std::min(diff[0], diff[1]), std::min(std::max(diff[0], diff[1]), diff[2]));
+    }
+
+    /*!
+    \brief Add a TDC time point to the linear fit window
+    \param ts Time of TDC event in clock ticks
+    \param p  Period number of the TDC event
+    */
+    inline void fit_add(int64_t ts, long p) noexcept
+    {
+        fit_ts[fit_next] = ts;
+        fit_period[fit_next] = p;
+        fit_next = (fit_next + 1) % fit_window;
+        fit_count = std::min(fit_count + 1, fit_window);
+    }
+
+    /*!
+    \brief Linear fit mode update
+    \param ts Time of TDC event in clock ticks
+    */
+    inline void fit_update(int64_t ts) noexcept
+    {
+        const long p = std::lround(period_prediction(ts));
+        fit_add(ts, p);
+
+        // least squares fit of y = a + b * x, relative to the latest TDC
+        const int64_t k = fit_count;
+        int64_t sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (unsigned i=0; i<fit_count; i++) {
+            const int64_t x = fit_period[i] - p;
+            const int64_t y = fit_ts[i] - ts;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        const int64_t den = k * sxx - sx * sx;
+        if (den > 0) {
+            const double b = double(k * sxy - sx * sy) / den;
+            if (b > 0.) {
+                const double a = (sy - b * sx) / k;
+                double sr = .0;
+                for (unsigned i=0; i<fit_count; i++) {
+                    const double r = (fit_ts[i] - ts) - (a + b * (fit_period[i] - p));
+                    sr += r * r;
+                }
+                fit_residual = std::sqrt(sr / k);
+                interval_drift += .125 * ((b - interval) - interval_drift);
+                interval = b;
+                interval_inv = 1. / interval;
+                start = ts + std::llround(a);
+                correction = p;
+                return;
+            }
+        }
+        start = ts;
+        correction = p;
     }
 
   public:
@@ -69,6 +149,33 @@ class period_predictor final {
         return interval;
     }
 
+    /*!
+    \brief Get inverse of predicted interval
+    \return 1 / period in number of clock ticks
+    */
+    inline double inverse_interval_prediction() const noexcept
+    {
+        return interval_inv;
+    }
+
+    /*!
+    \brief Get base reference time point
+    \return Reference time in clock ticks
+    */
+    inline int64_t reference_start() const noexcept
+    {
+        return start;
+    }
+
+    /*!
+    \brief Get period number correction
+    \return Distance in number of periods between 0 and `reference_start()`
+    */
+    inline long period_correction() const noexcept
+    {
+        return correction;
+    }
+
     /*!
     \brief Get predicted period
     \param ts Time in clock ticks
@@ -85,9 +192,14 @@ class period_predictor final {
     */
     inline void prediction_update(int64_t ts) noexcept
     {
+        if (fit_window) {
+            fit_update(ts);
+            return;
+        }
         past[first] = ts;
         first = (first + 1) % N;
         interval = predict_interval();
+        interval_inv = 1. / interval;
     }
 
     /*!
@@ -113,9 +225,73 @@ class period_predictor final {
     {
         start = start_;
         interval = period;
+        interval_inv = 1. / interval;
         for (int i=0; i<N; i++)
             past[N-i-1] = start - i * interval;
         correction = 0;
+        fit_count = fit_next = 0;
+        fit_residual = interval_drift = .0;
+        if (fit_window)
+            fit_add(start, 0);
+    }
+
+    /*!
+    \brief Restart prediction at a TDC after a gap in the data
+
+    The interval prediction is kept, but TDC time points from before the gap no longer take part in it.
+    The TDC becomes the new base reference time, its period number is the rounded period prediction.
+
+    \param ts Time of the first TDC event after the gap in clock ticks
+    */
+    inline void reseed(int64_t ts) noexcept
+    {
+        correction = std::lround(period_prediction(ts));
+        start = ts;
+        for (int i=0; i<N; i++)
+            past[N-i-1] = start - i * interval;
+        first = 0;
+        fit_count = fit_next = 0;
+        if (fit_window)
+            fit_add(start, correction);
+    }
+
+    /*!
+    \brief Select the prediction mode
+    \param w Number of TDC time points for the linear fit, 2..`max_window`, or 0 for median mode
+    */
+    inline void set_window(unsigned w) noexcept
+    {
+        fit_window = std::min(w, max_window);
+        fit_count = fit_next = 0;
+        if (fit_window)
+            fit_add(start, correction);
+    }
+
+    /*!
+    \brief Get the prediction mode
+    \return Number of TDC time points for the linear fit, 0 for median mode
+    */
+    inline unsigned window() const noexcept
+    {
+        return fit_window;
+    }
+
+    /*!
+    \brief Get the linear fit quality
+    \return RMS residual of the TDC time points around the fitted line in clock ticks, 0 in median mode
+    */
+    inline double residual() const noexcept
+    {
+        return fit_residual;
+    }
+
+    /*!
+    \brief Get the interval drift
+    \return Smoothed change of the interval prediction per TDC in clock ticks, 0 in median mode
+    */
+    inline double drift() const noexcept
+    {
+        return interval_drift;
     }
 
     /*!
@@ -151,6 +327,8 @@ class period_predictor final {
         for (const auto& dp : past)
             out << dp << ' ';
         out << 's' << start << " i" << interval << " c" << correction << " f" << first;
+        if (fit_window)
+            out << " w" << fit_count << '/' << fit_window << " r" << fit_residual << " d" << interval_drift;
     }
 };
 
@@ -168,7 +346,7 @@ Stream& operator<<(Stream& out, const period_predictor& p)
 }
 
 #ifdef LOGGING_H
-    LogProxy& operator<<(LogProxy& proxy, const period_predictor& p)
+    inline LogProxy& operator<<(LogProxy& proxy, const period_predictor& p)
     {
         return proxy.operator<<(p);
     }
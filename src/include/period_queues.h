@@ -7,9 +7,13 @@ Code for event to period assignment logic
 */
 
 #include <memory>
-#include <map>
+#include <vector>
 #include <cassert>
+#include <cmath>
+#include <array>
+#include <limits>
 #include "event_reordering.h"
+#include "period_predictor.h"
 #include "shared_types.h"
 
 /*!
@@ -17,24 +21,33 @@ Code for event to period assignment logic
 */
 struct period_queue_element final {
     /*!
-    \brief Event reordeing queue for this period interval change
+    \brief Events of the disputed interval around this period change
 
-    The queue should be empty if the start time stamp (TDC event at the beginning of the period)
-    has been seen. In that case `start_seen` should be true.
+    The events are kept unordered, they are split up between the two periods once
+    the start time stamp (TDC event at the beginning of the period) arrives.
+    The vector is cleared, but keeps its capacity, when the element is reused.
+    The queue should be empty if the start time stamp has been seen. In that case `start_seen` should be true.
     */
-    std::unique_ptr<event_reorder_queue> queue;
+    std::vector<reordering_element> queue;
     int64_t start = 0;                          //!< The period start time stamp in number of clock ticks
     bool start_seen = false;                    //!< Either start is valid, or the queue, but not both
 
-    inline period_queue_element()
-        : queue{new event_reorder_queue{}}
-    {}
-
+    inline period_queue_element() = default;
     inline ~period_queue_element() = default;
     period_queue_element(const period_queue_element&) = delete;
     inline period_queue_element(period_queue_element&&) = default;              //!< Move constructor
     period_queue_element& operator=(const period_queue_element&) = delete;
     inline period_queue_element& operator=(period_queue_element&&) = default;   //!< Move assignment \return Reference to `this`
+
+    /*!
+    \brief Prepare element for reuse, keeps allocated memory
+    */
+    inline void reset() noexcept
+    {
+        queue.clear();
+        start = 0;
+        start_seen = false;
+    }
 };
 
 /*!
@@ -72,22 +85,182 @@ Stream& operator<<(Stream& out, const period_index& idx)
 }
 
 #ifdef LOGGING_H
-    LogProxy& operator<<(LogProxy& proxy, const period_index& idx)
+    inline LogProxy& operator<<(LogProxy& proxy, const period_index& idx)
     {
         return proxy.operator<<(idx);
     }
 #endif
 
+/*!
+\brief Period attribution for a block of TOAs between two TDC events
+
+Filled in by `period_queues::period_indices_for()`, read with `period_queues::refined_index(period_block&, ...)`.
+*/
+struct period_block final {
+    /*!
+    \brief Period attribution kind
+    */
+    enum kind_type : uint8_t {
+        undisputed,     //!< Event is in `period`
+        disputed_low,   //!< Event is in `period - 1` or `period`
+        disputed_high   //!< Event is in `period` or `period + 1`
+    };
+
+    std::vector<period_type> period;    //!< Period number (floor of predicted period) per event
+    std::vector<uint8_t> kind;          //!< Attribution kind per event, see `kind_type`
+
+    /*!
+    \brief Cached reorder queue state for a disputed period change
+    */
+    struct cache_entry final {
+        period_type disputed_period = std::numeric_limits<period_type>::min();  //!< Higher period of the period change, minimum for unused entries
+        int64_t start = 0;                  //!< Period change time stamp, if `start_seen`
+        bool start_seen = false;            //!< Has the TDC for the period change been seen?
+    };
+    std::array<cache_entry, 2> cache;   //!< Lookups of the current block, the higher and lower period change
+
+    /*!
+    \brief Make room for events
+    \param n Number of events in the block
+    */
+    inline void reserve(size_t n)
+    {
+        if (period.size() < n) {
+            period.resize(n);
+            kind.resize(n);
+        }
+    }
+};
+
 /*!
 \brief Collection of recent period change interval representations
+
+The period changes are stored in a power of two sized ring of slots indexed by `period & mask`.
+Periods increase monotonically and only a few recent period changes are remembered, so slots
+are reused without allocating. If a period maps to a slot that is occupied by another period,
+the ring is grown until all remembered periods map to distinct slots.
+Slots are allocated individually, so references to elements stay valid when the ring grows.
 */
 struct period_queues final {
+    static constexpr period_type unused = std::numeric_limits<period_type>::min();  //!< Period number of unused slots
+    static constexpr size_t default_capacity = 16;  //!< Default number of slots
+
+    /*!
+    \brief Ring slot
+    */
+    struct slot final {
+        period_type period = unused;    //!< Period number, `unused` if the slot is free
+        period_queue_element element;   //!< Period change interval representation
+    };
+
+  private:
+    std::vector<std::unique_ptr<slot>> ring;    //!< Slots, indexed by `period & mask`
+    period_type mask;                           //!< Slot index mask
+    size_t count = 0;                           //!< Number of used slots
+    size_t reserved = 0;                        //!< Reorder queue capacity of new slots, see `reserve()`
+
+    /*!
+    \brief Create an unused slot
+    \return Slot with `reserved` reorder queue capacity
+    */
+    std::unique_ptr<slot> new_slot() const
+    {
+        std::unique_ptr<slot> s{new slot{}};
+        s->element.queue.reserve(reserved);
+        return s;
+    }
+
+    /*!
+    \brief Grow ring until all used slots and `period` map to distinct slots
+    \param period Period number that needs a slot
+    */
+    void grow(period_type period)
+    {
+        size_t capacity = ring.size();
+        bool distinct;
+        do {
+            capacity *= 2;
+            const period_type m = capacity - 1;
+            std::vector<bool> taken(capacity, false);
+            taken[period & m] = true;
+            distinct = true;
+            for (const auto& s : ring) {
+                if (s->period == unused)
+                    continue;
+                if (taken[s->period & m]) {
+                    distinct = false;
+                    break;
+                }
+                taken[s->period & m] = true;
+            }
+        } while (! distinct);
+
+        std::vector<std::unique_ptr<slot>> grown(capacity);
+        std::vector<std::unique_ptr<slot>> spare;
+        mask = capacity - 1;
+        for (auto& s : ring) {
+            if (s->period == unused)
+                spare.push_back(std::move(s));
+            else
+                grown[s->period & mask] = std::move(s);
+        }
+        for (auto& s : grown) {
+            if (s)
+                continue;
+            if (spare.empty()) {
+                s = new_slot();
+            } else {
+                s = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        ring.swap(grown);
+    }
+
+  public:
     /*!
-    \brief Shortcut for the container type of the period interval change event reorder queues
+    \brief Constructor
+    \param capacity Initial number of slots, rounded up to a power of two
+    */
+    inline explicit period_queues(size_t capacity = default_capacity)
+    {
+        size_t c = 1;
+        while (c < capacity)
+            c <<= 1;
+        ring.resize(c);
+        for (auto& s : ring)
+            s = new_slot();
+        mask = c - 1;
+    }
 
-    These period interval representing queues are stored with a key corresponding to the (predicted) period number.
+    /*!
+    \brief Preallocate the reorder queues of all slots, so they don't grow in the steady state
+    \param events Expected maximum number of events within the disputed interval of a period change
     */
-    using queue_type = std::map<period_type, period_queue_element>;
+    inline void reserve(size_t events)
+    {
+        reserved = events;
+        for (auto& s : ring)
+            s->element.queue.reserve(events);
+    }
+
+    inline ~period_queues() = default;
+    period_queues(const period_queues&) = delete;
+    inline period_queues(period_queues&&) = default;                //!< Move constructor
+    period_queues& operator=(const period_queues&) = delete;
+    inline period_queues& operator=(period_queues&&) = default;     //!< Move assignment \return Reference to `this`
+
+    /*!
+    \brief Find period queue element
+    \param period Period number
+    \return Pointer to period queue element, nullptr if there is none for `period`
+    */
+    [[gnu::pure]]
+    inline const period_queue_element* find(period_type period) const noexcept
+    {
+        const slot& s = *ring[period & mask];
+        return (s.period == period) ? &s.element : nullptr;
+    }
 
     /*!
     \brief Get abstract period index for period prediction
@@ -112,6 +285,79 @@ struct period_queues final {
         return { p, p, false };
     }
 
+    /*!
+    \brief Get period attribution for a block of TOAs
+
+    The period predictor state must not change within the block, i.e. there must not be a
+    TDC event between the TOAs. This is the batch version of
+    `period_index_for(predictor.period_prediction(ts))`, but multiplies by the
+    inverse period interval, so events extremely close to the period boundaries might be attributed differently.
+    The loop has no branches and is vectorized by the compiler.
+
+    \param predictor    Period predictor
+    \param ts           TOAs in clock ticks
+    \param n            Number of TOAs
+    \param block        Output, contains period attribution information for the block
+    */
+    inline void period_indices_for(const period_predictor& predictor, const int64_t* ts, size_t n, period_block& block) const
+    {
+        block.reserve(n);
+        block.cache.fill({});
+        const int64_t start = predictor.reference_start();
+        const double inv = predictor.inverse_interval_prediction();
+        const double correction = predictor.period_correction();
+        const double high = 1. - threshold;
+        const double low = threshold;
+        period_type* __restrict__ period = block.period.data();
+        uint8_t* __restrict__ kind = block.kind.data();
+        for (size_t i=0; i<n; i++) {
+            const double pf = (ts[i] - start) * inv + correction;
+            const double fl = std::floor(pf);
+            const double f = pf - fl;
+            period[i] = (period_type)fl;
+            kind[i] = (f > high) ? period_block::disputed_high : ((f < low) ? period_block::disputed_low : period_block::undisputed);
+        }
+    }
+
+    /*!
+    \brief Get refined abstract period index for an event of a block
+
+    Equivalent to `refined_index()` on the abstract period index for event `i`, but
+    the reorder queue lookups are cached within the block. This is valid because
+    period change start time stamps are only registered at TDC events.
+
+    \param block        Period attribution for the block, see `period_indices_for()`
+    \param i            Event number within the block
+    \param time_stamp   Time stamp (in clock ticks) of the event
+    \return Refined abstract period index for the event
+    */
+    inline period_index refined_index(period_block& block, size_t i, int64_t time_stamp) const noexcept
+    {
+        const period_type p = block.period[i];
+        const uint8_t kind = block.kind[i];
+        if (__builtin_expect(kind == period_block::undisputed, 1))
+            return { p, p, false };
+
+        period_index idx = (kind == period_block::disputed_high) ? period_index{ p, p+1, true } : period_index{ p-1, p, true };
+        auto& entry = block.cache[kind - period_block::disputed_low];
+        if (entry.disputed_period != idx.disputed_period) {
+            entry.disputed_period = idx.disputed_period;
+            const auto pqe = find(idx.disputed_period);
+            entry.start_seen = (pqe != nullptr) && pqe->start_seen;
+            if (entry.start_seen)
+                entry.start = pqe->start;
+        }
+        if (! entry.start_seen)
+            return idx;
+
+        idx.disputed = false;
+        if (entry.start > time_stamp)
+            idx.disputed_period = idx.period;
+        else
+            idx.period = idx.disputed_period;
+        return idx;
+    }
+
     /*!
     \brief Refine abstract period index according to timestamp
 
@@ -126,17 +372,16 @@ struct period_queues final {
         if (! to_refine.disputed)
             return;
 
-        const auto pqe_ptr = element.find(to_refine.disputed_period);
-        if (pqe_ptr == std::end(element))
+        const auto pqe = find(to_refine.disputed_period);
+        if (pqe == nullptr)
             return;
 
-        const auto& pqe = pqe_ptr->second;
-        if (! pqe.start_seen)
+        if (! pqe->start_seen)
             return;
         
         to_refine.disputed = false;
 
-        if (pqe.start > time_stamp)
+        if (pqe->start > time_stamp)
             to_refine.disputed_period = to_refine.period;
         else
             to_refine.period = to_refine.disputed_period;
@@ -147,68 +392,89 @@ struct period_queues final {
     /*!
     \brief Map abstract period index to period queue element
     \param idx Abstract period change index
-    \return Period queue element
+    \return Period queue element, created if necessary
     */
-    [[gnu::pure]]
-    inline period_queue_element& operator[](const period_index& idx) noexcept
+    inline period_queue_element& operator[](const period_index& idx)
     {
-        return element[idx.disputed_period];
+        return (*this)[idx.disputed_period];
     }
 
     /*!
     \brief Map period number to period queue element
     \param period Period number
-    \return Period queue element
+    \return Period queue element, created if necessary
     */
-    [[gnu::pure]]
-    inline period_queue_element& operator[](const period_type& period) noexcept
+    inline period_queue_element& operator[](const period_type& period)
     {
-        return element[period];
+        slot* s = ring[period & mask].get();
+        if (__builtin_expect(s->period == period, 1))
+            return s->element;
+        if (s->period != unused) {
+            grow(period);
+            s = ring[period & mask].get();
+        }
+        s->period = period;
+        count++;
+        return s->element;
     }
 
     /*!
     \brief Register start timestamp for a period change indexed by a disputed period index
     \param idx      Abstract period index, must be disputed
     \param start    Time stamp in clock ticks
-    \return Event reorder queue for the period change indexed by `idx`
+    \return Unordered events of the disputed interval for the period change indexed by `idx`
     */
-    inline event_reorder_queue& registerStart(const period_index& idx, int64_t start) noexcept
+    inline std::vector<reordering_element>& registerStart(const period_index& idx, int64_t start)
     {
         assert(idx.disputed);
         auto& pqe = (*this)[idx];
         assert(! pqe.start_seen);
         pqe.start = start;
         pqe.start_seen = true;
-        return *pqe.queue;
+        return pqe.queue;
     }
 
     /*!
-    \brief Get iterator to earliest period queue element
-    \return Iterator to earliest period queue element
+    \brief Get earliest remembered period change
+    \return Period number of earliest period queue element, must not be called for an empty collection
     */
     [[gnu::pure]]
-    inline queue_type::iterator oldest() noexcept
+    inline period_type oldest() const noexcept
     {
-        return std::begin(element);
+        assert(count > 0);
+        period_type p = std::numeric_limits<period_type>::max();
+        for (const auto& s : ring)
+            if ((s->period != unused) && (s->period < p))
+                p = s->period;
+        return p;
     }
 
     /*!
-    \brief End iterator
-    \return End iterator
+    \brief Erase period queue element
+    The slot is kept for reuse.
+    \param period Period number of period queue element
     */
-    [[gnu::pure]]
-    inline queue_type::iterator end() noexcept
+    inline void erase(period_type period) noexcept
     {
-        return std::end(element);
+        slot& s = *ring[period & mask];
+        if (s.period != period)
+            return;
+        s.period = unused;
+        s.element.reset();
+        count--;
     }
 
     /*!
-    \brief Erase period queue element
-    \param pos Period queue element position as iterator
+    \brief Call a function for every remembered period change, in ring order
+    \tparam Function    Callable type
+    \param f            Called as `f(period, element)` for every remembered period change
     */
-    inline void erase(queue_type::iterator pos)
+    template<typename Function>
+    inline void visit(Function&& f) const
     {
-        element.erase(pos);
+        for (const auto& s : ring)
+            if (s->period != unused)
+                f(s->period, static_cast<const period_queue_element&>(s->element));
     }
 
     /*!
@@ -216,9 +482,9 @@ struct period_queues final {
     \return Number of period queue elements
     */
     [[gnu::pure]]
-    inline queue_type::size_type size() const noexcept
+    inline size_t size() const noexcept
     {
-        return element.size();
+        return count;
     }
 
     /*!
@@ -228,10 +494,18 @@ struct period_queues final {
     [[gnu::pure]]
     inline bool empty() const noexcept
     {
-        return element.empty();
+        return count == 0;
     }
 
-    queue_type element;         //!< The remembered period changes
+    /*!
+    \brief Get number of slots
+    \return Ring capacity
+    */
+    [[gnu::pure]]
+    inline size_t capacity() const noexcept
+    {
+        return ring.size();
+    }
 
     /*!
     \brief Disputed period threshold
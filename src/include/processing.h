@@ -6,10 +6,48 @@
 Includes for processing code
 */
 
+#include <ostream>
+#include <istream>
+#include <string>
+#include <vector>
+#include <cstdint>
 #include "layout.h"
 
+namespace preview {
+    class publisher;
+}
+
+namespace checkpoint {
+    struct chip_state;
+    struct image;
+}
+
+namespace latency_trace {
+    class tracer;
+}
+
 namespace processing {
 
+    /*!
+    \brief Set the live preview publisher (see live_preview.h)
+
+    Every aggregated period histogram, or merged histogram for `collect()`, is published
+    before it is written. Takes effect with the next `init()` or `collect()`.
+
+    \param live Live preview publisher, must outlive the analysis, nullptr for none
+    */
+    void setPreview(preview::publisher* live);
+
+    /*!
+    \brief Set the period latency tracer (see latency_trace.h)
+
+    `init()` configures the tracer for the detector and the aggregate+write thread
+    stamps every output period into it. Takes effect with the next `init()`.
+
+    \param trace Period latency tracer, must outlive the analysis, nullptr for none
+    */
+    void setTrace(latency_trace::tracer* trace);
+
     /*!
     \brief Initialize the event analysis code
 
@@ -17,9 +55,67 @@ namespace processing {
     The "Processing.ini" file in the current directory will be parsed, and
     corresponding Detector and Analysis objects will be created.
 
-    \param layout The detector layout
+    \param layout          The detector layout
+    \param workersPerChip  Number of histogramming workers per chip, each of them fills in its own data
+    */
+    void init(const detector_layout& layout, unsigned workersPerChip=1);
+
+    /*!
+    \brief Initialize the event analysis code for an analysis shard (see sharding.h)
+
+    Like `init(layout, workersPerChip)`, but the analysis only covers the given chips,
+    which are renumbered 0..chips.size()-1 in the order of `chips`.
+
+    \param layout          The complete detector layout, matching the "XESPoints.inp" file
+    \param workersPerChip  Number of histogramming workers per chip
+    \param chips           Global chip numbers of the shard chips, indexed by chip number within the shard
+    \param partialOutput   If not nullptr, partial period histograms are written to this stream
+                           in the binary output format instead of the "Processing.ini" output
+    */
+    void init(const detector_layout& layout, unsigned workersPerChip, const std::vector<unsigned>& chips, std::ostream* partialOutput);
+
+    /*!
+    \brief Write outstanding period histograms and release the analysis objects
+
+    Must be called after the last event was processed if the output stream
+    given to `init()` is destroyed before the end of the program.
+    */
+    void finish();
+
+    /*!
+    \brief Merge partial period histograms of analysis shards and write them
+
+    Output files and format are taken from "Processing.ini". A period is written once every stream has
+    delivered its partial histogram for it. At the end, incomplete periods are written as well.
+
+    \param partials    Partial histogram streams, one per shard, in the binary output format
+    \return Number of periods written
+    \throw std::runtime_error if a stream is invalid
+    */
+    uint64_t collect(const std::vector<std::istream*>& partials);
+
+    /*!
+    \brief Name of the event processing kernel selected by `init()`
+
+    `init()` selects a specialization of the event processing code for the histogramming mode
+    (HistogramMode entry of "Processing.ini"), for energy point tables where every pixel maps to a
+    single energy point with weight 1, and for power of two time bin steps.
+
+    \return Kernel name like "toa/single-ep", empty before `init()`
+    */
+    std::string kernelName();
+
+    /*!
+    \brief Check if purging a period changes the histogram saving state
+
+    If this is true, all events of earlier periods must have been processed before `purgePeriod()`
+    is called for `period`, and no worker of the chip may process events concurrently.
+
+    \param chipIndex    Chip number
+    \param period       Period that is about to be purged
+    \return True if `purgePeriod()` for `period` will return histogram data or move the save point
     */
-    void init(const detector_layout& layout);
+    bool purgeRequired(unsigned chipIndex, period_type period);
 
     /*!
     \brief Purge an old period change interval off the period queue
@@ -36,10 +132,67 @@ namespace processing {
     \param chipIndex        Event was on this chip
     \param period           Period of the event
     \param relative_toaclk  The relative TOA for the event, relative to the last TDC event
-    \param event            The raw event data
+    \param event            Packed hit (see AsiRawStreamDecoder::packHit)
     */
     void processEvent(unsigned chipIndex, const period_type period, int64_t relative_toaclk, uint64_t event);
 
+    /*!
+    \brief Process a TOA event in a histogramming worker
+    \param chipIndex        Event was on this chip
+    \param worker           Histogramming worker number for this chip
+    \param period           Period of the event
+    \param relative_toaclk  The relative TOA for the event, relative to the last TDC event
+    \param event            Packed hit (see AsiRawStreamDecoder::packHit)
+    */
+    void processEvent(unsigned chipIndex, unsigned worker, const period_type period, int64_t relative_toaclk, uint64_t event);
+
+    /*!
+    \brief Reallocate the per thread histograms of a histogramming thread
+
+    Called by the histogramming thread itself before it processes any event,
+    so the histogram memory is first touched on the NUMA node of that thread.
+
+    \param chipIndex    Chip number
+    \param worker       Histogramming worker number for this chip
+    */
+    void localize(unsigned chipIndex, unsigned worker);
+
+    /*!
+    \brief Write live XES data manager counters in Prometheus text format
+
+    Only reads counters, can be called from any thread at any time after `init()`.
+
+    \param out Output stream
+    */
+    void writeMetrics(std::ostream& out);
+
+    /*!
+    \brief Describe the histogram layout for checkpoints (see checkpoint.h)
+    \param img Set `workers`, `bins` and `save_interval` of the checkpoint image
+    */
+    void checkpointLayout(checkpoint::image& img);
+
+    /*!
+    \brief Copy the histogram state of a chip into a checkpoint
+
+    Must be called by the analyser thread of the chip, with all events of the chip processed
+    by the histogramming workers.
+
+    \param chipIndex    Chip number
+    \param state        The save point and the histograms of periods that are not saved yet are appended
+    */
+    void capture(unsigned chipIndex, checkpoint::chip_state& state);
+
+    /*!
+    \brief Restore the histogram state of all chips from a checkpoint
+
+    Must be called after `init()` and before any event is processed.
+
+    \param img Checkpoint image
+    \throw std::invalid_argument if the checkpoint doesn't match the "Processing.ini" settings
+    */
+    void restore(const checkpoint::image& img);
+
     // /*!
     // \brief Process a TOA event
     // \param chipIndex        Event was on this chip
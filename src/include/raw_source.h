@@ -0,0 +1,207 @@
+#ifndef RAW_SOURCE_H
+#define RAW_SOURCE_H
+
+/*!
+\file
+Provide raw event data stream sources: TCP socket or memory mapped file
+*/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Poco/Exception.h"
+#include "Poco/Net/StreamSocket.h"
+#include "block_compression.h"
+
+/*!
+\brief Raw event data stream source interface
+
+The reader thread of `DataHandler` only needs `receiveBytes()` semantics from its source.
+*/
+struct raw_source {
+    /*!
+    \brief Receive raw stream bytes
+    \param buf  Byte buffer
+    \param size Maximum number of bytes to receive
+    \return Number of bytes received, 0 at the end of the stream
+    */
+    virtual int receiveBytes(void* buf, int size) = 0;
+
+    /*!
+    \brief Source description for logging
+    \return Human readable source name
+    */
+    virtual std::string name() const = 0;
+
+    /*!
+    \brief Destructor
+    */
+    virtual ~raw_source() = default;
+};
+
+/*!
+\brief Raw event data stream from the ASI server TCP connection
+*/
+class socket_source final : public raw_source {
+    Poco::Net::StreamSocket& socket;    //!< Raw event data stream receiving end
+
+  public:
+    /*!
+    \brief Constructor
+    \param s Connected raw event data stream socket
+    */
+    inline explicit socket_source(Poco::Net::StreamSocket& s) noexcept
+        : socket{s}
+    {}
+
+    inline int receiveBytes(void* buf, int size) override
+    {
+        return socket.receiveBytes(buf, size);
+    }
+
+    inline std::string name() const override
+    {
+        return socket.address().toString();
+    }
+};
+
+/*!
+\brief Raw event data stream from a captured raw stream file
+
+The file is memory mapped read only with sequential access advice,
+so the kernel reads ahead and `receiveBytes()` is a plain copy.
+Block compressed files (see block_compression.h) are decompressed block by block
+while they are read, by a `block_compression::block_reader` with parallel read-ahead.
+*/
+class file_source final : public raw_source {
+    const std::string path;     //!< File path
+    const char* data = nullptr; //!< Mapped file content
+    size_t mapped = 0;          //!< Mapped file size in bytes
+    size_t size = 0;            //!< Raw stream size in bytes, uncompressed
+    size_t pos = 0;             //!< Read position
+    size_t packed = 0;          //!< Compressed file size in bytes, 0 for uncompressed files
+    std::unique_ptr<block_compression::block_reader> unpacker;  //!< Decompressing reader for compressed files, nullptr otherwise
+
+    /*!
+    \brief Set up block by block decompression of the mapped compressed file
+    \throw Poco::DataFormatException if the file does not consist of complete blocks
+    */
+    inline void decompress()
+    {
+        std::vector<block_compression::block_info> blocks;
+        try {
+            blocks = block_compression::index(data, mapped);
+        } catch (std::exception& ex) {
+            throw Poco::DataFormatException(path + ": " + ex.what());
+        }
+        packed = mapped;
+        size = block_compression::raw_size(blocks);
+        unpacker.reset(new block_compression::block_reader{data, blocks});
+    }
+
+  public:
+    /*!
+    \brief Constructor, maps the file
+    \param file_path Path to raw stream file
+    \throw Poco::ReadFileException if the file cannot be opened or mapped
+    */
+    inline explicit file_source(const std::string& file_path)
+        : path{file_path}
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw Poco::ReadFileException(std::string("unable to open input file ") + path + ": " + std::strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            const int err = errno;
+            close(fd);
+            throw Poco::ReadFileException(std::string("unable to stat input file ") + path + ": " + std::strerror(err));
+        }
+        size = mapped = info.st_size;
+        if (mapped > 0) {
+            void* mem = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE, fd, 0);
+            const int err = errno;
+            close(fd);
+            if (mem == MAP_FAILED)
+                throw Poco::ReadFileException(std::string("unable to map input file ") + path + ": " + std::strerror(err));
+            madvise(mem, mapped, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mem);
+            if (block_compression::is_compressed(data, mapped)) {
+                try {
+                    decompress();
+                } catch (...) {
+                    munmap(const_cast<char*>(data), mapped);
+                    throw;
+                }
+            }
+        } else {
+            close(fd);
+        }
+    }
+
+    file_source(const file_source&) = delete;
+    file_source(file_source&&) = delete;
+    file_source& operator=(const file_source&) = delete;
+    file_source& operator=(file_source&&) = delete;
+
+    /*!
+    \brief Destructor, unmaps the file
+    */
+    inline ~file_source() override
+    {
+        unpacker.reset();
+        if (data)
+            munmap(const_cast<char*>(data), mapped);
+    }
+
+    inline int receiveBytes(void* buf, int max_size) override
+    {
+        if (unpacker) {
+            try {
+                return unpacker->read(static_cast<char*>(buf), std::max(max_size, 0));
+            } catch (std::exception& ex) {
+                throw Poco::DataFormatException(path + ": " + ex.what());
+            }
+        }
+        const size_t n = std::min(size - pos, (size_t)std::max(max_size, 0));
+        if (n == 0)
+            return 0;
+        std::memcpy(buf, &data[pos], n);
+        pos += n;
+        return n;
+    }
+
+    inline std::string name() const override
+    {
+        return path;
+    }
+
+    /*!
+    \brief File size
+    \return Size of the raw stream in bytes, uncompressed
+    */
+    [[gnu::pure]]
+    inline size_t file_size() const noexcept
+    {
+        return size;
+    }
+
+    /*!
+    \brief Compressed file size
+    \return Size of a block compressed file in bytes, 0 for uncompressed files
+    */
+    [[gnu::pure]]
+    inline size_t compressed_size() const noexcept
+    {
+        return packed;
+    }
+};
+
+#endif // RAW_SOURCE_H
@@ -0,0 +1,294 @@
+#ifndef SHARD_HANDLER_H
+#define SHARD_HANDLER_H
+
+/*!
+\file
+Provide raw stream distribution to analysis shards
+*/
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include "Poco/Exception.h"
+#include "Poco/Net/StreamSocket.h"
+#include "logging.h"
+#include "raw_source.h"
+#include "spsc_ring.h"
+#include "adaptive_wait.h"
+#include "metrics.h"
+#include "sharding.h"
+
+namespace {
+    using Poco::Net::StreamSocket;
+    using Poco::LogicException;
+    using Poco::ReadFileException;
+    using Poco::DataFormatException;
+    using wall_clock = std::chrono::high_resolution_clock;  //!< Clock object
+}
+
+/*!
+\brief Handler object for splitting a raw stream by chip and forwarding it to analysis shards
+
+The reader thread reads raw event data packet chunks into preallocated buffers and relabels
+their chip number for the receiving shard (see sharding.h). One sender thread per shard writes
+the chunks to the shard connection, so a slow shard only stalls the stream once all of its
+buffers are in flight.
+*/
+class ShardHandler final {
+    constexpr static uint64_t tpxHeader = 861425748UL; //!< 'TPX3' as uint64_t
+
+    using buffer_type = std::unique_ptr<std::vector<char>>;   //!< Chunk buffer with packet header
+
+    /*!
+    \brief Connection to one shard
+    */
+    struct shard_link final {
+        StreamSocket& socket;               //!< Shard connection
+        spsc_ring<buffer_type> filled;      //!< Chunks for the sender thread
+        spsc_ring<buffer_type> empty;       //!< Buffers returned by the sender thread
+        adaptive_wait::wait_point queued;   //!< Signal filled chunks and `finished`, the sender waits here
+        adaptive_wait::wait_point returned; //!< Signal returned buffers, the reader waits here
+        std::atomic<bool> finished = false; //!< No more chunks are coming
+        std::thread sender;                 //!< Sender thread
+        metrics::counter bytes;             //!< Number of bytes sent, written by the sender thread
+        metrics::counter chunks;            //!< Number of chunks sent, written by the sender thread
+
+        /*!
+        \brief Constructor
+        \param s        Shard connection
+        \param buffers  Number of chunk buffers
+        */
+        inline shard_link(StreamSocket& s, std::size_t buffers)
+            : socket{s}, filled{buffers}, empty{buffers}
+        {
+            for (std::size_t i=0; i<buffers; i++) {
+                buffer_type buf{new std::vector<char>{}};
+                empty.try_push(std::move(buf));
+            }
+        }
+    };
+
+    raw_source& dataStream;     //!< Raw event data stream source
+    Logger& logger;             //!< Poco::Logger object for logging
+    const unsigned numChips;    //!< Number of detector chips
+    std::vector<std::unique_ptr<shard_link>> shard;   //!< Shard connections, indexed by shard number
+    std::thread readerThread;   //!< Raw event data reader thread
+    std::atomic<bool> stopOperation = false;    //!< Stop requested flag
+
+    /*!
+    \brief Check stop flag
+    \return True for stopping requested
+    */
+    bool stop() const
+    {
+        return stopOperation.load(std::memory_order_consume);
+    }
+
+    /*!
+    \brief Request threads to stop
+    */
+    void stopNow()
+    {
+        stopOperation.store(true, std::memory_order_release);
+        for (auto& link : shard) {
+            link->queued.notify();
+            link->returned.notify();
+        }
+    }
+
+    /*!
+    \brief Read data into byte buffer
+    \param buf  Byte buffer
+    \param size Number of bytes to read
+    \return Number of bytes effectively read
+    */
+    int readBytes(void* buf, int size)
+    {
+        int numBytes = 0;
+
+        do {
+            int numRead = dataStream.receiveBytes(&static_cast<char*>(buf)[numBytes], size - numBytes);
+            if (numRead == 0)
+                break;
+            numBytes += numRead;
+        } while (numBytes < size);
+
+        return numBytes;
+    }
+
+    /*!
+    \brief Code for raw event data reader thread
+    */
+    void readData()
+    {
+        double time = .0;
+
+        try {
+            const unsigned numShards = shard.size();
+            while (! stop()) {
+                uint64_t header = 0;
+                const auto t1 = wall_clock::now();
+                int bytesRead = readBytes(&header, sizeof(header));
+                if (bytesRead == 0)
+                    break;
+                if (bytesRead < (int)sizeof(header))
+                    throw ReadFileException("read incomplete header");
+                if ((header & 0xffffffffUL) != tpxHeader)
+                    throw DataFormatException("chunk header expected");
+                const unsigned chipIndex = (header >> 32) & 0xff;
+                const uint64_t chunkSize = header >> 48;
+                if (chipIndex >= numChips)
+                    throw DataFormatException(std::string("invalid chip index ") + std::to_string(chipIndex));
+
+                shard_link& link = *shard[sharding::shard_of(chipIndex, numShards)];
+                buffer_type buf;
+                link.returned.await([this, &link, &buf]() { return link.empty.try_pop(buf) || stop(); });
+                if (! buf)
+                    break;
+
+                buf->resize(sizeof(header) + chunkSize);
+                header = sharding::relabel(header, sharding::local_chip(chipIndex, numShards));
+                std::memcpy(buf->data(), &header, sizeof(header));
+                bytesRead = readBytes(&(*buf)[sizeof(header)], chunkSize);
+                if (bytesRead < (int)chunkSize)
+                    throw DataFormatException("incomplete chunk");
+                time += std::chrono::duration<double>(wall_clock::now() - t1).count();
+
+                link.filled.try_push(std::move(buf));   // never full, there are as many slots as buffers
+                link.queued.notify();
+            }
+        } catch (Poco::Exception& ex) {
+            stopNow();
+            logger << "reader exception: " << ex.displayText() << log_critical;
+        } catch (std::exception& ex) {
+            stopNow();
+            logger << "reader exception: " << ex.what() << log_critical;
+        }
+
+        for (auto& link : shard) {
+            link->finished.store(true, std::memory_order_release);
+            link->queued.notify();
+        }
+        readTime += time;
+        logger << "reader waits: " << adaptive_wait::stats.to_string() << log_info;
+        logger << "reader stopped" << log_debug;
+    }
+
+    /*!
+    \brief Code for shard sender thread
+    \param link Shard connection
+    */
+    void sendData(shard_link& link)
+    {
+        try {
+            while (true) {
+                buffer_type buf;
+                link.queued.await([this, &link, &buf]() {
+                    const bool done = link.finished.load(std::memory_order_acquire) || stop();
+                    return link.filled.try_pop(buf) || done;
+                });
+                if (! buf || stop())
+                    break;
+                for (std::size_t sent=0; sent<buf->size();) {
+                    const int n = link.socket.sendBytes(&(*buf)[sent], buf->size() - sent);
+                    if (n <= 0)
+                        throw ReadFileException("shard connection closed");
+                    sent += n;
+                }
+                link.bytes.add(buf->size());
+                link.chunks.add();
+                link.empty.try_push(std::move(buf));
+                link.returned.notify();
+            }
+            link.socket.shutdownSend();
+        } catch (Poco::Exception& ex) {
+            stopNow();
+            logger << "sender exception for " << link.socket.peerAddress().toString() << ": " << ex.displayText() << log_critical;
+        } catch (std::exception& ex) {
+            stopNow();
+            logger << "sender exception: " << ex.what() << log_critical;
+        }
+        logger << "sender waits: " << adaptive_wait::stats.to_string() << log_info;
+    }
+
+public:
+    /*!
+    \brief Constructor
+    \param source       Raw event data stream source
+    \param log          Logging object
+    \param shards       Connected shard sockets, chip c goes to shard c % shards.size()
+    \param chips        Number of detector chips
+    \param buffers      Number of chunk buffers per shard
+    \throw LogicException without shards
+    */
+    ShardHandler(raw_source& source, Logger& log, std::vector<StreamSocket>& shards, unsigned chips, std::size_t buffers)
+        : dataStream{source}, logger{log}, numChips{chips}
+    {
+        logger << "ShardHandler(" << source.name() << ", " << shards.size() << ", " << chips << ", " << buffers << ')' << log_trace;
+        if (shards.empty())
+            throw LogicException("no shards");
+        for (auto& socket : shards)
+            shard.emplace_back(new shard_link{socket, std::max<std::size_t>(buffers, 1)});
+    }
+
+    ShardHandler(const ShardHandler&) = delete;
+    ShardHandler(ShardHandler&&) = delete;
+    ShardHandler& operator=(const ShardHandler&) = delete;
+    ShardHandler& operator=(ShardHandler&&) = delete;
+
+    /*!
+    \brief Start reader and sender threads
+    */
+    void run_async()
+    {
+        for (auto& link : shard)
+            link->sender = std::thread([this, &link]{ this->sendData(*link); });
+        readerThread = std::thread([this]{ this->readData(); });
+    }
+
+    /*!
+    \brief Wait for completion of reader and sender threads
+    */
+    void await()
+    {
+        readerThread.join();
+        for (auto& link : shard)
+            link->sender.join();
+    }
+
+    /*!
+    \brief Number of bytes sent to a shard
+    \param s Shard number
+    \return Bytes including packet headers
+    */
+    uint64_t bytesSent(unsigned s) const noexcept
+    {
+        return shard[s]->bytes.get();
+    }
+
+    /*!
+    \brief Number of chunks sent to a shard
+    \param s Shard number
+    \return Raw event data packet chunks
+    */
+    uint64_t chunksSent(unsigned s) const noexcept
+    {
+        return shard[s]->chunks.get();
+    }
+
+    /*!
+    \brief Check for errors
+    \return True if a thread failed
+    */
+    bool failed() const noexcept
+    {
+        return stop();
+    }
+
+    double readTime = .0;   //!< Time used by the reader thread for reading
+};
+
+#endif // SHARD_HANDLER_H
@@ -0,0 +1,198 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+/*!
+\file
+Provide chip shard routing and partial histogram merging for distributed analysis
+*/
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+/*!
+\brief Distributed analysis over several nodes
+
+An ingest process receives the raw stream and forwards the chunks of chip `c` to shard
+`c % shards`, relabelled as local chip `c / shards`. Every shard runs the normal analysis
+pipeline for its chips and sends its partial period histograms to a collector, which
+sums them up per period and writes the result once all shards have contributed.
+*/
+namespace sharding {
+
+    /*!
+    \brief Shard of a chip
+    \param chip     Global chip number
+    \param shards   Number of shards
+    \return Shard number
+    */
+    [[gnu::const]]
+    inline unsigned shard_of(unsigned chip, unsigned shards) noexcept
+    {
+        return chip % shards;
+    }
+
+    /*!
+    \brief Local chip number within the shard of a chip
+    \param chip     Global chip number
+    \param shards   Number of shards
+    \return Chip number within the shard
+    */
+    [[gnu::const]]
+    inline unsigned local_chip(unsigned chip, unsigned shards) noexcept
+    {
+        return chip / shards;
+    }
+
+    /*!
+    \brief Global chip numbers of a shard
+    \param shard        Shard number
+    \param shards       Number of shards
+    \param num_chips    Number of detector chips
+    \return Global chip number indexed by local chip number
+    */
+    inline std::vector<unsigned> shard_chips(unsigned shard, unsigned shards, unsigned num_chips)
+    {
+        std::vector<unsigned> res;
+        for (unsigned chip=shard; chip<num_chips; chip+=shards)
+            res.push_back(chip);
+        return res;
+    }
+
+    /*!
+    \brief Parse shard specification
+    \param spec Specification in the form K/N for shard K of N shards
+    \return Shard number and number of shards
+    \throw std::invalid_argument if `spec` is invalid
+    */
+    inline std::pair<unsigned, unsigned> parse_shard(const std::string& spec)
+    {
+        const auto slash = spec.find('/');
+        std::size_t pos1 = 0, pos2 = 0;
+        unsigned long shard = 0, shards = 0;
+        try {
+            if (slash == std::string::npos)
+                throw std::invalid_argument("no slash");
+            shard = std::stoul(spec.substr(0, slash), &pos1);
+            shards = std::stoul(spec.substr(slash + 1), &pos2);
+        } catch (std::exception&) {
+            throw std::invalid_argument(std::string("invalid shard specification ") + spec + ", K/N expected");
+        }
+        if ((pos1 != slash) || (pos2 != spec.size() - slash - 1) || (shards == 0) || (shard >= shards))
+            throw std::invalid_argument(std::string("invalid shard specification ") + spec + ", K/N with K < N expected");
+        return {shard, shards};
+    }
+
+    /*!
+    \brief Change the chip number of a raw event data packet header
+    \param header   First packet header word
+    \param chip     New chip number
+    \return Header with chip number bits 39..32 replaced by `chip`
+    */
+    [[gnu::const]]
+    inline uint64_t relabel(uint64_t header, unsigned chip) noexcept
+    {
+        return (header & ~(0xffUL << 32)) | (uint64_t(chip & 0xff) << 32);
+    }
+
+    /*!
+    \brief Partial or merged histogram of one period
+    */
+    struct record final {
+        int64_t period = 0;             //!< Period number
+        uint32_t npoints = 0;           //!< Number of energy points
+        uint64_t time_points = 0;       //!< Number of time points
+        int64_t before_roi = 0;         //!< Number of events before the time ROI
+        int64_t after_roi = 0;          //!< Number of events after the time ROI
+        int64_t total = 0;              //!< Total number of events
+        std::vector<int32_t> bins;      //!< Histogram indexed by [time_point * npoints + energy_point]
+    };
+
+    /*!
+    \brief Sum up partial period histograms of all shards
+
+    Shards may deliver periods in any order. A period is complete as soon as
+    every shard delivered its partial histogram for it.
+    */
+    class merger final {
+        /*!
+        \brief Period being merged
+        */
+        struct entry final {
+            unsigned parts = 0;         //!< Number of partial histograms added
+            record sum;                 //!< Sum of partial histograms
+        };
+
+        const unsigned shards;          //!< Number of shards
+        std::map<int64_t, entry> open;  //!< Incomplete periods
+
+      public:
+        /*!
+        \brief Constructor
+        \param n Number of shards
+        */
+        inline explicit merger(unsigned n)
+            : shards{n}
+        {}
+
+        /*!
+        \brief Add partial histogram
+        \param part         Partial histogram of one shard, moved from
+        \param complete     Set to the merged histogram if `part` completes its period
+        \return True if `complete` was set
+        \throw std::invalid_argument if `part` doesn't match the dimensions of earlier parts
+        */
+        inline bool add(record&& part, record& complete)
+        {
+            if (part.bins.size() != std::size_t(part.npoints) * part.time_points)
+                throw std::invalid_argument(std::string("partial histogram for period ") + std::to_string(part.period) + " has the wrong size");
+            auto [it, created] = open.try_emplace(part.period);
+            entry& e = it->second;
+            if (created) {
+                e.sum = std::move(part);
+            } else {
+                record& sum = e.sum;
+                if ((sum.npoints != part.npoints) || (sum.time_points != part.time_points))
+                    throw std::invalid_argument(std::string("partial histograms for period ") + std::to_string(part.period) + " have different dimensions");
+                for (std::size_t i=0; i<sum.bins.size(); i++)
+                    sum.bins[i] += part.bins[i];
+                sum.before_roi += part.before_roi;
+                sum.after_roi += part.after_roi;
+                sum.total += part.total;
+            }
+            if (++e.parts < shards)
+                return false;
+            complete = std::move(e.sum);
+            open.erase(it);
+            return true;
+        }
+
+        /*!
+        \brief Take incomplete periods
+        \return Merged histograms of periods not all shards contributed to, in period order
+        */
+        inline std::vector<record> incomplete()
+        {
+            std::vector<record> res;
+            for (auto& [period, e] : open)
+                res.push_back(std::move(e.sum));
+            open.clear();
+            return res;
+        }
+
+        /*!
+        \brief Number of incomplete periods
+        \return Periods waiting for partial histograms
+        */
+        inline std::size_t pending() const noexcept
+        {
+            return open.size();
+        }
+    };
+
+} // namespace sharding
+
+#endif // SHARDING_H
@@ -0,0 +1,122 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/*!
+\file
+Provide a bounded single producer single consumer ring buffer
+*/
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/*!
+\brief Bounded lock-free single producer single consumer ring buffer
+
+The capacity is rounded up to a power of two, all slots are allocated up front.
+Producer and consumer positions live on separate cache lines, and each side keeps
+a cached copy of the other side's position, so the shared atomics are only touched
+when the cached value says the ring is full (producer) or empty (consumer).
+
+Only one thread may call `try_push()`, and only one thread may call `try_pop()`.
+
+\tparam T Element type, must be default constructible and move assignable
+*/
+template<typename T>
+class spsc_ring final {
+    static constexpr std::size_t cache_line = 64;   //!< Assumed cache line size in bytes
+
+    alignas(cache_line) std::atomic<std::size_t> head{0};   //!< Consumer position
+    std::size_t cached_tail = 0;                            //!< Consumer's copy of `tail`
+    alignas(cache_line) std::atomic<std::size_t> tail{0};   //!< Producer position
+    std::size_t cached_head = 0;                            //!< Producer's copy of `head`
+    alignas(cache_line) std::vector<T> slot;                //!< Ring slots
+    std::size_t mask;                                       //!< Slot index mask, `slot.size() - 1`
+
+    /*!
+    \brief Round up to power of two
+    \param n Value
+    \return Smallest power of two >= max(n, 1)
+    */
+    static constexpr std::size_t round_up(std::size_t n) noexcept
+    {
+        std::size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+  public:
+    /*!
+    \brief Constructor
+    \param capacity Minimum number of elements the ring can hold
+    */
+    explicit spsc_ring(std::size_t capacity)
+        : slot(round_up(capacity)), mask{slot.size() - 1}
+    {}
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring(spsc_ring&&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+    spsc_ring& operator=(spsc_ring&&) = delete;
+    ~spsc_ring() = default;
+
+    /*!
+    \brief Producer side: append element
+    \param value Will be moved into the ring if there is space
+    \return False if the ring is full, `value` is untouched in that case
+    */
+    inline bool try_push(T&& value) noexcept
+    {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        if (__builtin_expect(t - cached_head > mask, 0)) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+                return false;
+        }
+        slot[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+    \brief Consumer side: remove oldest element
+    \param value Oldest element will be moved into this if the ring is not empty
+    \return False if the ring is empty
+    */
+    inline bool try_pop(T& value) noexcept
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        if (__builtin_expect(h == cached_tail, 0)) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        value = std::move(slot[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+    \brief Approximate number of elements in the ring
+    Exact if called while neither side is active.
+    \return Number of elements
+    */
+    [[gnu::pure]]
+    inline std::size_t size() const noexcept
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    /*!
+    \brief Maximum number of elements in the ring
+    \return Ring capacity
+    */
+    [[gnu::pure]]
+    inline std::size_t capacity() const noexcept
+    {
+        return slot.size();
+    }
+};
+
+#endif // SPSC_RING_H
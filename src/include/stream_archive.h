@@ -0,0 +1,302 @@
+#ifndef STREAM_ARCHIVE_H
+#define STREAM_ARCHIVE_H
+
+/*!
+\file
+Provide raw stream archiving from receive slabs while the stream is analysed
+*/
+
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <ios>
+#include <fcntl.h>
+#include <unistd.h>
+#include "io_slabs.h"
+#include "spsc_ring.h"
+#include "metrics.h"
+#include "thread_placement.h"
+#include "adaptive_wait.h"
+
+/*!
+\brief Raw stream archive writer for slab receive mode (tee mode)
+
+The reader thread passes every full receive slab to the archive with an extra reference.
+The archive writer thread writes the complete raw event data packet chunks of the slab to the
+archive file with one large `write()` straight from slab memory and drops the reference afterwards,
+so the raw stream is never copied for archiving.
+
+If the writer falls behind, the `block` policy makes the reader wait, which eventually stalls the
+data stream, while the `drop` policy drops the slab content from the archive and counts the dropped
+bytes. The archive holds whole chunks in both cases.
+
+With direct IO (`O_DIRECT`, block policy only) all writes but the last one must be a multiple of
+`block_size` long. The reader therefore only archives up to the last block boundary of a slab
+and carries the rest over into the next slab, together with the incomplete chunk at the end.
+*/
+class stream_archive final {
+  public:
+    /*!
+    \brief What to do if the archive writer cannot keep up
+    */
+    enum policy_type {
+        block,  //!< Reader waits for the writer
+        drop    //!< Slab content is dropped from the archive
+    };
+
+    static constexpr std::size_t block_size = 4096; //!< Direct IO length and offset alignment
+
+  private:
+    /*!
+    \brief Slab range to archive
+    */
+    struct range final {
+        io_slab* slab = nullptr;    //!< Slab holding a reference for the archive
+        std::size_t size = 0;       //!< Number of bytes to write from the slab start
+        bool last = false;          //!< Last range of the stream
+    };
+
+    const std::string path;         //!< Archive file path
+    int fd = -1;                    //!< Archive file descriptor
+    bool direct;                    //!< Direct IO is on, switched off by the writer thread for the last write
+    const std::size_t align;        //!< Alignment of archived ranges
+    const policy_type policy;       //!< Back-pressure policy
+    spsc_ring<range> queue;         //!< Ranges not written yet
+    adaptive_wait::wait_point queued;   //!< Signal new ranges and `finished`, the writer waits here
+    adaptive_wait::wait_point popped; //!< Signal written ranges, the reader waits here with the block policy
+    std::atomic<bool> finished = false; //!< No more ranges are coming
+    std::thread writer;             //!< Archive writer thread
+    std::string error;              //!< Write error, only valid after the writer thread is joined
+    std::string writerPlacement_;   //!< Writer thread placement description, only valid after the writer thread is joined
+
+    /*!
+    \brief Live counters of the writer thread
+    */
+    struct alignas(metrics::cache_line) writer_metrics final {
+        metrics::counter written;   //!< Number of bytes written
+        metrics::counter failed;    //!< Number of bytes not written because of a write error
+    } writerMetrics;                //!< Live counters of the writer thread
+
+    /*!
+    \brief Live counters of the reader thread
+    */
+    struct alignas(metrics::cache_line) reader_metrics final {
+        metrics::counter dropped;   //!< Number of bytes dropped by the drop policy
+    } readerMetrics;                //!< Live counters of the reader thread
+
+    /*!
+    \brief Write all bytes
+    \param data Bytes
+    \param size Number of bytes
+    \throw std::ios_base::failure on write errors
+    */
+    inline void writeAll(const char* data, std::size_t size)
+    {
+        while (size > 0) {
+            const ssize_t n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::ios_base::failure(std::string("archive write to ") + path + " failed: " + std::strerror(errno));
+            }
+            data += n;
+            size -= n;
+            writerMetrics.written.add(n);
+        }
+    }
+
+    /*!
+    \brief Write range to archive file
+    \param r Slab range
+    */
+    inline void write(const range& r)
+    {
+        if (! error.empty()) {
+            writerMetrics.failed.add(r.size);
+            return;
+        }
+        const uint64_t before = writerMetrics.written.get();
+        try {
+            std::size_t done = 0;
+            if (direct && r.last) {
+                // only the tail may be unaligned, write it without direct IO
+                done = r.size & ~(block_size - 1);
+                writeAll(r.slab->data, done);
+                const int flags = fcntl(fd, F_GETFL);
+                if ((flags < 0) || (fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0))
+                    throw std::ios_base::failure(std::string("unable to switch off direct IO for ") + path);
+                direct = false;
+            }
+            writeAll(&r.slab->data[done], r.size - done);
+        } catch (std::exception& ex) {
+            error = ex.what();
+            writerMetrics.failed.add(r.size - (writerMetrics.written.get() - before));
+        }
+    }
+
+    /*!
+    \brief Archive writer thread main loop
+    */
+    inline void serve()
+    {
+        writerPlacement_ = placement::place(placement::archiver, 0);
+        range r;
+        while (true) {
+            bool got = false;
+            queued.await([this, &r, &got]() {
+                const bool done = finished.load(std::memory_order_acquire);
+                return (got = queue.try_pop(r)) || done;
+            });
+            if (! got)
+                break;
+            write(r);
+            r.slab->release();
+            popped.notify();
+            if (r.last)
+                break;
+        }
+        if ((fd >= 0) && (::close(fd) != 0) && error.empty())
+            error = std::string("closing archive ") + path + " failed: " + std::strerror(errno);
+        fd = -1;
+    }
+
+  public:
+    /*!
+    \brief Constructor, creates (truncates) the archive file and starts the writer thread
+    \param file     Archive file path
+    \param p        Back-pressure policy
+    \param o_direct Use direct IO, requires the block policy
+    \param slabs    Number of receive slabs, at most half of them are queued for the writer
+    \throw std::ios_base::failure if the file cannot be created
+    \throw std::invalid_argument if direct IO is combined with the drop policy
+    */
+    inline stream_archive(const std::string& file, policy_type p, bool o_direct, std::size_t slabs)
+        : path{file}, direct{o_direct}, align{o_direct ? block_size : 1}, policy{p}, queue{std::max<std::size_t>(slabs / 2, 1)}
+    {
+        if (direct && (policy == drop))
+            throw std::invalid_argument("direct IO archiving requires the block policy");
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+        if (fd < 0)
+            throw std::ios_base::failure(std::string("unable to create archive ") + path + ": " + std::strerror(errno));
+        writer = std::thread([this]{ serve(); });
+    }
+
+    stream_archive(const stream_archive&) = delete;
+    stream_archive(stream_archive&&) = delete;
+    stream_archive& operator=(const stream_archive&) = delete;
+    stream_archive& operator=(stream_archive&&) = delete;
+
+    /*!
+    \brief Destructor, waits for queued ranges to be written
+    */
+    inline ~stream_archive()
+    {
+        finish();
+    }
+
+    /*!
+    \brief Alignment of archived ranges
+    \return `block_size` for direct IO, 1 otherwise
+    */
+    [[gnu::pure]]
+    inline std::size_t alignment() const noexcept
+    {
+        return align;
+    }
+
+    /*!
+    \brief Reader side: archive the start of a slab
+    \param slab     Slab, the archive acquires its own reference
+    \param end      End of the last complete chunk within the slab
+    \param last     Last slab of the stream
+    \return Number of bytes archived from the slab start, `end` rounded down to `alignment()` unless `last` is set.
+            The remaining bytes must be carried over into the next slab.
+    */
+    inline std::size_t put(io_slab* slab, std::size_t end, bool last=false)
+    {
+        const std::size_t size = last ? end : (end & ~(alignment() - 1));
+        if (size == 0 && ! last)
+            return 0;
+        slab->acquire();
+        range r{slab, size, last};
+        if (! queue.try_push(std::move(r))) {
+            if (policy == drop) {
+                readerMetrics.dropped.add(size);
+                slab->release();
+                if (last)
+                    finish();
+                return size;
+            }
+            popped.await([this, &r]() { return queue.try_push(std::move(r)); });
+        }
+        queued.notify();
+        return size;
+    }
+
+    /*!
+    \brief Reader side: no more slabs are coming, wait for queued ranges to be written
+    */
+    inline void finish()
+    {
+        finished.store(true, std::memory_order_release);
+        queued.notify();
+        if (writer.joinable())
+            writer.join();
+    }
+
+    /*!
+    \brief Write live archive counters in Prometheus text format
+    \param out Output stream
+    */
+    inline void writeMetrics(std::ostream& out) const
+    {
+        metrics::describe(out, "tpx3_archive_bytes_total", "counter", "Number of raw stream bytes written to the archive");
+        metrics::sample(out, "tpx3_archive_bytes_total", writerMetrics.written.get());
+        metrics::describe(out, "tpx3_archive_dropped_bytes_total", "counter", "Number of raw stream bytes dropped from the archive");
+        metrics::sample(out, "tpx3_archive_dropped_bytes_total", readerMetrics.dropped.get() + writerMetrics.failed.get());
+        metrics::describe(out, "tpx3_archive_queued_slabs", "gauge", "Number of receive slabs waiting for the archive writer");
+        metrics::sample(out, "tpx3_archive_queued_slabs", queue.size());
+    }
+
+    /*!
+    \brief Number of bytes written
+    \return Bytes written to the archive file
+    */
+    inline uint64_t written() const noexcept
+    {
+        return writerMetrics.written.get();
+    }
+
+    /*!
+    \brief Number of bytes dropped
+    \return Bytes dropped by the drop policy or because of write errors
+    */
+    inline uint64_t dropped() const noexcept
+    {
+        return readerMetrics.dropped.get() + writerMetrics.failed.get();
+    }
+
+    /*!
+    \brief Write error
+    \return Error message, empty if there was none; only valid after `finish()`
+    */
+    inline const std::string& writeError() const noexcept
+    {
+        return error;
+    }
+
+    /*!
+    \brief Writer thread placement
+    \return Placement description for logging; only valid after `finish()`
+    */
+    inline const std::string& writerPlacement() const noexcept
+    {
+        return writerPlacement_;
+    }
+};
+
+#endif // STREAM_ARCHIVE_H
@@ -0,0 +1,673 @@
+#ifndef STREAM_GENERATOR_H
+#define STREAM_GENERATOR_H
+
+/*!
+\file
+Synthetic raw event stream generator, C++ version of generate_data/generate_data.jl,
+and a model of production scale streams for the generator tool (see generate_stream.cpp) and the replay server
+*/
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <ostream>
+#include "layout.h"
+
+/*!
+\brief Synthetic raw event stream generation
+*/
+namespace stream_generator {
+
+    /*!
+    \brief Raw representation of the chunk header identification
+    \return 'TPX3' as uint64_t
+    */
+    [[gnu::const]]
+    constexpr uint64_t tpx3() noexcept
+    {
+        return (uint64_t('3') << 24) | (uint64_t('X') << 16) | (uint64_t('P') << 8) | uint64_t('T');
+    }
+
+    /*!
+    \brief Raw chunk header
+    \param nbytes   Chunk payload size in bytes
+    \param chip     Chip number
+    \return Raw chunk header word
+    */
+    [[gnu::const]]
+    constexpr uint64_t chunk_header(uint64_t nbytes, uint64_t chip) noexcept
+    {
+        return (nbytes << 48) + (chip << 32) + tpx3();
+    }
+
+    /*!
+    \brief Raw pixel address
+    \param x Pixel column within the chip, doublecolumn * 2 + pixel / 4
+    \param y Pixel row within the chip, superpixel * 4 + pixel % 4
+    \return Raw pixel coordinate representation, the inverse of AsiRawStreamDecoder::calculateXY()
+    */
+    [[gnu::const]]
+    constexpr uint64_t pixel_address(uint64_t x, uint64_t y) noexcept
+    {
+        return ((x >> 1) << 9) | ((y >> 2) << 3) | ((x & 1) << 2) | (y & 3);
+    }
+
+    /*!
+    \brief Raw TOA event
+    \param pixaddr  Raw pixel coordinate representation
+    \param toa      TOA
+    \param tot      TOT
+    \param ftoa     Fine TOA
+    \param spidr    SPIDR time
+    \return Raw TOA event word
+    */
+    [[gnu::const]]
+    constexpr uint64_t toa(uint64_t pixaddr, uint64_t toa, uint64_t tot, uint64_t ftoa, uint64_t spidr) noexcept
+    {
+        return (0xbUL << 60) + (pixaddr << 44) + (toa << 30) + (tot << 20) + (ftoa << 16) + spidr;
+    }
+
+    /*!
+    \brief Raw TOA event at a clock tick
+    \param pixaddr  Raw pixel coordinate representation
+    \param clk      TOA in clock ticks
+    \param tot      TOT
+    \return Raw TOA event word
+    */
+    [[gnu::const]]
+    constexpr uint64_t toa(uint64_t pixaddr, int64_t clk, uint64_t tot) noexcept
+    {
+        int64_t ticks = clk;
+        uint64_t spidr = ticks >> 18;
+        ticks -= spidr << 18;
+        uint64_t toa_ = ticks >> 4;
+        ticks -= toa_ << 4;
+        uint64_t ftoa = 0;
+        if (ticks > 0) {
+            ftoa = 16 - ticks;
+            toa_ += 1;
+            if (toa_ == (1UL << 14)) {  // carry into spidr time, the Julia version overflows into tot here
+                toa_ = 0;
+                spidr += 1;
+            }
+        }
+        spidr &= (1UL << 16) - 1;
+        return toa(pixaddr, toa_, tot, ftoa, spidr);
+    }
+
+    /*!
+    \brief Raw TDC event
+    \param t    Coarse time
+    \param ft   Time fraction
+    \return Raw TDC event word
+    */
+    [[gnu::const]]
+    constexpr uint64_t tdc(uint64_t t, uint64_t ft) noexcept
+    {
+        return (0x6bUL << 56) + (t << 9) + (ft << 5);
+    }
+
+    /*!
+    \brief Raw TDC event at a clock tick
+    \param clk  TDC time in clock ticks
+    \return Raw TDC event word
+    */
+    [[gnu::const]]
+    constexpr uint64_t tdc(int64_t clk) noexcept
+    {
+        uint64_t ticks = clk;
+        uint64_t coarse = ticks >> 1;
+        ticks -= coarse << 1;
+        uint64_t fract = ticks * 6 + 1;
+        if (fract > 12)
+            fract = 12;
+        coarse &= (1UL << 35) - 1;
+        return tdc(coarse, fract);
+    }
+
+    /*!
+    \brief Shift the time stamp of a raw event
+    \param word     Raw word
+    \param ticks    Time shift in clock ticks, a multiple of 16
+    \return TOA and TDC events with their time stamp shifted by `ticks`, other words unchanged
+    */
+    [[gnu::const]]
+    constexpr uint64_t shift_time(uint64_t word, int64_t ticks) noexcept
+    {
+        if ((word >> 60) == 0xb) {
+            const uint64_t coarse = ((word & 0xffffUL) << 14) + ((word >> 30) & 0x3fffUL) + (ticks >> 4);
+            return (word & ~((0x3fffUL << 30) | 0xffffUL)) | ((coarse & 0x3fffUL) << 30) | ((coarse >> 14) & 0xffffUL);
+        }
+        if ((word >> 60) == 0x6) {
+            const uint64_t coarse = ((word >> 9) + (ticks >> 1)) & 0x7ffffffffUL;
+            return (word & ~(0x7ffffffffUL << 9)) | (coarse << 9);
+        }
+        return word;
+    }
+
+    /*!
+    \brief Raw packet id
+    \param count Packet id
+    \return Raw packet id word
+    */
+    [[gnu::const]]
+    constexpr uint64_t pkcount(uint64_t count) noexcept
+    {
+        return (0x50UL << 56) + count;
+    }
+
+    /*!
+    \brief Append a raw event packet for one period to a stream
+
+    The packet has one TDC event at the start of the period, and `ntoa` TOA events
+    evenly spread out across the period. If `ntdc` is bigger than 1, another TDC event
+    at the end of the period is added. Unlike the Julia version, the pixel address
+    advances by `pixel_step` for every TOA event.
+
+    \param out          Raw stream words
+    \param chip         Chip number
+    \param period_id    Period number, also used as packet id
+    \param period       Period length in clock ticks
+    \param tot          TOT of all TOA events
+    \param ntoa         Number of TOA events
+    \param ntdc         Number of TDC events, 1 or 2
+    \param pixel_step   Pixel address increment between TOA events
+    */
+    inline void generate_packet(std::vector<uint64_t>& out, unsigned chip, uint64_t period_id, int64_t period, uint64_t tot, unsigned ntoa, unsigned ntdc=1, uint64_t pixel_step=0)
+    {
+        const int64_t t = period_id * period;
+        const uint64_t nevents = 1 + ntoa + ((ntdc > 1) ? 1 : 0);
+        out.push_back(chunk_header(8 + 8 * nevents, chip));
+        out.push_back(pkcount(period_id));
+        out.push_back(tdc(t));
+        const int64_t dtoa = period / ntoa;
+        for (unsigned i=1; i<=ntoa; i++)
+            out.push_back(toa((i * pixel_step) & 0xffff, t + i * dtoa, tot));
+        if (ntdc > 1)
+            out.push_back(tdc(t + period));
+    }
+
+    /*!
+    \brief Generate a raw event stream like generate_data.jl
+    \param nchips       Number of chips
+    \param period       Period length in clock ticks
+    \param nperiods     Number of periods
+    \param tot          TOT of all TOA events
+    \param ntoa         Number of TOA events per chip and period
+    \param pixel_step   Pixel address increment between TOA events
+    \return Raw stream words, packets ordered by period and chip
+    */
+    inline std::vector<uint64_t> generate_stream(unsigned nchips, int64_t period, uint64_t nperiods, uint64_t tot=50, unsigned ntoa=10, uint64_t pixel_step=0)
+    {
+        std::vector<uint64_t> out;
+        out.reserve(nperiods * nchips * (3 + ntoa));
+        for (uint64_t p=0; p<nperiods; p++)
+            for (unsigned c=0; c<nchips; c++)
+                generate_packet(out, c, p, period, tot, ntoa, 1, pixel_step);
+        return out;
+    }
+
+    /*!
+    \brief Settings of the production scale stream model
+    */
+    struct config final {
+        unsigned chips = 4;             //!< Number of chips
+        int64_t period = 640000;        //!< Mean period length in clock ticks (1 kHz)
+        uint64_t periods = 10000;       //!< Number of periods
+        double hits = 1000.;            //!< Mean number of hits per chip and period, Poisson distributed
+        unsigned chunk_hits = 2000;     //!< Mean number of hits per chunk, this fixes the number of chunks per chip and period
+        int64_t tdc_jitter = 0;         //!< Largest TDC deviation from the period grid in clock ticks
+        int64_t disorder = 0;           //!< Largest emission delay of hits and TDCs in clock ticks, they overtake each other within this window
+        unsigned tot_min = 10;          //!< Smallest TOT
+        unsigned tot_max = 200;         //!< Largest TOT
+        unsigned points = 16;           //!< Number of energy points for XESPoints.inp, stripes along the pixel row
+        unsigned bins = 100;            //!< Minimum number of time bins per period for Processing.ini
+        bool packet_ids = true;         //!< Start chunks with SERVAL 3.2 packet ids
+        uint64_t seed = 1;              //!< Random seed
+
+        static constexpr unsigned max_chunk_hits = 2000;    //!< Largest `chunk_hits`, well below the room of a chunk
+        static constexpr uint64_t max_chunk_words = 0xffff / sizeof(uint64_t);  //!< Largest chunk payload in words, the header has a 16 bit byte count
+        static constexpr int64_t max_time = int64_t{1} << 34;   //!< TOA clock tick range of the raw TOA event
+
+        /*!
+        \brief Set a value
+        \param key      Field name
+        \param value    Field value
+        \throw std::invalid_argument for an unknown key or an invalid value
+        */
+        void set(const std::string& key, const std::string& value)
+        {
+            size_t end = 0;
+            bool known = true;
+            try {
+                if (key == "chips") chips = std::stoul(value, &end);
+                else if (key == "period") period = std::stoll(value, &end);
+                else if (key == "periods") periods = std::stoull(value, &end);
+                else if (key == "hits") hits = std::stod(value, &end);
+                else if (key == "chunk_hits") chunk_hits = std::stoul(value, &end);
+                else if (key == "tdc_jitter") tdc_jitter = std::stoll(value, &end);
+                else if (key == "disorder") disorder = std::stoll(value, &end);
+                else if (key == "tot_min") tot_min = std::stoul(value, &end);
+                else if (key == "tot_max") tot_max = std::stoul(value, &end);
+                else if (key == "points") points = std::stoul(value, &end);
+                else if (key == "bins") bins = std::stoul(value, &end);
+                else if (key == "packet_ids") packet_ids = (std::stoul(value, &end) != 0);
+                else if (key == "seed") seed = std::stoull(value, &end);
+                else known = false;
+            } catch (std::logic_error&) {
+                end = std::string::npos;    // no number or out of range
+            }
+            if (! known)
+                throw std::invalid_argument(std::string{"unknown stream generator setting: "} + key);
+            if (end != value.size())
+                throw std::invalid_argument(std::string{"invalid value for stream generator setting "} + key + ": " + value);
+        }
+
+        /*!
+        \brief Set values from a specification
+        \param spec Comma separated `key=value` list, see `set()`
+        \throw std::invalid_argument for an invalid specification
+        */
+        void parse(const std::string& spec)
+        {
+            for (size_t pos=0; pos<spec.size();) {
+                size_t end = spec.find(',', pos);
+                if (end == std::string::npos)
+                    end = spec.size();
+                const std::string item = spec.substr(pos, end - pos);
+                const size_t eq = item.find('=');
+                if (eq == std::string::npos)
+                    throw std::invalid_argument(std::string{"stream generator setting without value: "} + item);
+                set(item.substr(0, eq), item.substr(eq + 1));
+                pos = end + 1;
+            }
+            validate();
+        }
+
+        /*!
+        \brief Check settings
+        \throw std::invalid_argument for inconsistent settings
+        */
+        void validate() const
+        {
+            if ((chips < 1) || (chips > 256))
+                throw std::invalid_argument("stream generator chips must be within 1..256");
+            if (period < 2)
+                throw std::invalid_argument("stream generator period must be at least 2 clock ticks");
+            if (! (hits >= .0))
+                throw std::invalid_argument("stream generator hits must not be negative");
+            if ((chunk_hits < 1) || (chunk_hits > max_chunk_hits))
+                throw std::invalid_argument("stream generator chunk_hits must be within 1..2000");
+            if ((tdc_jitter < 0) || (disorder < 0) || (2 * (tdc_jitter + disorder) >= period))
+                throw std::invalid_argument("stream generator tdc_jitter and disorder must not be negative and together below half the period");
+            if ((tot_min > tot_max) || (tot_max > 1023))
+                throw std::invalid_argument("stream generator tot_min..tot_max must be within 0..1023");
+            if ((points < 1) || (points > chip_size) || (bins < 1))
+                throw std::invalid_argument("stream generator points must be within 1..256 and bins positive");
+            if (periods > max_periods())
+                throw std::invalid_argument("stream generator periods * period exceeds the 2^34 clock tick TOA range");
+        }
+
+        /*!
+        \brief Largest number of periods within the TOA clock range
+        \return Number of periods that fit into `max_time` with the current period settings
+        */
+        uint64_t max_periods() const noexcept
+        {
+            return std::max<int64_t>((max_time - disorder - 1) / (period + tdc_jitter) - 2, 0);
+        }
+    };
+
+    /*!
+    \brief Write a stream model configuration
+    \param out  Output stream
+    \param cfg  Stream model configuration
+    \return out
+    */
+    inline std::ostream& operator<<(std::ostream& out, const config& cfg)
+    {
+        return out << "chips=" << cfg.chips << ",period=" << cfg.period << ",periods=" << cfg.periods << ",hits=" << cfg.hits
+                   << ",chunk_hits=" << cfg.chunk_hits << ",tdc_jitter=" << cfg.tdc_jitter << ",disorder=" << cfg.disorder
+                   << ",tot_min=" << cfg.tot_min << ",tot_max=" << cfg.tot_max << ",points=" << cfg.points << ",bins=" << cfg.bins
+                   << ",packet_ids=" << cfg.packet_ids << ",seed=" << cfg.seed;
+    }
+
+    /*!
+    \brief Counter based pseudo random numbers (splitmix64)
+    */
+    struct random final {
+        uint64_t state; //!< Generator state
+
+        /*!
+        \brief Constructor for an independent sequence
+        \param seed     Random seed
+        \param a        First sequence selector
+        \param b        Second sequence selector
+        */
+        explicit random(uint64_t seed, uint64_t a=0, uint64_t b=0) noexcept
+            : state{seed}
+        {
+            state = next() ^ a;
+            state = next() ^ b;
+        }
+
+        /*!
+        \brief Next random number
+        \return Uniformly distributed 64 bit value
+        */
+        inline uint64_t next() noexcept
+        {
+            uint64_t z = (state += 0x9e3779b97f4a7c15UL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+            return z ^ (z >> 31);
+        }
+
+        /*!
+        \brief Uniform integer
+        \param n Upper bound
+        \return Value within [0..n)
+        */
+        inline uint64_t below(uint64_t n) noexcept
+        {
+            return (unsigned __int128)next() * n >> 64;
+        }
+
+        /*!
+        \brief Uniform real
+        \return Value within [0..1)
+        */
+        inline double uniform() noexcept
+        {
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        /*!
+        \brief Poisson distributed integer
+        \param mean Mean value
+        \return Exact sample for small means, normal approximation for means of 64 and above
+        */
+        uint64_t poisson(double mean) noexcept
+        {
+            if (mean < 64.) {
+                const double limit = std::exp(-mean);
+                uint64_t k = 0;
+                for (double prod = uniform(); prod > limit; prod *= uniform())
+                    k++;
+                return k;
+            }
+            const double z = std::sqrt(-2. * std::log(1. - uniform())) * std::cos(6.283185307179586 * uniform());
+            return (uint64_t)std::max(std::llround(mean + std::sqrt(mean) * z), 0LL);
+        }
+    };
+
+    /*!
+    \brief Production scale stream model
+
+    Every chip sees the same TDC at the start of every period, on a grid with `tdc_jitter`.
+    Hits are spread uniformly over the period, with random pixels and TOTs. Events are emitted
+    in the order of their time stamp plus a random delay of up to `disorder` clock ticks, so
+    hits and TDCs overtake each other around period boundaries. The events of period window `p`,
+    those emitted between the TDCs of periods p and p+1, go into a fixed number of chunks per chip,
+    which keeps the SERVAL 3.2 packet ids of a chip consecutive.
+
+    Everything about period `p` of chip `c` derives from `seed`, `c` and `p` only, so any range of
+    periods can be generated independently of the others.
+    */
+    class generator final {
+        const config cfg;           //!< Stream model settings
+        const uint64_t chunks;      //!< Number of chunks per chip and period window
+        const uint64_t room;        //!< Number of events that fit into the chunks of a period window
+
+    public:
+        /*!
+        \brief Event with its emission order key
+        */
+        struct item final {
+            int64_t key;            //!< Emission time
+            uint64_t word;          //!< Raw event
+
+            /*!
+            \brief Emission order
+            \param other Other event
+            \return True if this event is emitted first, TDCs before hits with the same key
+            */
+            inline bool operator<(const item& other) const noexcept
+            {
+                return (key < other.key) || ((key == other.key) && (word >> 60 == 0x6) && (other.word >> 60 != 0x6));
+            }
+        };
+
+        /*!
+        \brief Constructor
+        \param settings Stream model settings
+        \throw std::invalid_argument for inconsistent settings
+        */
+        explicit generator(const config& settings)
+            : cfg{settings}, chunks{std::max<uint64_t>(1, std::ceil(settings.hits / settings.chunk_hits))},
+              room{chunks * (config::max_chunk_words - (settings.packet_ids ? 1 : 0))}
+        {
+            cfg.validate();
+        }
+
+        /*!
+        \brief Stream model settings
+        \return Settings
+        */
+        inline const config& settings() const noexcept
+        {
+            return cfg;
+        }
+
+        /*!
+        \brief Number of chunks per chip and period window
+        \return Chunk count
+        */
+        inline uint64_t chunks_per_period() const noexcept
+        {
+            return chunks;
+        }
+
+        /*!
+        \brief Packet id of a chunk
+        \param p Period window
+        \param k Chunk number within the period window
+        \return Packet id, starting at 1 and consecutive per chip
+        */
+        inline uint64_t packet_id(uint64_t p, uint64_t k) const noexcept
+        {
+            return p * chunks + k + 1;
+        }
+
+        /*!
+        \brief TDC time of a period, the same for all chips
+        \param p Period
+        \return TDC time in clock ticks
+        */
+        inline int64_t tdc_time(uint64_t p) const noexcept
+        {
+            const int64_t t = (p + 1) * cfg.period;
+            if (cfg.tdc_jitter == 0)
+                return t;
+            random rng{cfg.seed, ~0UL, p};
+            return t + (int64_t)rng.below(2 * cfg.tdc_jitter + 1) - cfg.tdc_jitter;
+        }
+
+        /*!
+        \brief Events of a period for one chip
+        \param chip Chip number
+        \param p    Period
+        \param out  The TDC starting the period and the hits within it are appended, not sorted
+
+        The Poisson distributed number of hits is only cut off where the TDC and the hits
+        would no longer fit into the chunks of the period window.
+        */
+        void events(unsigned chip, uint64_t p, std::vector<item>& out) const
+        {
+            random rng{cfg.seed, chip, p};
+            const int64_t start = tdc_time(p);
+            const uint64_t length = tdc_time(p + 1) - start;
+            const uint64_t delay = cfg.disorder + 1;
+            out.push_back({start + (int64_t)rng.below(delay), tdc(start)});
+            const uint64_t n = std::min<uint64_t>(rng.poisson(cfg.hits), room - 1);
+            const uint64_t tots = cfg.tot_max - cfg.tot_min + 1;
+            for (uint64_t i=0; i<n; i++) {
+                const int64_t t = start + rng.below(length);
+                const uint64_t r = rng.next();
+                const uint64_t pixel = pixel_address(r & 0xff, (r >> 8) & 0xff);
+                out.push_back({t + (int64_t)rng.below(delay), toa(pixel, t, cfg.tot_min + rng.below(tots))});
+            }
+        }
+
+        /*!
+        \brief Sequential chunk emitter for one chip
+        */
+        class chip_stream final {
+            const generator& gen;       //!< Stream model
+            const unsigned chip;        //!< Chip number
+            uint64_t next;              //!< Next period window
+            std::vector<item> carry;    //!< Events of the previous period emitted after the next TDC
+            std::vector<item> window;   //!< Events of the current period window
+
+        public:
+            /*!
+            \brief Constructor
+            \param g        Stream model
+            \param c        Chip number
+            \param first    First period window, the previous period is generated for its late events
+            */
+            chip_stream(const generator& g, unsigned c, uint64_t first)
+                : gen{g}, chip{c}, next{first}
+            {
+                if (first > 0) {
+                    gen.events(chip, first - 1, window);
+                    const int64_t end = gen.tdc_time(first);
+                    for (const auto& ev : window)
+                        if (ev.key >= end)
+                            carry.push_back(ev);
+                    window.clear();
+                }
+            }
+
+            /*!
+            \brief Append the chunks of the next period window
+            \param out Raw stream words
+            \return Number of hits appended
+            */
+            uint64_t emit(std::vector<uint64_t>& out)
+            {
+                const config& cfg = gen.settings();
+                const int64_t end = gen.tdc_time(next + 1);
+                window.swap(carry);
+                const size_t own = window.size();
+                gen.events(chip, next, window);
+                carry.clear();
+                size_t keep = own;
+                for (size_t i=own; i<window.size(); i++) {
+                    if (window[i].key >= end)
+                        carry.push_back(window[i]);
+                    else
+                        window[keep++] = window[i];
+                }
+                window.resize(keep);
+                if (window.size() > gen.room)   // drop late events of the previous period that don't fit, never the TDC
+                    window.erase(std::begin(window), std::begin(window) + (window.size() - gen.room));
+                std::sort(std::begin(window), std::end(window));
+
+                const uint64_t header_words = cfg.packet_ids ? 1 : 0;
+                size_t pos = 0;
+                for (uint64_t k=0; k<gen.chunks; k++) {
+                    const size_t last = window.size() * (k + 1) / gen.chunks;
+                    out.push_back(chunk_header(8 * (header_words + last - pos), chip));
+                    if (cfg.packet_ids)
+                        out.push_back(pkcount(gen.packet_id(next, k)));
+                    for (; pos<last; pos++)
+                        out.push_back(window[pos].word);
+                }
+                next++;
+                return window.size() - 1;
+            }
+        };
+
+        /*!
+        \brief Append a range of period windows for all chips, in period and chip order
+        \param first    First period window
+        \param last     Period window after the last one
+        \param out      Raw stream words
+        \return Number of hits appended
+        */
+        uint64_t generate(uint64_t first, uint64_t last, std::vector<uint64_t>& out) const
+        {
+            std::vector<chip_stream> streams;
+            streams.reserve(cfg.chips);
+            for (unsigned c=0; c<cfg.chips; c++)
+                streams.emplace_back(*this, c, first);
+            uint64_t nhits = 0;
+            for (uint64_t p=first; p<last; p++)
+                for (auto& s : streams)
+                    nhits += s.emit(out);
+            return nhits;
+        }
+    };
+
+    /*!
+    \brief Write the XES points file matching a stream model
+
+    Every chip is divided into `points` stripes along the pixel row, stripe i maps to energy point i
+    with weight 1, so the analysis uses its single energy point kernel.
+
+    \param out  Output stream
+    \param cfg  Stream model settings
+    */
+    inline void write_points(std::ostream& out, const config& cfg)
+    {
+        for (unsigned c=0; c<cfg.chips; c++)
+            for (unsigned x=0; x<chip_size; x++)
+                for (unsigned y=0; y<chip_size; y++)
+                    out << c << ',' << (x * chip_size + y) << ',' << (y * cfg.points / chip_size) << ",1\n";
+    }
+
+    /*!
+    \brief Write the processing configuration matching a stream model
+
+    The time bins cover the whole period with at least `bins` bins of a power of two clock ticks.
+
+    \param out  Output stream
+    \param cfg  Stream model settings
+    */
+    inline void write_processing(std::ostream& out, const config& cfg)
+    {
+        int64_t step = 1;
+        while (step * (int64_t)cfg.bins < cfg.period)
+            step <<= 1;
+        step = std::max<int64_t>(step >> 1, 1);
+        out << "HistogramMode=toa\nTRStart=0\nTRStep=" << step << "\nTRN=" << ((cfg.period + cfg.tdc_jitter + step - 1) / step)
+            << "\nFileOutputPath=./\nShortFileName=synthetic\nOutputFormat=binary\n";
+    }
+
+    /*!
+    \brief Write the detector layout matching a stream model, like the replay server /detector/layout response
+
+    Chips are arranged in a square if possible, in a row otherwise.
+
+    \param out  Output stream
+    \param cfg  Stream model settings
+    */
+    inline void write_layout(std::ostream& out, const config& cfg)
+    {
+        unsigned width = std::ceil(std::sqrt(cfg.chips));
+        if (width * (cfg.chips / width) != cfg.chips)
+            width = cfg.chips;
+        const unsigned height = cfg.chips / width;
+        out << R"({"Original":{"Width":)" << width * chip_size << R"(,"Height":)" << height * chip_size << R"(,"Chips":[)";
+        for (unsigned i=0; i<cfg.chips; i++)
+            out << (i ? "," : "") << R"({"X":)" << (i / width) * chip_size << R"(,"Y":)" << (i % width) * chip_size << '}';
+        out << "]}}\n";
+    }
+
+} // namespace stream_generator
+
+#endif // STREAM_GENERATOR_H
@@ -0,0 +1,182 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+/*!
+\file
+Provide CPU affinity configuration for the processing threads
+*/
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+
+/*!
+\brief Thread placement
+
+Every processing thread role can be restricted to a list of CPUs. Reader, writer and archive
+threads run on all CPUs of their list, analyser and worker threads are each pinned to a single CPU,
+assigned round robin by thread number. IO buffers and per thread histograms are allocated
+by the thread that uses them after it has been placed, so the kernel's first touch policy
+puts them on the NUMA node of that thread.
+*/
+namespace placement {
+
+    using cpu_list = std::vector<unsigned>; //!< Sorted list of CPU numbers
+
+    /*!
+    \brief Thread role
+    */
+    enum role : unsigned {
+        reader,     //!< Raw stream reader thread
+        analyser,   //!< Per chip analyser threads
+        worker,     //!< Histogramming worker threads
+        writer,     //!< XES data aggregate+write thread
+        archiver,   //!< Raw stream archive writer thread
+        num_roles   //!< Number of roles
+    };
+
+    /*!
+    \brief Role names, used for option names and logging
+    */
+    inline const std::array<const char*, num_roles> role_name = { "reader", "analyser", "worker", "writer", "archive" };
+
+    /*!
+    \brief Configured CPU lists indexed by role, empty for no restriction
+
+    Set before the processing threads are started.
+    */
+    inline std::array<cpu_list, num_roles> cpus;
+
+    /*!
+    \brief Parse CPU list
+    \param text CPU list like `0-3,8,10-11`
+    \return Sorted list of CPU numbers without duplicates
+    \throw std::invalid_argument if `text` is not a valid CPU list
+    */
+    inline cpu_list parse(const std::string& text)
+    {
+        cpu_list res;
+        std::size_t pos = 0;
+        while (pos < text.size()) {
+            std::size_t end = text.find(',', pos);
+            if (end == std::string::npos)
+                end = text.size();
+            const std::string range = text.substr(pos, end - pos);
+            const std::size_t dash = range.find('-');
+            std::size_t n1 = 0, n2 = 0;
+            unsigned first = 0, last = 0;
+            try {
+                first = std::stoul(range, &n1);
+                last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1), &n2);
+            } catch (std::exception&) {
+                throw std::invalid_argument(std::string("invalid CPU list: ") + text);
+            }
+            if ((n1 != ((dash == std::string::npos) ? range.size() : dash)) ||
+                ((dash != std::string::npos) && (dash + 1 + n2 != range.size())) ||
+                (first > last) || (last >= CPU_SETSIZE))
+                throw std::invalid_argument(std::string("invalid CPU list: ") + text);
+            for (unsigned cpu=first; cpu<=last; cpu++)
+                res.push_back(cpu);
+            pos = end + 1;
+        }
+        if (res.empty())
+            throw std::invalid_argument("empty CPU list");
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+        return res;
+    }
+
+    /*!
+    \brief CPU list representation
+    \param list Sorted list of CPU numbers
+    \return CPU list like `0-3,8,10-11`
+    */
+    inline std::string to_string(const cpu_list& list)
+    {
+        std::string res;
+        for (std::size_t i=0; i<list.size();) {
+            std::size_t j = i;
+            while ((j + 1 < list.size()) && (list[j + 1] == list[j] + 1))
+                j++;
+            if (! res.empty())
+                res += ',';
+            res += std::to_string(list[i]);
+            if (j > i)
+                res += '-' + std::to_string(list[j]);
+            i = j + 1;
+        }
+        return res;
+    }
+
+    /*!
+    \brief CPUs configured for a thread
+    \param r        Thread role
+    \param index    Thread number within the role
+    \return CPUs the thread should run on, empty for no restriction
+    */
+    inline cpu_list for_thread(role r, unsigned index)
+    {
+        const cpu_list& list = cpus[r];
+        if (list.empty() || (r == reader) || (r == writer) || (r == archiver))
+            return list;
+        return { list[index % list.size()] };
+    }
+
+    /*!
+    \brief CPUs the calling thread may run on
+    \return Affinity of the calling thread, empty if it cannot be determined
+    */
+    inline cpu_list current()
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        cpu_list res;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            return res;
+        for (unsigned cpu=0; cpu<CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                res.push_back(cpu);
+        return res;
+    }
+
+    /*!
+    \brief Restrict the calling thread to CPUs
+    \param list CPUs
+    \return 0 on success, error number otherwise
+    */
+    inline int pin(const cpu_list& list)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned cpu : list)
+            CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    /*!
+    \brief Place the calling thread according to the configuration
+    \param r        Thread role
+    \param index    Thread number within the role
+    \return Placement description for logging
+    */
+    inline std::string place(role r, unsigned index)
+    {
+        std::string res = std::string(role_name[r]) + ' ' + std::to_string(index) + ": ";
+        const cpu_list list = for_thread(r, index);
+        if (! list.empty()) {
+            const int err = pin(list);
+            if (err != 0)
+                res += "pinning to cpus " + to_string(list) + " failed (" + std::strerror(err) + "), ";
+        }
+        res += "cpus " + to_string(current()) + ", running on cpu " + std::to_string(sched_getcpu());
+        return res;
+    }
+
+} // namespace placement
+
+#endif // THREAD_PLACEMENT_H
@@ -65,6 +65,9 @@ namespace xes {
                 assert(data.TDSpectra.size() == TDSpectra.size());
                 for (histo_type::size_type i=0; i<data.TDSpectra.size(); i++)
                     TDSpectra[i] += data.TDSpectra[i];
+                BeforeRoi += data.BeforeRoi;
+                AfterRoi += data.AfterRoi;
+                Total += data.Total;
                 return *this;
             }
 
@@ -9,15 +9,24 @@ Provide functionality to manage partial XES data per thread
 */
 
 #include <atomic>
+#include <vector>
+#include <algorithm>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <limits>
 #include <chrono>
 #include <stdexcept>
+#include <ostream>
 #include "shared_types.h"
 #include "logging.h"
+#include "metrics.h"
+#include "thread_placement.h"
 #include "timing.h"
+#include "histogram_reduction.h"
+#include "xes_output.h"
+#include "live_preview.h"
+#include "latency_trace.h"
 
 /*!
 \brief XES data manager functionality
@@ -40,10 +49,22 @@ namespace xes {
         struct alignas(256) CacheEntry final {
             period_type period = none;  //!< Period
             Data* data = nullptr;       //!< Pointer to per thread XES data
+            std::atomic<uint64_t> waitNs{0};    //!< Time spent waiting for a free period slot in nanoseconds
+            std::atomic<uint64_t> exhausted{0}; //!< Number of times no period slot was free
+
+            CacheEntry() = default;
+
+            /*!
+            \brief Copy constructor, needed for resizing
+            \param other Other value
+            */
+            CacheEntry(const CacheEntry& other)
+                : period{other.period}, data{other.data}, waitNs{other.waitNs.load()}, exhausted{other.exhausted.load()}
+            {}
         };
 
         /*!
-        \brief Cache indexed by thread id (=chip id)
+        \brief Cache indexed by thread number (chip number * workers per chip + worker number)
         */
         std::vector<CacheEntry> dataCache;
 
@@ -92,38 +113,74 @@ namespace xes {
         std::vector<Period> periodData;
 
         std::vector<Period*> periodQueue;   //!< Ready period data queue pointing into data pool
+        std::vector<Period*> freeSlots;     //!< Period data not in use, pointing into data pool
 
         std::mutex thread_lock;             //!< Protect parallel data access
         std::condition_variable action_required; //!< Signal for data aggregate+write thread
+        std::condition_variable slot_available;  //!< Signal from data aggregate+write thread to analysis threads waiting for `freeSlots`
+        unsigned threadsPerChip = 1;        //!< Number of analysis threads per chip
         bool stopWriter = false;            //!< Stop data aggregate+write thread
         std::thread writerThread;           //!< Data aggregate+write thread
 
-        const std::string outFileName;      //!< Output file name (without period and .xes)
+        /*!
+        \brief Helper threads for aggregating large histograms
+        */
+        histogram_reduction::pool<Data::histo_type::value_type> aggregationPool;
+        static constexpr unsigned maxAggregationHelpers = 3;    //!< Upper limit for the number of aggregation helper threads
+        Data output;                        //!< Aggregated period data, owned by the aggregate+write thread
+        std::vector<Data::histo_type::value_type*> partialSpectra;  //!< Per thread histograms of the period being aggregated
+
+        const std::unique_ptr<Writer> writer;   //!< Output format writer, used by the aggregate+write thread
+        preview::publisher* const preview;      //!< Live preview receiving every aggregated period, nullptr for none
+        latency_trace::tracer* const trace;     //!< Period latency tracing, nullptr for none
+
+        /*!
+        \brief Live counters of the aggregate+write thread
+        */
+        struct alignas(metrics::cache_line) WriterMetrics final {
+            metrics::counter written;       //!< Number of periods written
+            metrics::counter lastPeriod;    //!< Last period written
+            metrics::counter aggregateNs;   //!< Time spent aggregating per thread data in nanoseconds
+            metrics::counter writeNs;       //!< Time spent writing in nanoseconds
+        } writerMetrics;                    //!< Live counters of the aggregate+write thread
+        alignas(metrics::cache_line) metrics::counter periodsQueued;   //!< Number of periods passed to the aggregate+write thread, written under `thread_lock`
 
         Logger& logger;                     //!< Logger reference
 
         /*!
         \brief Constructor
         \param detector Detector data reference
-        \param fname    Output file name (without period and .xes)
-        \param nPeriods How many periods receive/emit data in parallel (see periodData member)
+        \param format   Output format writer
+        \param nPeriods How many periods receive/emit data in parallel (see periodData member), at least 2
+        \param nThreads Number of analysis threads filling in data, one per chip by default
+        \param live     Live preview publisher, nullptr for none
+        \param tracing  Period latency tracing, configured for the detector, nullptr for none
         */
-        inline Manager(const Detector& detector, const std::string& fname, unsigned nPeriods)
-            : outFileName(fname), logger(Logger::get("Tpx3App"))
+        inline Manager(const Detector& detector, std::unique_ptr<Writer>&& format, unsigned nPeriods, unsigned nThreads=0, preview::publisher* live=nullptr, latency_trace::tracer* tracing=nullptr)
+            : aggregationPool{histogram_reduction::pool<Data::histo_type::value_type>::helpers_for(detector.TRoiN * detector.energy_points.npoints, maxAggregationHelpers)},
+              writer(std::move(format)), preview{live}, trace{tracing}, logger(Logger::get("Tpx3App"))
         {
-            const unsigned nThreads = detector.layout.chip.size();
+            if (nThreads == 0)
+                nThreads = detector.layout.chip.size();
+            if (nPeriods < 2)
+                throw std::invalid_argument("at least 2 period data slots are required");
+            threadsPerChip = std::max(nThreads / (unsigned)detector.layout.chip.size(), 1u);
             dataCache.resize(nThreads);
             periodData.resize(nPeriods, Period{});
             for (auto& pd : periodData) {
                 pd.threadData.resize(nThreads);
                 for (auto& d : pd.threadData)
                     d.Init(detector);
+                freeSlots.push_back(&pd);
             }
+            output.Init(detector);
+            partialSpectra.resize(nThreads);
 
             writerThread = std::thread([this]() {
                 double t_wait = .0;
                 double t_aggregate = .0;
                 double t_write = .0;
+                logger << placement::place(placement::writer, 0) << log_info;
                 Timer clock;
 
                 try {
@@ -133,10 +190,10 @@ namespace xes {
                             clock.set();
                             std::unique_lock lock(thread_lock);
                             while (true) {
-                                if (stopWriter)
-                                    goto stop;
                                 if (periodQueue.size() > 0)
                                     break;
+                                if (stopWriter)
+                                    goto stop;  // only after all returned periods are written
                                 action_required.wait(lock);
                             }
                             // periodQueue.size() > 0
@@ -147,24 +204,35 @@ namespace xes {
                         }
 
                         logger << "output: aggregate and write data for period " << period->period << log_debug;
-                        Data* data = nullptr;
-                        for (auto& d : period->threadData) {
-                            if (data) {
-                                *data += d;
-                                d.Reset();
-                            } else {
-                                data = &d;
-                            }
-                        }
-                        t_aggregate += clock.elapsed();
+                        const period_type periodNo = period->period;
+                        Aggregate(*period);
+                        const double aggregated = clock.elapsed();
+                        t_aggregate += aggregated;
+                        writerMetrics.aggregateNs.add(aggregated * 1e9);
+                        if (trace)
+                            trace->writer().stamp(latency_trace::aggregated, periodNo, 0);
                         clock.set();
 
-                        data->SaveToFile(outFileName+"-"+std::to_string(period->period));
-                        data->Reset();
-                        period->ready.store(0);
-                        period->period.store(none);
+                        // the slot is free as soon as the per thread data has been summed up and cleared
+                        {
+                            std::unique_lock lock(thread_lock);
+                            period->ready.store(0);
+                            period->period.store(none);
+                            freeSlots.push_back(period);
+                        }
+                        slot_available.notify_all();
 
-                        t_write += clock.elapsed();
+                        if (preview)
+                            preview->publish(periodNo, output.detector->energy_points.npoints, output.detector->TRoiN, output.TDSpectra.data(),
+                                             output.BeforeRoi, output.AfterRoi, output.Total);
+                        writer->Write(output, periodNo);
+                        const double written = clock.elapsed();
+                        t_write += written;
+                        writerMetrics.writeNs.add(written * 1e9);
+                        writerMetrics.lastPeriod.set(periodNo);
+                        writerMetrics.written.add();
+                        if (trace)
+                            trace->writer().stamp(latency_trace::written, periodNo, 0);
                     }
                 } catch (std::exception& ex) {
                     logger << "writer thread exception: " << ex.what() << log_fatal;
@@ -195,44 +263,179 @@ namespace xes {
             }
             action_required.notify_all();
             writerThread.join();
+
+            LogProxy log(logger);
+            log << "period slots: " << periodData.size() << ", aggregation helpers: " << aggregationPool.helpers();
+            for (unsigned chip=0; chip<dataCache.size()/threadsPerChip; chip++)
+                log << "\n  chip " << chip << " wait: " << SlotWaitTime(chip) << "s, exhausted: " << SlotExhaustion(chip);
+            log << log_notice;
+        }
+
+        /*!
+        \brief Sum up per thread data of a period into `output`
+        The per thread data is cleared in the same pass, so the period slot can be reused
+        while `output` is written to disk. Large histograms are split across `aggregationPool`.
+        \param period Period data slot with all per thread data returned
+        */
+        void Aggregate(Period& period)
+        {
+            output.BeforeRoi = output.AfterRoi = output.Total = 0;
+            for (unsigned i=0; i<period.threadData.size(); i++) {
+                Data& d = period.threadData[i];
+                partialSpectra[i] = d.TDSpectra.data();
+                output.BeforeRoi += d.BeforeRoi;
+                output.AfterRoi += d.AfterRoi;
+                output.Total += d.Total;
+                d.BeforeRoi = d.AfterRoi = d.Total = 0;
+            }
+            aggregationPool.run(output.TDSpectra.data(), partialSpectra.data(), partialSpectra.size(), output.TDSpectra.size());
+        }
+
+        /*!
+        \brief Time analysis threads of a chip spent waiting for free period data slots
+        \param chip Chip number
+        \return Wait time in seconds
+        */
+        double SlotWaitTime(unsigned chip) const noexcept
+        {
+            uint64_t ns = 0;
+            for (unsigned i=0; i<threadsPerChip; i++)
+                ns += dataCache[chip * threadsPerChip + i].waitNs.load(std::memory_order_relaxed);
+            return ns * 1e-9;
+        }
+
+        /*!
+        \brief Number of times analysis threads of a chip found no free period data slot
+        \param chip Chip number
+        \return Pool exhaustion count
+        */
+        uint64_t SlotExhaustion(unsigned chip) const noexcept
+        {
+            uint64_t n = 0;
+            for (unsigned i=0; i<threadsPerChip; i++)
+                n += dataCache[chip * threadsPerChip + i].exhausted.load(std::memory_order_relaxed);
+            return n;
+        }
+
+        /*!
+        \brief Reallocate the per thread data of an analysis thread in all period data slots
+
+        Must be called by the analysis thread itself before it processes events,
+        so the memory is first touched by, and placed on the NUMA node of, that thread.
+        The content, e.g. restored from a checkpoint, is kept.
+
+        \param threadNo Analysis thread number (chip number * workers per chip + worker number)
+        */
+        void Localize(unsigned threadNo)
+        {
+            for (auto& pd : periodData) {
+                Data& d = pd.threadData[threadNo];
+                Data local{*d.detector};
+                std::copy(std::begin(d.TDSpectra), std::end(d.TDSpectra), std::begin(local.TDSpectra));
+                local.BeforeRoi = d.BeforeRoi;
+                local.AfterRoi = d.AfterRoi;
+                local.Total = d.Total;
+                d = std::move(local);
+            }
+        }
+
+        /*!
+        \brief Write live data manager counters in Prometheus text format
+        \param out Output stream
+        */
+        void WriteMetrics(std::ostream& out) const
+        {
+            const unsigned nchips = dataCache.size() / threadsPerChip;
+            metrics::describe(out, "tpx3_period_slot_wait_seconds_total", "counter", "Time analysis threads waited for a free period data slot");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_period_slot_wait_seconds_total", chip, SlotWaitTime(chip));
+            metrics::describe(out, "tpx3_period_slot_exhausted_total", "counter", "Number of times analysis threads found no free period data slot");
+            for (unsigned chip=0; chip<nchips; chip++)
+                metrics::sample(out, "tpx3_period_slot_exhausted_total", chip, SlotExhaustion(chip));
+            const uint64_t written = writerMetrics.written.get();
+            const uint64_t queued = std::max(periodsQueued.get(), written);
+            metrics::describe(out, "tpx3_output_periods_total", "counter", "Number of periods written");
+            metrics::sample(out, "tpx3_output_periods_total", written);
+            metrics::describe(out, "tpx3_output_lag_periods", "gauge", "Number of complete periods not written yet");
+            metrics::sample(out, "tpx3_output_lag_periods", queued - written);
+            metrics::describe(out, "tpx3_output_last_period", "gauge", "Last period written");
+            metrics::sample(out, "tpx3_output_last_period", (int64_t)writerMetrics.lastPeriod.get());
+            metrics::describe(out, "tpx3_output_aggregate_seconds_total", "counter", "Time spent aggregating per thread period data");
+            metrics::sample(out, "tpx3_output_aggregate_seconds_total", writerMetrics.aggregateNs.get() * 1e-9);
+            metrics::describe(out, "tpx3_output_write_seconds_total", "counter", "Time spent writing period data");
+            metrics::sample(out, "tpx3_output_write_seconds_total", writerMetrics.writeNs.get() * 1e-9);
+        }
+
+        /*!
+        \brief Find period data slot claimed for a period
+        \param period   Period
+        \return Period data slot, nullptr if no slot has been claimed for `period`
+        */
+        Period* ClaimedSlot(period_type period) noexcept
+        {
+            for (auto& pd : periodData)
+                if (pd.period.load(std::memory_order_acquire) == period)
+                    return &pd;
+            return nullptr;
         }
 
         /*!
         \brief Get XES data for period
         Retrieve per thread XES data for the purpose of filling in the histogram.
-        \param threadNo Analysis thread number (=chip number)
+        If no period data slot is free, wait until the aggregate+write thread releases one.
+        \param threadNo Analysis thread number (chip number * workers per chip + worker number)
         \param period   Period
         \return Reference to per thread XES period data
         */
-        Data& DataForPeriod(unsigned threadNo, period_type period) noexcept
+        Data& DataForPeriod(unsigned threadNo, period_type period)
         {
             CacheEntry& cached = dataCache[threadNo];
             if (cached.period == period)
                 return *cached.data;
 
-            Period* firstNone;
-            period_type expect;
-            do {
-                expect = none;
-                while(true) {
-                    firstNone = nullptr;
-                    for (auto& pd : periodData) {
-                        if (!firstNone && (pd.period == none)) {
-                            firstNone = &pd;
-                        } else if (pd.period == period) {
-                            cached.period = period;
-                            cached.data = &pd.threadData[threadNo];
-                            return *cached.data;
+            // another thread might have claimed a slot for the period already
+            for (auto& pd : periodData) {
+                if (pd.period.load(std::memory_order_acquire) == period) {
+                    cached.period = period;
+                    cached.data = &pd.threadData[threadNo];
+                    return *cached.data;
+                }
+            }
+
+            Period* slot = nullptr;
+            bool claimed = false;
+            {
+                std::unique_lock lock(thread_lock);
+                slot = ClaimedSlot(period); // slots are claimed under the lock
+                if (! slot) {
+                    if (freeSlots.empty()) {
+                        // xes::Manager too slow/unbalanced
+                        cached.exhausted.fetch_add(1, std::memory_order_relaxed);
+                        const auto t1 = std::chrono::steady_clock::now();
+                        slot_available.wait(lock, [this, period, &slot]{
+                            slot = ClaimedSlot(period);     // might have been claimed by another thread while waiting
+                            return slot || ! freeSlots.empty();
+                        });
+                        const auto t2 = std::chrono::steady_clock::now();
+                        cached.waitNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count(), std::memory_order_relaxed);
+                        if (trace) {
+                            latency_trace::ring& r = trace->worker(threadNo);
+                            r.stamp(latency_trace::slot_wait, period, threadNo, std::chrono::duration_cast<std::chrono::nanoseconds>(t1.time_since_epoch()).count());
+                            r.stamp(latency_trace::slot_wait_end, period, threadNo, std::chrono::duration_cast<std::chrono::nanoseconds>(t2.time_since_epoch()).count());
                         }
                     }
-                    if (firstNone)
-                        break;
-                    // xes::Manager too slow/unbalanced
-                    std::this_thread::sleep_for(1ms);
+                    if (! slot) {
+                        slot = freeSlots.back();
+                        freeSlots.pop_back();
+                        slot->period.store(period, std::memory_order_release);
+                        claimed = true;
+                    }
                 }
-            } while (! firstNone->period.compare_exchange_weak(expect, period));
+            }
+            if (claimed)
+                slot_available.notify_all();    // wake up threads waiting for the same period
             cached.period = period;
-            cached.data = &firstNone->threadData[threadNo];
+            cached.data = &slot->threadData[threadNo];
             return *cached.data;
         }
 
@@ -241,12 +444,15 @@ namespace xes {
         Return per thread XES data for period that will not receive more events.
         This activates the aggregate+write thread for the period data when all
         analysis threads have returned their data.
-        \param threadNo Thread number (=chip number)
+        Must be called by the analyser thread of the chip, or before it started.
+        \param threadNo Thread number (chip number * workers per chip + worker number)
         \param period   Period
         */
         void ReturnData(unsigned threadNo, period_type period)
         {
             dataCache[threadNo].period = none;
+            if (trace)
+                trace->analyser(threadNo / threadsPerChip).stamp(latency_trace::returned, period, threadNo);
             Period* periodPtr = nullptr;
             for (auto& pd : periodData) {
                 if (pd.period == period) {
@@ -259,6 +465,7 @@ namespace xes {
                 {
                     std::unique_lock lock(thread_lock);
                     periodQueue.push_back(periodPtr);
+                    periodsQueued.add();
                 }
                 action_required.notify_one();
             }
@@ -0,0 +1,383 @@
+#pragma once
+
+#ifndef XES_OUTPUT_H
+#define XES_OUTPUT_H
+
+/*!
+\file
+Provide output formats for XES data
+*/
+
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstdint>
+#include "shared_types.h"
+#include "xes_data.h"
+#include "sharding.h"
+
+#ifdef HAVE_HDF5
+    #include <hdf5.h>
+#endif
+
+namespace xes {
+
+    /*!
+    \brief Output format interface
+
+    Implementations are used by the aggregate+write thread of `xes::Manager` only.
+    */
+    struct Writer {
+        /*!
+        \brief Write aggregated data of one period
+        \param data     Aggregated XES data
+        \param period   Period of `data`
+        \throw std::ios_base::failure on output errors
+        */
+        virtual void Write(const Data& data, period_type period) = 0;
+
+        /*!
+        \brief Destructor, flushes and closes open files
+        */
+        virtual ~Writer() = default;
+
+        /*!
+        \brief Create writer for output format
+        \param format       Output format name: "text", "binary", or "hdf5"
+        \param fname        Output file name (without period and extension)
+        \param compression  Compression level 0..9 for formats that support it (hdf5)
+        \return Writer object
+        \throw std::invalid_argument if the format is unknown or not compiled in
+        */
+        static std::unique_ptr<Writer> create(const std::string& format, const std::string& fname, unsigned compression=0);
+    };
+
+    /*!
+    \brief Text output, one .xes file per period
+
+    Every line holds the time bins of one energy point as space separated decimal numbers.
+    */
+    struct TextWriter final : Writer {
+        const std::string outFileName;  //!< Output file name (without period and .xes)
+
+        /*!
+        \brief Constructor
+        \param fname Output file name (without period and .xes)
+        */
+        inline explicit TextWriter(const std::string& fname)
+            : outFileName{fname}
+        {}
+
+        inline void Write(const Data& data, period_type period) override
+        {
+            data.SaveToFile(outFileName + "-" + std::to_string(period));
+        }
+    };
+
+    /*!
+    \brief Binary output, one .xesb file per period
+
+    The file starts with a `Header` followed by the TDSpectra bins as little endian
+    32 bit integers in memory order, indexed by [time_point * npoints + energy_point].
+    */
+    struct BinaryWriter final : Writer {
+        const std::string outFileName;  //!< Output file name (without period and .xesb)
+
+        /*!
+        \brief Binary file header, all values little endian
+        */
+        struct Header final {
+            char magic[4] = {'X', 'E', 'S', 'B'};   //!< File magic
+            uint32_t version = 1;                   //!< Format version
+            uint32_t bin_size = sizeof(Data::histo_type::value_type);   //!< Bytes per bin
+            uint32_t npoints = 0;                   //!< Number of energy points
+            uint64_t time_points = 0;               //!< Number of time points (TRoiN)
+            int64_t period = 0;                     //!< Period number
+            int64_t before_roi = 0;                 //!< Number of events before the time ROI
+            int64_t after_roi = 0;                  //!< Number of events after the time ROI
+            int64_t total = 0;                      //!< Total number of events
+        };
+        static_assert(sizeof(Header) == 56, "binary header must not contain padding");
+        static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "binary output assumes a little endian host");
+
+        /*!
+        \brief Constructor
+        \param fname Output file name (without period and .xesb)
+        */
+        inline explicit BinaryWriter(const std::string& fname)
+            : outFileName{fname}
+        {}
+
+        /*!
+        \brief Write header and bins of one period
+        \param out      Output stream
+        \param data     XES data
+        \param period   Period of `data`
+        */
+        static inline void WriteRecord(std::ostream& out, const Data& data, period_type period)
+        {
+            Header header;
+            header.npoints = data.detector->energy_points.npoints;
+            header.time_points = data.detector->TRoiN;
+            header.period = period;
+            header.before_roi = data.BeforeRoi;
+            header.after_roi = data.AfterRoi;
+            header.total = data.Total;
+
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(data.TDSpectra.data()), data.TDSpectra.size() * sizeof(Data::histo_type::value_type));
+        }
+
+        /*!
+        \brief Read header and bins of one period
+        \param in       Input stream positioned at a header
+        \param rec      Set to the period data
+        \return False at the end of `in`
+        \throw std::ios_base::failure for invalid or incomplete records
+        */
+        static inline bool ReadRecord(std::istream& in, sharding::record& rec)
+        {
+            Header header;
+            if (! in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+                if (in.gcount() == 0)
+                    return false;
+                throw std::ios_base::failure("incomplete binary XES header");
+            }
+            const Header expected;
+            if (! std::equal(std::begin(header.magic), std::end(header.magic), std::begin(expected.magic)) ||
+                (header.version != expected.version) || (header.bin_size != expected.bin_size))
+                throw std::ios_base::failure("invalid binary XES header");
+            rec.period = header.period;
+            rec.npoints = header.npoints;
+            rec.time_points = header.time_points;
+            rec.before_roi = header.before_roi;
+            rec.after_roi = header.after_roi;
+            rec.total = header.total;
+            rec.bins.resize(header.time_points * header.npoints);
+            if (! in.read(reinterpret_cast<char*>(rec.bins.data()), rec.bins.size() * sizeof(rec.bins[0])))
+                throw std::ios_base::failure("incomplete binary XES data");
+            return true;
+        }
+
+        inline void Write(const Data& data, period_type period) override
+        {
+            std::ofstream OutFile(outFileName + "-" + std::to_string(period) + ".xesb", std::ios::binary);
+            WriteRecord(OutFile, data, period);
+            OutFile.close();
+            if (OutFile.fail())
+                throw std::ios_base::failure("BinaryWriter::Write failed");
+        }
+    };
+
+    /*!
+    \brief Partial histogram output of an analysis shard (see sharding.h)
+
+    Periods are written to a stream, usually the connection to the collector,
+    in the binary output format without file boundaries.
+    */
+    struct PartialWriter final : Writer {
+        std::ostream& out;  //!< Output stream
+
+        /*!
+        \brief Constructor
+        \param stream Output stream, must outlive the writer
+        */
+        inline explicit PartialWriter(std::ostream& stream)
+            : out{stream}
+        {}
+
+        inline void Write(const Data& data, period_type period) override
+        {
+            BinaryWriter::WriteRecord(out, data, period);
+            out.flush();
+            if (out.fail())
+                throw std::ios_base::failure("PartialWriter::Write failed");
+        }
+    };
+
+#ifdef HAVE_HDF5
+    /*!
+    \brief HDF5 output, one NeXus style .h5 file for all periods
+
+    Each period is appended as dataset /entry/data/period_<period> of shape [TRoiN, npoints],
+    chunked by time points and optionally deflate compressed. The event counters
+    are stored as dataset attributes.
+    */
+    class Hdf5Writer final : public Writer {
+        hid_t file = H5I_INVALID_HID;   //!< HDF5 file
+        hid_t group = H5I_INVALID_HID;  //!< NXdata group
+        const unsigned compression;     //!< Deflate level, 0 for none
+
+        /*!
+        \brief Throw on HDF5 error
+        \param status   HDF5 call result
+        \param what     Error message
+        \return status
+        */
+        static inline hid_t check(hid_t status, const char* what)
+        {
+            if (status < 0)
+                throw std::ios_base::failure(std::string("Hdf5Writer: ") + what);
+            return status;
+        }
+
+        /*!
+        \brief HDF5 identifier that is closed when it goes out of scope
+        */
+        class handle final {
+            const hid_t id;             //!< HDF5 identifier
+            herr_t (*const close)(hid_t);   //!< HDF5 close function for `id`
+
+          public:
+            /*!
+            \brief Constructor, takes ownership of a valid identifier
+            \param ident    HDF5 call result
+            \param closer   HDF5 close function for the identifier type
+            \param what     Error message if `ident` is invalid
+            \throw std::ios_base::failure for an invalid identifier, nothing has to be closed then
+            */
+            inline handle(hid_t ident, herr_t (*closer)(hid_t), const char* what)
+                : id{check(ident, what)}, close{closer}
+            {}
+
+            /*!
+            \brief Destructor, closes the identifier
+            */
+            inline ~handle()
+            {
+                close(id);
+            }
+
+            /*!
+            \brief Conversion for HDF5 calls
+            \return HDF5 identifier
+            */
+            inline operator hid_t() const noexcept
+            {
+                return id;
+            }
+
+            handle(const handle&) = delete;
+            handle(handle&&) = delete;
+            handle& operator=(const handle&) = delete;
+            handle& operator=(handle&&) = delete;
+        };
+
+        /*!
+        \brief Add string attribute
+        \param obj      HDF5 object
+        \param name     Attribute name
+        \param value    Attribute value
+        */
+        static inline void StringAttribute(hid_t obj, const char* name, const char* value)
+        {
+            const handle type{H5Tcopy(H5T_C_S1), H5Tclose, "string type"};
+            check(H5Tset_size(type, std::char_traits<char>::length(value)), "string size");
+            const handle space{H5Screate(H5S_SCALAR), H5Sclose, "attribute space"};
+            const handle attr{H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose, "attribute"};
+            check(H5Awrite(attr, type, value), "attribute write");
+        }
+
+        /*!
+        \brief Add integer attribute
+        \param obj      HDF5 object
+        \param name     Attribute name
+        \param value    Attribute value
+        */
+        static inline void IntAttribute(hid_t obj, const char* name, int64_t value)
+        {
+            const handle space{H5Screate(H5S_SCALAR), H5Sclose, "attribute space"};
+            const handle attr{H5Acreate2(obj, name, H5T_STD_I64LE, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose, "attribute"};
+            check(H5Awrite(attr, H5T_NATIVE_INT64, &value), "attribute write");
+        }
+
+      public:
+        /*!
+        \brief Constructor, creates (truncates) the output file
+        \param fname        Output file name (without .h5)
+        \param level        Deflate compression level 0..9, 0 for none
+        */
+        inline Hdf5Writer(const std::string& fname, unsigned level)
+            : compression{level}
+        {
+            file = check(H5Fcreate((fname + ".h5").c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), "file create");
+            hid_t entry = H5I_INVALID_HID;
+            try {
+                entry = check(H5Gcreate2(file, "entry", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), "entry group");
+                StringAttribute(entry, "NX_class", "NXentry");
+                group = check(H5Gcreate2(entry, "data", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), "data group");
+                StringAttribute(group, "NX_class", "NXdata");
+                H5Gclose(entry);
+            } catch (...) {
+                if (group >= 0)
+                    H5Gclose(group);
+                if (entry >= 0)
+                    H5Gclose(entry);
+                H5Fclose(file);
+                throw;
+            }
+        }
+
+        Hdf5Writer(const Hdf5Writer&) = delete;
+        Hdf5Writer(Hdf5Writer&&) = delete;
+        Hdf5Writer& operator=(const Hdf5Writer&) = delete;
+        Hdf5Writer& operator=(Hdf5Writer&&) = delete;
+
+        /*!
+        \brief Destructor, closes the output file
+        */
+        inline ~Hdf5Writer() override
+        {
+            if (group >= 0)
+                H5Gclose(group);
+            if (file >= 0)
+                H5Fclose(file);
+        }
+
+        inline void Write(const Data& data, period_type period) override
+        {
+            static_assert(sizeof(Data::histo_type::value_type) == sizeof(int32_t), "Hdf5Writer assumes 32 bit bins");
+            const hsize_t dims[2] = { data.detector->TRoiN, data.detector->energy_points.npoints };
+            const hsize_t chunk[2] = { std::max<hsize_t>(1, std::min<hsize_t>(dims[0], (1u << 16) / std::max<hsize_t>(dims[1], 1))), std::max<hsize_t>(dims[1], 1) };
+            const handle space{H5Screate_simple(2, dims, nullptr), H5Sclose, "data space"};
+            const handle plist{H5Pcreate(H5P_DATASET_CREATE), H5Pclose, "dataset properties"};
+            if (dims[0] * dims[1] > 0) {
+                H5Pset_chunk(plist, 2, chunk);
+                if (compression > 0)
+                    H5Pset_deflate(plist, compression);
+            }
+            const std::string name = "period_" + std::to_string(period);
+            const handle dset{H5Dcreate2(group, name.c_str(), H5T_STD_I32LE, space, H5P_DEFAULT, plist, H5P_DEFAULT), H5Dclose, "dataset create"};
+            check(H5Dwrite(dset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.TDSpectra.data()), "dataset write");
+            IntAttribute(dset, "period", period);
+            IntAttribute(dset, "before_roi", data.BeforeRoi);
+            IntAttribute(dset, "after_roi", data.AfterRoi);
+            IntAttribute(dset, "total", data.Total);
+            check(H5Fflush(file, H5F_SCOPE_LOCAL), "dataset write");
+        }
+    };
+#endif // HAVE_HDF5
+
+    inline std::unique_ptr<Writer> Writer::create(const std::string& format, const std::string& fname, unsigned compression)
+    {
+        if (format == "text")
+            return std::make_unique<TextWriter>(fname);
+        if (format == "binary")
+            return std::make_unique<BinaryWriter>(fname);
+        if (format == "hdf5") {
+            #ifdef HAVE_HDF5
+                return std::make_unique<Hdf5Writer>(fname, compression);
+            #else
+                (void)compression;
+                throw std::invalid_argument("hdf5 output format not compiled in (see compile.sh HDF5 option)");
+            #endif
+        }
+        throw std::invalid_argument(std::string("unknown output format: ") + format);
+    }
+
+} // namespace xes
+
+#endif // XES_OUTPUT_H
@@ -12,6 +12,9 @@ Author: hans-christian.stadler@psi.ch
 #include <vector>
 #include <fstream>
 #include <chrono>
+#include <cmath>
+#include <tuple>
+#include <limits>
 
 #include "Poco/Dynamic/Var.h"
 #include "Poco/JSON/Object.h"
@@ -22,6 +25,7 @@ Author: hans-christian.stadler@psi.ch
 #include "Poco/Net/SocketAddress.h"
 #include "Poco/Net/StreamSocket.h"
 #include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/SocketStream.h"
 #include "Poco/Net/HTTPClientSession.h"
 #include "Poco/Net/HTTPRequest.h"
 #include "Poco/Net/HTTPResponse.h"
@@ -29,13 +33,26 @@ Author: hans-christian.stadler@psi.ch
 #include "Poco/URI.h"
 #include "Poco/Process.h"
 #include "Poco/Exception.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/ConsoleChannel.h"
 
 #include "logging.h"
+#include "async_log.h"
 #include "decoder.h"
 #include "data_handler.h"
 #include "copy_handler.h"
+#include "shard_handler.h"
+#include "sharding.h"
+#include "raw_source.h"
 #include "layout.h"
 #include "processing.h"
+#include "metrics_endpoint.h"
+#include "live_preview.h"
+#include "thread_placement.h"
+#include "checkpoint.h"
+#include "latency_trace.h"
+#define ALLOC_COUNTER_DEFINE
+#include "alloc_counter.h"
 
 namespace {
     using namespace std::string_view_literals;
@@ -48,6 +65,7 @@ namespace {
     using Poco::Net::SocketAddress;
     using Poco::Net::StreamSocket;
     using Poco::Net::ServerSocket;
+    using Poco::Net::SocketStream;
     using Poco::Net::HTTPClientSession;
     using Poco::Net::HTTPRequest;
     using Poco::Net::HTTPResponse;
@@ -110,7 +128,7 @@ namespace {
 
         constexpr static unsigned DEFAULT_BUFFER_SIZE = 1024;   //!< Default IO buffer size
         constexpr static unsigned DEFAULT_NUM_BUFFERS = 8;      //!< Default number of IO buffers
-        // constexpr static unsigned DEFAULT_NUM_ANALYSERS = 6;
+        constexpr static unsigned DEFAULT_SLAB_SIZE = 4u << 20; //!< Default slab size for slab receive mode
 
         Logger& logger;                 //!< Poco::Logger object
         bool stop = false;              //!< Stop flag for options processing
@@ -118,6 +136,12 @@ namespace {
 
         SocketAddress serverAddress = SocketAddress{"localhost:8080"};  //!< Default ASI server address
         SocketAddress clientAddress = SocketAddress{"127.0.0.1:8451"};  //!< Default raw data stream tcp destination (own address)
+        SocketAddress metricsAddress;   //!< Live metrics HTTP endpoint address
+        bool metricsEnabled = false;    //!< Was a metrics address given on the commandline?
+        SocketAddress previewAddress;   //!< Live preview HTTP endpoint address
+        bool previewEnabled = false;    //!< Was a preview address given on the commandline?
+        std::unique_ptr<preview::publisher> livePreview;    //!< Live preview snapshots, published by the aggregate+write thread
+        std::unique_ptr<metrics::endpoint> previewEndpoint; //!< Live preview HTTP endpoint
 
         std::unique_ptr<HTTPClientSession> clientSession;   //!< Client session with ASI server
         std::unique_ptr<ServerSocket> serverSocket;         //!< Socket for connecting to myself
@@ -127,14 +151,43 @@ namespace {
         std::string bpcFilePath;        //!< Path to ASI bpc detector configuration file (optional)
         std::string dacsFilePath;       //!< Path to ASI dacs detector configuration file (optional)
         std::string streamFilePath;     //!< Path (and flag) to file to which the raw event stream should be copied (don't copy if empty)
+        std::string inputFilePath;      //!< Path (and flag) to captured raw event stream file to analyse instead of talking to the ASI server
+        std::string layoutFilePath;     //!< Path to detector layout JSON file for input file mode (optional)
+        unsigned long compressionThreads = 0;   //!< Number of block compression threads for --stream-to-file, 0 for uncompressed copies
+        unsigned long compressionLevel = 1;     //!< zlib compression level for --stream-to-file
+        std::string archiveFilePath;    //!< Path (and flag) to file to which the raw event stream is archived while it is analysed (don't archive if empty)
+        std::string archivePolicy = "block";    //!< Archive back-pressure policy: "block" or "drop"
+        std::string archiveIo = "buffered";     //!< Archive file IO: "buffered" or "direct"
+        std::string checkpointFilePath; //!< Path (and flag) to the analysis state checkpoint file (no checkpoints if empty)
+        double checkpointInterval = 1.; //!< Time between analysis state checkpoints in seconds
+        bool resume = false;            //!< Resume the analysis from the checkpoint file?
+        unsigned long latencyTraceEvents = 0;   //!< Number of latency trace stamps kept per thread, 0 for no latency tracing
+        std::string latencyTraceFilePath;       //!< Path (and flag) to the Chrome trace JSON file for the latency trace (not written if empty)
+        std::unique_ptr<latency_trace::tracer> latencyTrace;    //!< Period latency tracing, nullptr for none
+        std::vector<SocketAddress> shardAddresses;  //!< Analysis shard addresses, the raw stream is forwarded to them instead of analysed if not empty
+        unsigned shardIndex = 0;        //!< Shard number of this analysis shard
+        unsigned numShards = 0;         //!< Number of analysis shards if this is one of them, 0 otherwise
+        SocketAddress collectorAddress; //!< Collector address for partial histograms of an analysis shard
+        bool collectorSet = false;      //!< Was a collector address given on the commandline?
+        unsigned long collectShards = 0;    //!< Number of analysis shards to collect partial histograms from, 0 for no collector
 
         int64_t initialPeriod;                          //!< Initial period interval in clock ticks
         double undisputedThreshold = 0.1;               //!< Default undisputed period interval threshold as ratio, [t..1-t] is undisputed
         unsigned long numBuffers = DEFAULT_NUM_BUFFERS; //!< Number of IO buffers
         unsigned long bufferSize = DEFAULT_BUFFER_SIZE; //!< IO buffer size
-        // unsigned long numAnalysers = DEFAULT_NUM_ANALYSERS;
-        unsigned long numChips = 0;                     //!< Number of TPX3 chips on the detector
+        bool bufferSizeSet = false;                     //!< Was the IO buffer size given on the commandline?
+        unsigned long rawDestinations = 1;              //!< Number of raw stream destinations (connections) requested from the ASI server
+        unsigned long receiveBufferSize = 0;            //!< Socket receive buffer size (SO_RCVBUF) for raw stream connections, 0 for the system default
+        unsigned long numChips = 0;                     //!< Number of TPX3 chips on the detector (input file mode: given on the commandline, 0 for unset)
         unsigned long maxPeriodQueues = 4;              //!< Maximum number of remembered period interval changes
+        unsigned long disputedEvents = 0;               //!< Expected maximum number of events per chip within a disputed period change interval, preallocated
+        unsigned long predictorWindow = 0;              //!< Number of TDCs for the period predictor linear fit, 0 for the median interval prediction
+        std::string bufferPool = "map";                 //!< IO buffer pool type: "map" (io_buffer_pool) or "ring" (io_buffer_ring)
+        std::string receiveMode = "chunk";              //!< Raw stream receive mode: "chunk" (copy into IO buffers) or "slab" (views into receive slabs)
+        std::string dataErrors = "abort";               //!< Raw stream data error handling: "abort" (stop the analysis) or "resync" (skip corrupted data)
+        unsigned long workersPerChip = 1;               //!< Number of histogramming workers per chip, 1: histogram in the analyser thread
+        Poco::AutoPtr<Poco::Channel> syncChannel;       //!< Original logging channel, target of `asyncChannel`
+        Poco::AutoPtr<Poco::Channel> asyncChannel;      //!< Asynchronous logging channel, set by --async-log
 
     protected:
         /*!
@@ -152,6 +205,13 @@ namespace {
                 .argument("LEVEL")
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleLogLevel)));
 
+            options.addOption(Option("async-log", "A")
+                .description("log through a writer thread,\nmessages beyond NUM queued ones are dropped")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
             options.addOption(Option("help", "h")
                 .description("display help information")
                 .required(false)
@@ -172,6 +232,20 @@ namespace {
                 .argument("ADDRESS")
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleAddress)));
 
+            options.addOption(Option("metrics-address", "M")
+                .description("serve live counters at\nhttp://ADDRESS/metrics\nin Prometheus text format")
+                .required(false)
+                .repeatable(false)
+                .argument("ADDRESS")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleAddress)));
+
+            options.addOption(Option("preview-address", "")
+                .description("serve live preview histograms at\nhttp://ADDRESS/preview as JSON")
+                .required(false)
+                .repeatable(false)
+                .argument("ADDRESS")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleAddress)));
+
             options.addOption(Option("bpc-file", "b")
                 .description("bpc file path")
                 .required(false)
@@ -187,14 +261,28 @@ namespace {
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
 
             options.addOption(Option("num-buffers", "n")
-                .description("number of data buffers")
+                .description("number of data buffers per chip,\npreallocated (ring pool: rounded up to a power of 2)")
                 .required(false)
                 .repeatable(false)
                 .argument("NUM")
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
 
             options.addOption(Option("buf-size", "N")
-                .description("individual data buffer byte size,\nwill be rounded up to a multiple of 8")
+                .description("individual data buffer byte size,\nwill be rounded up to a multiple of 8,\nslab size for slab receive mode")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("raw-destinations", "")
+                .description("number of raw stream connections\nrequested from the ASI server, each with\nits own reader thread (default 1)")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("receive-buffer", "")
+                .description("socket receive buffer size (SO_RCVBUF)\nfor raw stream connections\n(default: system default)")
                 .required(false)
                 .repeatable(false)
                 .argument("NUM")
@@ -221,6 +309,48 @@ namespace {
                 .argument("NUM")
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
 
+            options.addOption(Option("predictor-window", "")
+                .description("period prediction from a linear fit over\nthe last NUM TDCs (2..64), 0 (default):\nmedian of the last 3 TDC intervals")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("disputed-events", "")
+                .description("expected maximum number of events per chip\nwithin a disputed period change interval,\npreallocated for every period reorder queue")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("buffer-pool", "B")
+                .description("IO buffer pool type:\nmap (default), ring")
+                .required(false)
+                .repeatable(false)
+                .argument("TYPE")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleChoice)));
+
+            options.addOption(Option("receive-mode", "R")
+                .description("raw stream receive mode:\nchunk (default), slab (large receive slabs,\n-n slabs of -N bytes, default 4MiB)")
+                .required(false)
+                .repeatable(false)
+                .argument("MODE")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleChoice)));
+
+            options.addOption(Option("data-errors", "")
+                .description("raw stream data error handling:\nabort (default), resync (skip to the next\nvalid packet header and continue)")
+                .required(false)
+                .repeatable(false)
+                .argument("MODE")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleChoice)));
+
+            options.addOption(Option("workers-per-chip", "w")
+                .description("histogramming worker threads per chip,\n1 (default): histogram in analyser thread")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
             options.addOption(Option("stream-to-file", "f")
                 .description("stream to file")
                 .required(false)
@@ -228,6 +358,159 @@ namespace {
                 .argument("PATH")
                 .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
 
+            options.addOption(Option("compression-threads", "z")
+                .description("compress --stream-to-file copies in\nindependent zlib blocks with NUM threads,\n0 (default): uncompressed")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("compression-level", "")
+                .description("zlib compression level 1 (default, fast) .. 9")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("archive-file", "t")
+                .description("archive raw stream to file while analysing it,\nforces slab receive mode")
+                .required(false)
+                .repeatable(false)
+                .argument("PATH")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
+
+            options.addOption(Option("archive-policy", "")
+                .description("if archiving falls behind:\nblock (default, stall the stream), drop (skip slabs)")
+                .required(false)
+                .repeatable(false)
+                .argument("POLICY")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleChoice)));
+
+            options.addOption(Option("archive-io", "")
+                .description("archive file IO:\nbuffered (default), direct (O_DIRECT, block policy only)")
+                .required(false)
+                .repeatable(false)
+                .argument("MODE")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleChoice)));
+
+            options.addOption(Option("checkpoint-file", "")
+                .description("periodically checkpoint the analysis state\ninto memory mapped file PATH")
+                .required(false)
+                .repeatable(false)
+                .argument("PATH")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
+
+            options.addOption(Option("checkpoint-interval", "")
+                .description("seconds between checkpoints, default 1")
+                .required(false)
+                .repeatable(false)
+                .argument("SECONDS")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFloat)));
+
+            options.addOption(Option("resume", "")
+                .description("resume the analysis from --checkpoint-file\nand reattach to the continuing raw stream")
+                .required(false)
+                .repeatable(false)
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFlag)));
+
+            options.addOption(Option("latency-trace", "")
+                .description("trace period latencies from raw data arrival\nto written output, keep the last NUM\ntime stamps per thread, summary at the end")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("latency-trace-file", "")
+                .description("write the latency trace as Chrome trace JSON\nto PATH, implies --latency-trace=65536\nif not given")
+                .required(false)
+                .repeatable(false)
+                .argument("PATH")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
+
+            options.addOption(Option("input-file", "i")
+                .description("analyse captured raw event stream file,\nno ASI server interaction")
+                .required(false)
+                .repeatable(false)
+                .argument("PATH")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
+
+            options.addOption(Option("layout-file", "L")
+                .description("detector layout JSON file for --input-file,\nformat of the ASI server /detector/layout response,\ndefault: input file path + .json if it exists")
+                .required(false)
+                .repeatable(false)
+                .argument("PATH")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleFilePath)));
+
+            options.addOption(Option("num-chips", "c")
+                .description("number of chips for --input-file without layout file,\nchips are arranged like the replay server does")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("shard-to", "")
+                .description("forward the raw stream by chip to analysis shards\ninstead of analysing it, chip c goes to\nshard c modulo the number of addresses")
+                .required(false)
+                .repeatable(false)
+                .argument("HOST:PORT,...")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleAddress)));
+
+            options.addOption(Option("shard", "")
+                .description("analyse shard K of N, the shard stream is received\nat --address without ASI server interaction,\nrequires --num-chips or --layout-file")
+                .required(false)
+                .repeatable(false)
+                .argument("K/N")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleShard)));
+
+            options.addOption(Option("collector", "")
+                .description("send the partial histograms of --shard\nto the collector at this address\ninstead of writing them")
+                .required(false)
+                .repeatable(false)
+                .argument("HOST:PORT")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleAddress)));
+
+            options.addOption(Option("collect", "")
+                .description("accept NUM shard connections at --address,\nmerge their partial histograms and write them")
+                .required(false)
+                .repeatable(false)
+                .argument("NUM")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleNumber)));
+
+            options.addOption(Option("reader-cpus", "")
+                .description("run the reader thread on CPUs LIST,\nlike 0-3,8")
+                .required(false)
+                .repeatable(false)
+                .argument("LIST")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleCpuList)));
+
+            options.addOption(Option("analyser-cpus", "")
+                .description("pin analyser thread of chip i\nto CPU i of LIST, round robin")
+                .required(false)
+                .repeatable(false)
+                .argument("LIST")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleCpuList)));
+
+            options.addOption(Option("worker-cpus", "")
+                .description("pin histogramming worker i\nto CPU i of LIST, round robin")
+                .required(false)
+                .repeatable(false)
+                .argument("LIST")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleCpuList)));
+
+            options.addOption(Option("writer-cpus", "")
+                .description("run the aggregate+write thread\non CPUs LIST")
+                .required(false)
+                .repeatable(false)
+                .argument("LIST")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleCpuList)));
+
+            options.addOption(Option("archive-cpus", "")
+                .description("run the raw stream archive writer thread\non CPUs LIST")
+                .required(false)
+                .repeatable(false)
+                .argument("LIST")
+                .callback(OptionCallback<Tpx3App>(this, &Tpx3App::handleCpuList)));
+
             options.addOption(Option("version", "v")
                 .description("show version")
                 .required(false)
@@ -244,6 +527,24 @@ namespace {
         {
             logger.setLevel(Logger::parseLevel(value));
             logger << "handleLogLevel(" << name << ", " << value << ")" << log_trace;
+            if (logger.getLevel() > LOG_MAX_PRIORITY)
+                logger << "log level " << value << ": messages with priority above " << LOG_MAX_PRIORITY
+                       << " are not compiled in (see compile.sh LOG_MAX_PRIORITY)" << log_warn;
+        }
+
+        /*!
+        \brief Pass log messages through an `async_channel`
+        \param capacity Maximum number of queued log messages
+        */
+        inline void startAsyncLog(std::size_t capacity)
+        {
+            Poco::Channel* current = logger.getChannel();
+            if (current)
+                syncChannel = Poco::AutoPtr<Poco::Channel>(current, true);
+            else
+                syncChannel = Poco::AutoPtr<Poco::Channel>(new Poco::ConsoleChannel);
+            asyncChannel = Poco::AutoPtr<Poco::Channel>(new async_channel{syncChannel, capacity});
+            logger.setChannel(asyncChannel);
         }
 
         /*!
@@ -263,6 +564,20 @@ namespace {
             stop = true;
         }
 
+        /*!
+        \brief Option handler for options without value
+        \param name     Option name
+        \param value    Option value (empty)
+        */
+        inline void handleFlag(const std::string& name, const std::string& value)
+        {
+            logger << "handleFlag(" << name << ", " << value << ")" << log_trace;
+            if (name == "resume")
+                resume = true;
+            else
+                throw LogicException{std::string{"unknown flag argument name: "} + name};
+        }
+
         /*!
         \brief Integer valued option handler
         \param name     Option name
@@ -281,10 +596,19 @@ namespace {
                 if (num < 8)
                     throw InvalidArgumentException{"buffer size too small"};
                 bufferSize = (num + 7ul) & ~7ul;
+                bufferSizeSet = true;
             } else if (name == "num-buffers") {
                 if (num < 1)
                     throw InvalidArgumentException{"non-positive number of data buffers"};
                 numBuffers = num;
+            } else if (name == "raw-destinations") {
+                if ((num < 1) || (num > 256))
+                    throw InvalidArgumentException{"number of raw destinations must be within 1..256"};
+                rawDestinations = num;
+            } else if (name == "receive-buffer") {
+                if ((num < 1) || (num > std::numeric_limits<int>::max()))
+                    throw InvalidArgumentException{"invalid socket receive buffer size"};
+                receiveBufferSize = num;
             } else if (name == "initial-period") {
                 if (num < 1)
                     throw InvalidArgumentException{"non-positive initial TDC period"};
@@ -293,6 +617,39 @@ namespace {
                 if (num < 1)
                     throw InvalidArgumentException{"non-positive maximum period queues"};
                 maxPeriodQueues = num;
+            } else if (name == "predictor-window") {
+                if ((num == 1) || (num > period_predictor::max_window))
+                    throw InvalidArgumentException{"predictor window must be 0 or within 2..64"};
+                predictorWindow = num;
+            } else if (name == "disputed-events") {
+                disputedEvents = num;
+            } else if (name == "latency-trace") {
+                if (num < 2)
+                    throw InvalidArgumentException{"latency trace needs at least 2 stamps per thread"};
+                latencyTraceEvents = num;
+            } else if (name == "workers-per-chip") {
+                if (num < 1)
+                    throw InvalidArgumentException{"non-positive number of workers per chip"};
+                workersPerChip = num;
+            } else if (name == "num-chips") {
+                if (num < 1)
+                    throw InvalidArgumentException{"non-positive number of chips"};
+                numChips = num;
+            } else if (name == "collect") {
+                if (num < 1)
+                    throw InvalidArgumentException{"non-positive number of shards to collect"};
+                collectShards = num;
+            } else if (name == "compression-threads") {
+                compressionThreads = num;
+            } else if (name == "compression-level") {
+                if ((num < 1) || (num > 9))
+                    throw InvalidArgumentException{"compression level must be within 1..9"};
+                compressionLevel = num;
+            } else if (name == "async-log") {
+                if (num < 2)
+                    throw InvalidArgumentException{"asynchronous log queue too small"};
+                if (asyncChannel.isNull())
+                    startAsyncLog(num);
             } else {
                 throw LogicException{std::string{"unknown number argument name: "} + name};
             }
@@ -316,6 +673,10 @@ namespace {
                 if ((val < .0) || (val > .5))
                     throw InvalidArgumentException{"undisputed-period outside of [0 .. 0.5]"};
                 undisputedThreshold = val;
+            } else if (name == "checkpoint-interval") {
+                if (! (val > .0))
+                    throw InvalidArgumentException{"non-positive checkpoint interval"};
+                checkpointInterval = val;
             } else {
                 throw LogicException{std::string{"unknown float argument name: "} + name};
             }
@@ -341,6 +702,38 @@ namespace {
                 } catch (Poco::Exception& ex) {
                     throw InvalidArgumentException{"my address", ex, __LINE__};
                 }
+            } else if (name == "metrics-address") {
+                try {
+                    metricsAddress = SocketAddress{value};
+                    metricsEnabled = true;
+                } catch (Poco::Exception& ex) {
+                    throw InvalidArgumentException{"metrics address", ex, __LINE__};
+                }
+            } else if (name == "preview-address") {
+                try {
+                    previewAddress = SocketAddress{value};
+                    previewEnabled = true;
+                } catch (Poco::Exception& ex) {
+                    throw InvalidArgumentException{"preview address", ex, __LINE__};
+                }
+            } else if (name == "collector") {
+                try {
+                    collectorAddress = SocketAddress{value};
+                    collectorSet = true;
+                } catch (Poco::Exception& ex) {
+                    throw InvalidArgumentException{"collector address", ex, __LINE__};
+                }
+            } else if (name == "shard-to") {
+                shardAddresses.clear();
+                for (std::size_t pos=0; pos<=value.size();) {
+                    const std::size_t end = std::min(value.find(',', pos), value.size());
+                    try {
+                        shardAddresses.emplace_back(value.substr(pos, end - pos));
+                    } catch (Poco::Exception& ex) {
+                        throw InvalidArgumentException{"shard address", ex, __LINE__};
+                    }
+                    pos = end + 1;
+                }
             } else {
                 throw LogicException{std::string{"unknown address argument name: "} + name};
             }
@@ -360,10 +753,89 @@ namespace {
                 dacsFilePath = value;
             else if (name == "stream-to-file")
                 streamFilePath = value;
+            else if (name == "input-file")
+                inputFilePath = value;
+            else if (name == "layout-file")
+                layoutFilePath = value;
+            else if (name == "archive-file")
+                archiveFilePath = value;
+            else if (name == "checkpoint-file")
+                checkpointFilePath = value;
+            else if (name == "latency-trace-file")
+                latencyTraceFilePath = value;
             else
                 throw LogicException{std::string{"unknown file path argument name: "} + name};
         }
 
+        /*!
+        \brief Option handler for options with a fixed set of values
+        \param name     Option name
+        \param value    Option value
+        */
+        inline void handleChoice(const std::string& name, const std::string& value)
+        {
+            logger << "handleChoice(" << name << ", " << value << ')' << log_trace;
+            if (name == "buffer-pool") {
+                if ((value != "map") && (value != "ring"))
+                    throw InvalidArgumentException{std::string{"unknown buffer pool type: "} + value};
+                bufferPool = value;
+            } else if (name == "receive-mode") {
+                if ((value != "chunk") && (value != "slab"))
+                    throw InvalidArgumentException{std::string{"unknown receive mode: "} + value};
+                receiveMode = value;
+            } else if (name == "data-errors") {
+                if ((value != "abort") && (value != "resync"))
+                    throw InvalidArgumentException{std::string{"unknown data error handling: "} + value};
+                dataErrors = value;
+            } else if (name == "archive-policy") {
+                if ((value != "block") && (value != "drop"))
+                    throw InvalidArgumentException{std::string{"unknown archive policy: "} + value};
+                archivePolicy = value;
+            } else if (name == "archive-io") {
+                if ((value != "buffered") && (value != "direct"))
+                    throw InvalidArgumentException{std::string{"unknown archive IO mode: "} + value};
+                archiveIo = value;
+            } else {
+                throw LogicException{std::string{"unknown choice argument name: "} + name};
+            }
+        }
+
+        /*!
+        \brief Analysis shard option handler
+        \param name     Option name
+        \param value    Option value
+        */
+        inline void handleShard(const std::string& name, const std::string& value)
+        {
+            logger << "handleShard(" << name << ", " << value << ')' << log_trace;
+            try {
+                std::tie(shardIndex, numShards) = sharding::parse_shard(value);
+            } catch (std::invalid_argument& ex) {
+                throw InvalidArgumentException{ex.what()};
+            }
+        }
+
+        /*!
+        \brief CPU list option handler
+        \param name     Option name
+        \param value    Option value
+        */
+        inline void handleCpuList(const std::string& name, const std::string& value)
+        {
+            logger << "handleCpuList(" << name << ", " << value << ')' << log_trace;
+            for (unsigned r=0; r<placement::num_roles; r++) {
+                if (name == std::string{placement::role_name[r]} + "-cpus") {
+                    try {
+                        placement::cpus[r] = placement::parse(value);
+                    } catch (std::invalid_argument& ex) {
+                        throw InvalidArgumentException{name + ": " + ex.what()};
+                    }
+                    return;
+                }
+            }
+            throw LogicException{std::string{"unknown CPU list argument name: "} + name};
+        }
+
         /*!
         \brief Version option handler
         \param name     Option name
@@ -582,12 +1054,16 @@ namespace {
         /*!
         \brief Send raw event stream destination IP and port information to ASI server
         \param address TCP address
+        \param count   Number of raw destinations, the server connects to `address` once for each of them
         */
-        void serverRawDestination(const SocketAddress& address)
+        void serverRawDestination(const SocketAddress& address, unsigned count=1)
         {
-            logger << "serverRawDestination(" << address.toString() << ")" << log_trace;
+            logger << "serverRawDestination(" << address.toString() << ", " << count << ")" << log_trace;
             HTTPResponse response;
-            std::string destinationJsonString = R"({ "Raw": [{ "Base": "tcp://connect@)" + address.toString() + R"(" }] })";
+            std::string destinationJsonString = R"({ "Raw": [)";
+            for (unsigned i=0; i<count; i++)
+                destinationJsonString += std::string{i ? ", " : ""} + R"({ "Base": "tcp://connect@)" + address.toString() + R"(" })";
+            destinationJsonString += "] }";
             auto& in = putJsonString("/server/destination", destinationJsonString, response);
             checkResponse(response, in);
             logger << "Response of uploading the Destination Configuration to SERVAL : " << in.rdbuf() << log_notice;
@@ -607,6 +1083,399 @@ namespace {
             checkSession(in);
         }
 
+        /*!
+        \brief Extract detector layout from JSON object
+        \param layoutPtr    Detector layout JSON object in ASI server /detector/layout response format
+        \return Detector layout for the first `numChips` chips
+        */
+        detector_layout parseLayout(const Poco::JSON::Object::Ptr& layoutPtr)
+        {
+            detector_layout layout;
+            auto origPtr = layoutPtr | "Original";
+            origPtr->get("Width").convert(layout.width);
+            origPtr->get("Height").convert(layout.height);
+
+            auto chipPtr = origPtr / "Chips";
+            for (decltype(numChips) i=0; i<numChips; i++) {
+                chip_position chip;
+                (chipPtr | i)->get("X").convert(chip.x);
+                (chipPtr | i)->get("Y").convert(chip.y);
+                layout.chip.push_back(chip);
+            }
+
+            {
+                LogProxy log(logger);
+                log << "layout: " << layout.width << ',' << layout.height << ':';
+                for (decltype(numChips) i=0; i<numChips; i++)
+                    log << ' ' << layout.chip[i].x << ',' << layout.chip[i].y;
+                log << log_debug;
+            }
+            return layout;
+        }
+
+        /*!
+        \brief Detector layout for input file mode
+
+        The layout is read from the layout file if there is one, otherwise it is generated
+        for `numChips` chips the same way the replay server (test_server.cpp) does it.
+
+        \return Detector layout
+        */
+        detector_layout inputFileLayout()
+        {
+            std::string path = layoutFilePath;
+            if (path.empty() && std::ifstream(inputFilePath + ".json").good())
+                path = inputFilePath + ".json";
+
+            if (! path.empty()) {
+                logger << "reading detector layout from " << path << log_info;
+                std::ifstream in(path);
+                if (! in)
+                    throw InvalidArgumentException{std::string{"unable to open layout file "} + path};
+                jsonParser.reset();
+                auto layoutPtr = jsonParser.parse(in).extract<Poco::JSON::Object::Ptr>();
+                const auto numLayoutChips = ((layoutPtr | "Original") / "Chips")->size();
+                if (numChips == 0)
+                    numChips = numLayoutChips;
+                else if (numChips > numLayoutChips)
+                    throw InvalidArgumentException{std::string{"layout file has less than "} + std::to_string(numChips) + " chips"};
+                return parseLayout(layoutPtr);
+            }
+
+            if (numChips == 0)
+                throw InvalidArgumentException{"--input-file and --shard require --num-chips or a layout file"};
+            const auto width = static_cast<unsigned>(std::ceil(std::sqrt(numChips)));
+            const auto height = numChips / width;
+            if ((width * height) != numChips)
+                throw InvalidArgumentException{"number of chips cannot be decomposed properly into width and height, use a layout file"};
+            detector_layout layout;
+            layout.width = width * chip_size;
+            layout.height = height * chip_size;
+            for (unsigned h=0; h<height; h++)
+                for (unsigned w=0; w<width; w++)
+                    layout.chip.push_back({h * chip_size, w * chip_size});
+            return layout;
+        }
+
+        /*!
+        \brief Listen for raw event data stream connections at the client address
+
+        The socket receive buffer size is set before listening, so accepted connections inherit it
+        and TCP window scaling can make use of it.
+        */
+        void listenRaw()
+        {
+            logger << "listening at " << clientAddress.toString() << log_notice;
+            serverSocket.reset(new ServerSocket{});
+            if (receiveBufferSize > 0)
+                serverSocket->setReceiveBufferSize(receiveBufferSize);
+            serverSocket->bind(clientAddress, true);
+            serverSocket->listen();
+        }
+
+        /*!
+        \brief Accept raw event data stream connections
+        \param count Number of connections
+        \return Connected sockets in order of acceptance
+        */
+        std::vector<StreamSocket> acceptRaw(unsigned count)
+        {
+            std::vector<StreamSocket> connections;
+            for (unsigned i=0; i<count; i++) {
+                SocketAddress senderAddress;
+                connections.push_back(serverSocket->acceptConnection(senderAddress));
+                logger << "raw stream " << i << " connection from " << senderAddress.toString()
+                       << ", receive buffer " << connections.back().getReceiveBufferSize() << " bytes" << log_info;
+            }
+            return connections;
+        }
+
+        /*!
+        \brief Analyse raw event data streams
+        \tparam Pool        IO buffer pool type
+        \param dataStreams  Raw event data stream sources, each one gets its own reader thread
+        */
+        template<typename Pool>
+        void analyseStream(const std::vector<raw_source*>& dataStreams)
+        {
+            const auto t1 = wall_clock::now();
+
+            const bool slabs = (receiveMode == "slab");
+            const unsigned long bufSize = (slabs && !bufferSizeSet) ? DEFAULT_SLAB_SIZE : bufferSize;
+            std::unique_ptr<stream_archive> archive;
+            if (! archiveFilePath.empty()) {
+                try {
+                    archive.reset(new stream_archive{archiveFilePath, (archivePolicy == "drop") ? stream_archive::drop : stream_archive::block,
+                                                     archiveIo == "direct", numBuffers});
+                } catch (std::invalid_argument& ex) {
+                    throw InvalidArgumentException{ex.what()};
+                } catch (std::exception& ex) {
+                    throw RuntimeException{ex.what()};
+                }
+                logger << "archiving raw stream to " << archiveFilePath << ", " << archivePolicy << " policy, " << archiveIo << " IO" << log_info;
+            }
+            checkpoint::image resumed;
+            std::unique_ptr<checkpoint::store> checkpoints;
+            if (! checkpointFilePath.empty()) {
+                try {
+                    if (resume)
+                        resumed = checkpoint::load(checkpointFilePath);
+                    checkpoint::image layout;
+                    processing::checkpointLayout(layout);
+                    layout.chip.resize(numChips);
+                    checkpoints.reset(new checkpoint::store{checkpointFilePath, std::move(layout), std::chrono::duration<double>{checkpointInterval}});
+                } catch (std::exception& ex) {
+                    throw RuntimeException{ex.what()};
+                }
+                logger << "checkpointing analysis state to " << checkpointFilePath << " every " << checkpointInterval << 's' << log_info;
+            }
+            DataHandler<AsiRawStreamDecoder, Pool> dataHandler(dataStreams, logger, bufSize, numBuffers, numChips, initialPeriod, undisputedThreshold, maxPeriodQueues, slabs, workersPerChip, archive.get(), disputedEvents, dataErrors == "resync", predictorWindow, checkpoints.get());
+            dataHandler.setTrace(latencyTrace.get());
+            if (resume) {
+                try {
+                    dataHandler.resume(resumed);
+                } catch (std::invalid_argument& ex) {
+                    throw InvalidArgumentException{ex.what()};
+                }
+                logger << "resumed from checkpoint " << resumed.sequence << " in " << checkpointFilePath << log_notice;
+            }
+            std::unique_ptr<metrics::endpoint> metricsEndpoint;
+            if (metricsEnabled) {
+                metricsEndpoint.reset(new metrics::endpoint{metricsAddress, [&dataHandler](std::ostream& out) {
+                    dataHandler.writeMetrics(out);
+                    processing::writeMetrics(out);
+                }});
+                logger << "serving metrics at http://" << metricsAddress.toString() << "/metrics" << log_info;
+            }
+            dataHandler.run_async();
+            dataHandler.await();
+            if (checkpoints) {
+                checkpoints->finish(! dataHandler.failed());
+                logger << checkpoints->writerPlacement() << log_info;
+                if (! checkpoints->writeError().empty())
+                    logger << "checkpoint error: " << checkpoints->writeError() << log_error;
+                logger << checkpoints->written() << " checkpoints written, " << checkpoints->abandoned() << " abandoned" << log_info;
+            }
+            if (latencyTrace) {
+                processing::finish();   // the aggregate+write thread stamps the last periods
+                reportTrace();
+            }
+
+            const auto t2 = wall_clock::now();
+            const double time = std::chrono::duration<double>{t2 - t1}.count();
+
+            const uint64_t hits = dataHandler.hitCount;
+            LogProxy log_proxy(logger);
+            log_proxy << "time: " << time << "s, hits: " << hits << ", rate: " << (hits / time) << " hits/s\n"
+                << "analysis spin: " << dataHandler.analyseSpinTime << "s, work: " << dataHandler.analyseTime << "s, waits: " << dataHandler.analyseWaits.to_string()
+                << "\nreading spin: " << dataHandler.readSpinTime << "s, work: " << dataHandler.readTime << "s, waits: " << dataHandler.readWaits.to_string();
+            if (workersPerChip > 1)
+                log_proxy << "\nhistogram spin: " << dataHandler.histogramSpinTime << "s, work: " << dataHandler.histogramTime << "s, waits: " << dataHandler.histogramWaits.to_string();
+            log_proxy << log_notice;
+        }
+
+        /*!
+        \brief Start period latency tracing, before `processing::init()`
+        */
+        void startTrace()
+        {
+            latencyTrace.reset(new latency_trace::tracer{latencyTraceEvents ? latencyTraceEvents : latency_trace::tracer::default_capacity});
+            processing::setTrace(latencyTrace.get());
+            logger << "latency trace with " << (latencyTraceEvents ? latencyTraceEvents : latency_trace::tracer::default_capacity) << " stamps per thread" << log_info;
+        }
+
+        /*!
+        \brief Log the latency summary and write the Chrome trace file, after the analysis stopped
+        \throw RuntimeException if the trace file cannot be written
+        */
+        void reportTrace()
+        {
+            {
+                LogProxy log(logger);
+                latencyTrace->report(log);
+                log << log_notice;
+            }
+            if (latencyTraceFilePath.empty())
+                return;
+            std::ofstream out{latencyTraceFilePath};
+            latencyTrace->write_chrome(out);
+            out.close();
+            if (! out)
+                throw RuntimeException{std::string{"failed to write latency trace file "} + latencyTraceFilePath};
+            logger << "latency trace written to " << latencyTraceFilePath << log_info;
+        }
+
+        /*!
+        \brief Start serving live preview histograms
+
+        The endpoint stays up for the lifetime of the application, so the last period
+        can still be looked at after the analysis has finished.
+        */
+        void startPreview()
+        {
+            livePreview.reset(new preview::publisher);
+            processing::setPreview(livePreview.get());
+            previewEndpoint.reset(new metrics::endpoint{previewAddress, [this](std::ostream& out) {
+                preview::snapshot snapshot;
+                livePreview->read(snapshot);
+                preview::write_json(out, snapshot);
+            }, "/preview", "application/json"});
+            logger << "serving live preview at http://" << previewAddress.toString() << "/preview" << log_info;
+        }
+
+        /*!
+        \brief Connect to the analysis shards
+        \return Connected sockets, indexed by shard number
+        */
+        std::vector<StreamSocket> connectShards()
+        {
+            std::vector<StreamSocket> shards;
+            for (const auto& address : shardAddresses) {
+                logger << "connecting to shard " << shards.size() << " at " << address.toString() << log_notice;
+                shards.emplace_back(address);
+            }
+            return shards;
+        }
+
+        /*!
+        \brief Forward raw event data stream by chip to the analysis shards
+        \param dataStream   Raw event data stream source
+        \param shards       Connected analysis shard sockets
+        */
+        void forwardStream(raw_source& dataStream, std::vector<StreamSocket>& shards)
+        {
+            const auto t1 = wall_clock::now();
+
+            ShardHandler shardHandler(dataStream, logger, shards, numChips, numBuffers);
+            shardHandler.run_async();
+            shardHandler.await();
+
+            const auto t2 = wall_clock::now();
+            const double time = std::chrono::duration<double>{t2 - t1}.count();
+
+            LogProxy log_proxy(logger);
+            log_proxy << "time: " << time << "s, reading work: " << shardHandler.readTime << 's';
+            for (unsigned s=0; s<shards.size(); s++)
+                log_proxy << "\nshard " << s << ": " << shardHandler.chunksSent(s) << " chunks, " << shardHandler.bytesSent(s) << " bytes";
+            log_proxy << log_notice;
+            if (shardHandler.failed())
+                throw RuntimeException{"forwarding the raw stream to the analysis shards failed"};
+        }
+
+        /*!
+        \brief Analyse the stream of one analysis shard without ASI server interaction
+        \return 0 for ok
+        */
+        inline int analyseShard()
+        {
+            if (! inputFilePath.empty() || ! streamFilePath.empty() || ! shardAddresses.empty())
+                throw InvalidArgumentException{"--shard cannot be combined with --input-file, --stream-to-file or --shard-to"};
+
+            const detector_layout layout = inputFileLayout();
+            const std::vector<unsigned> chips = sharding::shard_chips(shardIndex, numShards, numChips);
+            if (chips.empty())
+                throw InvalidArgumentException{std::string{"shard "} + std::to_string(shardIndex) + " has no chips"};
+
+            std::unique_ptr<StreamSocket> collector;
+            std::unique_ptr<SocketStream> partials;
+            if (collectorSet) {
+                logger << "connecting to collector at " << collectorAddress.toString() << log_notice;
+                collector.reset(new StreamSocket{collectorAddress});
+                partials.reset(new SocketStream{*collector});
+            }
+            processing::init(layout, workersPerChip, chips, partials.get());
+            numChips = chips.size();
+
+            logger << "shard " << shardIndex << '/' << numShards << ", " << numChips << " chips" << log_notice;
+            listenRaw();
+            StreamSocket dataStream = std::move(acceptRaw(1)[0]);
+            logger << bufferPool << " buffer pool, " << receiveMode << " receive mode" << log_info;
+
+            socket_source source{dataStream};
+            if (bufferPool == "ring")
+                analyseStream<io_buffer_ring>({&source});
+            else
+                analyseStream<io_buffer_pool>({&source});
+            dataStream.close();
+
+            processing::finish();
+            if (collector) {
+                partials->flush();
+                collector->shutdownSend();
+            }
+            return Application::EXIT_OK;
+        }
+
+        /*!
+        \brief Merge the partial histograms of the analysis shards and write them
+        \return 0 for ok
+        */
+        inline int collectPartials()
+        {
+            const auto t1 = wall_clock::now();
+
+            logger << "collecting partial histograms of " << collectShards << " shards at " << clientAddress.toString() << log_notice;
+            serverSocket.reset(new ServerSocket{clientAddress});
+            std::vector<StreamSocket> connections;
+            for (unsigned i=0; i<collectShards; i++) {
+                SocketAddress shardAddress;
+                connections.push_back(serverSocket->acceptConnection(shardAddress));
+                logger << "shard connection from " << shardAddress.toString() << log_info;
+            }
+            std::vector<std::unique_ptr<SocketStream>> streams;
+            std::vector<std::istream*> partials;
+            for (auto& connection : connections) {
+                streams.emplace_back(new SocketStream{connection});
+                partials.push_back(streams.back().get());
+            }
+
+            uint64_t periods = 0;
+            try {
+                periods = processing::collect(partials);
+            } catch (std::invalid_argument& ex) {
+                throw InvalidArgumentException{ex.what()};
+            } catch (std::exception& ex) {
+                throw RuntimeException{ex.what()};
+            }
+
+            const auto t2 = wall_clock::now();
+            const double time = std::chrono::duration<double>{t2 - t1}.count();
+            logger << "time: " << time << "s, periods written: " << periods << log_notice;
+            return Application::EXIT_OK;
+        }
+
+        /*!
+        \brief Analyse captured raw event stream file without ASI server interaction
+        \return 0 for ok
+        */
+        inline int analyseFile()
+        {
+            if (! streamFilePath.empty())
+                throw InvalidArgumentException{"--stream-to-file cannot be combined with --input-file"};
+
+            const detector_layout layout = inputFileLayout();
+            std::vector<StreamSocket> shards;
+            if (shardAddresses.empty())
+                processing::init(layout, workersPerChip);
+            else
+                shards = connectShards();
+
+            file_source source{inputFilePath};
+            logger << "input file " << inputFilePath << ", " << source.file_size() << " bytes"
+                   << (source.compressed_size() ? std::string{" ("} + std::to_string(source.compressed_size()) + " compressed)" : std::string{})
+                   << ", " << numChips << " chips, "
+                   << bufferPool << " buffer pool, " << receiveMode << " receive mode" << log_info;
+
+            if (! shards.empty())
+                forwardStream(source, shards);
+            else if (bufferPool == "ring")
+                analyseStream<io_buffer_ring>({&source});
+            else
+                analyseStream<io_buffer_pool>({&source});
+
+            return Application::EXIT_OK;
+        }
+
         /*!
         \brief Poco application main function
         \param args Positional commandline args
@@ -615,7 +1484,8 @@ namespace {
         inline int main(const std::vector<std::string>& args) override
         {
             {
-                auto log_proxy = logger << "main(";
+                LogProxy log_proxy(logger);
+                log_proxy << "main(";
                 for (const auto& arg : args)
                     log_proxy << ' ' << arg;
                 log_proxy << " )" << log_trace;
@@ -626,6 +1496,40 @@ namespace {
             if (stop)
                 return rval;
 
+            if (! archiveFilePath.empty()) {
+                if (! streamFilePath.empty())
+                    throw InvalidArgumentException{"--archive-file cannot be combined with --stream-to-file"};
+                if (receiveMode != "slab")
+                    logger << "--archive-file forces slab receive mode" << log_notice;
+                receiveMode = "slab";
+            }
+
+            if (resume && checkpointFilePath.empty())
+                throw InvalidArgumentException{"--resume requires --checkpoint-file"};
+
+            if (! shardAddresses.empty() && (! streamFilePath.empty() || ! archiveFilePath.empty()))
+                throw InvalidArgumentException{"--shard-to cannot be combined with --stream-to-file or --archive-file"};
+
+            if ((rawDestinations > 1) && (! streamFilePath.empty() || ! archiveFilePath.empty() || ! shardAddresses.empty()
+                                          || ! inputFilePath.empty() || (numShards > 0) || (collectShards > 0)))
+                throw InvalidArgumentException{"--raw-destinations requires analysing the ASI server stream, it cannot be combined with "
+                                               "--stream-to-file, --archive-file, --shard-to, --input-file, --shard or --collect"};
+
+            if (previewEnabled)
+                startPreview();
+
+            if ((latencyTraceEvents > 0) || ! latencyTraceFilePath.empty())
+                startTrace();
+
+            if (collectShards > 0)
+                return collectPartials();
+
+            if (numShards > 0)
+                return analyseShard();
+
+            if (! inputFilePath.empty())
+                return analyseFile();
+
             logger << "connecting to ASI server at " << serverAddress.toString() << log_notice;
             clientSession.reset(new HTTPClientSession{serverAddress});
 
@@ -675,68 +1579,55 @@ namespace {
                     log << log_notice;
                 }
 
-                auto origPtr = layoutPtr | "Original";
-                origPtr->get("Width").convert(layout.width);
-                origPtr->get("Height").convert(layout.height);
-
-                auto chipPtr = origPtr / "Chips";
-                for (decltype(numChips) i=0; i<numChips; i++) {
-                    chip_position chip;
-                    (chipPtr | i)->get("X").convert(chip.x);
-                    (chipPtr | i)->get("Y").convert(chip.y);
-                    layout.chip.push_back(chip);
-                }
-
-                {
-                    LogProxy log(logger);
-                    log << "layout: " << layout.width << ',' << layout.height << ':';
-                    for (decltype(numChips) i=0; i<numChips; i++)
-                        log << ' ' << layout.chip[i].x << ',' << layout.chip[i].y;
-                    log << log_debug;
-                }
+                layout = parseLayout(layoutPtr);
             }
 
-            processing::init(layout);
+            std::vector<StreamSocket> shards;
+            if (! shardAddresses.empty())
+                shards = connectShards();
+            else
+                processing::init(layout, workersPerChip);
 
-            logger << "listening at " << clientAddress.toString() << log_notice;
-            serverSocket.reset(new ServerSocket{clientAddress});
+            listenRaw();
 
-            serverRawDestination(clientAddress);
+            serverRawDestination(clientAddress, rawDestinations);
 
             acquisitionStart();
 
-            SocketAddress senderAddress;
-            StreamSocket dataStream = serverSocket->acceptConnection(senderAddress);
+            std::vector<StreamSocket> connections = acceptRaw(rawDestinations);
+            StreamSocket& dataStream = connections[0];
 
-            if (! streamFilePath.empty()) {
+            if (! shards.empty()) {
+                logger << "forwarding to " << shards.size() << " shards" << log_info;
+                socket_source source{dataStream};
+                forwardStream(source, shards);
+                dataStream.close();
+            } else if (! streamFilePath.empty()) {
                 const auto t1 = wall_clock::now();
 
-                CopyHandler copyHandler(dataStream, streamFilePath, logger);
+                CopyHandler copyHandler(dataStream, streamFilePath, logger, compressionThreads, compressionLevel);
                 copyHandler.run_async();
                 copyHandler.await();
 
                 const auto t2 = wall_clock::now();
                 const double time = std::chrono::duration<double>{t2 - t1}.count();
                 
-                logger << "time: " << time << "s\n";
+                logger << "time: " << time << "s" << log_notice;
             } else {
-                const auto t1 = wall_clock::now();
-
-                logger << "connection from " << senderAddress.toString() << log_info;
+                logger << connections.size() << " raw streams, " << bufferPool << " buffer pool, " << receiveMode << " receive mode" << log_info;
 
-                DataHandler<AsiRawStreamDecoder> dataHandler(dataStream, logger, bufferSize, numChips, initialPeriod, undisputedThreshold, maxPeriodQueues);
-                dataHandler.run_async();
-                dataHandler.await();
-
-                const auto t2 = wall_clock::now();
-                const double time = std::chrono::duration<double>{t2 - t1}.count();
-
-                dataStream.close();
-
-                const uint64_t hits = dataHandler.hitCount;
-                logger << "time: " << time << "s, hits: " << hits << ", rate: " << (hits / time) << " hits/s\n"
-                    << "analysis spin: " << dataHandler.analyseSpinTime << "s, work: " << dataHandler.analyseTime
-                    << "\nreading spin: " << dataHandler.readSpinTime << "s, work: " << dataHandler.readTime << log_notice;
+                std::vector<std::unique_ptr<socket_source>> sources;
+                std::vector<raw_source*> streams;
+                for (auto& connection : connections) {
+                    sources.emplace_back(new socket_source{connection});
+                    streams.push_back(sources.back().get());
+                }
+                if (bufferPool == "ring")
+                    analyseStream<io_buffer_ring>(streams);
+                else
+                    analyseStream<io_buffer_pool>(streams);
+                for (auto& connection : connections)
+                    connection.close();
             }
 
             return Application::EXIT_OK;
@@ -755,7 +1646,23 @@ namespace {
             init(argc, argv);
         }
 
-        inline virtual ~Tpx3App() {}
+        /*!
+        \brief Destructor, writes out queued log messages if --async-log was used
+
+        With --preview-address, outstanding periods are written first, because
+        they are published to the live preview that is destroyed with the application.
+        */
+        inline virtual ~Tpx3App()
+        {
+            if (livePreview) {
+                processing::finish();
+                processing::setPreview(nullptr);
+            }
+            if (! asyncChannel.isNull()) {
+                logger.setChannel(syncChannel);
+                asyncChannel->close();
+            }
+        }
     };
 
 } // namespace
@@ -807,6 +1714,8 @@ The software consists of
     Unit tests for some of the tpx3app components
 - server\n
     ASI server raw event stream replay server
+- bench\n
+    Benchmarks for performance critical components and the whole processing pipeline on a synthetic stream (see stream_generator.h)
 
 \section design_sec Design
 
@@ -822,7 +1731,12 @@ The incoming data stream is split into per chip data streams.
 
 The raw event stream from the ASI server comes in packets per chip.
 These packets are distributed by a single reader thread to per chip reordering IO buffer queues (see io_buffers.h).
+With --buffer-pool=ring, a preallocated single producer single consumer ring (see io_buffer_ring and spsc_ring.h) is used instead.
+With --receive-mode=slab, the reader receives the stream into large slabs (see io_slabs.h) and the IO buffers become views into these slabs.
 Per chip there's a single analysis thread that dispatches events from IO buffers.
+Each IO buffer is first classified and decoded in bulk (see AsiRawStreamDecoder::classify in decoder.h, vectorized with AVX2/AVX-512 if available) into
+structure of arrays columns for hit TOA, TOT and pixel and TDC positions. The period stage reads these columns, and the histogramming code receives
+TOT and pixel packed into one word instead of the raw event.
 
 Every analysis thread deals with event data originating from a single detector chip.
 
@@ -833,11 +1747,16 @@ Events that fall into a disputed interval (see undisputedThreshold) around expec
 Such reordering queues are maintained for a number of recent period changes (see maxPeriodQueues and period_queues.h). Events for which period number assignment
 is undisputed - because they don't fall into a disputed interval, or because the TDC of the disputed interval has been seen - are sent to the histogramming code
 (see processing.cpp). The histogram is saved and cleared periodically (see save_interval).
+With --workers-per-chip=N (N > 1), the analysis thread passes period attributed events in batches to N histogramming workers
+(see event_batches.h), each of them filling in its own copy of the period histogram. Before a period is saved, the analysis thread waits for its workers.
 
 \section issues_sec Issues
 
+- Tee mode (--archive-file) writes whole slabs and therefore needs slab receive mode.
 - The parallelization into and synchronization between threads is probably too simple to be fast.
-- Logging and error handling are implemented for debugging right now, which might be too slow.
+- Error handling is implemented for debugging right now, which might be too slow.
+- Log messages less important than LOG_MAX_PRIORITY (see compile.sh) are compiled out, so optimized builds ignore --log-level debug and trace.
+  Console output is synchronous, use --async-log to hand log messages to a writer thread instead.
 - Missing requirements for many aspects, like logging, exception handling, and configuration.
 - Missing requirements for the software environment the analysis process will be embedded into.
 - No functional verification has been done yet.
@@ -854,6 +1773,235 @@ $ ./test
 This should give you a list of executed tests with all OK as test result. Extra arguments are documented through the --help option.
 The test executable takes a C++ regular expression as filter pattern, for example.
 
+\section benchmarks Benchmarks
+
+The bench executable measures the raw stream decoder, period prediction and attribution, period queues at several
+disputed event densities, IO buffer hand-off, histogram aggregation, histogramming, output writing, and the whole
+processing pipeline on a synthetic raw event stream file (one chip per spare core, up to 4). Input is generated with fixed seeds,
+so runs on the same machine are comparable.
+Processing.ini, XESPoints.inp and output files are written to a temporary directory that is removed at the end.
+With --json the results are printed as one JSON object that also contains the version string, for tracking
+regressions across commits:
+
+\code{.unparsed}
+$ CXX=g++-11 ./compile.sh bench
+$ ./bench --json > bench-$(git log -n1 --format=%h).json
+\endcode
+
+The optional positional arguments are the number of raw words, the chunk size in words, and the number of repetitions.
+
+\section live_metrics Live Metrics
+
+With --metrics-address=HOST:PORT the analysis serves live counters at http://HOST:PORT/metrics in Prometheus text format:
+received bytes and chunks, per chip TOA, TDC and disputed events, analysed and queued IO buffers, reorder queues,
+period data slot waits, output lag in periods and output aggregate/write time. Rates are left to the scraper.
+The counters are written with relaxed atomic stores by the thread owning them and sit on per thread cache lines,
+so scraping does not take any locks of the processing pipeline.
+
+\code{.unparsed}
+$ ./tpx3app --input-file=raw.tpx3 --num-chips=4 --metrics-address=localhost:9100 &
+$ curl -s localhost:9100/metrics | grep tpx3_events_total
+\endcode
+
+\section live_preview Live Preview
+
+With --preview-address=HOST:PORT the analysis serves the latest aggregated period histogram and the running sum of all
+periods since the start at http://HOST:PORT/preview as one JSON object (see live_preview.h). The aggregate+write thread
+publishes every period through a triple buffer before writing it, so neither the analysers nor the writer ever wait for
+a preview request, and every response is a consistent pair of histograms. Bins are indexed by
+[time_point * energy_points + energy_point], like the binary output format. The preview is updated once per histogram
+saving period, which the SaveInterval entry of Processing.ini sets in TDC periods (default 131000, about 1s at 131kHz);
+a smaller value gives more frequent updates and more output files. A collector (--collect) publishes the merged histograms.
+
+\code{.unparsed}
+$ ./tpx3app --preview-address=localhost:9101 &
+$ curl -s localhost:9101/preview | jq '.sequence, .total'
+\endcode
+
+\section thread_placement Thread Placement
+
+By default the operating system places all threads. On multi socket machines, the --reader-cpus, --analyser-cpus,
+--worker-cpus and --writer-cpus options restrict the threads of a role to CPU lists (see thread_placement.h). Analyser and
+histogramming worker threads are pinned to single CPUs of their list, round robin. Every thread allocates its IO buffers
+and per thread histograms after it has been placed, so first touch puts them on the NUMA node of that thread.
+The resulting placement of every thread is logged at information level. For a NIC attached to the socket with CPUs 0-15:
+
+\code{.unparsed}
+$ ./tpx3app --reader-cpus=0-1 --analyser-cpus=2-5 --writer-cpus=6-7 -l information
+\endcode
+
+\section period_prediction Period Prediction
+
+By default, the period interval is predicted as the median of the last 3 TDC intervals, and the prediction
+is rebased every 100 periods. With --predictor-window=N, the predictor fits a line through the (period number, time)
+pairs of the last N TDCs instead, and rebases on every TDC (see period_predictor). This follows a drifting TDC
+interval more closely, which allows a smaller --undisputed-threshold, so fewer events go through the reorder queues.
+
+To choose the threshold, every analyser logs its fraction of disputed events, the number of disputed events the
+prediction alone would have attributed to the wrong period, and its largest TDC prediction error relative to the
+period and to the threshold at the end of a run. The same numbers, plus the RMS fit residual, are live metrics.
+The threshold must stay well above the largest relative prediction error, otherwise a TDC falls into the undisputed
+part of a period and the analysis stops (see --data-errors).
+
+\code{.unparsed}
+$ ./tpx3app --predictor-window=16 --undisputed-threshold=0.02
+\endcode
+
+\section resync_mode Data Error Recovery
+
+By default, a corrupted raw stream stops the analysis. With --data-errors=resync the analysis continues instead:
+
+- A reader that encounters an invalid packet header scans forward in 64 bit words to the next valid one.
+- An analyser that finds a chunk header or packet ID within a chunk drops the rest of the truncated chunk.
+- Gaps in the packet number sequence of a chip are counted, and the period predictor (see period_predictor.h) is reseeded at the next TDC,
+  so period numbers stay consistent. A TDC outside every disputed interval also reseeds the predictor.
+- A truncated chunk at the end of the stream is dropped.
+
+Skipped and dropped bytes, lost and late packets, and predictor reseeds are logged as warnings
+at the end of a run and published as tpx3_* counters through the live metrics endpoint.
+
+\section checkpoints Checkpoint and Resume
+
+With --checkpoint-file=PATH the analysis state is checkpointed every --checkpoint-interval seconds (see checkpoint.h).
+The analyser threads copy their period predictor, the period reorder queues, the histogram save point and the histograms
+of periods that are not saved yet at the TDC event starting a common cut period, a few periods ahead of the fastest chip,
+so no output period is half returned by the checkpointed chips. A checkpoint that a chip misses is abandoned and counted
+in tpx3_checkpoints_abandoned_total. A checkpoint writer thread, placed like the aggregate+write thread,
+writes them into one of two image slots of the memory mapped file, so a crash while writing keeps the previous checkpoint.
+A run that finishes without errors marks the file as complete.
+
+After a restart mid-acquisition, --resume reloads the newest valid checkpoint before the stream is analysed.
+Each analyser skips events up to the first TDC of the continuing stream and rebases the restored period predictor there,
+so it doesn't relearn the period interval over several TDCs. Events between the checkpoint and the restart are lost.
+Processing.ini, --workers-per-chip and the number of chips must match the checkpointed run. The energy point table
+comes from its cache (see \ref points_cache), so processing::init doesn't reparse XESPoints.inp either.
+
+\code
+$ ./tpx3app --checkpoint-file=/dev/shm/tpx3.ckpt --checkpoint-interval=0.5
+$ ./tpx3app --checkpoint-file=/dev/shm/tpx3.ckpt --resume
+\endcode
+
+\section latency_trace Latency Tracing
+
+With --latency-trace=NUM, the pipeline stamps period milestones into per thread rings of NUM time stamps (see latency_trace.h):
+the reader thread stamps the arrival of every IO buffer, the analyser the first event of a period, the TDC ending it and the
+return of its histogram, and the aggregate+write thread the aggregation and writing of the output period. Waits for a free period
+data slot are stamped as well. Stamps are steady clock reads without synchronization, the rings are only read after the analysis.
+At the end, HDR style latency histograms from the arrival of an output period to each later milestone are logged, and
+--latency-trace-file=PATH writes all stamps as Chrome trace JSON for chrome://tracing or https://ui.perfetto.dev.
+Only the periods whose stamps are still in the rings are covered.
+
+\code
+$ ./tpx3app --input-file=run.tpx3 --latency-trace=262144 --latency-trace-file=/tmp/run.trace.json
+\endcode
+
+\section synthetic_streams Synthetic Streams
+
+The generator tool writes production scale synthetic raw event streams (see stream_generator.h), together with matching
+XESPoints.inp and Processing.ini files and a detector layout file next to the stream. The stream model is set by a comma separated
+list of KEY=VALUE settings: number of chips, period length in clock ticks, number of periods, mean hits per chip and period,
+TDC jitter, disorder (hits and TDCs are emitted out of order within this many clock ticks, so they overtake each other around
+period boundaries), TOT range, and whether chunks start with SERVAL 3.2 packet ids. Worker threads generate blocks of periods
+independently, the output doesn't depend on the number of threads. The replay server generates the same stream in its sender
+threads with --generate, so runs are not limited by the size of a captured file:
+
+\code{.unparsed}
+$ ./compile.sh generator
+$ ./generator --threads 8 --output synthetic.tpx3 chips=4,period=640000,periods=20000,hits=5000,disorder=2000,tdc_jitter=20
+$ ./tpx3app --input-file=synthetic.tpx3 --initial-period=640000
+$ ./server --generate=chips=4,period=640000,periods=20000,hits=5000,disorder=2000,tdc_jitter=20
+\endcode
+
+The analysis has no TOA rollover handling, so the number of periods times the period length must stay below 2^34 clock ticks.
+With --loop, the server generates loop times the number of periods as one continuous run, the same limit applies to the product.
+
+\section preallocation Preallocation
+
+The reader and analyser threads don't allocate heap memory once they are warmed up. The IO buffers (--num-buffers) and receive slabs
+are preallocated, io_buffer_pool recycles its multimap nodes, and the period reorder queues (see period_queues.h) are sized for
+--max-period-queues remembered period changes. The --disputed-events option preallocates room for that many disputed events in every
+reorder queue, so they don't grow in the first period changes either. Period data slots with their histograms are preallocated
+and recycled by the output manager (see xes_data_manager.h).
+
+Builds with DEBUG set (see compile.sh) count heap allocations per thread (see alloc_counter.h). At the end of a run, every reader
+and analyser thread logs the number of heap allocations after its first 1024 IO buffers (slabs in slab receive mode), which should be zero. Nonzero
+counts are logged as warnings; they show that the io_buffer_pool had to grow because the analyser fell behind, or that a reorder
+queue needed more room than --disputed-events.
+
+\section points_cache Energy Point Table Cache
+
+The compact pixel to energy point table built from XESPoints.inp is cached in XESPoints.inp.cache (see energy_point_cache.h).
+The cache is keyed by a hash of the XESPoints.inp content and the number of chips, so a changed XESPoints.inp or detector
+rebuilds it automatically at the next start. The points-cache tool validates XESPoints.inp and writes the cache ahead of time:
+
+\code{.unparsed}
+$ ./compile.sh points-cache
+$ ./points-cache --chips 4 XESPoints.inp
+\endcode
+
+\section compressed_copies Compressed Raw Stream Copies
+
+With --compression-threads=N the --stream-to-file copy is cut into blocks of about 1MiB of complete chunks, which N threads
+compress independently with zlib (--compression-level, default 1 for speed), see block_compression.h. --input-file and the
+replay server recognize compressed files by their block magic and decompress them block by block while reading, with
+parallel read-ahead, so compressed and uncompressed copies can be used the same way and only a few blocks are held in memory. The synthetic benchmark stream shrinks to about 1/8 at level 1.
+
+\code{.unparsed}
+$ ./tpx3app --stream-to-file=run42.tpx3z --compression-threads=4
+$ ./server --input=run42.tpx3z --nchips=4
+\endcode
+
+\section tee_mode Tee Mode
+
+With --archive-file=PATH the raw event stream is archived while it is analysed (see stream_archive.h), so there is no need
+to choose between --stream-to-file and live analysis. This forces slab receive mode: every full receive slab is handed to
+an archive writer thread with an extra reference and written straight from slab memory, the raw stream is never copied for archiving.
+If the archive writer falls behind, --archive-policy=block (default) stalls the stream, while --archive-policy=drop skips
+whole slabs in the archive and counts the dropped bytes (tpx3_archive_dropped_bytes_total with --metrics-address).
+The archive always consists of complete chunks, so it can be analysed with --input-file afterwards.
+--archive-io=direct writes with O_DIRECT to keep the raw stream out of the page cache; it requires the block policy,
+and slabs are archived up to the last 4KiB boundary with the rest carried over into the next slab.
+The archive writer thread can be placed with --archive-cpus.
+
+\code{.unparsed}
+$ ./tpx3app --archive-file=/data/run42.tpx3 --archive-io=direct --archive-cpus=6-7
+\endcode
+
+\section sharding Distributed Analysis
+
+For detectors with more chips than one node can analyse, the analysis can be split into shards by chip (see sharding.h).
+An ingest process receives the raw stream as usual, but with --shard-to it forwards the chunks of chip c to shard
+c modulo the number of shard addresses instead of analysing them (see shard_handler.h). The chunks are relabelled to the
+chip number within the shard, so every shard receives a normal raw stream at its --address, without ASI server interaction.
+A shard started with --shard=K/N analyses it with the regular pipeline and XESPoints.inp for the whole detector, of which
+only the rows of its chips are used. With --collector it sends its partial period histograms to a collector process
+started with --collect=N, which sums them up per period and writes them as configured in Processing.ini, once all
+N shards have delivered the period. Without --collector, every shard writes its own partial output.
+
+\code{.unparsed}
+$ ./tpx3app --collect=2 --address=10.0.0.1:8460 &
+$ ./tpx3app --shard=0/2 --num-chips=4 --address=10.0.0.2:8451 --collector=10.0.0.1:8460 &
+$ ./tpx3app --shard=1/2 --num-chips=4 --address=10.0.0.3:8451 --collector=10.0.0.1:8460 &
+$ ./tpx3app --shard-to=10.0.0.2:8451,10.0.0.3:8451
+\endcode
+
+The shards and the collector must be listening before the ingest process connects. The ingest process also works with --input-file.
+
+\section raw_destinations Parallel Raw Streams
+
+A single TCP connection and reader thread can become the bottleneck at high hit rates. With --raw-destinations=N the
+ASI server is asked for N raw destinations at --address, and the analysis accepts N connections, each drained by its own
+reader thread into the per chip IO buffers (see data_handler.h). The first connection delivering a chunk of a chip owns
+the chip, the other connections skip chunks of that chip (see chip_ownership.h). So it doesn't matter whether the server
+sends chip c to destination c modulo N only, or duplicates the full stream to every destination. In slab receive mode every reader gets its own -n receive slabs.
+--receive-buffer=BYTES sets the socket receive buffer size (SO_RCVBUF) of the listening socket, so it applies to all
+accepted raw stream connections; the effective size is logged per connection. Parallel raw streams are only available
+for analysis, not for --stream-to-file, --archive-file or --shard-to.
+
+\code{.unparsed}
+$ ./tpx3app --raw-destinations=4 --receive-buffer=33554432 --reader-cpus=0-3
+\endcode
+
 \section example_run Example Run
 
 In order to get some test output, the tpx3app and server executables have to be compiled. Assuming your C++ compiler is g++-11:
@@ -871,6 +2019,11 @@ $ ./server  --input=/data/TCP-raw/event-stream-v3-asynch-70Kcs.raw --nchips=4
 \endcode
 
 The server will print TCP address information for the TCP address it is listening on. The --help option documents other options.
+For load testing, the server can pace the stream with --rate-mbs or --rate-hits, ramp the rate up with --ramp-step every
+--ramp-interval seconds, and replay the file several times with --loop. Passes after the first one shift packet ids and
+TOA/TDC time stamps, so the replayed stream continues in time; the 2^34 clock tick TOA range limits the number of passes. If the raw destination list sent by the analysis
+program has several entries, chip c is sent to entry c modulo the number of entries. The server reports achieved throughput
+and the time blocked in send calls, which shows back-pressure from the receiving side.
 
 Now the analysis application can be started. For this the tpx3app needs a number of inputs, the specification of which is not
 very consistent, unfortunately, due to lack of specifications.
@@ -878,7 +2031,16 @@ very consistent, unfortunately, due to lack of specifications.
 - "XESPoints.inp" is a file with hardcoded name in the current directory (see readAreaROI() function in processing.cpp) specifying
   the mapping between detector pixels and energy points.
 - "Processing.ini" is a file with hardcoded name in the current directory (see init() function in processing.cpp) specifying
-  time ROI and output files.
+  time ROI and output files. The optional PeriodSlots entry (default 3) sets the number of period histograms that can be filled
+  in and written out at the same time (see xes::Manager). The optional OutputFormat entry selects the output format (see xes::Writer):
+  "text" (default) writes one .xes text file per period, "binary" writes one .xesb file per period with a little endian header
+  followed by the raw histogram bins, and "hdf5" appends one dataset per period to a single .h5 file. The hdf5 format must be
+  enabled at compile time (HDF5=1 ./compile.sh) and supports deflate compression with the OutputCompression entry (0..9, default 0).
+  The optional HistogramMode entry selects what is binned with the TRStart, TRStep and TRN time ROI: "toa" (default) bins the
+  TOA relative to the period start, "tot" bins the TOT. The event processing code is specialized for the histogramming mode,
+  for XES points files that map every pixel to a single energy point with weight 1, and for power of two TRStep values.
+  The specialization is picked at startup and logged as "event processing kernel", so no recompilation is needed to switch modes.
+  The optional SaveInterval entry sets the number of TDC periods summed up into one output period (default 131000).
 - Commandline options documented through the --help option. All of them have defaults which should make sense for well behaved data
   and TCP adresses. The --max-period-queues option gives the size of the period changes memory described above.
 
@@ -889,4 +2051,15 @@ $ ./tpx3app --initial-period=5000 --max-period-queues=6 --loglevel=warning
 \endcode
 
 And hopefully you'll have some output in the folder specified via the Processing.inp file.
+
+A captured raw event stream file can also be analysed directly, without the replay server and ASI server interaction.
+The file is memory mapped (see raw_source.h) and fed to the reader thread, so the analysis runs as fast as it can:
+
+\code{.unparsed}
+$ ./tpx3app --input-file=/data/TCP-raw/event-stream-v3-asynch-70Kcs.raw --num-chips=4 --initial-period=5000
+\endcode
+
+The detector layout is taken from the --layout-file JSON file (same format as the ASI server /detector/layout response),
+or from the input file path with .json appended if that file exists. Otherwise --num-chips chips are arranged the same way the
+replay server arranges them.
 */
@@ -0,0 +1,99 @@
+/*!
+\file
+Validate an XES points file and write its binary energy point table cache
+*/
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <exception>
+#include "energy_point_cache.h"
+
+namespace {
+
+    /*!
+    \brief Print help text
+    \param progname The name of the executable
+    */
+    [[noreturn]]
+    void help(const std::string& progname)
+    {
+        std::cout << progname << " (-h | --help)\n";
+        std::cout << progname << " [(-c | --chips) NUM] [XESPoints.inp]\n";
+        std::cout << "  Parse and validate the XES points file (default XESPoints.inp) and write the\n"
+                     "  energy point table cache that tpx3app loads at startup (file path + .cache).\n"
+                     "  -c, --chips  number of detector chips (default: highest chip number in the file + 1),\n"
+                     "               the cache only matches a detector with this number of chips\n";
+        exit(0);
+    }
+
+    /*!
+    \brief Highest chip number in an XES points file
+    \param text XES points file content
+    \return Highest chip number of all lines, 0 for an empty file
+    \throw std::invalid_argument on lines without a valid chip number
+    */
+    unsigned max_chip(std::string_view text)
+    {
+        unsigned res = 0;
+        unsigned line = 0;
+        while (! text.empty()) {
+            line++;
+            const std::string_view s = text.substr(0, text.find('\n'));
+            text.remove_prefix(std::min(s.size() + 1, text.size()));
+            if (s.empty() || (s == "\r"))
+                continue;
+            res = std::max(res, ep_cache::parse_field<unsigned>(s.substr(0, s.find(',')), line));
+        }
+        return res;
+    }
+
+} // namespace
+
+/*!
+\brief Main function
+\param argc Number of commandline arguments
+\param argv Commandline argument values
+\return 0 if no errors, not 0 otherwise
+*/
+int main(int argc, char *argv[])
+{
+    std::string path = "XESPoints.inp";
+    unsigned chips = 0;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "--help") || (arg == "-h")) {
+            help(argv[0]);
+        } else if ((arg == "--chips") || (arg == "-c")) {
+            if ((++i == argc) || ((chips = std::strtoul(argv[i], nullptr, 10)) == 0)) {
+                std::cerr << "positive number of chips expected\n";
+                return 1;
+            }
+        } else {
+            path = arg;
+        }
+    }
+
+    try {
+        const std::string text = ep_cache::read_file(path);
+        if (chips == 0)
+            chips = max_chip(text) + 1;
+        PixelIndexToEp energy_points;
+        ep_cache::parse_points(text, chips, energy_points);
+        EpTable table;
+        table.build(energy_points);
+        const std::string cache = ep_cache::cache_path(path);
+        ep_cache::save(cache, ep_cache::content_hash(text), chips, table);
+        std::cout << path << ": " << chips << " chips, " << table.npoints << " energy points, "
+                  << table.energy_point.size() << " parts, "
+                  << std::count_if(std::begin(table.entry), std::end(table.entry), [](uint32_t e) { return e & EpTable::single; })
+                  << " single energy point pixels\n"
+                  << "cache written to " << cache << '\n';
+    } catch (std::exception& ex) {
+        std::cerr << path << ": " << ex.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -13,17 +13,26 @@ Event analysis code
 #include <cmath>
 #include <unordered_map>
 #include <memory>
+#include <thread>
+#include <mutex>
 
 #include "shared_types.h"
 #include "logging.h"
 #include "decoder.h"
 #include "pixel_index.h"
 #include "energy_points.h"
+#include "energy_point_cache.h"
 #include "shared_types.h"
 #include "processing.h"
 #include "detector.h"
 #include "xes_data.h"
+#include "xes_output.h"
 #include "xes_data_manager.h"
+#include "sharding.h"
+#include "live_preview.h"
+#include "checkpoint.h"
+#include "latency_trace.h"
+#include "event_kernel.h"
 
 #include "Poco/Util/IniFileConfiguration.h"
 
@@ -50,7 +59,7 @@ namespace {
 
         Logger& logger = Logger::get("Tpx3App");        //!< Poco logger object
 
-        const period_type save_interval = 131000;       //!< Histogram saving period: ~1s for TDC frequency 131kHz
+        const period_type default_save_interval = 131000;       //!< Default histogram saving period: ~1s for TDC frequency 131kHz
 
         /*!
         \brief Processing configuration file object
@@ -68,23 +77,41 @@ namespace {
         };
 
         std::unique_ptr<Detector> detptr;       //!< Pointer to detector object, created by init()
+        detector_layout shardLayout;            //!< Layout of the shard chips for a shard analysis, referenced by `detptr`
 
         /*!
-        \brief Parse object of type T in a string
-        \param s   String having a representation of T at pos
-        \param pos Position in the string from where to parse
-        \return Parsed object of type Tualified-id before ‘>’ token
+        \brief Output settings of the processing configuration file
         */
-        template <typename T>
-        T parse(std::string_view& s, std::string_view::size_type pos)
-        {
-                std::istringstream iss(s.substr(pos).data());
-                T t;
-                iss >> t;
-                if (!iss)
-                        throw std::ios_base::failure("failed to parse XESPoints file data");
-                return t;
-        }
+        struct OutputConfig final {
+                std::string FileOutputPath;     //!< Output directory
+                std::string ShortFileName;      //!< Output file name prefix
+                std::string OutputFormat;       //!< Output format, see xes::Writer::create()
+                int OutputCompression;          //!< Output compression level
+
+                /*!
+                \brief Read output settings
+                \param config Processing configuration
+                \throw std::invalid_argument for invalid settings
+                */
+                inline explicit OutputConfig(const ConfigFile& config)
+                        : FileOutputPath{config.getString("FileOutputPath")},
+                          ShortFileName{config.getString("ShortFileName")},
+                          OutputFormat{config.getString("OutputFormat", "text")},
+                          OutputCompression{config.getInt("OutputCompression", 0)}
+                {
+                        if ((OutputCompression < 0) || (OutputCompression > 9))
+                                throw std::invalid_argument("OutputCompression in Processing.ini must be within 0..9");
+                }
+
+                /*!
+                \brief Create output writer
+                \return Writer for the configured format and files
+                */
+                inline std::unique_ptr<xes::Writer> Writer() const
+                {
+                        return xes::Writer::create(OutputFormat, FileOutputPath + ShortFileName, OutputCompression);
+                }
+        };
 
         /*!
         \brief Read region of interest related to are (pixel to energy point mapping)
@@ -93,70 +120,44 @@ namespace {
 
         chip flatPixel energyPoint0 weight0 [energyPoint1 weight1 ...]
 
-        \param energy_points    Set this mapping to what was defined in XESPointsFile
+        The compact table is loaded from the binary cache next to XESPointsFile if that matches the file content,
+        otherwise it is built from the text and cached (see energy_point_cache.h).
+
+        \param energy_points    Set this mapping to what was defined in XESPointsFile, only `npoints` is set for a cached table
+        \param ep_table         Set this to the compact version of `energy_points`
         \param layout           The detector layout
         \param XESPointsFile    Name of the file that defines the pixel to energy point mapping
         */
-        void readAreaROI(PixelIndexToEp& energy_points, const detector_layout& layout, const std::string& XESPointsFile)
+        void readAreaROI(PixelIndexToEp& energy_points, EpTable& ep_table, const detector_layout& layout, const std::string& XESPointsFile)
         {
                 logger << "readAreaROI(" << XESPointsFile << ')' << log_trace;
-                const auto numPixels = chip_size * chip_size;
-                const auto numChips = layout.chip.size();
-
-                energy_points.chip.resize(numChips);
-                for (auto& chip: energy_points.chip) {
-                        chip.flat_pixel.resize(numPixels);
+                const unsigned numChips = layout.chip.size();
+
+                const std::string text = ep_cache::read_file(XESPointsFile);
+                const uint64_t hash = ep_cache::content_hash(text);
+                const std::string cachePath = ep_cache::cache_path(XESPointsFile);
+                if (ep_cache::load(cachePath, hash, numChips, ep_table)) {
+                        // the per pixel mapping is only needed for building the table
+                        energy_points.chip.clear();
+                        energy_points.npoints = ep_table.npoints;
+                        logger << "energy point table from " << cachePath << ": " << ep_table.energy_point.size() << " parts, "
+                               << energy_points.npoints << " energy points" << log_debug;
+                        return;
                 }
 
-                constexpr size_t bufSize = 1024;
-                char buf[bufSize] = {0};
-                std::string_view::size_type posN[bufSize] = {0};
-                std::ifstream ifs(XESPointsFile);
-                if (! ifs)
-                        throw std::ios_base::failure(std::string{"failed to open "} + XESPointsFile);
-
-                for (unsigned line=1;;line++) {
-                        // i, j, XESEnergyIndex[i,j,k]..., XESWeight [i,j,k]...
-                        if (! ifs.getline(buf, bufSize).good()) {
-                                if (! ifs.eof())
-                                        throw std::ios_base::failure(std::string{"failed to parse XESPoints file at line "} + std::to_string(line));
-                                break;
-                        }
-                        std::string_view s(buf);
-                        std::string_view::size_type pos = 0;
-                        unsigned count = 0;
-                        posN[count] = pos;
-                        while ((pos = s.find(',', pos)) != std::string_view::npos) {
-                                count++;
-                                pos++;
-                                posN[count] = pos;
-                        }
-                        count += 1;
-                        if (count < 2)
-                                throw std::invalid_argument("invalid XESPoints file line (count < 2)");
-                        if ((count % 2) != 0)
-                                throw std::invalid_argument("invalid XESPoints file line (count % 2 != 0)");
-                        unsigned k = parse<unsigned>(s, posN[0]);       // chip
-                        if (k >= numChips)
-                                throw std::invalid_argument("invalid chip number in XESPoints file");
-                        unsigned l = parse<unsigned>(s, posN[1]);       // flatPixel
-                        if (l >= numPixels)
-                                throw std::invalid_argument("invalid pixel number in XESPoints file");
-                        FlatPixelToEp& pixel = energy_points.at(PixelIndex::from(k, l));
-                        const unsigned numEnergyPoints = (count - 2u) / 2u;
-                        for (unsigned m=0; m<numEnergyPoints; m++) {
-                                EpPart part;
-                                part.energy_point = parse<unsigned>(s, posN[2+m]);
-                                energy_points.npoints = std::max(energy_points.npoints, part.energy_point);
-                                pixel.part.push_back(std::move(part));
-                        }
-                        for (unsigned m=0; m<numEnergyPoints; m++)
-                                pixel.part[m].weight = parse<float>(s, posN[2+numEnergyPoints+m]);
-                }
-
-                energy_points.npoints += 1;
+                ep_cache::parse_points(text, numChips, energy_points);
                 logger << "num energy points: " << energy_points.npoints << log_debug;
 
+                ep_table.build(energy_points);
+                logger << "energy point table: " << ep_table.energy_point.size() << " parts, "
+                       << std::count_if(std::begin(ep_table.entry), std::end(ep_table.entry), [](uint32_t e) { return e & EpTable::single; })
+                       << " single energy point pixels" << log_debug;
+                try {
+                        ep_cache::save(cachePath, hash, numChips, ep_table);
+                } catch (std::exception& ex) {
+                        logger << "energy point table not cached: " << ex.what() << log_warn;
+                }
+
 	/*
 	//check that it was read correctly:
 	for (int ii=0;ii<numPixels; ii++) {
@@ -171,9 +172,11 @@ namespace {
 
         /*!
         \brief Analysis data and operations
-        \tparam TOAMode TOA Mode
+
+        The per event operations are templates specialized for the histogramming mode and the properties
+        of the time ROI and the energy point table, see event_kernel.h. init() selects one of the specializations
+        from the `kernels` registry, so the hot path doesn't test these properties for every event.
         */
-        template<bool TOAMode>
         struct Analysis final {
 
                 using Data = xes::Data;                 //!< XES data type
@@ -188,18 +191,29 @@ namespace {
                 static constexpr period_type no_save = 2; //!< Don't save save data before this period
                 std::vector<period_type> save_point;    //!< Next period for which a file is written
                 const Detector& detector;               //!< Reference to constant Detector data
-                const float TRoiStep_inv;               //!< 1. / TRoiStep
+                const EpTable& table;                   //!< Compact energy point table of the detector
+                const event_kernel::binning bins;       //!< Copy of the detector time ROI and number of energy points
+                const unsigned workers;                 //!< Number of histogramming workers per chip
+                const period_type save_interval;        //!< Histogram saving period in TDC periods
 
                 /*!
                 \brief Constructor
                 \param det      Constant detector data
-                \param OutFName Output file name
+                \param writer   Output format writer
+                \param nWorkers Number of histogramming workers per chip
+                \param nSlots   Number of period data slots in the data manager
+                \param interval Histogram saving period in TDC periods
+                \param live     Live preview publisher, nullptr for none
+                \param trace    Period latency tracing, configured for the detector, nullptr for none
                 */
-                inline Analysis(const Detector& det, const std::string& OutFName)
-                        : dataManager{det, OutFName, 3},
+                inline Analysis(const Detector& det, std::unique_ptr<xes::Writer>&& writer, unsigned nWorkers, unsigned nSlots, period_type interval, preview::publisher* live, latency_trace::tracer* trace)
+                        : dataManager{det, std::move(writer), nSlots, (unsigned)det.layout.chip.size() * nWorkers, live, trace},
                           save_point(det.layout.chip.size(), no_save),
                           detector{det},
-                          TRoiStep_inv{1.f/detector.TRoiStep}
+                          table{det.ep_table},
+                          bins{det.TRoiStart, det.TRoiStep, det.TRoiN, det.ep_table.npoints},
+                          workers{nWorkers},
+                          save_interval{interval}
                 {}
 
                 /*!
@@ -231,110 +245,16 @@ namespace {
                 }
 
                 /*!
-                \brief Add one event to histogram
-                TOT must be within (TOTRoiStart,TOTRoiEnd) for this event
-                \param data             Histogram
-                \param index            Abstract pixel index of event
-                \param TimePoint        Clock tick relative to period interval start
+                \brief Check if PurgePeriod() changes saving state
+                \param chipIndex        Chip number
+                \param period           Interval change at start of this period will be purged
+                \return True if PurgePeriod() will return data or move the save point
                 */
-                inline void Register(Data& data, PixelIndex index, int TimePoint) noexcept
+                inline bool PurgeRequired(unsigned chipIndex, period_type period) const noexcept
                 {
-
-
-//                        logger << "Register(" << (int)dataIndex << ", " << index.chip << ':' << index.flat_pixel << ", " << TimePoint << ", " << TOT << ')' << log_trace;
-			//std::cout<<"e"<<TOT<<"  "<<detector.TOTRoiStart<<"  "<<detector.TOTRoiEnd<<"\n";
-                        //TOT is always 100 which is probably wrong. Check....
-                        //std::cout<<"w";
-                        const auto& flat_pixel = detector.energy_points[index];
-
-                        //std::cout<<"q";
-                        // const float clb = detector.Calibrate(PixelIndex, TimePoint);
-                        for (const auto& part : flat_pixel.part) {
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////                                             
-//This line takes most of the time of Register (and 50% of time of ProcessEvent)
-                                //if (detector.energy_points.npoints!=15) std::cout<<"!!!!!!! ";
-                                //std::cout<<part.energy_point<<" ";
-                                //in the example detector.energy_points.npoints is always 15
-                                // in the example part.energy_point is from 0 to 14 defined by the event coordinate 
-                                // in the example part.weight is 1;
-                                // TimePoint is from 0 to ~2500
-                                //std::cout<<TimePoint<<" ";
-
-                                //int iii=index.flat_pixel;
-
-                                //std::cout<<iii<<" pep "<<part.energy_point<<"\n";
-                                data.TDSpectra[TimePoint * detector.energy_points.npoints + part.energy_point] += part.weight; // / clb;
-                        }
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////                                
-                        //      logger << index.chip << ": " << TOT << " outside of ToT ROI " << detector.TOTRoiStart << '-' << detector.TOTRoiEnd << log_debug;
-  
+                        return period >= save_point[chipIndex];
                 }
 
-                // /*!
-                // \brief Add one event to histogram
-                // \param data             Histogram
-                // \param index            Abstract pixel index of event
-                // \param TimePoint        Clock tick relative to period interval start
-                // \param TOT              Event TOT value
-                // */
-                // inline void RegisterXAS(Data& data, PixelIndex index, int TimePoint) noexcept //, u16 TOT) noexcept
-                // {
-                //         data.TDSpectra[TimePoint * 15] += 1;
-                // }
-
-
-
-                /*!
-                \brief Analyse event and add it to histogram if appropriate
-                \param data             Histogram
-                \param index            Abstract pixel index of event
-                \param reltoa           Event TOA relative to period interval start
-                \param tot              Event TOT value
-                */
-                inline void Analyse(Data& data, PixelIndex index, int64_t reltoa, int64_t tot) noexcept
-                {
-  //                      logger << "Analyse(" << (int)dataIndex << ", " << index.chip << ':' << index.flat_pixel << ", " << reltoa << ", " << tot << ')' << log_trace;
-                        //----------------------------------------------------------------------
-                        // parsing one data line
-                        //----------------------------------------------------------------------
-                        // double fulltoa = toa*25.0 - ftoa*25.0/16.0;
-                        // double ftoaC=ftoa*1.0;
-
-                        data.Total++;
-
-                        // temporary here
-                        //if (tot < TOTMin)
-                        //        TOTMin = tot;
-                        //if (tot > TOTMax)
-                        //        TOTMax = tot;
-                        // end of temporary
-
-                        const u64 FullToA = TOAMode ? reltoa : tot;
-
-                        if (FullToA < detector.TRoiStart) {
-                                data.BeforeRoi++;
-//                                logger << index.chip << ": " << FullToA << " before ToA ROI " << detector.TRoiStart << log_debug;
-                        } else if (FullToA >= detector.TRoiEnd) {
-                                data.AfterRoi++;
-//                                logger << index.chip << ": " << FullToA << " after ToA ROI " << detector.TRoiEnd << log_debug;
-                        } else if ((tot > detector.TOTRoiStart) && (tot < detector.TOTRoiEnd)) {
-                                // not ideal here. Does not work if tot step is
-                                // not 1
-
-                                if constexpr (TOAMode == true) {
-                                        //have changed here in order to check speed in the XAS mode when information about pixels can be ignored
-                                        const int TP = static_cast<int>((FullToA - detector.TRoiStart) * TRoiStep_inv);
-                                        Register(data, index, TP);
-                                        //RegisterXAS(data, index, TP, tot);
-
-                                } else {
-                                        const int TOTP = tot;
-                                        Register(data, index, TOTP);
-                                        //RegisterXAS(data, index, TOTP, tot);
-                                }
-                        }
-                } // end Analyse()
-
                 /*!
                 \brief Purge period interval change from memory
 
@@ -359,20 +279,26 @@ namespace {
                                 return;
                         }
 
-                        dataManager.ReturnData(chipIndex, sp);
+                        for (unsigned worker=0; worker<workers; worker++)
+                                dataManager.ReturnData(chipIndex * workers + worker, sp);
                         sp += save_interval;
                 }
 
                 /*!
                 \brief Process event
                 \param chipIndex        Chip that detected the event
+                \param worker           Histogramming worker number for the chip
                 \param period           Period number of the event
                 \param toaclk           Event TOA in clock ticks
                 \param relative_toaclk  Event TOA in clock ticks relative to start of `period`
-                \param event            Raw event
+                \param event            Packed hit, TOT and pixel are decoded by the stream classifier
+                \tparam TOAMode         See event_kernel::analyse()
+                \tparam SingleEp        See event_kernel::add()
+                \tparam Pow2Step        See event_kernel::analyse()
                 */
                 // void ProcessEvent(unsigned chipIndex, const period_type period, int64_t toaclk, int64_t relative_toaclk, uint64_t event)
-                void ProcessEvent(unsigned chipIndex, const period_type period, int64_t relative_toaclk, uint64_t event)
+                template<bool TOAMode, bool SingleEp, bool Pow2Step>
+                inline void ProcessEvent(unsigned chipIndex, unsigned worker, const period_type period, int64_t relative_toaclk, uint64_t event)
                 {
 //                        logger << "ProcessEvent(" << chipIndex << ", " << period << ", " << toaclk << ", " << relative_toaclk << ", " << std::hex << event << std::dec << ')' << log_trace;
 
@@ -380,48 +306,170 @@ namespace {
                         if (period > sp)
                                 sp += save_interval;
 
-                        // substituted tot by constant to test speed since tot is typically ignored 
+                        event_kernel::process<TOAMode, SingleEp, Pow2Step>(dataManager.DataForPeriod(chipIndex * workers + worker, sp), table, bins,
+                                                                           chipIndex, relative_toaclk, event);
+                }
 
-                        const uint64_t totclk = Decode::getTotClock(event);
-                        //const uint64_t totclk = 100;
-                        
-                        
-                        
-                        //const float toa = Decode::clockToFloat(toaclk);
-                        //const float tot = Decode::clockToFloat(totclk, 40e6);
-                        
-                        
-                        // commented to test speed since xy is typically ignored for XAS (not for XES!)
+                /*!
+                \brief Copy save point and unsaved histograms of a chip into a checkpoint
 
-                        const std::pair<uint64_t, uint64_t> xy = Decode::calculateXY(event);
-                        
-                                             
-//                          logger << chipIndex << ": event: " << period << " (" << xy.first << ' ' << xy.second << ") " << toa << ' ' << tot
-//                        << " (" << toaclk << ' ' << totclk << std::hex << event << std::dec << ')' << log_info;
-                
-                        //can be replaced to test speed in XAS mode
-                        
-                        auto index = PixelIndex::from(chipIndex, xy);
-                        //auto index = PixelIndex::from(chipIndex, 10);
+                The chip's per thread data of periods from its save point on is only touched by the chip's
+                own threads, and its slots cannot be released by the aggregate+write thread.
 
+                \param chipIndex        Chip number
+                \param state            Checkpoint chip state to append to
+                */
+                void Capture(unsigned chipIndex, checkpoint::chip_state& state) const
+                {
+                        const period_type sp = save_point[chipIndex];
+                        state.save_point = sp;
+                        for (const auto& pd : dataManager.periodData) {
+                                const period_type period = pd.period.load(std::memory_order_acquire);
+                                if ((period == xes::Manager::none) || (period < sp))
+                                        continue;
+                                for (unsigned worker=0; worker<workers; worker++) {
+                                        const Data& d = pd.threadData[chipIndex * workers + worker];
+                                        state.histograms.push_back({period, worker, d.BeforeRoi, d.AfterRoi, d.Total});
+                                        state.bins.insert(std::end(state.bins), std::begin(d.TDSpectra), std::end(d.TDSpectra));
+                                }
+                        }
+                }
 
-                        
-                        {
-                                // std::lock_guard lock{histo_lock}; // <---- problematic lock
-                                Analyse(dataManager.DataForPeriod(chipIndex, sp), index, relative_toaclk, totclk);
+                /*!
+                \brief Restore save points and unsaved histograms of all chips from a checkpoint
+                \param img              Checkpoint image
+                \throw std::invalid_argument if the checkpoint doesn't match the analysis settings
+                */
+                void Restore(const checkpoint::image& img)
+                {
+                        const uint64_t bins = uint64_t(detector.TRoiN) * table.npoints;
+                        if (img.chip.size() != save_point.size())
+                                throw std::invalid_argument("checkpoint has " + std::to_string(img.chip.size()) + " chips, analysis has " + std::to_string(save_point.size()));
+                        if (img.workers != workers)
+                                throw std::invalid_argument("checkpoint has " + std::to_string(img.workers) + " histogramming workers per chip, analysis has " + std::to_string(workers));
+                        if ((img.bins != bins) || (img.save_interval != save_interval))
+                                throw std::invalid_argument("checkpoint histogram size or SaveInterval doesn't match Processing.ini");
+                        std::vector<period_type> periods;
+                        for (const auto& state : img.chip) {
+                                for (const auto& h : state.histograms) {
+                                        if (h.worker >= workers)
+                                                throw std::invalid_argument("checkpoint histogram for unknown worker " + std::to_string(h.worker));
+                                        if (std::find(std::begin(periods), std::end(periods), h.period) == std::end(periods))
+                                                periods.push_back(h.period);
+                                }
+                        }
+                        if (periods.size() > dataManager.periodData.size())
+                                throw std::invalid_argument("checkpoint needs " + std::to_string(periods.size()) + " period data slots, PeriodSlots in Processing.ini is too small");
+
+                        for (unsigned chip=0; chip<img.chip.size(); chip++) {
+                                const auto& state = img.chip[chip];
+                                save_point[chip] = state.save_point;
+                                for (std::size_t i=0; i<state.histograms.size(); i++) {
+                                        const auto& h = state.histograms[i];
+                                        Data& d = dataManager.DataForPeriod(chip * workers + h.worker, h.period);
+                                        const auto first = std::begin(state.bins) + i * bins;
+                                        std::copy(first, first + bins, std::begin(d.TDSpectra));
+                                        d.BeforeRoi = h.before_roi;
+                                        d.AfterRoi = h.after_roi;
+                                        d.Total = h.total;
+                                }
+                        }
+                        // chips past the period of a slot returned their data before the checkpoint
+                        for (auto& pd : dataManager.periodData) {
+                                const period_type period = pd.period.load(std::memory_order_acquire);
+                                if (period == xes::Manager::none)
+                                        continue;
+                                for (unsigned chip=0; chip<save_point.size(); chip++) {
+                                        if (period >= save_point[chip])
+                                                continue;
+                                        for (unsigned worker=0; worker<workers; worker++)
+                                                dataManager.ReturnData(chip * workers + worker, period);
+                                }
                         }
-                
                 }
 
         }; // end type Analysis
 
-        std::unique_ptr<Analysis<Detector::TOAMode>> analysis;    //!< Analysis object
+        std::unique_ptr<Analysis> analysis;     //!< Analysis object
+        preview::publisher* livePreview = nullptr;      //!< Live preview publisher set by setPreview()
+        latency_trace::tracer* latencyTrace = nullptr;  //!< Period latency tracing set by setTrace()
+
+        /*!
+        \brief Event processing kernel, a specialization of Analysis::ProcessEvent()
+        */
+        using kernel_type = void (*)(Analysis&, unsigned, unsigned, const period_type, int64_t, uint64_t);
+
+        /*!
+        \brief Event processing kernel for a specialization
+        \tparam TOAMode         See event_kernel::analyse()
+        \tparam SingleEp        See event_kernel::add()
+        \tparam Pow2Step        See event_kernel::analyse()
+        \param a                Analysis object
+        \param chipIndex        Chip that detected the event
+        \param worker           Histogramming worker number for the chip
+        \param period           Period number of the event
+        \param relative_toaclk  Event TOA in clock ticks relative to start of `period`
+        \param event            Packed hit
+        */
+        template<bool TOAMode, bool SingleEp, bool Pow2Step>
+        void Kernel(Analysis& a, unsigned chipIndex, unsigned worker, const period_type period, int64_t relative_toaclk, uint64_t event)
+        {
+                a.ProcessEvent<TOAMode, SingleEp, Pow2Step>(chipIndex, worker, period, relative_toaclk, event);
+        }
+
+        /*!
+        \brief Kernel registry entry
+        */
+        struct KernelEntry final {
+                bool TOAMode;           //!< Histogram TOA (true) or TOT (false)
+                bool SingleEp;          //!< Requires single energy point pixels only
+                bool Pow2Step;          //!< Requires a power of two time bin step
+                const char* name;       //!< Kernel name for logging
+                kernel_type process;    //!< Kernel function
+        };
+
+        /*!
+        \brief Kernel registry, one entry per specialization
+        */
+        constexpr KernelEntry kernels[] = {
+                { true,  true,  true,  "toa/single-ep/pow2-step", Kernel<true,  true,  true>  },
+                { true,  true,  false, "toa/single-ep",           Kernel<true,  true,  false> },
+                { true,  false, true,  "toa/pow2-step",           Kernel<true,  false, true>  },
+                { true,  false, false, "toa",                     Kernel<true,  false, false> },
+                { false, true,  true,  "tot/single-ep/pow2-step", Kernel<false, true,  true>  },
+                { false, true,  false, "tot/single-ep",           Kernel<false, true,  false> },
+                { false, false, true,  "tot/pow2-step",           Kernel<false, false, true>  },
+                { false, false, false, "tot",                     Kernel<false, false, false> },
+        };
+
+        const KernelEntry* kernel = nullptr;    //!< Kernel selected by init()
+
+        /*!
+        \brief Select event processing kernel for a detector
+        \param det      Detector with time ROI and energy point table set up
+        \return Kernel registry entry
+        */
+        const KernelEntry& SelectKernel(const Detector& det)
+        {
+                const bool singleEp = det.ep_table.single_only();
+                const bool pow2Step = (det.TRoiStep & (det.TRoiStep - 1)) == 0;
+                for (const auto& k : kernels) {
+                        if ((k.TOAMode == det.TOAMode) && (k.SingleEp == singleEp) && (k.Pow2Step == pow2Step))
+                                return k;
+                }
+                throw std::logic_error("no event processing kernel");
+        }
 
 } // anonymous namespace
 
 namespace processing {
 
-        void init(const detector_layout& layout)
+        void init(const detector_layout& layout, unsigned workersPerChip)
+        {
+                init(layout, workersPerChip, {}, nullptr);
+        }
+
+        void init(const detector_layout& layout, unsigned workersPerChip, const std::vector<unsigned>& chips, std::ostream* partialOutput)
         {
                 ConfigFile config{"Processing.ini"};
 
@@ -484,19 +532,151 @@ namespace processing {
                 int TRStart = config.getInt("TRStart");
                 int TRStep = config.getInt("TRStep");
                 int TRN = config.getInt("TRN");
+                if ((TRStep < 1) || (TRN < 1))
+                        throw std::invalid_argument("TRStep and TRN in Processing.ini must be positive");
+                std::string HistogramMode = config.getString("HistogramMode", "toa");
+                if ((HistogramMode != "toa") && (HistogramMode != "tot"))
+                        throw std::invalid_argument("HistogramMode in Processing.ini must be toa or tot");
 
                 // std::string FileInputPath = config.getString("FileInputPath");
-                std::string FileOutputPath = config.getString("FileOutputPath");
-                std::string ShortFileName = config.getString("ShortFileName");
+                int PeriodSlots = config.getInt("PeriodSlots", 3);
+                if (PeriodSlots < 2)
+                        throw std::invalid_argument("PeriodSlots in Processing.ini must be at least 2");
+                const period_type SaveInterval = config.getInt64("SaveInterval", default_save_interval);
+                if (SaveInterval < 1)
+                        throw std::invalid_argument("SaveInterval in Processing.ini must be positive");
+                const OutputConfig output{config};
+
+                logger << "HistogramMode=" << HistogramMode << ", TRStart=" << TRStart << ", TRStep=" << TRStep << ", TRN=" << TRN
+                       << ", FileOutputPath=" << output.FileOutputPath << ", ShortFileName=" << output.ShortFileName
+                       << ", PeriodSlots=" << PeriodSlots << ", SaveInterval=" << SaveInterval << ", OutputFormat=" << output.OutputFormat
+                       << ", OutputCompression=" << output.OutputCompression << log_info;
+
+                analysis.reset();
+                detptr.reset();
+                const detector_layout* detectorLayout = &layout;
+                if (! chips.empty()) {
+                        shardLayout = detector_layout{layout.width, layout.height, {}};
+                        for (const unsigned chip : chips) {
+                                if (chip >= layout.chip.size())
+                                        throw std::invalid_argument("shard chip " + std::to_string(chip) + " is not part of the detector layout");
+                                shardLayout.chip.push_back(layout.chip[chip]);
+                        }
+                        detectorLayout = &shardLayout;
+                }
+                detptr.reset(new Detector{*detectorLayout});
+                detptr->TOAMode = (HistogramMode == "toa");
+                detptr->SetTimeROI(TRStart, TRStep, TRN);
+                readAreaROI(detptr->energy_points, detptr->ep_table, layout, "XESPoints.inp");
+                if (! chips.empty()) {
+                        detptr->ep_table = detptr->ep_table.select(chips);
+                        LogProxy log(logger);
+                        log << "shard chips:";
+                        for (const unsigned chip : chips)
+                                log << ' ' << chip;
+                        log << log_info;
+                }
 
-                logger << "TRStart=" << TRStart << ", TRStep=" << TRStep << ", TRN=" << TRN
-                       << ", FileOutputPath=" << FileOutputPath << ", ShortFileName=" << ShortFileName << log_info;
+                std::unique_ptr<xes::Writer> writer;
+                if (partialOutput)
+                        writer = std::make_unique<xes::PartialWriter>(*partialOutput);
+                else
+                        writer = output.Writer();
+                if (latencyTrace)
+                        latencyTrace->configure(detptr->layout.chip.size(), std::max(workersPerChip, 1u));
+                analysis.reset(new Analysis{*detptr, std::move(writer), std::max(workersPerChip, 1u), (unsigned)PeriodSlots, SaveInterval, livePreview, latencyTrace});
+                kernel = &SelectKernel(*detptr);
+                logger << "event processing kernel " << kernel->name << log_info;
+        }
 
-                detptr.reset(new Detector{layout});
-                detptr->SetTimeROI(TRStart, TRStep, TRN);
-                readAreaROI(detptr->energy_points, layout, "XESPoints.inp");
+        void setPreview(preview::publisher* live)
+        {
+                livePreview = live;
+        }
+
+        void setTrace(latency_trace::tracer* trace)
+        {
+                latencyTrace = trace;
+        }
+
+        void finish()
+        {
+                analysis.reset();
+                kernel = nullptr;
+        }
 
-                analysis.reset(new Analysis<Detector::TOAMode>{*detptr, FileOutputPath + ShortFileName});
+        uint64_t collect(const std::vector<std::istream*>& partials)
+        {
+                ConfigFile config{"Processing.ini"};
+                const OutputConfig output{config};
+                logger << "collecting " << partials.size() << " shards, FileOutputPath=" << output.FileOutputPath << ", ShortFileName=" << output.ShortFileName
+                       << ", OutputFormat=" << output.OutputFormat << ", OutputCompression=" << output.OutputCompression << log_info;
+                auto writer = output.Writer();
+
+                const detector_layout noChips{0, 0, {}};
+                std::unique_ptr<Detector> det;  // only provides the histogram dimensions to the writer
+                xes::Data data;
+                uint64_t written = 0;
+                auto write = [&](const sharding::record& rec) {
+                        if (!det || (det->TRoiN != rec.time_points) || (det->energy_points.npoints != rec.npoints)) {
+                                det.reset(new Detector{noChips});
+                                det->SetTimeROI(0, 1, rec.time_points);
+                                det->energy_points.npoints = rec.npoints;
+                                data.Init(*det);
+                        }
+                        std::copy(std::begin(rec.bins), std::end(rec.bins), std::begin(data.TDSpectra));
+                        data.BeforeRoi = rec.before_roi;
+                        data.AfterRoi = rec.after_roi;
+                        data.Total = rec.total;
+                        if (livePreview)
+                                livePreview->publish(rec.period, rec.npoints, rec.time_points, data.TDSpectra.data(),
+                                                     rec.before_roi, rec.after_roi, rec.total);
+                        writer->Write(data, rec.period);
+                        written++;
+                };
+
+                sharding::merger merger{(unsigned)partials.size()};
+                std::mutex lock;        // protects merger and writing
+                std::vector<std::string> error(partials.size());
+                std::vector<std::thread> readers;
+                for (unsigned i=0; i<partials.size(); i++) {
+                        readers.emplace_back([&, i]() {
+                                try {
+                                        sharding::record rec, complete;
+                                        while (xes::BinaryWriter::ReadRecord(*partials[i], rec)) {
+                                                std::lock_guard guard{lock};
+                                                if (merger.add(std::move(rec), complete)) {
+                                                        logger << "period " << complete.period << " complete" << log_debug;
+                                                        write(complete);
+                                                }
+                                        }
+                                } catch (std::exception& ex) {
+                                        error[i] = ex.what();
+                                }
+                        });
+                }
+                for (auto& reader : readers)
+                        reader.join();
+
+                for (const auto& rec : merger.incomplete()) {
+                        logger << "period " << rec.period << " lacks partial histograms of some shards" << log_warn;
+                        write(rec);
+                }
+                for (unsigned i=0; i<error.size(); i++) {
+                        if (! error[i].empty())
+                                throw std::runtime_error("shard " + std::to_string(i) + ": " + error[i]);
+                }
+                return written;
+        }
+
+        std::string kernelName()
+        {
+                return kernel ? kernel->name : "";
+        }
+
+        bool purgeRequired(unsigned chipIndex, period_type period)
+        {
+                return analysis->PurgeRequired(chipIndex, period);
         }
 
         void purgePeriod(unsigned chipIndex, period_type period)
@@ -508,7 +688,40 @@ namespace processing {
         void processEvent(unsigned chipIndex, const period_type period, int64_t relative_toaclk, uint64_t event)
         {
                 // analysis->ProcessEvent(chipIndex, period, toaclk, relative_toaclk, event);
-                analysis->ProcessEvent(chipIndex, period, relative_toaclk, event);
+                kernel->process(*analysis, chipIndex, 0, period, relative_toaclk, event);
+        }
+
+        void processEvent(unsigned chipIndex, unsigned worker, const period_type period, int64_t relative_toaclk, uint64_t event)
+        {
+                kernel->process(*analysis, chipIndex, worker, period, relative_toaclk, event);
+        }
+
+        void localize(unsigned chipIndex, unsigned worker)
+        {
+                analysis->dataManager.Localize(chipIndex * analysis->workers + worker);
+        }
+
+        void writeMetrics(std::ostream& out)
+        {
+                if (analysis)
+                        analysis->dataManager.WriteMetrics(out);
+        }
+
+        void checkpointLayout(checkpoint::image& img)
+        {
+                img.workers = analysis->workers;
+                img.bins = uint64_t(analysis->detector.TRoiN) * analysis->bins.npoints;
+                img.save_interval = analysis->save_interval;
+        }
+
+        void capture(unsigned chipIndex, checkpoint::chip_state& state)
+        {
+                analysis->Capture(chipIndex, state);
+        }
+
+        void restore(const checkpoint::image& img)
+        {
+                analysis->Restore(img);
         }
 
 } // namespace processing
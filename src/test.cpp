@@ -4,14 +4,46 @@ Unit tests
 */
 
 #include <set>
+#include <algorithm>
 #include <vector>
 #include <functional>
 #include <iostream>
+#include <sstream>
 #include <cstring>
 #include <regex>
+#include <thread>
+#include <fstream>
+#include <iterator>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#define COUNT_ALLOCATIONS
+#define ALLOC_COUNTER_DEFINE
+#include "alloc_counter.h"
+#include "spsc_ring.h"
+#include "mpsc_ring.h"
+#include "io_buffers.h"
+#include "event_batches.h"
+#include "decoder.h"
+#include "energy_points.h"
+#include "energy_point_cache.h"
 #include "period_predictor.h"
 #include "event_reordering.h"
 #include "period_queues.h"
+#include "histogram_reduction.h"
+#include "stream_generator.h"
+#include "metrics.h"
+#include "thread_placement.h"
+#include "stream_archive.h"
+#include "block_compression.h"
+#include "adaptive_wait.h"
+#include "sharding.h"
+#include "live_preview.h"
+#include "checkpoint.h"
+#include "latency_trace.h"
+#include "chip_ownership.h"
+#include "chunk_scan.h"
+#include "event_kernel.h"
 
 namespace {
 
@@ -211,6 +243,80 @@ namespace {
             check_eq(unit, t, p.interval_prediction(), 3.0);
             check_eq(unit, t, p.period_prediction(14), 5.0);
         }
+
+        /*!
+        \brief Period predictor reseed() unit test
+        \param unit Test unit
+        */
+        void predictor_reseed_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::period_predictor p{0, 10};
+            p.prediction_update(10);
+            p.prediction_update(20);
+            p.prediction_update(30);
+            p.reseed(1003);     // TDCs of periods 4..99 went missing
+            check_eq(unit, t, p.reference_start(), (int64_t)1003);
+            check_eq(unit, t, p.period_correction(), 100L);
+            check_eq(unit, t, p.period_prediction(1003), 100.0);
+            check_eq(unit, t, p.interval_prediction(), 10.0);
+            p.prediction_update(1013);
+            check_eq(unit, t, p.interval_prediction(), 10.0);
+            check_eq(unit, t, p.period_prediction(1023), 102.0);
+        }
+
+        /*!
+        \brief Period predictor linear fit mode unit test with a drifting, jittering TDC interval
+        \param unit Test unit
+        */
+        void predictor_fit_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            for (unsigned window : {0u, 16u}) {
+                ::period_predictor p{0, 1000};
+                p.set_window(window);
+                check_eq(unit, t, p.window(), window);
+                double interval = 1000.;
+                int64_t ts = 0;
+                uint64_t seed = 1;
+                unsigned wrong = 0;
+                double error = .0;
+                for (long k=1; k<2000; k++) {
+                    interval += .05;
+                    ts += (int64_t)interval;
+                    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                    const int64_t tdc = ts + (int64_t)((seed >> 33) % 11) - 5;
+                    const double predicted = p.period_prediction(tdc);
+                    wrong += (std::lround(predicted) != k);
+                    if (k > 16)
+                        error = std::max(error, std::fabs(predicted - std::round(predicted)));
+                    p.prediction_update(tdc);
+                    if (! p.ok(tdc))
+                        p.start_update(tdc);
+                }
+                if (window == 0) {
+                    check_eq(unit, t, wrong > 0, true);     // median mode loses track of the drift
+                } else {
+                    check_eq(unit, t, wrong, 0u);
+                    check_eq(unit, t, error < .02, true);
+                    check_eq(unit, t, std::fabs(p.interval_prediction() - interval) < 2., true);
+                    check_eq(unit, t, p.residual() < 5., true);
+                }
+            }
+
+            ::period_predictor p{0, 100};
+            p.set_window(8);
+            int64_t ts = 0;
+            for (long k=1; k<100; k++) {
+                ts += 100 + k;      // interval grows by 1 tick per period
+                p.prediction_update(ts);
+            }
+            check_eq(unit, t, p.period_correction(), 99L);
+            check_eq(unit, t, std::fabs(p.drift() - 1.) < .01, true);
+            p.reseed(ts + 398);     // one TDC missing
+            check_eq(unit, t, p.period_correction(), 101L);
+            check_eq(unit, t, p.reference_start(), ts + 398);
+        }
     }
 
     /*! Event reorder queue unit tests */
@@ -297,14 +403,1858 @@ namespace {
             double d = pq.threshold / 2.0;
             period_index idx = pq.period_index_for(d);
             pq[idx] = period_queue_element{};
-            auto rq = pq.registerStart(idx, 1);
+            auto& rq = pq.registerStart(idx, 1);
             auto oldest = pq.oldest();
-            check_eq(unit, t, oldest->first, (period_type)0);
-            check_eq(unit, t, oldest->second.start, (int64_t)1);
+            check_eq(unit, t, oldest, (period_type)0);
+            check_eq(unit, t, pq[oldest].start, (int64_t)1);
             check_eq(unit, t, rq.empty(), true);
-            check_eq(unit, t, pq.element.size(), (::period_queues::queue_type::size_type)1);
+            check_eq(unit, t, pq.size(), (size_t)1);
             pq.erase(oldest);
-            check_eq(unit, t, pq.element.size(), (::period_queues::queue_type::size_type)0);
+            check_eq(unit, t, pq.size(), (size_t)0);
+            check_eq(unit, t, pq.find(0) == nullptr, true);
+        }
+
+        /*!
+        \brief Period queues slot reuse and ring growth on collision
+        \param unit Test unit
+        */
+        void ring_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::period_queues pq{4};
+            check_eq(unit, t, pq.capacity(), (size_t)4);
+            for (period_type p=0; p<100; p++) {
+                pq[p].queue.emplace_back(p, 0);
+                if (pq.size() > 3) {
+                    pq.erase(pq.oldest());
+                }
+            }
+            check_eq(unit, t, pq.capacity(), (size_t)4);
+            check_eq(unit, t, pq.size(), (size_t)3);
+            check_eq(unit, t, pq.oldest(), (period_type)97);
+            auto& e99 = pq[(period_type)99];
+            pq[(period_type)103].start = 5;     // collides with 99
+            check_eq(unit, t, pq.capacity(), (size_t)8);
+            check_eq(unit, t, &pq[(period_type)99] == &e99, true);
+            check_eq(unit, t, pq[(period_type)99].queue.size(), (size_t)1);
+            check_eq(unit, t, pq.find(103)->start, (int64_t)5);
+            check_eq(unit, t, pq.size(), (size_t)4);
+            check_eq(unit, t, pq.oldest(), (period_type)97);
+        }
+
+        /*!
+        \brief Period queues batch period_indices_for() and cached refined_index() unit test
+        \param unit Test unit
+        */
+        void period_indices_for_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::period_queues pq;
+            ::period_predictor pred{0, 1000};
+            pq[(period_type)3].start = 2990;
+            pq[(period_type)3].start_seen = true;
+            pq[(period_type)4] = period_queue_element{};
+            std::vector<int64_t> ts;
+            for (int64_t toa=-50; toa<5000; toa+=7)
+                ts.push_back(toa);
+            period_block block;
+            pq.period_indices_for(pred, ts.data(), ts.size(), block);
+            bool same = true;
+            for (size_t i=0; i<ts.size(); i++) {
+                auto idx = pq.period_index_for(pred.period_prediction(ts[i]));
+                pq.refined_index(idx, ts[i]);
+                same = same && ! (pq.refined_index(block, i, ts[i]) != idx);
+            }
+            check_eq(unit, t, same, true);
+            check_eq(unit, t, pq.refined_index(block, 427, ts[427]), period_index{2, 2, false});   // 2939 before start 2990
+            check_eq(unit, t, pq.refined_index(block, 435, ts[435]), period_index{3, 3, false});   // 2995
+            check_eq(unit, t, pq.refined_index(block, 578, ts[578]), period_index{3, 4, true});    // 3996
+        }
+
+        /*!
+        \brief Reserved period queues don't allocate once all slots have been used
+        \param unit Test unit
+        */
+        void allocations_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::period_queues pq{8};
+            pq.reserve(64);
+            uint64_t mark = 0;
+            for (period_type p=0; p<200; p++) {
+                if (p == 16)
+                    mark = alloc_counter::mark();
+                auto& rq = pq[p];
+                for (int64_t i=0; i<64; i++)
+                    rq.queue.emplace_back(p * 100 + i, 0);
+                if (pq.size() > 3)
+                    pq.erase(pq.oldest());
+            }
+            const uint64_t allocations = alloc_counter::since(mark);
+            check_eq(unit, t, allocations, (uint64_t)0);
+            check_eq(unit, t, pq.capacity(), (size_t)8);
+            check_eq(unit, t, pq[(period_type)199].queue.size(), (size_t)64);
+        }
+    }
+
+    /*! IO buffer unit tests */
+    namespace io_buffers {
+        /*!
+        \brief Check spsc_ring capacity, ordering and full/empty behaviour
+        \param unit Test unit
+        */
+        void spsc_ring_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::spsc_ring<int> r{3};
+            int v = 0;
+            check_eq(unit, t, r.capacity(), (size_t)4);
+            check_eq(unit, t, r.try_pop(v), false);
+            for (int i=0; i<4; i++)
+                r.try_push(int{i});
+            check_eq(unit, t, r.try_push(4), false);
+            check_eq(unit, t, r.size(), (size_t)4);
+            check_eq(unit, t, r.try_pop(v), true);
+            check_eq(unit, t, v, 0);
+            check_eq(unit, t, r.try_push(4), true);
+            for (int i=1; i<5; i++) {
+                r.try_pop(v);
+                check_eq(unit, t, v, i);
+            }
+            check_eq(unit, t, r.try_pop(v), false);
+        }
+
+        /*!
+        \brief Hand buffers from a producer to a consumer thread through io_buffer_ring
+        \param unit Test unit
+        */
+        void buffer_ring_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            constexpr unsigned n = 10000;
+            ::io_buffer_ring pool{4, 16};
+            check_eq(unit, t, pool.free.size(), (size_t)4);
+            std::thread producer([&pool]() {
+                for (unsigned i=0; i<n; i++) {
+                    auto buf = pool.get_empty_buffer();
+                    buf->content[0] = (char)i;
+                    buf->content_size = 1;
+                    pool.put_nonempty_buffer({i, std::move(buf)});
+                }
+                pool.finish_writing();
+            });
+            unsigned received = 0;
+            bool in_order = true;
+            while (true) {
+                auto [packet, buf] = pool.get_nonempty_buffer();
+                if (buf == nullptr)
+                    break;
+                in_order = in_order && (packet == received) && (buf->content[0] == (char)received);
+                received++;
+                pool.put_empty_buffer(std::move(buf));
+            }
+            producer.join();
+            check_eq(unit, t, received, n);
+            check_eq(unit, t, in_order, true);
+            check_eq(unit, t, pool.free.size(), (size_t)4);
+            pool.finish_reading();
+            std::vector<std::unique_ptr<io_buffer>> taken;
+            for (unsigned i=0; i<4; i++)
+                taken.push_back(pool.get_empty_buffer());
+            check_eq(unit, t, taken.back() != nullptr, true);
+            check_eq(unit, t, pool.get_empty_buffer() == nullptr, true);
+        }
+
+        /*!
+        \brief io_buffer_pool recycles buffers and multimap nodes without heap allocations
+        \param unit Test unit
+        */
+        void pool_allocations_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::io_buffer_pool pool{4, 16};
+            const uint64_t mark = alloc_counter::mark();
+            bool in_order = true;
+            for (uint64_t i=0; i<1000; i+=4) {
+                for (uint64_t j=4; j>0; j--) {
+                    auto buf = pool.get_empty_buffer();
+                    buf->content_size = 1;
+                    pool.put_nonempty_buffer({i + j - 1, std::move(buf)});
+                }
+                for (uint64_t j=0; j<4; j++) {
+                    auto [packet, buf] = pool.get_nonempty_buffer();
+                    in_order = in_order && (packet == i + j);
+                    pool.put_empty_buffer(std::move(buf));
+                }
+            }
+            const uint64_t allocations = alloc_counter::since(mark);
+            check_eq(unit, t, allocations, (uint64_t)0);
+            check_eq(unit, t, in_order, true);
+            check_eq(unit, t, pool.buffer.empty(), true);
+            check_eq(unit, t, pool.free_list.size(), (size_t)4);
+            check_eq(unit, t, pool.spare_nodes.size(), (size_t)4);
+        }
+    }
+
+    namespace decoder {
+        /*!
+        \brief Generate raw words: mostly hits, some TDCs and unknown words
+        \param n       Number of words
+        \param seed    Random seed
+        \return Raw words
+        */
+        std::vector<uint64_t> raw_words(size_t n, uint64_t seed)
+        {
+            std::vector<uint64_t> words(n);
+            for (auto& w : words) {
+                seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                const uint64_t r = seed >> 4;
+                switch (seed >> 60) {
+                    case 0:     // TDC with valid fract
+                        w = (0x6UL << 60) | (r & 0x0ffffffffffffe1fUL) | ((1 + (r >> 50) % 12) << 5); break;
+                    case 1:     // unknown
+                        w = (0x4UL << 60) | r; break;
+                    default:    // hit
+                        w = (0xbUL << 60) | r;
+                }
+            }
+            return words;
+        }
+
+        /*!
+        \brief Compare vector and scalar classifier against per word decoding
+        \param unit Test unit
+        */
+        void classify_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            unsigned t = 0;
+            event_columns vec, sc;
+            for (size_t n : {0ul, 3ul, 8ul, 77ul, 1000ul}) {
+                auto words = raw_words(n, n);
+                Decode::classify(words.data(), n, vec);
+                Decode::classifyScalar(words.data(), n, sc);
+                size_t hits = 0, tdcs = 0;
+                bool ok = true;
+                for (auto w : words) {
+                    if (Decode::matchesNibble(w, 0xb)) {
+                        ok = ok && (vec.toa[hits] == Decode::getToaClock(w)) && (sc.toa[hits] == vec.toa[hits])
+                                && (vec.tot[hits] == Decode::getTotClock(w)) && (sc.tot[hits] == vec.tot[hits])
+                                && (vec.pixel[hits] == Decode::getFlatPixel(w)) && (sc.pixel[hits] == vec.pixel[hits]);
+                        hits++;
+                    } else if (Decode::matchesNibble(w, 0x6)) {
+                        ok = ok && (vec.tdc[tdcs] == w) && (vec.tdc_position[tdcs] == hits) && (sc.tdc_position[tdcs] == hits);
+                        tdcs++;
+                    }
+                }
+                check_eq(unit, t, ok, true);
+                check_eq(unit, t, vec.num_hits, hits);
+                check_eq(unit, t, sc.num_hits, hits);
+                check_eq(unit, t, vec.num_tdc, tdcs);
+                check_eq(unit, t, vec.stop, n);
+                check_eq(unit, t, (unsigned)vec.reason, (unsigned)event_columns::none);
+            }
+            auto words = raw_words(100, 42);
+            words[37] = Decode::chunkHeader;
+            words[70] = 0x50UL << 56;
+            Decode::classify(words.data(), words.size(), vec);
+            check_eq(unit, t, vec.stop, (size_t)37);
+            check_eq(unit, t, (unsigned)vec.reason, (unsigned)event_columns::chunk_header);
+            words[37] = 0;
+            Decode::classify(words.data(), words.size(), vec);
+            Decode::classifyScalar(words.data(), words.size(), sc);
+            check_eq(unit, t, vec.stop, (size_t)70);
+            check_eq(unit, t, (unsigned)vec.reason, (unsigned)event_columns::packet_id);
+            check_eq(unit, t, vec.num_hits, sc.num_hits);
+            check_eq(unit, t, vec.num_tdc, sc.num_tdc);
+        }
+    }
+
+    namespace energy_points {
+        /*!
+        \brief Build compact energy point table from pixel to energy point mapping
+        \param unit Test unit
+        */
+        void ep_table_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            PixelIndexToEp ep;
+            ep.chip.resize(2);
+            for (auto& chip : ep.chip)
+                chip.flat_pixel.resize(EpTable::pixels_per_chip);
+            ep.at(PixelIndex::from(0, 5u)).part = {{3, 1.f}};
+            ep.at(PixelIndex::from(1, 7u)).part = {{4, .5f}};
+            ep.at(PixelIndex::from(1, 8u)).part = {{1, 1.f}, {2, .25f}};
+            ep.npoints = 5;
+            EpTable table;
+            table.build(ep);
+            check_eq(unit, t, table.npoints, 5u);
+            check_eq(unit, t, table.entry.size(), (size_t)2 * EpTable::pixels_per_chip);
+            check_eq(unit, t, table.energy_point.size(), (size_t)4);
+            const auto p0 = table.position(PixelIndex::from(0, 5u));
+            check_eq(unit, t, table.entry[p0], EpTable::single | 3u);
+            const auto p1 = table.position(PixelIndex::from(1, 7u));
+            check_eq(unit, t, table.entry[p1], 0u);
+            check_eq(unit, t, table.offset[p1 + 1] - table.offset[p1], 1u);
+            check_eq(unit, t, table.weight[table.offset[p1]], .5f);
+            const auto p2 = table.position(PixelIndex::from(1, 8u));
+            check_eq(unit, t, table.entry[p2], 0u);
+            check_eq(unit, t, table.offset[p2 + 1] - table.offset[p2], 2u);
+            check_eq(unit, t, table.energy_point[table.offset[p2] + 1], 2u);
+            check_eq(unit, t, table.weight[table.offset[p2] + 1], .25f);
+            const auto p3 = table.position(PixelIndex::from(1, 9u));
+            check_eq(unit, t, table.entry[p3], 0u);
+            check_eq(unit, t, table.offset[p3 + 1] - table.offset[p3], 0u);
+            check_eq(unit, t, table.offset.back(), 4u);
+            check_eq(unit, t, table.single_only(), false);
+            ep.at(PixelIndex::from(1, 7u)).part = {{4, 1.f}};
+            ep.at(PixelIndex::from(1, 8u)).part.clear();
+            table.build(ep);
+            check_eq(unit, t, table.single_only(), true);
+        }
+
+        /*!
+        \brief Parse XES points text, write and load the binary table cache
+        \param unit Test unit
+        */
+        void cache_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            const std::string text = "0,5,3,1\n1, 7, 4, 0.5\r\n\n1,8,1,2,1,0.25\n";
+            PixelIndexToEp ep;
+            ::ep_cache::parse_points(text, 2, ep);
+            check_eq(unit, t, ep.npoints, 5u);
+            check_eq(unit, t, ep.at(PixelIndex::from(1, 8u)).part.size(), (size_t)2);
+            check_eq(unit, t, ep.at(PixelIndex::from(1, 8u)).part[1].weight, .25f);
+            for (const char* bad : {"0,5,3\n", "2,5,3,1\n", "0,65536,3,1\n", "0,5,x,1\n", "0,5,3,1y\n"}) {
+                bool thrown = false;
+                try {
+                    ::ep_cache::parse_points(bad, 2, ep);
+                } catch (std::invalid_argument&) {
+                    thrown = true;
+                }
+                check_eq(unit, t, thrown, true);
+            }
+
+            ::ep_cache::parse_points(text, 2, ep);
+            EpTable table;
+            table.build(ep);
+            char name[] = "/tmp/tpx3_ep_cache_test_XXXXXX";
+            const int fd = mkstemp(name);
+            check_eq(unit, t, fd >= 0, true);
+            if (fd < 0)
+                return;
+            ::close(fd);
+            const uint64_t hash = ::ep_cache::content_hash(text);
+            check_eq(unit, t, hash != ::ep_cache::content_hash(text + ' '), true);
+            ::ep_cache::save(name, hash, 2, table);
+            EpTable cached;
+            check_eq(unit, t, ::ep_cache::load(name, hash + 1, 2, cached), false);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 3, cached), false);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), true);
+            check_eq(unit, t, cached.npoints, table.npoints);
+            check_eq(unit, t, cached.entry == table.entry, true);
+            check_eq(unit, t, cached.offset == table.offset, true);
+            check_eq(unit, t, cached.energy_point == table.energy_point, true);
+            check_eq(unit, t, cached.weight == table.weight, true);
+
+            // corrupt part offsets: decreasing, beyond the parts
+            const std::size_t numPixels = 2 * EpTable::pixels_per_chip;
+            const off_t offsets = sizeof(::ep_cache::cache_header) + numPixels * sizeof(uint32_t);
+            const auto patch = [&](std::size_t i, uint32_t value) {
+                const int wfd = ::open(name, O_WRONLY);
+                const bool ok = (wfd >= 0) && (pwrite(wfd, &value, sizeof(value), offsets + i * sizeof(value)) == sizeof(value));
+                if (wfd >= 0)
+                    ::close(wfd);
+                return ok;
+            };
+            const std::size_t pixel = EpTable::pixels_per_chip + 8;    // chip 1, pixel 8 with two parts
+            check_eq(unit, t, patch(pixel + 1, table.offset[pixel] - 1), true);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), false);
+            check_eq(unit, t, patch(pixel + 1, table.offset[pixel + 1]), true);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), true);
+            check_eq(unit, t, patch(numPixels, table.energy_point.size() + 1), true);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), false);
+            check_eq(unit, t, patch(numPixels, table.energy_point.size()), true);
+            check_eq(unit, t, patch(0, 1), true);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), false);
+
+            check_eq(unit, t, truncate(name, 100), 0);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), false);
+            std::remove(name);
+            check_eq(unit, t, ::ep_cache::load(name, hash, 2, cached), false);
+        }
+    }
+
+    namespace event_batches {
+        /*!
+        \brief Pass event batches to a worker thread through batch_channel, drain in between
+        \param unit Test unit
+        */
+        void batch_channel_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            constexpr unsigned n = 1000;
+            ::batch_channel channel{2, 3};
+            check_eq(unit, t, channel.free.size(), (size_t)2);
+            uint64_t sum = 0;
+            std::thread worker([&channel, &sum]() {
+                while (auto batch = channel.get_full()) {
+                    for (const auto& ev : batch->event)
+                        sum += ev.event;
+                    channel.put_empty(std::move(batch));
+                }
+            });
+            uint64_t expected = 0;
+            bool drained = true;
+            auto batch = channel.get_empty();
+            for (unsigned i=0; i<n; i++) {
+                batch->event.push_back({i, 0, i});
+                expected += i;
+                if (batch->full()) {
+                    channel.dispatch(std::move(batch));
+                    batch = channel.get_empty();
+                }
+                if ((i % 100) == 99) {
+                    channel.dispatch(std::move(batch));
+                    channel.drain();
+                    drained = drained && (channel.processed == channel.dispatched);
+                    batch = channel.get_empty();
+                }
+            }
+            channel.dispatch(std::move(batch));
+            channel.drain();
+            channel.finish();
+            worker.join();
+            check_eq(unit, t, drained, true);
+            check_eq(unit, t, sum, expected);
+            check_eq(unit, t, channel.free.size(), (size_t)2);
+        }
+    }
+
+    namespace histogram_reduction {
+        /*!
+        \brief Sum up and clear partial histograms, on the calling thread and with helpers
+        \param unit Test unit
+        */
+        void pool_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            using pool_type = ::histogram_reduction::pool<int>;
+            check_eq(unit, t, pool_type::helpers_for(100, 3), 0u);
+            check_eq(unit, t, pool_type::helpers_for(3 * pool_type::min_part_size, 3), 2u);
+            check_eq(unit, t, pool_type::helpers_for(10 * pool_type::min_part_size, 3), 3u);
+            constexpr std::size_t size = 3 * ::histogram_reduction::block_size + 17;
+            for (unsigned num_helpers : {0u, 2u}) {
+                pool_type pool{num_helpers};
+                std::vector<std::vector<int>> part(3, std::vector<int>(size));
+                std::vector<int*> src;
+                for (unsigned k=0; k<part.size(); k++) {
+                    for (std::size_t i=0; i<size; i++)
+                        part[k][i] = (k + 1) * i;
+                    src.push_back(part[k].data());
+                }
+                std::vector<int> dst(size, -1);
+                for (unsigned r=0; r<2; r++) {
+                    pool.run(dst.data(), src.data(), src.size(), size);
+                    bool sum_ok = true, clear_ok = true;
+                    for (std::size_t i=0; i<size; i++) {
+                        sum_ok = sum_ok && (dst[i] == int(r == 0 ? 6 * i : 0));
+                        for (const auto& p : part)
+                            clear_ok = clear_ok && (p[i] == 0);
+                    }
+                    check_eq(unit, t, sum_ok, true);
+                    check_eq(unit, t, clear_ok, true);
+                }
+            }
+        }
+    }
+
+    namespace stream_generator {
+        /*!
+        \brief Decode generated raw events and check generated packet structure
+        \param unit Test unit
+        */
+        void generate_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            namespace gen = ::stream_generator;
+            unsigned t = 0;
+            bool tdc_ok = true, toa_ok = true, tot_ok = true, shift_ok = true;
+            for (int64_t clk : {0l, 1l, 15l, 16l, 17l, (1l << 18) - 1, (1l << 18) + 5, 123456789l, (1l << 34) - 20}) {
+                tdc_ok = tdc_ok && (Decode::getTdcClock(gen::tdc(clk)) == (uint64_t)clk);
+                toa_ok = toa_ok && (Decode::getToaClock(gen::toa(0x1234, clk, 77)) == clk);
+                tot_ok = tot_ok && (Decode::getTotClock(gen::toa(0x1234, clk, 77)) == 77u);
+                for (int64_t ticks : {16l, 4096l, (1l << 18) + 48, 1l << 30}) {
+                    if (clk + ticks > (1l << 34) - 16)
+                        continue;
+                    const uint64_t shifted = gen::shift_time(gen::toa(0x1234, clk, 77), ticks);
+                    shift_ok = shift_ok && (Decode::getToaClock(shifted) == clk + ticks) && (Decode::getTotClock(shifted) == 77u)
+                                        && (Decode::getFlatPixel(shifted) == Decode::getFlatPixel(gen::toa(0x1234, clk, 77)));
+                    shift_ok = shift_ok && (Decode::getTdcClock(gen::shift_time(gen::tdc(clk), ticks)) == (uint64_t)(clk + ticks));
+                }
+            }
+            check_eq(unit, t, tdc_ok, true);
+            check_eq(unit, t, toa_ok, true);
+            check_eq(unit, t, tot_ok, true);
+            check_eq(unit, t, shift_ok, true);
+            check_eq(unit, t, gen::shift_time(gen::pkcount(17), 4096), gen::pkcount(17));
+            check_eq(unit, t, gen::shift_time(gen::chunk_header(64, 1), 4096), gen::chunk_header(64, 1));
+
+            const auto stream = gen::generate_stream(2, 1000, 3, 50, 10);
+            check_eq(unit, t, stream.size(), (size_t)(2 * 3 * 13));
+            size_t pos = 0;
+            bool chunks_ok = true;
+            for (uint64_t p=0; p<3; p++) {
+                for (uint64_t c=0; c<2; c++) {
+                    const uint64_t header = stream[pos];
+                    chunks_ok = chunks_ok && ((header & 0xffffffffUL) == 861425748UL);
+                    chunks_ok = chunks_ok && (Decode::getBits(header, 39, 32) == c);
+                    chunks_ok = chunks_ok && (Decode::getBits(header, 63, 48) == 8 * 12);
+                    chunks_ok = chunks_ok && Decode::matchesByte(stream[pos + 1], 0x50) && (Decode::getBits(stream[pos + 1], 47, 0) == p);
+                    chunks_ok = chunks_ok && (Decode::getTdcClock(stream[pos + 2]) == p * 1000);
+                    chunks_ok = chunks_ok && (Decode::getToaClock(stream[pos + 3]) == (int64_t)(p * 1000 + 100));
+                    pos += 1 + Decode::getBits(header, 63, 48) / 8;
+                }
+            }
+            check_eq(unit, t, chunks_ok, true);
+            check_eq(unit, t, pos, stream.size());
+        }
+
+        /*!
+        \brief Check stream model settings, pixel addresses, and the decoded structure of the production scale stream model
+        \param unit Test unit
+        */
+        void model_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            namespace gen = ::stream_generator;
+            unsigned t = 0;
+
+            bool pixel_ok = true;
+            for (uint64_t x=0; x<chip_size; x++)
+                for (uint64_t y=0; y<chip_size; y++)
+                    pixel_ok = pixel_ok && (Decode::getFlatPixel(gen::toa(gen::pixel_address(x, y), 1000l, 5)) == x * chip_size + y);
+            check_eq(unit, t, pixel_ok, true);
+
+            gen::config cfg;
+            cfg.parse("chips=2,period=20000,periods=20,hits=500,chunk_hits=200,tdc_jitter=100,disorder=1000,points=4,seed=7");
+            check_eq(unit, t, cfg.chips, 2u);
+            check_eq(unit, t, cfg.hits, 500.);
+            check_eq(unit, t, cfg.seed, (uint64_t)7);
+            check_eq(unit, t, cfg.max_periods(), (uint64_t)(((1l << 34) - 1001) / 20100 - 2));
+            for (const char* spec : {"chips=0", "colour=red", "hits=many", "period=10x", "disorder=5000,period=10000", "period=10000000,periods=2000", "chips"}) {
+                bool thrown = false;
+                try {
+                    gen::config{}.parse(spec);
+                } catch (std::invalid_argument&) {
+                    thrown = true;
+                }
+                check_eq(unit, t, thrown, true);
+            }
+
+            const gen::generator model{cfg};
+            check_eq(unit, t, model.chunks_per_period(), (uint64_t)3);
+            std::vector<uint64_t> stream, part;
+            const uint64_t nhits = model.generate(0, cfg.periods, stream);
+            uint64_t phits = model.generate(0, 7, part);
+            phits += model.generate(7, cfg.periods, part);
+            check_eq(unit, t, part == stream, true);
+            check_eq(unit, t, phits, nhits);
+            check_eq(unit, t, (nhits > 16000) && (nhits < 24000), true);
+
+            std::vector<uint64_t> next_id(cfg.chips, 1);
+            std::vector<int64_t> last_tdc(cfg.chips, -1);
+            uint64_t hits = 0, tdcs = 0, early = 0;
+            bool header_ok = true, id_ok = true, tdc_ok = true, toa_ok = true;
+            for (size_t pos=0; pos<stream.size();) {
+                const uint64_t header = stream[pos];
+                const unsigned chip = Decode::getBits(header, 39, 32);
+                const size_t end = pos + 1 + Decode::getBits(header, 63, 48) / 8;
+                header_ok = header_ok && ((header & 0xffffffffUL) == gen::tpx3()) && (chip < cfg.chips) && (end <= stream.size());
+                if (! header_ok)
+                    break;
+                id_ok = id_ok && Decode::matchesByte(stream[pos + 1], 0x50) && (Decode::getBits(stream[pos + 1], 47, 0) == next_id[chip]++);
+                for (size_t i=pos+2; i<end; i++) {
+                    if (Decode::matchesNibble(stream[i], 0x6)) {
+                        const int64_t clk = Decode::getTdcClock(stream[i]);
+                        tdc_ok = tdc_ok && (clk == model.tdc_time(tdcs / cfg.chips)) && (last_tdc[chip] < clk);
+                        last_tdc[chip] = clk;
+                        tdcs++;
+                    } else if (Decode::matchesNibble(stream[i], 0xb)) {
+                        const int64_t clk = Decode::getToaClock(stream[i]);
+                        toa_ok = toa_ok && (clk >= last_tdc[chip] - cfg.disorder) && (clk < last_tdc[chip] + cfg.period + cfg.tdc_jitter + cfg.disorder);
+                        early += (clk < last_tdc[chip]);
+                        hits++;
+                    }
+                }
+                pos = end;
+            }
+            check_eq(unit, t, header_ok, true);
+            check_eq(unit, t, id_ok, true);
+            check_eq(unit, t, next_id[1], cfg.periods * model.chunks_per_period() + 1);
+            check_eq(unit, t, tdc_ok, true);
+            check_eq(unit, t, tdcs, cfg.chips * cfg.periods);
+            check_eq(unit, t, toa_ok, true);
+            check_eq(unit, t, hits, nhits);
+            check_eq(unit, t, (early > 0) && (early < hits / 20), true);
+
+            gen::config tail;
+            tail.parse("chips=1,period=20000,periods=200,hits=2000,chunk_hits=2000,seed=3");
+            const gen::generator tail_model{tail};
+            gen::generator::chip_stream tail_stream{tail_model, 0, 0};
+            uint64_t above = 0, largest = 0;
+            for (uint64_t p=0; p<tail.periods; p++) {
+                std::vector<uint64_t> words;
+                const uint64_t n = tail_stream.emit(words);
+                above += (n > 2000);
+                largest = std::max(largest, n);
+            }
+            check_eq(unit, t, tail_model.chunks_per_period(), (uint64_t)1);
+            check_eq(unit, t, (above > 50) && (above < 150), true);
+            check_eq(unit, t, (largest > 2050) && (largest < 2300), true);
+
+            std::ostringstream points;
+            gen::write_points(points, cfg);
+            PixelIndexToEp energy_points;
+            ::ep_cache::parse_points(points.str(), cfg.chips, energy_points);
+            check_eq(unit, t, energy_points.npoints, cfg.points);
+        }
+    }
+
+    /*! Logging unit tests */
+    namespace logging {
+        /*!
+        \brief Check mpsc_ring capacity and full/empty behaviour, and per producer order with concurrent producers
+        \param unit Test unit
+        */
+        void mpsc_ring_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            {
+                ::mpsc_ring<int> r{3};
+                int v = 0;
+                check_eq(unit, t, r.capacity(), (size_t)4);
+                check_eq(unit, t, r.try_pop(v), false);
+                for (int i=0; i<4; i++)
+                    r.try_push(int{i});
+                check_eq(unit, t, r.try_push(4), false);
+                check_eq(unit, t, r.try_pop(v), true);
+                check_eq(unit, t, v, 0);
+                check_eq(unit, t, r.try_push(4), true);
+                for (int i=1; i<5; i++) {
+                    r.try_pop(v);
+                    check_eq(unit, t, v, i);
+                }
+                check_eq(unit, t, r.try_pop(v), false);
+            }
+            {
+                constexpr unsigned producers = 4;
+                constexpr uint64_t n = 20000;
+                ::mpsc_ring<uint64_t> r{64};
+                std::vector<std::thread> producer;
+                for (unsigned p=0; p<producers; p++) {
+                    producer.emplace_back([&r, p]() {
+                        for (uint64_t i=0; i<n; i++) {
+                            while (! r.try_push((uint64_t(p) << 32) | i))
+                                std::this_thread::yield();
+                        }
+                    });
+                }
+                std::vector<uint64_t> next(producers, 0);
+                bool in_order = true;
+                uint64_t received = 0;
+                while (received < producers * n) {
+                    uint64_t v;
+                    if (! r.try_pop(v)) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    const unsigned p = v >> 32;
+                    in_order = in_order && (p < producers) && ((v & 0xffffffffUL) == next[p]);
+                    if (p < producers)
+                        next[p]++;
+                    received++;
+                }
+                for (auto& thread : producer)
+                    thread.join();
+                uint64_t v;
+                check_eq(unit, t, in_order, true);
+                check_eq(unit, t, r.try_pop(v), false);
+            }
+        }
+    }
+
+    /*! Live metrics unit tests */
+    namespace metrics {
+        /*!
+        \brief Check counter updates and Prometheus text lines
+        \param unit Test unit
+        */
+        void text_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::metrics::counter c;
+            check_eq(unit, t, c.get(), (uint64_t)0);
+            c.add();
+            c.add(41);
+            check_eq(unit, t, c.get(), (uint64_t)42);
+            c.set(7);
+            check_eq(unit, t, c.get(), (uint64_t)7);
+
+            std::ostringstream out;
+            ::metrics::describe(out, "tpx3_x_total", "counter", "Number of x");
+            ::metrics::sample(out, "tpx3_x_total", c.get());
+            ::metrics::sample(out, "tpx3_y", 3u, 0.5);
+            check_eq(unit, t, out.str(), std::string{"# HELP tpx3_x_total Number of x\n# TYPE tpx3_x_total counter\ntpx3_x_total 7\ntpx3_y{chip=\"3\"} 0.5\n"});
+        }
+    }
+
+    /*! Thread placement unit tests */
+    namespace placement {
+        /*!
+        \brief Check CPU list parsing, representation, configured CPUs per thread, and pinning
+        \param unit Test unit
+        */
+        void cpu_list_test(const test_unit& unit)
+        {
+            using ::placement::cpu_list;
+            unsigned t = 0;
+            check_eq(unit, t, ::placement::parse("3,0-2,8,10-11,2").size(), (size_t)7);
+            check_eq(unit, t, ::placement::to_string(::placement::parse("3,0-2,8,10-11,2")), std::string{"0-3,8,10-11"});
+            check_eq(unit, t, ::placement::to_string(cpu_list{5}), std::string{"5"});
+            for (const char* bad : {"", "a", "1-", "-1", "3-1", "1,,2", "1 ", "1-2x", "100000"}) {
+                bool thrown = false;
+                try {
+                    ::placement::parse(bad);
+                } catch (std::invalid_argument&) {
+                    thrown = true;
+                }
+                check_eq(unit, t, thrown, true);
+            }
+
+            const auto saved = ::placement::cpus;
+            ::placement::cpus = {};
+            check_eq(unit, t, ::placement::to_string(::placement::for_thread(::placement::analyser, 1)), std::string{});
+            ::placement::cpus[::placement::analyser] = {4, 6};
+            ::placement::cpus[::placement::reader] = {0, 1};
+            check_eq(unit, t, ::placement::to_string(::placement::for_thread(::placement::analyser, 0)), std::string{"4"});
+            check_eq(unit, t, ::placement::to_string(::placement::for_thread(::placement::analyser, 3)), std::string{"6"});
+            check_eq(unit, t, ::placement::to_string(::placement::for_thread(::placement::reader, 3)), std::string{"0-1"});
+            ::placement::cpus = saved;
+
+            std::thread([&unit, &t]() {
+                const cpu_list all = ::placement::current();
+                check_eq(unit, t, all.empty(), false);
+                if (all.empty())
+                    return;
+                check_eq(unit, t, ::placement::pin({all.back()}), 0);
+                check_eq(unit, t, ::placement::to_string(::placement::current()), std::to_string(all.back()));
+            }).join();
+        }
+    }
+
+    namespace archive {
+        /*!
+        \brief Read whole file
+        \param path File path
+        \return File content
+        */
+        std::string slurp(const std::string& path)
+        {
+            std::ifstream in(path, std::ios::binary);
+            return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        /*!
+        \brief Check archived slab ranges, slab references, and drop accounting
+        \param unit Test unit
+        */
+        void tee_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            char name[] = "/tmp/tpx3_archive_test_XXXXXX";
+            const int fd = mkstemp(name);
+            check_eq(unit, t, fd >= 0, true);
+            if (fd < 0)
+                return;
+            ::close(fd);
+            const std::string path{name};
+
+            io_slab_pool pool{4, io_slab_pool::min_size};
+            auto fill = [](io_slab* slab, size_t n, char start) {
+                for (size_t i=0; i<n; i++)
+                    slab->data[i] = static_cast<char>(start + i % 61);
+                slab->fill = n;
+            };
+
+            std::string expected;
+            {
+                stream_archive tee{path, stream_archive::block, false, 4};
+                check_eq(unit, t, tee.alignment(), (size_t)1);
+                io_slab* a = pool.try_get();
+                io_slab* b = pool.try_get();
+                fill(a, 1000, 'a');
+                fill(b, 300, 'A');
+                check_eq(unit, t, tee.put(a, 600), (size_t)600);
+                a->release();
+                check_eq(unit, t, tee.put(b, b->fill, true), (size_t)300);
+                b->release();
+                expected = std::string(a->data, 600) + std::string(b->data, 300);
+                tee.finish();
+                check_eq(unit, t, tee.written(), (uint64_t)900);
+                check_eq(unit, t, tee.dropped(), (uint64_t)0);
+                check_eq(unit, t, tee.writeError(), std::string{});
+            }
+            check_eq(unit, t, slurp(path) == expected, true);
+
+            {
+                stream_archive tee{path, stream_archive::drop, false, 2};
+                uint64_t total = 0;
+                for (unsigned i=0; i<200; i++) {
+                    io_slab* slab = nullptr;
+                    while (! (slab = pool.try_get()))
+                        std::this_thread::yield();
+                    fill(slab, 100 + i, 'a');
+                    total += tee.put(slab, slab->fill, i == 199);
+                    slab->release();
+                }
+                tee.finish();
+                check_eq(unit, t, tee.written() + tee.dropped(), total);
+                check_eq(unit, t, (uint64_t)slurp(path).size(), tee.written());
+                std::ostringstream out;
+                tee.writeMetrics(out);
+                check_eq(unit, t, out.str().find("tpx3_archive_queued_slabs 0\n") != std::string::npos, true);
+            }
+
+            io_slab* slabs[4];
+            for (auto& slab : slabs)
+                check_eq(unit, t, (slab = pool.try_get()) != nullptr, true);
+            for (auto* slab : slabs)
+                if (slab)
+                    slab->release();
+
+            bool thrown = false;
+            try {
+                stream_archive tee{path, stream_archive::drop, true, 2};
+            } catch (std::invalid_argument&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+            std::remove(name);
+        }
+    }
+
+    namespace adaptive_wait {
+        /*!
+        \brief Check parking, wakeup by notification, timeout, and ping-pong without lost wakeups
+        \param unit Test unit
+        */
+        void wait_point_test(const test_unit& unit)
+        {
+            using namespace std::chrono_literals;
+            unsigned t = 0;
+            ::adaptive_wait::wait_point point;
+            std::atomic<bool> flag = false;
+
+            std::thread([&]() {
+                std::thread notifier([&]() {
+                    std::this_thread::sleep_for(50ms);
+                    flag.store(true, std::memory_order_release);
+                    point.notify();
+                });
+                point.await([&flag]() { return flag.load(std::memory_order_acquire); });
+                notifier.join();
+                check_eq(unit, t, flag.load(), true);
+                check_eq(unit, t, ::adaptive_wait::stats.waits, (uint64_t)1);
+                check_eq(unit, t, ::adaptive_wait::stats.parks > 0, true);
+                check_eq(unit, t, ::adaptive_wait::stats.parked > .0, true);
+            }).join();
+
+            flag = false;
+            std::thread([&]() {
+                std::thread setter([&]() {
+                    std::this_thread::sleep_for(20ms);
+                    flag.store(true, std::memory_order_release);    // no notification, the park timeout catches it
+                });
+                point.await([&flag]() { return flag.load(std::memory_order_acquire); });
+                setter.join();
+                check_eq(unit, t, flag.load(), true);
+            }).join();
+
+            // lost wakeups would cost a park timeout per round
+            constexpr unsigned rounds = 2000;
+            ::adaptive_wait::wait_point ping, pong;
+            std::atomic<unsigned> turn = 0;
+            const auto start = std::chrono::steady_clock::now();
+            std::thread partner([&]() {
+                for (unsigned i=0; i<rounds; i++) {
+                    ping.await([&turn, i]() { return turn.load(std::memory_order_acquire) == 2 * i + 1; });
+                    turn.store(2 * i + 2, std::memory_order_release);
+                    pong.notify();
+                }
+            });
+            for (unsigned i=0; i<rounds; i++) {
+                turn.store(2 * i + 1, std::memory_order_release);
+                ping.notify();
+                pong.await([&turn, i]() { return turn.load(std::memory_order_acquire) == 2 * i + 2; });
+            }
+            partner.join();
+            check_eq(unit, t, turn.load(), 2 * rounds);
+            check_eq(unit, t, std::chrono::steady_clock::now() - start < 5s, true);
+
+            ::adaptive_wait::wait_stats a, b;
+            a.waits = 1; a.parks = 2; a.spin = .5;
+            b.waits = 3; b.parks = 4; b.parked = .25;
+            a += b;
+            check_eq(unit, t, a.waits, (uint64_t)4);
+            check_eq(unit, t, a.parks, (uint64_t)6);
+            check_eq(unit, t, a.spin + a.parked, .75);
+        }
+    }
+
+    namespace sharding {
+        /*!
+        \brief Route chips to shards, select shard energy point tables, merge partial histograms
+        \param unit Test unit
+        */
+        void merge_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            check_eq(unit, t, ::sharding::shard_chips(1, 2, 5) == std::vector<unsigned>{1, 3}, true);
+            check_eq(unit, t, ::sharding::shard_chips(2, 3, 2).empty(), true);
+            for (unsigned chip=0; chip<7; chip++) {
+                const auto chips = ::sharding::shard_chips(::sharding::shard_of(chip, 3), 3, 7);
+                check_eq(unit, t, chips.at(::sharding::local_chip(chip, 3)), chip);
+            }
+            const uint64_t header = 861425748UL | (5UL << 32) | (0x1234UL << 48);
+            check_eq(unit, t, ::sharding::relabel(header, 2), 861425748UL | (2UL << 32) | (0x1234UL << 48));
+            check_eq(unit, t, ::sharding::parse_shard("2/4") == std::pair<unsigned, unsigned>{2, 4}, true);
+            for (const char* bad : {"4/4", "1", "1/0", "x/2", "1/2x", "/2"}) {
+                bool thrown = false;
+                try {
+                    ::sharding::parse_shard(bad);
+                } catch (std::invalid_argument&) {
+                    thrown = true;
+                }
+                check_eq(unit, t, thrown, true);
+            }
+
+            PixelIndexToEp ep;
+            ep.chip.resize(3);
+            for (auto& chip : ep.chip)
+                chip.flat_pixel.resize(EpTable::pixels_per_chip);
+            ep.at(PixelIndex::from(0, 1u)).part = {{1, 1.f}};
+            ep.at(PixelIndex::from(2, 1u)).part = {{2, .5f}, {3, .5f}};
+            ep.npoints = 4;
+            EpTable table;
+            table.build(ep);
+            const EpTable shard = table.select({2});
+            check_eq(unit, t, shard.npoints, 4u);
+            check_eq(unit, t, shard.entry.size(), (size_t)EpTable::pixels_per_chip);
+            check_eq(unit, t, shard.offset.size(), (size_t)EpTable::pixels_per_chip + 1);
+            check_eq(unit, t, shard.offset[2] - shard.offset[1], 2u);
+            check_eq(unit, t, shard.energy_point.size(), (size_t)2);
+            check_eq(unit, t, shard.energy_point[1], 3u);
+            check_eq(unit, t, table.select({0}).entry[1], EpTable::single | 1u);
+
+            auto part = [](int64_t period, int32_t value) {
+                ::sharding::record rec;
+                rec.period = period;
+                rec.npoints = 2;
+                rec.time_points = 3;
+                rec.total = value;
+                rec.bins.assign(6, value);
+                return rec;
+            };
+            ::sharding::merger merger{2};
+            ::sharding::record complete;
+            check_eq(unit, t, merger.add(part(10, 1), complete), false);
+            check_eq(unit, t, merger.add(part(20, 2), complete), false);
+            check_eq(unit, t, merger.add(part(10, 3), complete), true);
+            check_eq(unit, t, complete.period, (int64_t)10);
+            check_eq(unit, t, complete.total, (int64_t)4);
+            check_eq(unit, t, complete.bins[5], 4);
+            check_eq(unit, t, merger.pending(), (size_t)1);
+            bool thrown = false;
+            try {
+                auto bad = part(20, 1);
+                bad.npoints = 3;
+                bad.time_points = 2;
+                merger.add(std::move(bad), complete);
+            } catch (std::invalid_argument&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+            const auto rest = merger.incomplete();
+            check_eq(unit, t, rest.size(), (size_t)1);
+            check_eq(unit, t, rest[0].period, (int64_t)20);
+            check_eq(unit, t, rest[0].bins[0], 2);
+            check_eq(unit, t, merger.pending(), (size_t)0);
+        }
+    }
+
+    namespace preview {
+        /*!
+        \brief Publish period histograms while another thread reads consistent snapshots
+        \param unit Test unit
+        */
+        void snapshot_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::preview::publisher publisher;
+            ::preview::snapshot s;
+            check_eq(unit, t, publisher.read(s), false);
+
+            std::vector<int32_t> bins(6);
+            for (int i=0; i<6; i++)
+                bins[i] = i;
+            publisher.publish(7, 2, 3, bins.data(), 1, 2, 15);
+            publisher.publish(8, 2, 3, bins.data(), 0, 0, 15);
+            check_eq(unit, t, publisher.read(s), true);
+            check_eq(unit, t, s.sequence, (uint64_t)2);
+            check_eq(unit, t, s.period, (int64_t)8);
+            check_eq(unit, t, s.sum_total, (int64_t)30);
+            check_eq(unit, t, s.latest == bins, true);
+            check_eq(unit, t, s.sum[5], (int64_t)10);
+            check_eq(unit, t, publisher.read(s), true);     // nothing new, same snapshot
+            check_eq(unit, t, s.sequence, (uint64_t)2);
+
+            std::ostringstream json;
+            publisher.publish(9, 1, 2, bins.data(), 0, 1, 1);   // new dimensions restart the sum
+            publisher.read(s);
+            ::preview::write_json(json, s);
+            check_eq(unit, t, json.str(), std::string{"{\"sequence\":3,\"period\":9,\"energy_points\":1,\"time_points\":2,"
+                                                      "\"before_roi\":0,\"after_roi\":1,\"total\":1,\"sum_total\":1,"
+                                                      "\"latest\":[0,1],\"sum\":[0,1]}\n"});
+
+            // every snapshot must be internally consistent: latest bins all equal the period, sum matches the sequence
+            constexpr int64_t periods = 20000;
+            bool consistent = true;
+            std::thread writer([&publisher]() {
+                std::vector<int32_t> b(64);
+                for (int64_t p=1; p<=periods; p++) {
+                    std::fill(b.begin(), b.end(), (int32_t)p);
+                    publisher.publish(p, 8, 8, b.data(), 0, 0, 64);
+                }
+            });
+            uint64_t last = 0;
+            while (last < (uint64_t)periods + 3) {
+                ::preview::snapshot r;
+                publisher.read(r);
+                if (r.npoints != 8)
+                    continue;
+                const int64_t seq = r.sequence - 3;     // three periods of other dimensions were published before
+                if ((r.period != seq) || (r.sum_total != 64 * seq)
+                    || ! std::all_of(r.latest.begin(), r.latest.end(), [&r](int32_t v) { return v == r.period; })
+                    || (r.sum[63] != seq * (seq + 1) / 2))
+                    consistent = false;
+                last = r.sequence;
+            }
+            writer.join();
+            check_eq(unit, t, consistent, true);
+            check_eq(unit, t, s.sequence, (uint64_t)3);
+        }
+    }
+
+    namespace block_compression {
+        /*!
+        \brief Check multithreaded block compression round trip and corruption detection
+        \param unit Test unit
+        */
+        void round_trip_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            std::string raw;
+            std::ostringstream out;
+            {
+                ::block_compression::compressor packer{out, 3, 1, 1000};
+                for (unsigned i=0; i<500; i++) {
+                    std::string piece(8 * (1 + i % 13), char('a' + i % 7));
+                    piece[0] = char(i);
+                    raw += piece;
+                    packer.write(piece.data(), piece.size());
+                }
+                packer.flush();
+                check_eq(unit, t, packer.raw_bytes(), (uint64_t)raw.size());
+                check_eq(unit, t, packer.packed_bytes(), (uint64_t)out.str().size());
+            }
+            std::string packed = out.str();
+            check_eq(unit, t, ::block_compression::is_compressed(packed.data(), packed.size()), true);
+            check_eq(unit, t, ::block_compression::is_compressed(raw.data(), raw.size()), false);
+            check_eq(unit, t, packed.size() < raw.size(), true);
+
+            const auto blocks = ::block_compression::index(packed.data(), packed.size());
+            check_eq(unit, t, blocks.size() >= raw.size() / 1000, true);
+            check_eq(unit, t, ::block_compression::raw_size(blocks), raw.size());
+            std::string unpacked(raw.size(), '\0');
+            ::block_compression::decompress(packed.data(), blocks, unpacked.data(), 2);
+            check_eq(unit, t, unpacked == raw, true);
+
+            for (unsigned threads : {1u, 3u}) {
+                ::block_compression::block_reader reader{packed.data(), blocks, threads};
+                std::string streamed;
+                char buf[777];
+                for (std::size_t n; (n = reader.read(buf, 1 + streamed.size() % sizeof(buf))) > 0;)
+                    streamed.append(buf, n);
+                check_eq(unit, t, streamed == raw, true);
+                check_eq(unit, t, reader.read(buf, sizeof(buf)), (std::size_t)0);
+            }
+
+            packed[blocks[1].offset + blocks[1].packed / 2] ^= 0x5a;
+            bool thrown = false;
+            try {
+                ::block_compression::decompress(packed.data(), blocks, unpacked.data());
+            } catch (std::runtime_error&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+
+            thrown = false;
+            std::size_t before = 0;
+            try {
+                ::block_compression::block_reader reader{packed.data(), blocks, 2};
+                char c;
+                while (reader.read(&c, 1) > 0)
+                    before++;
+            } catch (std::runtime_error&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+            check_eq(unit, t, before, blocks[1].raw_offset);
+
+            thrown = false;
+            try {
+                ::block_compression::index(packed.data(), packed.size() - 1);
+            } catch (std::runtime_error&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+        }
+    }
+
+    namespace checkpoint {
+        /*!
+        \brief Check checkpoint image serialization and the reorder queue visitor
+        \param unit Test unit
+        */
+        void image_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            ::period_queues pq{4};
+            pq[period_index{6, 7, true}].queue.emplace_back(700, 1);
+            pq[period_index{6, 7, true}].queue.emplace_back(710, 2);
+            pq.registerStart(period_index{5, 6, true}, 600);
+            ::checkpoint::image img;
+            img.sequence = 9;
+            img.workers = 2;
+            img.bins = 3;
+            img.save_interval = 100;
+            img.chip.resize(2);
+            auto& state = img.chip[1];
+            state.predictor = ::period_predictor{100, 100};
+            state.predictor.set_window(4);
+            state.predictor.prediction_update(201);
+            state.tdcs = 12;
+            state.save_point = 102;
+            pq.visit([&state](period_type period, const period_queue_element& el) {
+                state.queues.push_back({period, el.start, el.queue.size(), el.start_seen});
+                state.events.insert(std::end(state.events), std::begin(el.queue), std::end(el.queue));
+            });
+            check_eq(unit, t, state.queues.size(), (size_t)2);
+            check_eq(unit, t, state.events.size(), (size_t)2);
+            state.histograms.push_back({102, 1, 4, 5, 6});
+            state.bins = {7, 8, 9};
+
+            std::vector<char> data;
+            ::checkpoint::serialize(img, data);
+            ::checkpoint::image res;
+            ::checkpoint::parse(data.data(), data.size(), res);
+            check_eq(unit, t, res.sequence, (uint64_t)9);
+            check_eq(unit, t, res.workers, 2u);
+            check_eq(unit, t, res.bins, (uint64_t)3);
+            check_eq(unit, t, res.save_interval, (int64_t)100);
+            check_eq(unit, t, res.chip.size(), (size_t)2);
+            check_eq(unit, t, res.chip[0].queues.empty() && res.chip[0].histograms.empty(), true);
+            const auto& r = res.chip[1];
+            check_eq(unit, t, r.tdcs, (uint64_t)12);
+            check_eq(unit, t, r.save_point, (period_type)102);
+            check_eq(unit, t, r.predictor.window(), 4u);
+            check_eq(unit, t, r.predictor.reference_start(), state.predictor.reference_start());
+            check_eq(unit, t, r.predictor.interval_prediction(), state.predictor.interval_prediction());
+            check_eq(unit, t, r.predictor.period_correction(), state.predictor.period_correction());
+            for (unsigned i=0; i<2; i++) {
+                const auto& q = r.queues[i];
+                check_eq(unit, t, q.period, state.queues[i].period);
+                check_eq(unit, t, q.start_seen != 0, q.period == 6);
+                check_eq(unit, t, q.start, (q.period == 6) ? (int64_t)600 : (int64_t)0);
+                check_eq(unit, t, q.events, (q.period == 7) ? (uint64_t)2 : (uint64_t)0);
+            }
+            check_eq(unit, t, r.events[1].toa, (int64_t)710);
+            check_eq(unit, t, r.events[1].event, (uint64_t)2);
+            check_eq(unit, t, r.histograms.size(), (size_t)1);
+            check_eq(unit, t, r.histograms[0].worker, 1u);
+            check_eq(unit, t, r.histograms[0].total, (int32_t)6);
+            check_eq(unit, t, r.bins == state.bins, true);
+
+            for (const size_t size : { data.size() - 1, sizeof(::checkpoint::image_header) + 8 }) {
+                bool thrown = false;
+                try {
+                    ::checkpoint::parse(data.data(), size, res);
+                } catch (std::runtime_error&) {
+                    thrown = true;
+                }
+                check_eq(unit, t, thrown, true);
+            }
+        }
+
+        /*!
+        \brief Check checkpoint file slots, corruption fallback, completion and the checkpoint store
+        \param unit Test unit
+        */
+        void file_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            char name[] = "/tmp/tpx3_checkpoint_test_XXXXXX";
+            const int fd = mkstemp(name);
+            check_eq(unit, t, fd >= 0, true);
+            if (fd < 0)
+                return;
+            ::close(fd);
+            const std::string path{name};
+
+            ::checkpoint::image img;
+            img.bins = 2;
+            img.chip.resize(1);
+            img.chip[0].histograms.push_back({4, 0, 0, 0, 1});
+            img.chip[0].bins = {1, 2};
+            std::vector<char> first, second;
+            img.sequence = 1;
+            ::checkpoint::serialize(img, first);
+            img.sequence = 2;
+            ::checkpoint::serialize(img, second);
+            {
+                ::checkpoint::file out{path};
+                check_eq(unit, t, out.sequence(), (uint64_t)0);
+                out.write(first, 1);
+                out.write(second, 2);
+                check_eq(unit, t, out.sequence(), (uint64_t)2);
+            }
+            check_eq(unit, t, ::checkpoint::load(path).sequence, (uint64_t)2);
+            {
+                // corrupt the newest image, it went into the second slot behind the first one
+                std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+                f.seekp(::checkpoint::page_size + ((first.size() * 3 / 2 + ::checkpoint::page_size - 1) & ~(::checkpoint::page_size - 1)));
+                f.put('\x55');
+            }
+            check_eq(unit, t, ::checkpoint::load(path).sequence, (uint64_t)1);
+            {
+                ::checkpoint::file out{path};
+                check_eq(unit, t, out.sequence(), (uint64_t)2);
+                out.write(second, 3);  // overwrites the older first slot
+                out.complete();
+            }
+            bool thrown = false;
+            try {
+                ::checkpoint::load(path);
+            } catch (std::runtime_error&) {
+                thrown = true;
+            }
+            check_eq(unit, t, thrown, true);
+
+            std::remove(name);
+        }
+
+        /*!
+        \brief Check that the checkpoint store cuts all chips at the same period, and abandons missed cuts
+        \param unit Test unit
+        */
+        void store_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            char name[] = "/tmp/tpx3_checkpoint_store_XXXXXX";
+            const int fd = mkstemp(name);
+            check_eq(unit, t, fd >= 0, true);
+            if (fd < 0)
+                return;
+            ::close(fd);
+            const std::string path{name};
+            ::checkpoint::image layout;
+            layout.bins = 2;
+            layout.chip.resize(2);
+
+            uint64_t written = 0;
+            {
+                // chips advance at different speeds
+                ::checkpoint::store ckpt{path, ::checkpoint::image{layout}, std::chrono::milliseconds{1}};
+                std::vector<std::thread> chip;
+                std::atomic<bool> same_cut = true;
+                for (unsigned c=0; c<2; c++) {
+                    chip.emplace_back([&ckpt, &same_cut, c]() {
+                        for (period_type p=1; ckpt.written() < 3; p++) {
+                            if (ckpt.pending(c, p)) {
+                                auto& state = ckpt.state(c);
+                                state.clear();
+                                state.tdcs = p;
+                                state.save_point = p / 8;
+                                ckpt.captured(c);
+                            }
+                            for (unsigned i=0; i<=4*c; i++)
+                                std::this_thread::yield();
+                        }
+                    });
+                }
+                for (auto& thread : chip)
+                    thread.join();
+                ckpt.finish(false);
+                written = ckpt.written();
+                check_eq(unit, t, ckpt.writeError(), std::string{});
+                check_eq(unit, t, ckpt.abandoned(), (uint64_t)0);
+                std::ostringstream out;
+                ckpt.writeMetrics(out);
+                check_eq(unit, t, out.str().find("tpx3_checkpoints_total " + std::to_string(written) + "\n") != std::string::npos, true);
+            }
+            auto res = ::checkpoint::load(path);
+            check_eq(unit, t, written >= 3, true);
+            check_eq(unit, t, res.sequence, written);
+            check_eq(unit, t, res.chip.size(), (size_t)2);
+            check_eq(unit, t, res.chip[0].tdcs, res.chip[1].tdcs);
+
+            {
+                // chip 1 is past the cut of the first request, chip states of the second one have different save points
+                ::checkpoint::store ckpt{path, ::checkpoint::image{layout}, std::chrono::milliseconds{1}};
+                for (unsigned round=0; round<3; round++) {
+                    period_type p = 1;
+                    while (! ckpt.pending(0, p))
+                        p++;
+                    check_eq(unit, t, ckpt.pending(1, (round == 0) ? p + 1 : p), round != 0);
+                    for (unsigned c=0; c<2; c++) {
+                        if ((round == 0) && (c == 1))
+                            continue;
+                        auto& state = ckpt.state(c);
+                        state.clear();
+                        state.tdcs = p;
+                        state.save_point = (round == 1) ? c : 0;
+                        ckpt.captured(c);
+                    }
+                    while (ckpt.written() + ckpt.abandoned() <= round)
+                        std::this_thread::yield();
+                }
+                ckpt.finish(false);
+                check_eq(unit, t, ckpt.abandoned(), (uint64_t)2);
+                check_eq(unit, t, ckpt.written(), (uint64_t)1);
+            }
+            res = ::checkpoint::load(path);
+            check_eq(unit, t, res.sequence, written + 3);
+            std::remove(name);
+        }
+    }
+
+    namespace latency_trace {
+        /*!
+        \brief Check latency histogram buckets and quantiles, and ring overwriting
+        \param unit Test unit
+        */
+        void histogram_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            using ::latency_trace::histogram;
+            for (const uint64_t v : { 0ul, 31ul, 32ul, 63ul, 64ul, 1000ul, 123456789ul, ~0ul }) {
+                const size_t i = histogram::index(v);
+                check_eq(unit, t, histogram::bucket_max(i) >= v, true);
+                check_eq(unit, t, (i == 0) || (histogram::bucket_max(i - 1) < v), true);
+                check_eq(unit, t, histogram::bucket_max(i) - v <= v / histogram::sub_count, true);
+            }
+            histogram h;
+            check_eq(unit, t, h.value_at(.5), (uint64_t)0);
+            for (uint64_t v=1; v<=1000; v++)
+                h.record(v * 1000);
+            check_eq(unit, t, h.count(), (uint64_t)1000);
+            check_eq(unit, t, h.min(), (uint64_t)1000);
+            check_eq(unit, t, h.max(), (uint64_t)1000000);
+            check_eq(unit, t, h.mean(), 500500.);
+            const uint64_t p50 = h.value_at(.5);
+            check_eq(unit, t, (p50 >= 500000) && (p50 <= 500000 + 500000 / histogram::sub_count), true);
+            const uint64_t p99 = h.value_at(.99);
+            check_eq(unit, t, (p99 >= 990000) && (p99 <= 990000 + 990000 / histogram::sub_count), true);
+            check_eq(unit, t, h.value_at(1.), (uint64_t)1000000);
+
+            ::latency_trace::ring r{3};
+            check_eq(unit, t, r.capacity(), (size_t)4);
+            for (uint64_t i=1; i<=6; i++)
+                r.stamp(::latency_trace::tdc, i, 0, i);
+            check_eq(unit, t, r.size(), (size_t)4);
+            check_eq(unit, t, r.overwritten(), (uint64_t)2);
+            uint64_t expected = 3;
+            r.visit([&unit, &t, &expected](const ::latency_trace::entry& e) {
+                check_eq(unit, t, e.ns, expected);
+                check_eq(unit, t, e.period, (period_type)expected);
+                expected++;
+            });
+            check_eq(unit, t, expected, (uint64_t)7);
+        }
+
+        /*!
+        \brief Check merging of stamps across rings into output period latencies and the Chrome trace
+        \param unit Test unit
+        */
+        void tracer_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            using namespace ::latency_trace;
+            tracer trace{64};
+            trace.configure(2, 2);
+            const uint64_t base = now();
+            for (period_type p=10; p<13; p++) {
+                const uint64_t t0 = base + p * 1000000;
+                for (unsigned chip=0; chip<2; chip++) {
+                    trace.analyser(chip).stamp(received, p, chip, t0 + 100 * chip);
+                    trace.analyser(chip).stamp(first_event, p, chip, t0 + 200 + 100 * chip);
+                    trace.analyser(chip).stamp(tdc, p, chip, t0 + 1000 + chip);
+                    for (unsigned worker=0; worker<2; worker++)
+                        trace.analyser(chip).stamp(returned, p, 2 * chip + worker, t0 + 2000 + 500 * chip + worker);
+                }
+                if (p == 12)
+                    continue;   // not written yet
+                trace.writer().stamp(aggregated, p, 0, t0 + 5000);
+                trace.writer().stamp(written, p, 0, t0 + 9000);
+            }
+            trace.worker(3).stamp(slot_wait, 11, 3, base + 100);
+            trace.worker(3).stamp(slot_wait_end, 11, 3, base + 400);
+
+            const latencies res = trace.analyse();
+            check_eq(unit, t, res.periods, (uint64_t)2);
+            check_eq(unit, t, res.overwritten, (uint64_t)0);
+            check_eq(unit, t, res.since_received[first_event].max(), (uint64_t)200);
+            check_eq(unit, t, res.since_received[tdc].max(), (uint64_t)1001);
+            check_eq(unit, t, res.since_received[returned].max(), (uint64_t)2501);
+            check_eq(unit, t, res.since_received[aggregated].count(), (uint64_t)2);
+            check_eq(unit, t, res.since_received[written].min(), (uint64_t)9000);
+            check_eq(unit, t, res.slot_wait.count(), (uint64_t)1);
+            check_eq(unit, t, res.slot_wait.max(), (uint64_t)300);
+
+            std::ostringstream summary;
+            trace.report(summary);
+            check_eq(unit, t, summary.str().find("2 output periods") != std::string::npos, true);
+            check_eq(unit, t, summary.str().find("received -> written: 2, p50 9us") != std::string::npos, true);
+
+            std::ostringstream chrome;
+            trace.write_chrome(chrome);
+            const std::string json = chrome.str();
+            check_eq(unit, t, json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", 0), (size_t)0);
+            check_eq(unit, t, json.substr(json.size() - 5), std::string{"}\n]}\n"});
+            check_eq(unit, t, json.find("\"args\":{\"name\":\"histogram 3\"}") != std::string::npos, true);
+            check_eq(unit, t, json.find("{\"name\":\"slot wait\",\"ph\":\"B\",\"pid\":1,\"tid\":5,") != std::string::npos, true);
+            check_eq(unit, t, json.find("\"ph\":\"b\",\"id\":11,") != std::string::npos, true);
+            check_eq(unit, t, json.find("\"ph\":\"b\",\"id\":12,") == std::string::npos, true);
+        }
+    }
+
+    /*! Resync mode chunk scan unit tests */
+    namespace chunk_scan {
+        /*!
+        \brief Feed a stream with garbage and a truncated chunk through the slab reader scan and the analyser discard path
+        \param unit Test unit
+        */
+        void resync_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            namespace gen = ::stream_generator;
+            constexpr unsigned nchips = 2;
+            constexpr unsigned ntoa = 10;
+            constexpr size_t chunk_words = 3 + ntoa;    // header, packet id, TDC, hits
+            unsigned t = 0;
+
+            uint64_t header[2] = { gen::chunk_header(8 + 8 * (1 + ntoa), 1), gen::pkcount(3) };
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 2>(header, nchips)), true);
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 2>(header, 1)), false);   // chip number
+            header[0] = gen::chunk_header(8 * ntoa + 4, 1);
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 2>(header, nchips)), false);   // size
+            header[0] = gen::chunk_header(0, 1);
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 2>(header, nchips)), false);   // no room for packet id
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 1>(header, nchips)), true);
+            header[0] = gen::chunk_header(8 + 8 * ntoa, 1);
+            header[1] = gen::tdc(100l);
+            check_eq(unit, t, (::chunk_scan::plausible_header<Decode, 2>(header, nchips)), false);   // packet id
+
+            // 12 chunks: 4 valid, garbage with a fake header, 2 valid, truncated by 3 hits, swallowed, 4 valid
+            const auto valid = gen::generate_stream(nchips, 1000, 6, 50, ntoa);
+            const auto chunk = [&valid](size_t i) { return std::begin(valid) + i * chunk_words; };
+            std::vector<uint64_t> stream(chunk(0), chunk(4));
+            for (uint64_t w : {0x1234567812345678UL, gen::chunk_header(64, 7), gen::pkcount(1), 0UL, ~0UL})
+                stream.push_back(w);
+            stream.insert(std::end(stream), chunk(4), chunk(7) - 3);
+            stream.insert(std::end(stream), chunk(7), std::end(valid));
+
+            // slab reader framing and analyser classification, like DataHandler::readSlabs and analyseData
+            const char* data = reinterpret_cast<const char*>(stream.data());
+            const size_t size = stream.size() * sizeof(uint64_t);
+            size_t pos = 0, skipped = 0, dropped = 0, hits = 0, tdcs = 0, chunks = 0;
+            unsigned resyncs = 0;
+            bool scanning = false;
+            event_columns columns;
+            while (pos + 2 * sizeof(uint64_t) <= size) {
+                const size_t next = ::chunk_scan::next_header<Decode, 2>(data, pos, size, nchips);
+                if (next != pos) {
+                    resyncs += ! scanning;
+                    scanning = true;
+                    skipped += next - pos;
+                    pos = next;
+                    continue;
+                }
+                scanning = false;
+                const size_t chunk_size = Decode::getBits(stream[pos / 8], 63, 48);
+                if (pos + 8 + chunk_size > size)
+                    break;
+                const size_t data_size = chunk_size - 8;
+                Decode::classify(&stream[pos / 8 + 2], data_size / 8, columns);
+                hits += columns.num_hits;
+                tdcs += columns.num_tdc;
+                dropped += ::chunk_scan::truncated_bytes(columns, data_size);
+                chunks++;
+                pos += 8 + chunk_size;
+            }
+            check_eq(unit, t, pos, size);
+            check_eq(unit, t, chunks, (size_t)11);
+            check_eq(unit, t, resyncs, 2u);
+            check_eq(unit, t, skipped, (size_t)(5 + chunk_words - 3) * 8);
+            check_eq(unit, t, dropped, (size_t)3 * 8);
+            check_eq(unit, t, hits, (size_t)(12 * ntoa - 3 - ntoa));
+            check_eq(unit, t, tdcs, (size_t)11);
+
+            event_columns complete;
+            Decode::classify(&valid[2], chunk_words - 2, complete);
+            check_eq(unit, t, ::chunk_scan::truncated_bytes(complete, (chunk_words - 2) * 8), (size_t)0);
+        }
+    }
+
+    /*! Parallel raw stream chip ownership unit tests */
+    namespace chip_ownership {
+        /*!
+        \brief Let readers consume raw streams, keep the chunks of owned chips
+        \param streams  Per reader raw stream words
+        \param owners   Chip ownership
+        \param nchips   Number of chips
+        \return Per chip kept raw stream words, per reader number of skipped chunks appended
+        */
+        std::vector<std::vector<uint64_t>> consume(const std::vector<std::vector<uint64_t>>& streams, ::chip_ownership& owners, unsigned nchips)
+        {
+            std::vector<std::vector<uint64_t>> kept(nchips + streams.size());
+            std::vector<std::thread> reader;
+            for (unsigned r=0; r<streams.size(); r++) {
+                reader.emplace_back([&, r]() {
+                    const auto& stream = streams[r];
+                    std::vector<std::vector<uint64_t>> own(nchips);
+                    uint64_t skipped = 0;
+                    for (size_t pos=0; pos<stream.size();) {
+                        const unsigned chip = AsiRawStreamDecoder::getBits(stream[pos], 39, 32);
+                        const size_t end = pos + 1 + AsiRawStreamDecoder::getBits(stream[pos], 63, 48) / 8;
+                        if (owners.claim(r, chip))
+                            own[chip].insert(std::end(own[chip]), &stream[pos], &stream[end]);
+                        else
+                            skipped++;
+                        pos = end;
+                    }
+                    for (unsigned c=0; c<nchips; c++)
+                        if (owners.reader(c) == (int)r)
+                            kept[c] = std::move(own[c]);
+                    kept[nchips + r].push_back(skipped);
+                });
+            }
+            for (auto& thread : reader)
+                thread.join();
+            return kept;
+        }
+
+        /*!
+        \brief Check chip claims, chips distributed modulo the number of readers, and duplicated full streams
+        \param unit Test unit
+        */
+        void claim_test(const test_unit& unit)
+        {
+            unsigned t = 0;
+            {
+                ::chip_ownership owners{2};
+                check_eq(unit, t, owners.reader(0), -1);
+                check_eq(unit, t, owners.claim(1, 0), true);
+                check_eq(unit, t, owners.claim(0, 0), false);
+                check_eq(unit, t, owners.claim(1, 0), true);
+                check_eq(unit, t, owners.claim(0, 1), true);
+                check_eq(unit, t, owners.claim(1, 1), false);
+                check_eq(unit, t, owners.reader(0), 1);
+                check_eq(unit, t, owners.reader(1), 0);
+            }
+
+            constexpr unsigned nchips = 4;
+            constexpr unsigned nreaders = 3;
+            const auto full = ::stream_generator::generate_stream(nchips, 1000, 200);
+            std::vector<std::vector<uint64_t>> per_chip(nchips);
+            for (size_t pos=0; pos<full.size();) {
+                const unsigned chip = AsiRawStreamDecoder::getBits(full[pos], 39, 32);
+                const size_t end = pos + 1 + AsiRawStreamDecoder::getBits(full[pos], 63, 48) / 8;
+                per_chip[chip].insert(std::end(per_chip[chip]), &full[pos], &full[end]);
+                pos = end;
+            }
+
+            {   // chip c on stream c % nreaders
+                std::vector<std::vector<uint64_t>> streams(nreaders);
+                for (size_t pos=0; pos<full.size();) {
+                    const unsigned chip = AsiRawStreamDecoder::getBits(full[pos], 39, 32);
+                    const size_t end = pos + 1 + AsiRawStreamDecoder::getBits(full[pos], 63, 48) / 8;
+                    streams[chip % nreaders].insert(std::end(streams[chip % nreaders]), &full[pos], &full[end]);
+                    pos = end;
+                }
+                ::chip_ownership owners{nchips};
+                const auto kept = consume(streams, owners, nchips);
+                bool ok = true;
+                for (unsigned c=0; c<nchips; c++)
+                    ok = ok && (owners.reader(c) == (int)(c % nreaders)) && (kept[c] == per_chip[c]);
+                check_eq(unit, t, ok, true);
+                for (unsigned r=0; r<nreaders; r++)
+                    check_eq(unit, t, kept[nchips + r][0], (uint64_t)0);
+            }
+
+            for (unsigned round=0; round<20; round++) {  // full stream duplicated to every reader
+                const std::vector<std::vector<uint64_t>> streams(nreaders, full);
+                ::chip_ownership owners{nchips};
+                const auto kept = consume(streams, owners, nchips);
+                bool ok = true;
+                uint64_t skipped = 0;
+                for (unsigned c=0; c<nchips; c++)
+                    ok = ok && (owners.reader(c) >= 0) && (kept[c] == per_chip[c]);
+                for (unsigned r=0; r<nreaders; r++)
+                    skipped += kept[nchips + r][0];
+                check_eq(unit, t, ok, true);
+                check_eq(unit, t, skipped, (uint64_t)((nreaders - 1) * nchips * 200));
+            }
+        }
+    }
+
+    namespace event_kernel {
+        /*!
+        \brief Histogram with the members used by the event kernels
+        */
+        struct histogram final {
+            std::vector<int> TDSpectra;     //!< Bins indexed by [time_point * npoints + energy_point]
+            int BeforeRoi = 0;              //!< Number of events before the ROI
+            int AfterRoi = 0;               //!< Number of events after the ROI
+            int Total = 0;                  //!< Number of events
+
+            /*!
+            \brief Compare histograms
+            \param other Other histogram
+            \return True for identical bins and counters
+            */
+            bool operator==(const histogram& other) const
+            {
+                return (TDSpectra == other.TDSpectra) && (BeforeRoi == other.BeforeRoi) && (AfterRoi == other.AfterRoi) && (Total == other.Total);
+            }
+        };
+
+        /*!
+        \brief Test event
+        */
+        struct event final {
+            unsigned chip;                  //!< Chip number
+            int64_t reltoa;                 //!< TOA relative to the period start
+            uint64_t hit;                   //!< Packed hit
+        };
+
+        /*!
+        \brief Histogram events with one kernel specialization
+        \param table    Energy point table
+        \param bins     Binning parameters
+        \param nbins    Number of time bins
+        \param events   Events
+        \return Histogram
+        */
+        template<bool TOAMode, bool SingleEp, bool Pow2Step>
+        histogram run(const EpTable& table, const ::event_kernel::binning& bins, unsigned nbins, const std::vector<event>& events)
+        {
+            histogram h;
+            h.TDSpectra.resize(nbins * bins.npoints);
+            for (const auto& e : events)
+                ::event_kernel::process<TOAMode, SingleEp, Pow2Step>(h, table, bins, e.chip, e.reltoa, e.hit);
+            return h;
+        }
+
+        /*!
+        \brief Compare the specialized kernels with the generic kernel of the same histogramming mode
+        \param unit     Test unit
+        \param t        Test number
+        \param table    Energy point table
+        \param bins     Binning parameters
+        \param nbins    Number of time bins
+        \param pow2     The bin width is a power of two
+        \param events   Events
+        */
+        template<bool TOAMode>
+        void compare(const test_unit& unit, unsigned& t, const EpTable& table, const ::event_kernel::binning& bins, unsigned nbins, bool pow2, const std::vector<event>& events)
+        {
+            const histogram generic = run<TOAMode, false, false>(table, bins, nbins, events);
+            check_eq(unit, t, generic.Total, (int)events.size());
+            check_eq(unit, t, generic.BeforeRoi + generic.AfterRoi < generic.Total, true);
+            check_eq(unit, t, std::count(std::begin(generic.TDSpectra), std::end(generic.TDSpectra), 0) < (long)generic.TDSpectra.size(), true);
+            if (pow2)
+                check_eq(unit, t, (run<TOAMode, false, true>(table, bins, nbins, events) == generic), true);
+            if (table.single_only()) {
+                check_eq(unit, t, (run<TOAMode, true, false>(table, bins, nbins, events) == generic), true);
+                if (pow2)
+                    check_eq(unit, t, (run<TOAMode, true, true>(table, bins, nbins, events) == generic), true);
+            }
+        }
+
+        /*!
+        \brief Run every kernel specialization on the same events as the generic kernel
+        \param unit Test unit
+        */
+        void specializations_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            constexpr unsigned nchips = 2;
+            constexpr unsigned npoints = 4;
+            constexpr unsigned nbins = 50;
+            unsigned t = 0;
+
+            PixelIndexToEp ep;
+            ep.chip.resize(nchips);
+            for (auto& chip : ep.chip)
+                chip.flat_pixel.resize(EpTable::pixels_per_chip);
+            ep.npoints = npoints;
+            for (unsigned chip=0; chip<nchips; chip++)
+                for (unsigned pixel=0; pixel<EpTable::pixels_per_chip; pixel+=3)    // others unmapped
+                    ep.at(PixelIndex::from(chip, pixel)).part = {{(pixel / 3 + chip) % npoints, 1.f}};
+            EpTable single;
+            single.build(ep);
+            for (unsigned pixel=1; pixel<EpTable::pixels_per_chip; pixel+=7)
+                ep.at(PixelIndex::from(1, pixel)).part = {{pixel % npoints, .5f}, {(pixel + 1) % npoints, 2.f}};
+            EpTable multi;
+            multi.build(ep);
+            check_eq(unit, t, single.single_only(), true);
+            check_eq(unit, t, multi.single_only(), false);
+
+            // TOA and TOT around and within both ROIs, TOT beyond the TOT ROI
+            std::vector<event> events;
+            uint64_t x = 0x9e3779b97f4a7c15UL;
+            auto next = [&x]() { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return x; };
+            for (unsigned i=0; i<20000; i++) {
+                const unsigned chip = next() % nchips;
+                const unsigned pixel = next() % EpTable::pixels_per_chip;
+                const uint64_t tot = (i % 97 == 0) ? ::event_kernel::tot_roi_end + next() % 100 : next() % 800;
+                events.push_back({chip, (int64_t)(next() % 800), Decode::packHit(tot, pixel)});
+            }
+
+            for (const uint64_t step : {1UL, 8UL, 6UL, 5UL}) {
+                const ::event_kernel::binning bins{100, step, nbins, npoints};
+                const bool pow2 = (step & (step - 1)) == 0;
+                check_eq(unit, t, bins.end, 100 + step * nbins);
+                for (const EpTable* table : {&single, &multi}) {
+                    compare<true>(unit, t, *table, bins, nbins, pow2, events);
+                    compare<false>(unit, t, *table, bins, nbins, pow2, events);
+                }
+            }
+        }
+    }
+
+    namespace event_batches {
+        /*!
+        \brief Histogram events with several workers per chip through batch_dispatcher and compare the per period aggregates with the single worker path
+        \param unit Test unit
+        */
+        void workers_test(const test_unit& unit)
+        {
+            using Decode = AsiRawStreamDecoder;
+            using histogram = event_kernel::histogram;
+            constexpr unsigned nchips = 2;
+            constexpr unsigned npoints = 4;
+            constexpr unsigned nbins = 50;
+            constexpr unsigned nperiods = 12;
+            constexpr unsigned save_interval = 3;
+            unsigned t = 0;
+
+            PixelIndexToEp ep;
+            ep.chip.resize(nchips);
+            for (auto& chip : ep.chip)
+                chip.flat_pixel.resize(EpTable::pixels_per_chip);
+            ep.npoints = npoints;
+            for (unsigned chip=0; chip<nchips; chip++)
+                for (unsigned pixel=0; pixel<EpTable::pixels_per_chip; pixel++)
+                    ep.at(PixelIndex::from(chip, pixel)).part = {{pixel % npoints, 1.f}};
+            for (unsigned pixel=1; pixel<EpTable::pixels_per_chip; pixel+=5)
+                ep.at(PixelIndex::from(0, pixel)).part = {{pixel % npoints, 1.f}, {(pixel + 1) % npoints, 2.f}};
+            EpTable table;
+            table.build(ep);
+            const ::event_kernel::binning bins{100, 8, nbins, npoints};
+            auto empty = [&]() { histogram h; h.TDSpectra.resize(nbins * npoints); return h; };
+
+            // per chip events of every period, and the single worker histograms
+            std::vector<std::vector<std::vector<batch_event>>> events(nchips, std::vector<std::vector<batch_event>>(nperiods));
+            std::vector<std::vector<histogram>> expected(nchips, std::vector<histogram>(nperiods, empty()));
+            uint64_t x = 0x2545f4914f6cdd1dUL;
+            auto next = [&x]() { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return x; };
+            for (unsigned chip=0; chip<nchips; chip++) {
+                for (unsigned period=0; period<nperiods; period++) {
+                    const unsigned n = 500 + next() % 1000;
+                    for (unsigned i=0; i<n; i++) {
+                        const batch_event ev{period, (int64_t)(next() % 600), Decode::packHit(1 + next() % 200, next() % EpTable::pixels_per_chip)};
+                        events[chip][period].push_back(ev);
+                        ::event_kernel::process<true, false, true>(expected[chip][period], table, bins, chip, ev.relative_toaclk, ev.event);
+                    }
+                }
+            }
+
+            for (const unsigned workers : {2u, 3u, 4u}) {
+                std::vector<std::unique_ptr<::batch_dispatcher>> dispatcher;
+                std::vector<std::vector<histogram>> partial(nchips * workers, std::vector<histogram>(nperiods, empty()));
+                std::vector<std::thread> worker;
+                for (unsigned chip=0; chip<nchips; chip++) {
+                    dispatcher.emplace_back(new ::batch_dispatcher{workers, 2, 64});
+                    for (unsigned w=0; w<workers; w++) {
+                        worker.emplace_back([&, chip, w]() {
+                            auto& channel = dispatcher[chip]->worker(w);
+                            auto& data = partial[chip * workers + w];
+                            while (auto batch = channel.get_full()) {
+                                for (const auto& ev : batch->event)
+                                    ::event_kernel::process<true, false, true>(data[ev.period], table, bins, chip, ev.relative_toaclk, ev.event);
+                                channel.put_empty(std::move(batch));
+                            }
+                        });
+                    }
+                }
+
+                // drain at save points like the analyser, then sum up the worker histograms of the saved periods
+                bool identical = true;
+                bool spread = true;
+                for (unsigned period=0; period<nperiods; period++) {
+                    for (unsigned chip=0; chip<nchips; chip++) {
+                        for (const auto& ev : events[chip][period])
+                            dispatcher[chip]->add(ev);
+                        if ((period + 1) % save_interval != 0)
+                            continue;
+                        dispatcher[chip]->drain();
+                        for (unsigned p=period+1-save_interval; p<=period; p++) {
+                            histogram sum = empty();
+                            std::vector<int*> src;
+                            for (unsigned w=0; w<workers; w++) {
+                                auto& h = partial[chip * workers + w][p];
+                                spread = spread && (h.Total > 0);
+                                src.push_back(h.TDSpectra.data());
+                                sum.BeforeRoi += h.BeforeRoi;
+                                sum.AfterRoi += h.AfterRoi;
+                                sum.Total += h.Total;
+                            }
+                            ::histogram_reduction::sum_and_clear(sum.TDSpectra.data(), src.data(), src.size(), 0, sum.TDSpectra.size());
+                            identical = identical && (sum == expected[chip][p]);
+                        }
+                    }
+                }
+                for (auto& d : dispatcher)
+                    d->finish();
+                for (auto& w : worker)
+                    w.join();
+                check_eq(unit, t, spread, true);
+                check_eq(unit, t, identical, true);
+            }
         }
     }
 
@@ -323,11 +2273,36 @@ namespace {
             "prediction_update, start_update",
             period_predictor::predictor_update_test
         });
+        tests.insert({
+            "period_predictor::predictor_reseed",
+            "reseed",
+            period_predictor::predictor_reseed_test
+        });
+        tests.insert({
+            "period_predictor::predictor_fit",
+            "set_window, linear fit prediction_update, residual, drift",
+            period_predictor::predictor_fit_test
+        });
         tests.insert({
             "event_reorder_queue::sorted",
             "iterator sequence",
             event_reorder_queue::sorted_test
         });
+        tests.insert({
+            "io_buffers::spsc_ring",
+            "try_push, try_pop, size, capacity",
+            io_buffers::spsc_ring_test
+        });
+        tests.insert({
+            "io_buffers::buffer_ring",
+            "get_empty_buffer, put_nonempty_buffer, get_nonempty_buffer, put_empty_buffer, finish_reading",
+            io_buffers::buffer_ring_test
+        });
+        tests.insert({
+            "io_buffers::pool_allocations",
+            "io_buffer_pool get_empty_buffer, put_nonempty_buffer, get_nonempty_buffer, put_empty_buffer without heap allocations",
+            io_buffers::pool_allocations_test
+        });
         tests.insert({
             "period_queues::period_index_for",
             "period_index_for",
@@ -343,6 +2318,141 @@ namespace {
             "registerStart, oldest, erase",
             period_queues::purge_test
         });
+        tests.insert({
+            "period_queues::ring",
+            "slot reuse, grow on collision",
+            period_queues::ring_test
+        });
+        tests.insert({
+            "period_queues::period_indices_for",
+            "period_indices_for, refined_index with period_block",
+            period_queues::period_indices_for_test
+        });
+        tests.insert({
+            "period_queues::allocations",
+            "reserve, slot reuse without heap allocations",
+            period_queues::allocations_test
+        });
+        tests.insert({
+            "decoder::classify",
+            "classify, classifyScalar, getFlatPixel",
+            decoder::classify_test
+        });
+        tests.insert({
+            "energy_points::ep_table",
+            "build, position, single_only",
+            energy_points::ep_table_test
+        });
+        tests.insert({
+            "energy_points::cache",
+            "parse_points, save, load, stale cache detection",
+            energy_points::cache_test
+        });
+        tests.insert({
+            "event_batches::batch_channel",
+            "get_empty, dispatch, drain, get_full, put_empty, finish",
+            event_batches::batch_channel_test
+        });
+        tests.insert({
+            "event_batches::workers",
+            "per period histograms of 2, 3 and 4 workers per chip through batch_dispatcher match the single worker path",
+            event_batches::workers_test
+        });
+        tests.insert({
+            "histogram_reduction::pool",
+            "helpers_for, run, sum_and_clear, part_range",
+            histogram_reduction::pool_test
+        });
+        tests.insert({
+            "stream_generator::generate",
+            "tdc, toa, generate_stream",
+            stream_generator::generate_test
+        });
+        tests.insert({
+            "stream_generator::model",
+            "stream model settings, pixel addresses, packet ids, TDC grid and out of order hits",
+            stream_generator::model_test
+        });
+        tests.insert({
+            "logging::mpsc_ring",
+            "try_push, try_pop, capacity, concurrent producers",
+            logging::mpsc_ring_test
+        });
+        tests.insert({
+            "metrics::text",
+            "counter, describe, sample",
+            metrics::text_test
+        });
+        tests.insert({
+            "placement::cpu_list",
+            "parse, to_string, for_thread, current, pin",
+            placement::cpu_list_test
+        });
+        tests.insert({
+            "archive::tee",
+            "stream_archive put, finish, drop policy, slab references",
+            archive::tee_test
+        });
+        tests.insert({
+            "adaptive_wait::wait_point",
+            "await, notify, park timeout, ping-pong",
+            adaptive_wait::wait_point_test
+        });
+        tests.insert({
+            "block_compression::round_trip",
+            "compressor, index, decompress, block_reader, corruption",
+            block_compression::round_trip_test
+        });
+        tests.insert({
+            "sharding::merge",
+            "shard routing, relabel, parse_shard, EpTable::select, merger",
+            sharding::merge_test
+        });
+        tests.insert({
+            "preview::snapshot",
+            "live preview publish, read, json, concurrent consistency",
+            preview::snapshot_test
+        });
+        tests.insert({
+            "checkpoint::image",
+            "serialize, parse, truncation, period_queues visit",
+            checkpoint::image_test
+        });
+        tests.insert({
+            "checkpoint::file",
+            "image slots, corruption fallback, complete, load",
+            checkpoint::file_test
+        });
+        tests.insert({
+            "checkpoint::store",
+            "common cut period, missed cuts, save point mismatch",
+            checkpoint::store_test
+        });
+        tests.insert({
+            "latency_trace::histogram",
+            "buckets, quantiles, ring overwriting",
+            latency_trace::histogram_test
+        });
+        tests.insert({
+            "latency_trace::tracer",
+            "stamp merging, latencies, report, chrome trace",
+            latency_trace::tracer_test
+        });
+        tests.insert({
+            "chunk_scan::resync",
+            "plausible_header, next_header, truncated_bytes with garbage and a truncated chunk",
+            chunk_scan::resync_test
+        });
+        tests.insert({
+            "chip_ownership::claim",
+            "claim, reader, chips modulo readers, duplicated full streams",
+            chip_ownership::claim_test
+        });
+        tests.insert({
+            "event_kernel::specializations",
+            "single energy point and power of two step kernels match the generic kernel for toa and tot",
+            event_kernel::specializations_test
+        });
     }
 
     /*!
@@ -12,7 +12,18 @@ Test server code for replaying an ASI raw event stream
 #include <mutex>
 #include <thread>
 #include <cmath>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
 #include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServer.h>
@@ -27,6 +38,8 @@ Test server code for replaying an ASI raw event stream
 #include <Poco/URI.h>
 #include <Poco/FileStream.h>
 #include <Poco/StreamCopier.h>
+#include "block_compression.h"
+#include "stream_generator.h"
 
 using Poco::Net::HTTPServerResponse;
 using Poco::Net::HTTPServerRequest;
@@ -54,54 +67,483 @@ using Poco::StreamCopier;
 using Poco::RuntimeException;
 using Poco::DataFormatException;
 using Poco::InvalidArgumentException;
+using Poco::ReadFileException;
 using Poco::Util::UnknownOptionException;
 
 namespace {
     using namespace std::chrono_literals;
 
+    using wall_clock = std::chrono::steady_clock;  //!< Clock type for pacing
+
     std::map<std::string, std::function<void(HTTPServerRequest&, HTTPServerResponse&)>> path_handler; //!< Map HTTP from path to handler
     ServerSocket bind_to{SocketAddress{"localhost:8080"}}; //!< Server binding address
-    SocketAddress destination;                  //!< Destination address
+    std::vector<SocketAddress> destination;     //!< Destination addresses, chip c is sent to destination c % destination.size()
     OptionSet args;                             //!< Commandline arguments OptionSet
     bool stop_server = false;                   //!< Signal for stop server
     std::mutex stop_mutex;                      //!< Protection for stop signal
+    std::atomic<bool> stop_sending = false;     //!< Signal for sender threads to stop early
     std::condition_variable stop_condition;     //!< Condition variable for stop signal
-    bool sender_ready = false;                  //!< Sender thread ready signal
+    unsigned senders_ready = 0;                 //!< Number of connected sender threads
+    unsigned senders_running = 0;               //!< Number of sender threads still sending
     std::mutex ready_mutex;                     //!< Protection for sender ready signal
     std::condition_variable ready_condition;    //!< Condition variable for ready signal
-    std::thread data_sender;                    //!< Data sender thread
+    std::vector<std::thread> data_sender;       //!< Data sender threads, one per destination
+    std::mutex print_mutex;                     //!< Serialize report output of sender threads
     std::string file_name;                      //!< Raw data stream file name
+    bool generate = false;                      //!< Generate the raw data stream instead of reading it from a file
+    stream_generator::config model;             //!< Stream model for generating the raw data stream
     unsigned number_of_chips = 4;               //!< Default value for number of detector chips
 
+    double rate = .0;                           //!< Send rate limit per destination, 0 for unlimited
+    bool rate_in_hits = false;                  //!< Rate is in hits/s instead of MB/s
+    double ramp_step = .0;                      //!< Rate increase per ramp step
+    double ramp_interval = 10.;                 //!< Ramp step duration in seconds
+    unsigned loops = 1;                         //!< Number of passes over the input file, 0 for as many as the TOA clock range allows
+
+    constexpr uint64_t tpx_header = 861425748UL;    //!< 'TPX3' as uint64_t
+    constexpr size_t send_buffer_size = 256ul << 10;//!< Chunks are collected into send buffers of this size, must hold the biggest chunk
+
+    /*!
+    \brief Raw event data packet chunk within the input file
+    */
+    struct chunk_info final {
+        size_t offset;      //!< Byte offset of the chunk header within the raw stream
+        uint32_t size;      //!< Chunk size in bytes including the header word
+        uint32_t hits;      //!< Number of pixel hits in the chunk
+        unsigned chip;      //!< Chip number
+        bool packet_id;     //!< Chunk starts with a packet id word
+    };
+
+    /*!
+    \brief Sequential access to the chunks of the input file
+
+    Block compressed files (see block_compression.h) are decompressed block by block while the chunks are read.
+    */
+    class chunk_cursor final {
+        const char* data;               //!< Mapped file content
+        const size_t size;              //!< Raw stream size in bytes, uncompressed
+        std::unique_ptr<block_compression::block_reader> reader;    //!< Decompressing reader for compressed files, nullptr otherwise
+        std::vector<char> buffer;       //!< Chunk copy for compressed files
+        size_t pos = 0;                 //!< Offset of the next chunk within the raw stream
+
+        /*!
+        \brief Read decompressed bytes
+        \param out  Output buffer
+        \param n    Number of bytes
+        \throw DataFormatException if a block is corrupt
+        */
+        void fetch(char* out, size_t n)
+        {
+            try {
+                if (reader->read(out, n) == n)
+                    return;
+            } catch (std::runtime_error& ex) {
+                throw DataFormatException(ex.what());
+            }
+            throw DataFormatException("incomplete compressed input file");
+        }
+
+    public:
+        /*!
+        \brief Constructor
+        \param file_data    Mapped file content
+        \param raw_size     Raw stream size in bytes, uncompressed
+        \param blocks       Blocks of a compressed file, empty for uncompressed files
+        \param threads      Number of decompression threads for compressed files, 0 for all hardware threads
+        */
+        chunk_cursor(const char* file_data, size_t raw_size, const std::vector<block_compression::block_info>& blocks, unsigned threads)
+            : data{file_data}, size{raw_size}
+        {
+            if (! blocks.empty()) {
+                reader.reset(new block_compression::block_reader{data, blocks, threads});
+                buffer.resize(sizeof(uint64_t) + 0xffff);
+            }
+        }
+
+        /*!
+        \brief Offset of the next chunk
+        \return Byte offset of the next chunk header within the raw stream
+        */
+        size_t offset() const noexcept
+        {
+            return pos;
+        }
+
+        /*!
+        \brief Advance to the next chunk
+        \param chunk_size Chunk size in bytes including the header word
+        \return Chunk content, valid until the next call, nullptr at the end of the file
+        \throw DataFormatException if the file does not consist of complete raw event data packet chunks
+        */
+        const char* next(uint32_t& chunk_size)
+        {
+            if (pos >= size)
+                return nullptr;
+            if (pos + sizeof(uint64_t) > size)
+                throw DataFormatException("incomplete chunk header at end of input file");
+            const char* chunk = reader ? buffer.data() : &data[pos];
+            if (reader)
+                fetch(buffer.data(), sizeof(uint64_t));
+            uint64_t header;
+            std::memcpy(&header, chunk, sizeof(header));
+            if ((header & 0xffffffffUL) != tpx_header)
+                throw DataFormatException(std::string("chunk header expected at offset ") + std::to_string(pos));
+            chunk_size = sizeof(uint64_t) + (header >> 48);
+            if (pos + chunk_size > size)
+                throw DataFormatException("incomplete chunk at end of input file");
+            if (reader)
+                fetch(&buffer[sizeof(uint64_t)], chunk_size - sizeof(uint64_t));
+            pos += chunk_size;
+            return chunk;
+        }
+    };
+
+    /*!
+    \brief Memory mapped input file with chunk index
+
+    Block compressed files (see block_compression.h) are decompressed block by block,
+    while the index is built and again during every pass, see `chunk_cursor`.
+    */
+    struct input_file final {
+        const char* data = nullptr;     //!< Mapped file content
+        size_t size = 0;                //!< Raw stream size in bytes, uncompressed
+        size_t mapped_size = 0;         //!< Mapped file size in bytes
+        std::vector<block_compression::block_info> blocks;  //!< Blocks of a compressed file, empty for uncompressed files
+        std::vector<chunk_info> chunk;  //!< Chunks in file order
+        uint64_t max_packet_id = 0;     //!< Largest packet id found
+        int64_t last_time = -1;         //!< Latest TOA or TDC time stamp in clock ticks, -1 without events
+        int64_t pass_shift = 0;         //!< Time stamp shift between passes in clock ticks, a multiple of 16
+
+        /*!
+        \brief Map file and build the chunk index
+        \param path File path
+        \throw ReadFileException if the file cannot be mapped
+        \throw DataFormatException if the file does not consist of complete raw event data packet chunks
+        */
+        void open(const std::string& path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw ReadFileException(std::string("unable to open ") + path);
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                ::close(fd);
+                throw ReadFileException(std::string("unable to stat ") + path);
+            }
+            size = mapped_size = info.st_size;
+            void* mem = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            ::close(fd);
+            if (mem == MAP_FAILED)
+                throw ReadFileException(std::string("unable to map ") + path);
+            data = static_cast<const char*>(mem);
+
+            if (block_compression::is_compressed(data, size)) {
+                try {
+                    blocks = block_compression::index(data, size);
+                } catch (std::exception& ex) {
+                    throw DataFormatException(path + ": " + ex.what());
+                }
+                std::cout << path << ": " << size << " bytes compressed\n";
+                size = block_compression::raw_size(blocks);
+            }
+
+            int64_t first_time = std::numeric_limits<int64_t>::max();
+            int64_t first_tdc = std::numeric_limits<int64_t>::max();
+            int64_t last_tdc = -1;
+            std::vector<uint64_t> tdcs(256);    // number of TDCs per chip
+            chunk_cursor cursor = chunks(0);
+            for (;;) {
+                const size_t pos = cursor.offset();
+                uint32_t chunk_size;
+                const char* chunk_data = cursor.next(chunk_size);
+                if (chunk_data == nullptr)
+                    break;
+                uint64_t header;
+                std::memcpy(&header, chunk_data, sizeof(header));
+                chunk_info info{pos, chunk_size, 0, unsigned((header >> 32) & 0xff), false};
+                const size_t num_words = info.size / sizeof(uint64_t);
+                for (size_t i=1; i<num_words; i++) {
+                    uint64_t word;
+                    std::memcpy(&word, &chunk_data[i * sizeof(uint64_t)], sizeof(word));
+                    if ((i == 1) && ((word >> 56) == 0x50)) {
+                        info.packet_id = true;
+                        max_packet_id = std::max(max_packet_id, word & 0xffffffffffffUL);
+                    } else if ((word >> 60) == 0xb) {
+                        info.hits++;
+                        const int64_t clk = ((((word & 0xffffUL) << 14) + ((word >> 30) & 0x3fffUL)) << 4) - ((word >> 16) & 0xfUL);
+                        first_time = std::min(first_time, clk);
+                        last_time = std::max(last_time, clk);
+                    } else if ((word >> 60) == 0x6) {
+                        const int64_t clk = (((word >> 9) & 0x7ffffffffUL) << 1) | ((int64_t((word >> 5) & 0xfUL) - 1) / 6);
+                        first_tdc = std::min(first_tdc, clk);
+                        last_tdc = std::max(last_tdc, clk);
+                        tdcs[info.chip]++;
+                    }
+                }
+                chunk.push_back(info);
+            }
+
+            // the next pass starts one mean TDC interval after the last TDC, so the period grid continues
+            const uint64_t ntdc = *std::max_element(std::begin(tdcs), std::end(tdcs));
+            if (ntdc > 1)
+                pass_shift = (last_tdc - first_tdc) + (last_tdc - first_tdc) / (ntdc - 1);
+            else if (last_time >= 0)
+                pass_shift = last_time - first_time + 1;
+            pass_shift = (pass_shift + 15) & ~int64_t{15};
+            last_time = std::max(last_time, last_tdc);
+        }
+
+        /*!
+        \brief Number of passes within the TOA clock range
+        \return Largest number of passes before shifted time stamps exceed the 2^34 clock tick TOA range
+        */
+        uint64_t max_passes() const noexcept
+        {
+            if ((last_time < 0) || (pass_shift == 0))
+                return std::numeric_limits<unsigned>::max();
+            if (last_time >= stream_generator::config::max_time)
+                return 1;
+            return (stream_generator::config::max_time - 1 - last_time) / pass_shift + 1;
+        }
+
+        /*!
+        \brief Sequential chunk access
+        \param threads Number of decompression threads for compressed files, 0 for all hardware threads
+        \return Cursor at the first chunk
+        */
+        chunk_cursor chunks(unsigned threads) const
+        {
+            return chunk_cursor{data, size, blocks, threads};
+        }
+
+        /*!
+        \brief Destructor, unmaps the file
+        */
+        ~input_file()
+        {
+            if (data)
+                munmap(const_cast<char*>(data), mapped_size);
+        }
+    } input;    //!< Input file
+
+    /*!
+    \brief Send statistics of one sender thread over one ramp step or the whole run
+    */
+    struct send_stats final {
+        uint64_t bytes = 0;         //!< Bytes sent
+        uint64_t hits = 0;          //!< Hits sent
+        double blocked = .0;        //!< Seconds spent in blocking sends (back-pressure)
+        double paced = .0;          //!< Seconds spent waiting for the rate limit
+
+        /*!
+        \brief Print statistics
+        \param what    Report label
+        \param time    Elapsed wall clock time in seconds
+        \param target  Target rate, 0 for unlimited
+        */
+        void report(const std::string& what, double time, double target) const
+        {
+            std::lock_guard lock(print_mutex);
+            std::cout << what << ": " << std::fixed << std::setprecision(3) << time << "s, " << (bytes / time * 1e-6) << " MB/s, "
+                      << (hits / time) << " hits/s";
+            if (target > .0)
+                std::cout << " (target " << target << (rate_in_hits ? " hits/s" : " MB/s") << ')';
+            std::cout << ", blocked in send " << blocked << "s (" << (100. * blocked / time) << "%), paced " << paced << "s\n"
+                      << std::defaultfloat;
+        }
+
+        /*!
+        \brief Add other statistics
+        \param other Other statistics
+        */
+        void operator+=(const send_stats& other) noexcept
+        {
+            bytes += other.bytes;
+            hits += other.hits;
+            blocked += other.blocked;
+            paced += other.paced;
+        }
+    };
+
+    /*!
+    \brief Send all bytes of a buffer
+    \param con     Connected socket
+    \param buf     Byte buffer
+    \param size    Number of bytes
+    \param stats   Blocked time is added here
+    */
+    void send_all(StreamSocket& con, const char* buf, size_t size, send_stats& stats)
+    {
+        const auto t1 = wall_clock::now();
+        while (size > 0) {
+            const int sent = con.sendBytes(buf, (int)size);
+            if (sent <= 0)
+                throw RuntimeException("connection closed by receiver");
+            buf += sent;
+            size -= sent;
+        }
+        stats.blocked += std::chrono::duration<double>(wall_clock::now() - t1).count();
+    }
+
     /*!
     \brief Code for send data thread
+    Chunks of chips `index`, `index + destination.size()`, ... are sent to `destination[index]`
+    at the configured rate, ramping up every `ramp_interval` seconds by `ramp_step`.
+    In passes after the first one, packet ids and TOA/TDC time stamps are shifted so they keep increasing.
+    For a generated stream, the chunks are generated period by period by the sender thread,
+    and the passes continue the stream model.
+    \param index Destination index
     */
-    void send_data()
+    void send_data(unsigned index)
     {
+        const std::string name = std::string("sender ") + std::to_string(index);
         try {
-            std::cout << "send data thread started ...\n";
             {
-                StreamSocket con(destination);
-                SocketOutputStream output_stream(con);
-                FileInputStream data_file{file_name};
+                std::lock_guard lock(print_mutex);
+                std::cout << name << " started, destination " << destination[index].toString() << " ...\n";
+            }
+            {
+                StreamSocket con(destination[index]);
                 {
                     std::lock_guard lock(ready_mutex);
-                    sender_ready = true;
+                    senders_ready++;
                     ready_condition.notify_one();
                 }
-                StreamCopier::copyStream(data_file, output_stream);
-                //std::this_thread::sleep_for(5s);
+
+                std::vector<char> buffer(send_buffer_size);
+                size_t fill = 0;
+                uint64_t fill_hits = 0;
+                send_stats total, step;
+                unsigned step_no = 0;
+                const auto start = wall_clock::now();
+                auto step_start = start;
+                double step_rate = rate;
+
+                // pace and send buffer content
+                const auto flush = [&]() {
+                    if (step_rate > .0) {
+                        const double amount = rate_in_hits ? double(step.hits + fill_hits) : (step.bytes + fill) * 1e-6;
+                        const auto due = step_start + std::chrono::duration_cast<wall_clock::duration>(std::chrono::duration<double>(amount / step_rate));
+                        const auto now = wall_clock::now();
+                        if (due > now) {
+                            std::this_thread::sleep_until(due);
+                            step.paced += std::chrono::duration<double>(due - now).count();
+                        }
+                    }
+                    send_all(con, buffer.data(), fill, step);
+                    step.bytes += fill;
+                    step.hits += fill_hits;
+                    fill = fill_hits = 0;
+
+                    if (ramp_step != .0) {
+                        const auto now = wall_clock::now();
+                        const double step_time = std::chrono::duration<double>(now - step_start).count();
+                        if (step_time >= ramp_interval) {
+                            step.report(name + " step " + std::to_string(step_no), step_time, step_rate);
+                            total += step;
+                            step = send_stats{};
+                            step_no++;
+                            step_start = now;
+                            step_rate = std::max(rate + step_no * ramp_step, .0);
+                        }
+                    }
+                };
+
+                // copy chunk into the send buffer, shift packet id and time stamps
+                const auto append = [&](const char* data, const chunk_info& chunk, uint64_t id_shift, int64_t time_shift) {
+                    if (fill + chunk.size > buffer.size())
+                        flush();
+                    std::memcpy(&buffer[fill], data, chunk.size);
+                    if (time_shift > 0) {
+                        for (size_t pos=fill+sizeof(uint64_t); pos<fill+chunk.size; pos+=sizeof(uint64_t)) {
+                            uint64_t word;
+                            std::memcpy(&word, &buffer[pos], sizeof(word));
+                            word = stream_generator::shift_time(word, time_shift);
+                            std::memcpy(&buffer[pos], &word, sizeof(word));
+                        }
+                    }
+                    if (chunk.packet_id && (id_shift > 0)) {
+                        uint64_t word;
+                        std::memcpy(&word, &buffer[fill + sizeof(uint64_t)], sizeof(word));
+                        word = (word & ~0xffffffffffffUL) | (((word & 0xffffffffffffUL) + id_shift) & 0xffffffffffffUL);
+                        std::memcpy(&buffer[fill + sizeof(uint64_t)], &word, sizeof(word));
+                    }
+                    fill += chunk.size;
+                    fill_hits += chunk.hits;
+                };
+
+                if (generate) {
+                    // the passes form one continuous run of the stream model, clocks and packet ids keep increasing
+                    const stream_generator::generator gen{model};
+                    std::vector<uint64_t> words;
+                    std::vector<stream_generator::generator::chip_stream> streams;
+                    for (unsigned c=index; c<model.chips; c+=destination.size())
+                        streams.emplace_back(gen, c, 0);
+                    for (uint64_t p=0; p<loops*model.periods; p++) {
+                        for (auto& stream : streams) {
+                            if (stop_sending.load(std::memory_order_relaxed))
+                                goto stopped;
+                            words.clear();
+                            stream.emit(words);
+                            for (size_t pos=0; pos<words.size();) {
+                                chunk_info chunk{0, uint32_t(sizeof(uint64_t) + (words[pos] >> 48)), 0, unsigned((words[pos] >> 32) & 0xff), model.packet_ids};
+                                const size_t num_words = chunk.size / sizeof(uint64_t);
+                                for (size_t i=1; i<num_words; i++)
+                                    chunk.hits += ((words[pos + i] >> 60) == 0xb);
+                                append(reinterpret_cast<const char*>(&words[pos]), chunk, 0, 0);
+                                pos += num_words;
+                            }
+                        }
+                    }
+                } else {
+                    const unsigned threads = std::max<unsigned>(std::thread::hardware_concurrency() / destination.size(), 1);
+                    for (unsigned loop=0; loop<loops; loop++) {
+                        const uint64_t id_shift = loop * (input.max_packet_id + 1);
+                        const int64_t time_shift = loop * input.pass_shift;
+                        chunk_cursor cursor = input.chunks(threads);
+                        for (const auto& chunk : input.chunk) {
+                            uint32_t chunk_size;
+                            const char* chunk_data = cursor.next(chunk_size);
+                            if ((chunk.chip % destination.size()) != index)
+                                continue;
+                            if (stop_sending.load(std::memory_order_relaxed))
+                                goto stopped;
+                            append(chunk_data, chunk, id_shift, time_shift);
+                        }
+                    }
+                }
+            stopped:
+                if (fill > 0)
+                    flush();
+                const auto stop = wall_clock::now();
+                total += step;
+                if ((ramp_step != .0) && (step.bytes > 0))
+                    step.report(name + " step " + std::to_string(step_no), std::chrono::duration<double>(stop - step_start).count(), step_rate);
+                total.report(name + " total", std::chrono::duration<double>(stop - start).count(), (ramp_step != .0) ? .0 : rate);
+            }
+            {
+                std::lock_guard lock(print_mutex);
+                std::cout << name << " stopped.\n";
             }
-            std::cout << "send data thread stopped.\n";
         } catch (std::exception& ex) {
-            std::cerr << "data sender: " << ex.what() << '\n';
+            std::lock_guard lock(print_mutex);
+            std::cerr << name << ": " << ex.what() << '\n';
         } catch (...) {
-            std::cerr << "data sender: undefined error\n";
+            std::lock_guard lock(print_mutex);
+            std::cerr << name << ": undefined error\n";
+        }
+        {
+            std::lock_guard lock(ready_mutex);
+            if (senders_ready < destination.size())
+                senders_ready = destination.size();     // don't leave the measurement start handler waiting
+            ready_condition.notify_one();
         }
         {
             std::lock_guard lock(stop_mutex);
-            stop_server = true;
-            stop_condition.notify_one();
+            if (--senders_running == 0) {
+                stop_server = true;
+                stop_condition.notify_one();
+            }
         }
     }
 
@@ -267,10 +709,19 @@ namespace {
     */
     void get_measurement_start([[maybe_unused]] HTTPServerRequest& request, HTTPServerResponse& response)
     {
-        data_sender = std::thread(send_data);
+        if (destination.empty()) {
+            error_response(response, "no raw data destination");
+            return;
+        }
+        {
+            std::lock_guard lock(stop_mutex);
+            senders_running = destination.size();
+        }
+        for (unsigned i=0; i<destination.size(); i++)
+            data_sender.emplace_back(send_data, i);
         {
             std::unique_lock lock(ready_mutex);
-            while (! sender_ready)
+            while (senders_ready < destination.size())
                 ready_condition.wait(lock);
         }
         response.setContentType("text/plain");
@@ -366,16 +817,26 @@ namespace {
             std::cout << json_data.toString() << '\n';
             auto json_object = json_data.extract<Object::Ptr>();
             auto json_array = check_ptr(json_object->getArray("Raw").get(), "expected 'Raw' array");
-            auto json_value = check_ptr(json_array->getObject(0).get(), "expected object as element 0");
-            auto connect_to = URI{json_value->getValue<std::string>("Base")};
-            if (connect_to.getScheme() != "tcp")
-                throw RuntimeException("expected tcp as scheme");
-            if (connect_to.getUserInfo() != "connect")
-                throw RuntimeException("expected connect as userinfo");
-            destination = SocketAddress(connect_to.getHost(), connect_to.getPort());
+            if (json_array->size() == 0)
+                throw RuntimeException("expected at least one 'Raw' destination");
+            std::vector<SocketAddress> raw_destination;
+            for (unsigned i=0; i<json_array->size(); i++) {
+                auto json_value = check_ptr(json_array->getObject(i).get(), std::string("expected object as element ") + std::to_string(i));
+                auto connect_to = URI{json_value->getValue<std::string>("Base")};
+                if (connect_to.getScheme() != "tcp")
+                    throw RuntimeException("expected tcp as scheme");
+                if (connect_to.getUserInfo() != "connect")
+                    throw RuntimeException("expected connect as userinfo");
+                raw_destination.emplace_back(connect_to.getHost(), connect_to.getPort());
+            }
+            destination = std::move(raw_destination);
 
             response.setContentType("text/plain");
-            response.send() << "server dest - " << destination.toString() << '\n';
+            auto& out = response.send();
+            out << "server dest -";
+            for (const auto& dest : destination)
+                out << ' ' << dest.toString();
+            out << '\n';
         } catch (Poco::Exception& ex) {
             error_response(response, ex.displayText());
         } catch (std::exception& ex) {
@@ -413,7 +874,7 @@ namespace {
             HelpFormatter helpFormatter(args);
             helpFormatter.setCommand("server");
             helpFormatter.setUsage("OPTIONS");
-            helpFormatter.setHeader("Simulate raw stream from raw events input file.");
+            helpFormatter.setHeader("Simulate raw stream from raw events input file or stream model.");
             helpFormatter.format(std::cout);
             std::exit(Application::EXIT_OK);
         }
@@ -427,6 +888,14 @@ namespace {
         {
             if (name == "input")
                 file_name = value;
+            else if (name == "generate") {
+                try {
+                    model.parse(value);
+                } catch (std::invalid_argument& ex) {
+                    throw InvalidArgumentException(ex.what());
+                }
+                generate = true;
+            }
             else if (name == "bind")
                 bind_to = ServerSocket{SocketAddress{value}};
         }
@@ -441,6 +910,36 @@ namespace {
             long num = stol(value);
             if (name == "nchips")
                 number_of_chips = static_cast<unsigned>(num);
+            else if (name == "loop") {
+                if (num < 0)
+                    throw InvalidArgumentException("negative loop count");
+                loops = static_cast<unsigned>(num);
+            }
+        }
+
+        /*!
+        \brief Real valued option handler
+        \param name  Option name
+        \param value Option value
+        */
+        inline void handle_float(const std::string& name, const std::string& value)
+        {
+            double num = stod(value);
+            if (name == "rate-mbs") {
+                rate = num;
+                rate_in_hits = false;
+            } else if (name == "rate-hits") {
+                rate = num;
+                rate_in_hits = true;
+            } else if (name == "ramp-step") {
+                ramp_step = num;
+            } else if (name == "ramp-interval") {
+                if (num <= .0)
+                    throw InvalidArgumentException("non-positive ramp interval");
+                ramp_interval = num;
+            }
+            if (rate < .0)
+                throw InvalidArgumentException("negative rate");
         }
     } option_handler;   //!< Commandline options handler object
 
@@ -452,10 +951,15 @@ namespace {
     void handle_args(int argc, char *argv[])
     {
         args.addOption(Option{"input", "i"}
-            .description("raw events input file")
+            .description("raw events input file,\nblock compressed files are decompressed")
             .repeatable(false)
             .argument("FNAME")
             .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_string}));
+        args.addOption(Option{"generate", "g"}
+            .description("generate the raw event stream instead of reading an input file,\nSPEC is a comma separated list of stream model settings\nlike chips=4,period=640000,periods=10000,hits=1000,disorder=100\n(see generator --help)")
+            .repeatable(false)
+            .argument("SPEC")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_string}));
         args.addOption(Option{"bind", "b"}
             .description("bind to address")
             .repeatable(false)
@@ -466,6 +970,31 @@ namespace {
             .repeatable(false)
             .argument("N")
             .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_number}));
+        args.addOption(Option{"rate-mbs", "r"}
+            .description("send rate limit per destination in MB/s (default: unlimited)")
+            .repeatable(false)
+            .argument("R")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_float}));
+        args.addOption(Option{"rate-hits", "H"}
+            .description("send rate limit per destination in hits/s")
+            .repeatable(false)
+            .argument("R")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_float}));
+        args.addOption(Option{"ramp-step", "s"}
+            .description("increase the rate by this amount every ramp interval")
+            .repeatable(false)
+            .argument("R")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_float}));
+        args.addOption(Option{"ramp-interval", "t"}
+            .description("ramp step duration in seconds (default: 10)")
+            .repeatable(false)
+            .argument("S")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_float}));
+        args.addOption(Option{"loop", "l"}
+            .description("number of passes over the input file or generated stream,\ntime stamps continue across passes,\n0: as many as fit into the 2^34 clock tick TOA range (default: 1)")
+            .repeatable(false)
+            .argument("N")
+            .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_number}));
         args.addOption(Option{"help", "h"}
             .description("show this help")
             .callback(OptionCallback<option_handler_type>{&option_handler, &option_handler_type::handle_help}));
@@ -492,6 +1021,23 @@ int main(int argc, char *argv[])
 {
     try {
         handle_args(argc, argv);
+        if (generate) {
+            number_of_chips = model.chips;
+            std::cout << "generating " << model << '\n';
+        } else {
+            input.open(file_name);
+            std::cout << file_name << ": " << input.size << " bytes, " << input.chunk.size() << " chunks\n";
+        }
+        {
+            const uint64_t passes = generate ? model.max_periods() / std::max<uint64_t>(model.periods, 1) : input.max_passes();
+            if (loops == 0) {
+                loops = static_cast<unsigned>(std::min<uint64_t>(passes, std::numeric_limits<unsigned>::max()));
+                std::cout << loops << " passes fit into the TOA clock range\n";
+            } else if (loops > passes) {
+                throw InvalidArgumentException(std::to_string(loops) + " passes exceed the 2^34 clock tick TOA range, at most "
+                                               + std::to_string(passes) + " are possible");
+            }
+        }
         init_handlers();
 
         {
@@ -509,9 +1055,11 @@ int main(int argc, char *argv[])
                 while (! stop_server)
                     stop_condition.wait(lock);
             }
-            if (data_sender.joinable()) {
-                std::cout << "joining sender thread ...\n";
-                data_sender.join();
+            stop_sending = true;
+            if (! data_sender.empty()) {
+                std::cout << "joining sender threads ...\n";
+                for (auto& sender : data_sender)
+                    sender.join();
             }
             server.stop();
             std::cout << "server stopped.\n";